@@ -0,0 +1,88 @@
+# Download engine shared by the GUI (download.pro) and the headless CLI (download-cli.pro).
+# Needs QtCore only.
+
+QT += core
+
+SOURCES += \
+    $$PWD/src/bandwidthshaper.cpp \
+    $$PWD/src/bufferpool.cpp \
+    $$PWD/src/curlshare.cpp \
+    $$PWD/src/deltasetup.cpp \
+    $$PWD/src/downloader.cpp \
+    $$PWD/src/downloadqueue.cpp \
+    $$PWD/src/integritycheck.cpp \
+    $$PWD/src/logger.cpp \
+    $$PWD/src/metadatacache.cpp \
+    $$PWD/src/metalink.cpp \
+    $$PWD/src/metrics.cpp \
+    $$PWD/src/resumejournal.cpp \
+    $$PWD/src/retrypolicy.cpp \
+    $$PWD/src/storagebackend.cpp \
+    $$PWD/src/streamdecoder.cpp \
+    $$PWD/src/streamhash.cpp \
+    $$PWD/src/tracer.cpp \
+    $$PWD/src/transferengine.cpp \
+    $$PWD/src/writestage.cpp \
+    $$PWD/src/zsync.cpp
+
+HEADERS += \
+    $$PWD/include/bandwidthshaper.h \
+    $$PWD/include/bufferpool.h \
+    $$PWD/include/curlshare.h \
+    $$PWD/include/deltasetup.h \
+    $$PWD/include/downloader.h \
+    $$PWD/include/downloadqueue.h \
+    $$PWD/include/integritycheck.h \
+    $$PWD/include/logger.h \
+    $$PWD/include/metadatacache.h \
+    $$PWD/include/metalink.h \
+    $$PWD/include/metrics.h \
+    $$PWD/include/resumejournal.h \
+    $$PWD/include/retrypolicy.h \
+    $$PWD/include/storagebackend.h \
+    $$PWD/include/streamdecoder.h \
+    $$PWD/include/streamhash.h \
+    $$PWD/include/tracer.h \
+    $$PWD/include/transferengine.h \
+    $$PWD/include/transferstats.h \
+    $$PWD/include/writestage.h \
+    $$PWD/include/zsync.h
+
+INCLUDEPATH += $$PWD/include
+
+# Optional io_uring storage backend on Linux
+linux {
+    packagesExist(liburing) {
+        DEFINES += HAVE_LIBURING
+        LIBS += -luring
+    }
+}
+
+# Optional decoders for storing .gz and .zst downloads decompressed
+packagesExist(zlib) {
+    DEFINES += HAVE_ZLIB
+    LIBS += -lz
+}
+packagesExist(libzstd) {
+    DEFINES += HAVE_ZSTD
+    LIBS += -lzstd
+}
+
+# Link libcurl
+LIBS += -LE:/curl/lib -lcurl
+INCLUDEPATH += E:/curl/include
+
+CERT_DIR_SRC = $$PWD/certs
+LIBCURL_DLL_SRC = $$PWD/libcurl-x64.dll
+DEST_DEBUG = $$OUT_PWD/debug
+DEST_RELEASE = $$OUT_PWD/release
+certs_debug.files = $$CERT_DIR_SRC
+certs_debug.path = $$DEST_DEBUG
+certs_release.files = $$CERT_DIR_SRC
+certs_release.path = $$DEST_RELEASE
+dll_debug.files = $$LIBCURL_DLL_SRC
+dll_debug.path = $$DEST_DEBUG
+dll_release.files = $$LIBCURL_DLL_SRC
+dll_release.path = $$DEST_RELEASE
+
+COPIES += certs_debug certs_release dll_debug dll_release
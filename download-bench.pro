@@ -0,0 +1,20 @@
+# End-to-end benchmark: the engine against a local HTTP/HTTPS stand-in server
+QT -= gui
+QT += network
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = download-bench
+
+include(core.pri)
+
+SOURCES += \
+    src/benchmain.cpp \
+    src/benchserver.cpp
+
+HEADERS += \
+    include/benchserver.h
+
+win32: LIBS += -lpsapi
+
+MOC_DIR = build/bench
+OBJECTS_DIR = build/bench
@@ -0,0 +1,18 @@
+# Headless batch downloader: same engine as the GUI, no widgets
+QT -= gui
+QT += network
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = download-cli
+
+include(core.pri)
+
+SOURCES += \
+    src/climain.cpp \
+    src/metricsserver.cpp
+
+HEADERS += \
+    include/metricsserver.h
+
+MOC_DIR = build/cli
+OBJECTS_DIR = build/cli
@@ -0,0 +1,14 @@
+# Behaviour checks of the engine's parsers, run with `make check`
+QT -= gui
+QT += testlib
+CONFIG += console testcase
+CONFIG -= app_bundle
+TARGET = download-tests
+
+include(core.pri)
+
+SOURCES += \
+    tests/tst_parsers.cpp
+
+MOC_DIR = build/tests
+OBJECTS_DIR = build/tests
@@ -0,0 +1,81 @@
+#ifndef BANDWIDTHSHAPER_H
+#define BANDWIDTHSHAPER_H
+
+#include "transferengine.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+
+// Token-bucket rate limiting for all downloads of the process: an optional global cap
+// shared by weight between the downloads that want bandwidth (weighted max-min fair),
+// plus an optional cap per download. Each download is a client with its own bucket;
+// a periodic refill on the engine thread hands out tokens at the client's current
+// rate and wakes clients that ran dry.
+//
+// Clients and buckets live on the engine thread, so the write path is a compare and
+// a subtraction without locks. The limit setters may be called from any thread and
+// take effect on the next refill, without restarting transfers.
+class BandwidthShaper {
+public:
+    struct Client;
+
+    static BandwidthShaper& instance();
+
+    // Global cap in bytes per second, 0 for none (any thread)
+    void setGlobalLimit(int64_t bytesPerSecond);
+    int64_t globalLimit() const { return globalBytesPerSecond.load(); }
+
+    // Registers a download; wake is called on the engine thread when a client that
+    // was refused bytes has tokens again (engine thread only)
+    Client* addClient(std::function<void()> wake);
+    void removeClient(Client* client);
+    // Cap of one client in bytes per second (0 for none) and its share of the global
+    // cap relative to the other clients (engine thread only)
+    void setClientLimit(Client* client, int64_t bytesPerSecond);
+    void setClientWeight(Client* client, double weight);
+
+    // Write path: accounts for bytes received by the client. False if its bucket is
+    // empty; the caller should pause and wait for the wake callback (engine thread only).
+    bool consume(Client* client, size_t bytes) {
+        if (!client->shaped) {
+            return true;
+        }
+        if (client->tokens < 0) {
+            client->blocked = true;
+            return false;
+        }
+        // The bucket may go into debt by one write, later refills pay it back
+        client->tokens -= static_cast<double>(bytes);
+        client->used += static_cast<double>(bytes);
+        return true;
+    }
+
+    struct Client {
+        std::function<void()> wake;
+        int64_t limit = 0;     // Own cap in bytes per second, 0 for none
+        double weight = 1.0;   // Share of the global cap relative to other clients
+        bool shaped = false;   // A cap applies (own or global)
+        double tokens = 0;     // Bytes the client may still receive, negative while in debt
+        double used = 0;       // Bytes received since the last refill
+        bool blocked = false;  // consume() failed, waiting for tokens
+        double rate = 0;       // Current refill rate in bytes per second
+    };
+
+private:
+    BandwidthShaper();
+    BandwidthShaper(const BandwidthShaper&) = delete;
+    BandwidthShaper& operator=(const BandwidthShaper&) = delete;
+
+    // Recomputes which clients are shaped and starts or stops the refill timer
+    void updateShaping();
+    // Periodic refill: splits the rates and hands out the tokens
+    void refill();
+
+    std::atomic<int64_t> globalBytesPerSecond;
+    std::list<Client> clients; // Stable addresses for the Client pointers
+    TransferEngine::TimerId refillTimer;
+    std::chrono::steady_clock::time_point lastRefill;
+};
+
+#endif // BANDWIDTHSHAPER_H
@@ -0,0 +1,81 @@
+#ifndef BENCHSERVER_H
+#define BENCHSERVER_H
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+#include <cstdint>
+#include <random>
+
+class QTcpSocket;
+class QTimer;
+
+// Deterministic file content of the benchmark server: byte i of every file is derived
+// from i alone, so any range can be generated on the fly and a download can be checked
+// without keeping a copy.
+void fillBenchContent(int64_t offset, char* data, size_t length);
+
+// Network conditions the benchmark server imitates, per connection
+struct NetworkProfile {
+    int64_t bandwidth = 0;     // Bytes per second per connection, 0 for unlimited
+    int latencyMs = 0;         // Delay before each response
+    double loss = 0;           // Chance per 64 KiB sent of a stall, standing in for a lost segment
+    int stallMs = 200;         // Length of such a stall (retransmission timeout)
+    double disconnect = 0;     // Chance per response of dropping the connection mid-body
+    double slow = 0;           // Chance per connection of getting a tenth of the bandwidth
+    uint64_t seed = 1;         // Seed of the loss, disconnect and slow draws, so runs repeat
+};
+
+// Minimal HTTP/1.1 server for benchmarks: GET and HEAD of "/file/<size>[/<name>]" with
+// keep-alive, byte ranges (Range, If-Range), an ETag and Last-Modified, over plain TCP
+// or TLS (with a certificate and key). Runs on the Qt event loop of its thread.
+class BenchServer : public QTcpServer {
+    Q_OBJECT
+public:
+    explicit BenchServer(const NetworkProfile& profile, QObject* parent = nullptr);
+    // Serves TLS with the PEM certificate and key; false if they cannot be loaded
+    bool enableTls(const QString& certificatePath, const QString& keyPath);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    NetworkProfile profile;
+    QByteArray certificatePem;
+    QByteArray keyPem;
+    std::mt19937_64 random;
+
+    friend class BenchConnection;
+};
+
+// One client connection: parses requests, then sends the body paced by the profile
+class BenchConnection : public QObject {
+    Q_OBJECT
+public:
+    BenchConnection(QTcpSocket* socket, BenchServer* server);
+
+private:
+    void onReadyRead();
+    // Answers the request at the start of the input buffer, if it is complete
+    void handleRequest();
+    // Sends body bytes while the socket buffer and the bandwidth budget allow
+    void pump();
+
+    QTcpSocket* socket;
+    BenchServer* server;
+    QTimer* pacer;
+    QByteArray input;
+    bool responding = false;     // Between the request and the end of its body
+    int64_t position = 0;        // Next body byte to send
+    int64_t end = 0;             // One past the last body byte
+    int64_t dropAt = -1;         // Offset at which the connection is dropped, -1 for never
+    int64_t sinceLossCheck = 0;  // Bytes sent since the last loss draw
+    int64_t bandwidth = 0;       // Bytes per second of this connection, 0 for unlimited
+    double tokens = 0;           // Bandwidth budget in bytes
+    qint64 lastRefillMs = 0;
+    qint64 stalledUntilMs = 0;
+    QByteArray chunk;
+};
+
+#endif // BENCHSERVER_H
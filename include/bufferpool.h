@@ -0,0 +1,81 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "storagebackend.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Memory budget of all transfers. The chunk buffers of the storage writers come from
+// free lists per size class (powers of two from 4 KiB), so writers with different chunk
+// sizes reuse each other's buffers without reallocating them. The receive buffer curl
+// allocates for a transfer is charged to the same budget before the transfer starts,
+// shrunk towards curl's default when memory is short. A request that does not fit is
+// refused: the writer pauses its transfer, a download starts no further transfers, and
+// the space listeners are told once memory comes back. Free buffers are only kept while
+// they fit into the budget next to the memory in use, so the pool never holds more.
+class BufferPool {
+public:
+    struct Stats {
+        size_t budgetBytes = 0;
+        size_t bufferBytes = 0;    // Chunk buffers handed out (being filled or queued)
+        size_t receiveBytes = 0;   // Receive buffers of running transfers
+        size_t idleBytes = 0;      // Free buffers kept for reuse
+        size_t peakUsedBytes = 0;  // Highest bufferBytes + receiveBytes seen
+        uint64_t refusals = 0;     // Requests refused for lack of memory
+    };
+
+    static BufferPool& instance();
+
+    // Memory all transfers may use at once (default 128 MiB), applies to later requests
+    void setBudget(size_t bytes);
+    // Bytes a request for size takes: its size class, or size itself above the largest
+    static size_t classSize(size_t size);
+
+    // Hands out an empty buffer with room for size bytes, false when it does not fit.
+    // A single buffer larger than the budget is still allowed when nothing else is out.
+    bool tryAcquire(size_t size, StorageBuffer& buffer);
+    // Returns a buffer obtained with tryAcquire(size)
+    void release(size_t size, StorageBuffer&& buffer);
+
+    // Charges the receive buffer of a transfer: preferred bytes if they fit, else halved
+    // as often as needed down to minimum; 0 if not even that fits. Receive buffers get
+    // at most half the budget, so running transfers always find chunk buffers to write
+    // into and drain.
+    size_t reserveReceive(size_t preferred, size_t minimum);
+    void unreserveReceive(size_t bytes);
+
+    // Called after a refused request, once memory is back (on the releasing thread)
+    int addSpaceListener(std::function<void()> listener);
+    void removeSpaceListener(int id);
+
+    Stats stats() const;
+
+private:
+    static const int kClasses = 15; // 4 KiB to 64 MiB
+
+    BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    static int classIndex(size_t charged);
+    size_t usedBytes() const { return counters.bufferBytes + counters.receiveBytes; }
+    void noteUsed();
+    // Frees idle buffers, largest first, until everything fits into the budget (mutex held)
+    void trimIdle();
+    // Wakes the listeners if a request was refused since the last time (mutex held)
+    void notifySpace(std::unique_lock<std::mutex>& lock);
+
+    mutable std::mutex mutex;
+    std::vector<StorageBuffer> freeLists[kClasses];
+    Stats counters;
+    bool spaceWanted; // A request was refused since the last notification
+
+    std::mutex listenerMutex;
+    std::map<int, std::function<void()>> spaceListeners;
+    int nextListenerId;
+};
+
+#endif // BUFFERPOOL_H
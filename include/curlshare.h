@@ -0,0 +1,47 @@
+#ifndef CURLSHARE_H
+#define CURLSHARE_H
+
+#include <curl/curl.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Process-wide setup shared by every easy handle: one CURLSH holding the DNS cache,
+// TLS sessions and (with libcurl >= 7.57) the connection pool, plus the CA bundle,
+// read from certs/cacert.pem once and handed to curl from memory. Together with the
+// engine's multi handle this lets the GET reuse the connection of the HEAD probe and
+// lets a resume or a repeat download from the same host skip DNS and the TLS handshake.
+class CurlShare {
+public:
+    // Process-wide instance, created on first use (after curl_global_init)
+    static CurlShare& instance();
+
+    // Attaches the share and the CA bundle to an easy handle. Returns false if the
+    // CA bundle is missing, in which case peer verification is left to the caller.
+    bool apply(CURL* handle);
+    // True once certs/cacert.pem has been loaded
+    bool hasCaBundle() const { return !caBundle.empty(); }
+    // Replaces the CA bundle with the PEM file at path (e.g. a test CA). Only call it
+    // before transfers start, running handles may point at the old bundle.
+    bool loadCaBundle(const std::string& path);
+    // Sends libcurl's trace of a handle (info text and headers) to the log under
+    // logContext if Logger::curlTrace() is on; without it curl is not made verbose
+    static void applyTrace(CURL* handle, uint64_t logContext);
+
+private:
+    CurlShare();
+    ~CurlShare();
+    CurlShare(const CurlShare&) = delete;
+    CurlShare& operator=(const CurlShare&) = delete;
+
+    static void lockCallback(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr);
+    static void unlockCallback(CURL* handle, curl_lock_data data, void* userptr);
+
+    CURLSH* share;
+    // One lock per shared data kind, curl never holds two at once
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+    std::string caBundle;     // Contents of certs/cacert.pem
+    std::string caBundlePath; // Location it was read from, used with libcurl < 7.77
+};
+
+#endif // CURLSHARE_H
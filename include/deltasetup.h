@@ -0,0 +1,67 @@
+#ifndef DELTASETUP_H
+#define DELTASETUP_H
+
+#include "transferengine.h"
+#include "zsync.h"
+#include <curl/curl.h>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// First phase of a delta download (Downloader::setDeltaSource): loads or fetches the
+// zsync manifest of the new file, moves the old copy aside if it is the output itself,
+// and runs the ZsyncScan that copies the blocks found in it into the output on a thread
+// of its own. Reports the ranges that are left to fetch, or a failure after which the
+// caller downloads the whole file. Used on the engine thread only.
+class DeltaSetup : private TransferObserver {
+public:
+    struct Result {
+        bool ok = false;  // False: nothing was reused, fetch the whole file
+        std::string sha1; // Lowercase hex SHA-1 of the new file from the manifest, may be empty
+        // Byte ranges [first, last] of the new file not found in the old copy
+        std::vector<std::pair<int64_t, int64_t>> missing;
+    };
+    using Callback = std::function<void(const Result&)>;
+
+    DeltaSetup();
+    ~DeltaSetup() override;
+
+    // Starts on the file at url, fileSize bytes stored at outputPath, with the old copy
+    // at source. manifest is a URL or a local path, empty for url + ".zsync". done is
+    // called on the engine thread once the setup is over, unless it is cancelled.
+    void start(const std::string& url, const std::string& manifest, const std::string& source,
+               const std::string& outputPath, int64_t fileSize, uint64_t logContext, Callback done);
+    // Stops a setup in progress without calling back, waiting for the scan thread
+    void cancel();
+
+private:
+    DeltaSetup(const DeltaSetup&) = delete;
+    DeltaSetup& operator=(const DeltaSetup&) = delete;
+
+    void onTransferDone(CURL* handle, CURLcode result) override;
+    // Searches the old copy for the manifest's blocks
+    void startScan(const std::shared_ptr<const ZsyncManifest>& manifest);
+    // Collects the result once the scan finished (timer)
+    void finishScan();
+    // Ends the setup and calls back
+    void complete(Result result);
+
+    std::string source;
+    std::string outputPath;
+    int64_t fileSize;
+    uint64_t logContext;
+    Callback done;
+    CURL* manifestHandle;                         // GET of the manifest in flight, if any
+    std::string manifestBody;                     // Manifest received so far
+    std::shared_ptr<const ZsyncManifest> manifest;
+    std::shared_ptr<ZsyncScan> scan;              // Search of the old copy, if running
+    std::thread scanThread;                       // Runs scan
+    TransferEngine::TimerId pollTimer;            // Polls scan until it finished
+    std::string scratch;                          // Old copy moved aside when it was the output
+};
+
+#endif // DELTASETUP_H
@@ -5,23 +5,146 @@
 #include <string>
 #include <functional>
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
 #include <curl/curl.h>
+#include "bandwidthshaper.h"
+#include "deltasetup.h"
+#include "integritycheck.h"
+#include "metadatacache.h"
+#include "resumejournal.h"
+#include "retrypolicy.h"
+#include "storagebackend.h"
+#include "streamdecoder.h"
+#include "streamhash.h"
+#include "transferstats.h"
+#include "transferengine.h"
 
-class Downloader : public QObject {
+// One byte range of the output file, fetched over its own connection in segmented mode
+struct DownloadSegment {
+    curl_off_t start = 0;   // First byte of the range
+    curl_off_t end = 0;     // Last byte of the range (inclusive, as in the Range header), -1 if unknown
+    curl_off_t written = 0; // Bytes of this range already stored at start..start+written-1
+    bool done = false;      // Range fully received
+    StreamHash blockHash;   // Running hash of the block being written, when verifying
+    // Stored decompressed: the decoder of the body (its state carries over a pause) and
+    // the compressed bytes it consumed, where a resumed request continues
+    std::shared_ptr<StreamDecoder> decoder;
+    curl_off_t received = 0;
+    // After a transient failure: consecutive failed attempts without progress, and when
+    // the next one may start (a default time point: right away)
+    int failures = 0;
+    std::chrono::steady_clock::time_point retryAt;
+
+    curl_off_t length() const { return end - start + 1; }
+    // A single stream download of unknown size runs until the server closes the body
+    bool openEnded() const { return end < 0; }
+};
+
+// What the HEAD probe (or the first GET response) learned about the remote file
+struct RemoteInfo {
+    bool acceptRanges = false; // Server answered with "Accept-Ranges: bytes"
+    std::string etag;          // ETag validator, empty if the server sent none
+    std::string lastModified;  // Last-Modified validator, empty if the server sent none
+    std::string contentEncoding; // Content-Encoding of a GET response, empty for identity
+};
+
+// A source of the file: the download URL or one of its mirrors
+struct Mirror {
+    std::string url;
+    double bytesPerSecond = 0; // Average throughput of one connection, 0 until measured
+    int failures = 0;          // Transient failures in a row without progress
+    bool dropped = false;      // Failed or served bad data, not used again in this run
+};
+
+struct CurlCallbackContext;
+
+// Drives one download on the shared TransferEngine. The HEAD probe and the segment
+// transfers are easy handles on the engine thread, so a download no longer needs a
+// thread of its own; the signals below are emitted from the engine thread.
+class Downloader : public QObject, private TransferObserver {
     Q_OBJECT
+    friend size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp);
 public:
-    // Constructor
+    // Constructor. onProgress is optional (may be empty) and called on the engine thread
+    // when the percentage changes; sampling stats() is cheaper for a UI.
     Downloader(const std::string& url, const std::string& outputPath, std::function<void(int)> onProgress);
+    // Stops any transfer still running on the engine
+    ~Downloader() override;
     // Check if download is paused
     bool isPaused() const;
-    // New method to request pause directly (thread-safe due to atomic flag)
+    // New method to request pause directly (thread-safe due to atomic flag). A pause
+    // requested while probing or setting up applies once the transfers would start.
     void requestPause();
+    // Number of parallel connections used when the server supports byte ranges (1 disables
+    // segmenting). A segmented download starts with this many and adapts the number to the
+    // measured throughput, up to twice as many.
+    void setConnectionCount(int count);
+    // Output backend, chunk and receive buffer sizes (applied when the next transfer starts)
+    void setStorageOptions(const StorageOptions& options);
+    // How long a pause keeps the connections open (curl_easy_pause) before the transfers
+    // are torn down and a resume has to reconnect with a range request; 0 always tears down
+    void setPauseKeepAlive(int idleTimeoutMs);
+    // Time from the last resume request to the first byte stored afterwards, -1 if none yet.
+    // After a resume of kept-alive connections curl hands over the bytes it buffered during
+    // the pause right away, so the figure is then close to 0 and says little about the network.
+    qint64 lastResumeLatencyUs() const;
+    // Cap of this download in bytes per second, 0 for none; applies to running transfers
+    void setRateLimit(qint64 bytesPerSecond);
+    // Share of the global bandwidth cap relative to other downloads (default 1)
+    void setWeight(double weight);
+    // Hashes the file while it is written (applies to the next start); None turns it off
+    void setHashAlgorithm(HashAlgorithm algorithm);
+    // Expected digest as "<algorithm>:<hex>" (e.g. "sha256:9f86..."), which also selects
+    // the algorithm; the download fails if the file does not match. False if malformed.
+    bool setExpectedDigest(const std::string& spec);
+    // Expected digest of every blockSize bytes of the file (Metalink pieces), each checked
+    // as soon as the block is complete. A bad block fails the download without waiting for
+    // the rest, or with mirrors is fetched again from another one. Selects the algorithm;
+    // an expected file digest of another algorithm is dropped.
+    void setExpectedBlockDigests(HashAlgorithm algorithm, int64_t blockSize,
+                                 const std::vector<std::string>& hexDigests);
+    // Other URLs of the same file. Segments are fetched from all of them at once, new
+    // connections going to the mirrors with the fastest connections; a mirror that fails,
+    // serves another file or a bad block is dropped. Applies to the next start.
+    void setMirrors(const std::vector<std::string>& urls);
+    // Small-file mode: no HEAD probe, the size, range support and validators are taken
+    // from the GET response. A file that turns out large enough is still split into
+    // segments once it is running. Files of unknown size share HTTP/2 connections.
+    void setSkipProbe(bool skip);
+    // Remembers the validators and location of completed downloads in the MetadataCache.
+    // A repeat download of a cached URL sends a conditional probe and, if the server
+    // answers 304 Not Modified, links the stored copy instead of transferring the body.
+    void setUseCache(bool use);
+    // Delta mode: an older copy of the file (may be the output itself) and the zsync
+    // manifest of the new one, by default the URL with ".zsync" appended; a location
+    // without a scheme is read from disk. The blocks found in the old copy are copied
+    // into the output and only the rest is fetched with range requests. Falls back to a
+    // full download if the manifest is missing or does not describe the file.
+    void setDeltaSource(const std::string& oldFile, const std::string& manifest = std::string());
+    // Offers gzip, br and zstd content encoding (whatever curl was built with) on requests
+    // without a range; curl decodes the body before it is stored. On by default, not used
+    // for names of already compressed files.
+    void setCompressedTransfer(bool enable);
+    // Stores ".gz" and ".zst" files decompressed as they arrive (see StreamDecoder). The
+    // body is a single stream then; not used with an expected digest, which describes the
+    // file as published.
+    void setDecompress(bool enable);
+    // Context id of this download's log messages (the queue's job id), 0 for none. Set
+    // before the start.
+    void setLogContext(uint64_t id);
+    // "<algorithm>:<hex>" of the last completed download, empty if it was not hashed
+    std::string digest() const { return lastDigest; }
+    // Live byte counters and throughput, safe to sample from any thread; stays valid
+    // after the Downloader is gone
+    std::shared_ptr<const TransferStats> stats() const { return liveStats; }
 
 public slots:
     // Slot to start the download
     void startDownload();
-    // Slot to pause the download (can potentially be removed if not used elsewhere)
-
     // Slot to resume the download
     void resumeDownload();
 
@@ -34,13 +157,9 @@ signals:
     void downloadResumed();
     // New signal: Emitted when the total file size is known
     void totalSizeKnown(qint64 size); // Use qint64 for Qt signal/slot compatibility
-    void downloadSpeedUpdated(qint64 bytesPerSecond); // Add this line
-
-public slots:
-    // Add a slot to emit the speed update signal
-    void emitSpeedUpdate(qint64 bytesPerSecond) {
-        emit downloadSpeedUpdated(bytesPerSecond);
-    }
+    // Pause-to-resume latency: from resumeDownload() to the first byte of data after it.
+    // keptAlive tells whether the paused connections were still open.
+    void resumeLatencyMeasured(qint64 microseconds, bool keptAlive);
 
 private:
     std::string url;
@@ -51,9 +170,183 @@ private:
     curl_off_t resumePosition;
     // Change totalFileSize type for consistency with signal, or cast when emitting
     qint64 totalFileSize; // Changed from curl_off_t
-    CURL* m_curlHandle;
-    // Function to handle the file download
-    bool downloadFile();
+    // Range support and validators reported by the HEAD probe
+    RemoteInfo remote;
+    // Requested number of parallel connections for segmented downloads
+    int connectionCount;
+    // Idle time a paused transfer keeps its connection, see setPauseKeepAlive()
+    std::atomic<int> pauseKeepAliveMs;
+    std::atomic<qint64> resumeLatencyUs;
+    // Bandwidth settings, applied to the shaper client on the engine thread
+    std::atomic<qint64> rateLimit;
+    std::atomic<double> weight;
+    // Byte ranges of the current download; a single stream download is one open range.
+    // A deque, so the segment pointers of running transfers survive splits.
+    std::deque<DownloadSegment> segments;
+    // Output path tuning and the open output file while transfers run
+    StorageOptions storageOptions;
+    std::unique_ptr<StorageBackend> storage;
+    // Completed blocks, persisted next to the output so a restart can continue. Only
+    // used when the server supports ranges and sends a validator for If-Range.
+    ResumeJournal journal;
+    bool journaled;
+    // Set after starting over because the remote file changed, to give up if it happens again
+    bool restartedOnChange;
+    // Verification settings, and the digest of the last completed download
+    HashAlgorithm hashAlgorithm;
+    std::string expectedDigest;
+    int64_t hashBlockSize;
+    std::vector<std::string> expectedBlockDigests;
+    std::string lastDigest;
+    std::vector<std::string> mirrorUrls;
+    std::atomic<bool> skipProbe;
+    std::atomic<bool> useCache;
+    std::atomic<bool> compressedTransfer;
+    std::atomic<bool> decompress;
+    std::string deltaSource;
+    std::string deltaManifest;
+    uint64_t logContext;
+
+    // --- Engine thread state ---
+    CURL* probeHandle;                                        // HEAD request in flight, if any
+    curl_slist* probeHeaders;                                 // Conditional headers of the probe
+    bool conditional;                                         // The probe asks whether cachedCopy is current
+    MetadataCache::Entry cachedCopy;                          // Stored copy of an earlier download
+    StreamDecoder::Format decodeFormat;                       // Stored decompressed unless None
+    qint64 sourceSize;                                        // Compressed size when decoding, -1 if unknown
+    DeltaSetup delta;                                         // Manifest and scan of a delta download
+    std::vector<std::unique_ptr<CurlCallbackContext>> transfers; // Segment transfers in flight
+    TransferEngine::TimerId progressTimer;                    // Periodic progress/speed report
+    std::shared_ptr<TransferStats> liveStats;                 // Written here, sampled by the UI
+    curl_off_t lastBytes;                                     // Bytes at the last throughput sample
+    std::chrono::steady_clock::time_point lastTime;           // Time of the last throughput sample
+    int lastPercent;                                          // Last percentage passed to onProgress
+    int spaceListener;                                        // BufferPool space listener id
+    std::chrono::steady_clock::time_point lastCheckpoint;     // Time of the last journal checkpoint
+    curl_off_t checkpointBytes;                               // Bytes written at the last checkpoint
+    TransferEngine::TimerId keepAliveTimer;                   // Tears down transfers paused for too long
+    std::chrono::steady_clock::time_point resumeRequestedAt;  // Start of the resume latency measurement
+    bool awaitingResumeData;                                  // No data stored since the resume request
+    bool resumedKeptAlive;                                    // The pending resume reused open connections
+    bool pauseBeforeStart;                                    // Pause requested while probing or setting up
+    BandwidthShaper::Client* shaperClient;                    // Token bucket of this download
+    IntegrityCheck integrity;                                 // Block and file digests of the download
+    // Connection count control of segmented downloads: the count is probed one step at a
+    // time and a step is kept if the throughput of the following window justifies it
+    bool adaptive;                                            // Segments may be split and connections added
+    int targetConnections;                                    // Transfers to keep running
+    int adaptStep;                                            // +1/-1 while a probe is measured, else 0
+    int adaptDirection;                                       // Direction of the next probe
+    int adaptHold;                                            // Windows to wait before the next probe
+    double adaptBaseline;                                     // Throughput before the running probe
+    std::chrono::steady_clock::time_point adaptWindowStart;   // Start of the measurement window
+    curl_off_t adaptWindowBytes;                              // Bytes stored at the window start
+    std::vector<Mirror> mirrors;                              // url first, then mirrorUrls
+    std::map<int64_t, int> blockRepairs;                      // Times each block was fetched again
+    std::shared_ptr<IntegrityCheck::CatchUp> catchUp;         // Read-back running on the write stage, if any
+    RetryPolicy retryPolicy;                                  // Backoff and budget of transient failures
+    TransferEngine::TimerId retryTimer;                       // Starts the segment whose retry is due next
+    std::chrono::steady_clock::time_point startedAt;          // Of the download, for its duration metric
+    uint64_t traceProcess;                                    // Tracer process of this download, 0 until traced
+    int64_t probeStartUs;                                     // Tracer time the probe was sent
+    int64_t pausedAtUs;                                       // Tracer time of the pause, 0 if not paused
+    bool waitingForMemory;                                    // A transfer could not start, the BufferPool was full
+
+    // TransferObserver: an easy handle of this download has finished
+    void onTransferDone(CURL* handle, CURLcode result) override;
+    // Names the Tracer process of the download on its first traced start
+    void traceStart();
+    // Sends the HEAD request that determines size and range support
+    void startProbe();
+    void onProbeDone(CURLcode result);
+    // Whether cachedCopy has the digest this download must report or match
+    bool cachedCopyUsable() const;
+    // Finishes with the cached copy after a 304, false if it could not be linked
+    bool useCachedCopy();
+    // Records the completed download in the MetadataCache
+    void rememberCopy();
+    // Once the delta setup is done: the found blocks become done segments, the rest is
+    // fetched; a failed setup falls back to a full download
+    void applyDelta(const DeltaSetup::Result& result);
+    // Starts (or continues) the body transfer after the probe or on resume
+    void downloadFile();
+    // Splits the file into byte ranges for segmented mode
+    void planSegments();
+    // Appends count equal pending segments covering first..last
+    void splitRange(curl_off_t first, curl_off_t last, curl_off_t count);
+    // Adopts the journal of an earlier run if it matches the probed file, else starts a new one
+    void openJournal();
+    // Rebuilds the segments from the journal's done and missing blocks
+    void restoreSegments();
+    // Marks the blocks whose bytes have been handed to the backend
+    void markJournal();
+    // Byte ranges [begin, end) handed to the storage backend, merged and in file order
+    std::vector<std::pair<int64_t, int64_t>> storedRanges() const;
+    // Saves the journal from the write stage once the bytes it records are synced
+    void checkpointJournal();
+    // Creates the easy handle for one range and hands it to the engine. receiveBytes is
+    // the receive buffer reserved in the BufferPool, which the transfer gives back.
+    bool startSegment(DownloadSegment& segment, size_t receiveBytes);
+    void onSegmentDone(CurlCallbackContext* transfer, CURLcode result);
+    // Takes size and range support of an unprobed download from its first response
+    // (write callback); a large enough file becomes a segmented download
+    void adoptResponse(CurlCallbackContext* transfer);
+    // Starts transfers until targetConnections run: pending segments first, then the second
+    // part of the segment that would finish last. False if a transfer could not start.
+    bool rebalance();
+    // Shortens the running segment with the longest expected remaining time and returns
+    // the new segment for the rest, nullptr if no segment is worth splitting
+    DownloadSegment* splitLaggingSegment();
+    // Removes one transfer from the engine; its segment keeps its progress and is
+    // continued by the next free connection. False if its buffered bytes could not be written.
+    bool stopSegment(CurlCallbackContext* transfer);
+    // After a transfer ended: starts what is left, unless paused
+    void refill();
+    // Sets a segment whose transfer failed transiently aside for a retry after the
+    // backoff, continuing at its progress. False if the failure is permanent or the
+    // retries are used up.
+    bool retrySegment(CurlCallbackContext* transfer, CURLcode result, long httpCode);
+    // Arms retryTimer for the earliest retryAt of the segments waiting for a retry
+    void scheduleRetry();
+    // Counts stored bytes that have to be received again
+    void discardBytes(int64_t bytes);
+    // Mirror for the next connection, -1 if all were dropped
+    int pickMirror() const;
+    // Drops a mirror and stops its other transfers; false if no other mirror is left
+    bool dropMirror(int index, const std::string& reason);
+    // Arranges for a bad block to be fetched again: the segment that delivered it goes back
+    // to the block start, else a segment of its own is added. False once a block failed too often.
+    bool repairBlock(int64_t block, DownloadSegment* segment);
+    // Sets targetConnections, starting or stopping transfers to match
+    bool setTargetConnections(int count);
+    // Measures the throughput window and probes the connection count (progress timer)
+    void adaptConnections();
+    // Continues transfers paused because the BufferPool had no buffers left and starts
+    // those that had to wait for memory (space listener)
+    void resumeBackpressured();
+    // Clears a pause reason on every transfer, unpausing those left without one
+    void clearPauseReason(unsigned reason);
+    // Pushes rateLimit and weight to the shaper (engine thread)
+    void applyShaping();
+    // First data after a resume request was stored (write callback)
+    void noteResumeData();
+    // Starts verification over with the current settings
+    void resetIntegrity();
+    // Takes over a finished catch-up and starts the next one (progress timer)
+    void advanceHashing();
+    // After the last transfer: hashes what is left and checks the expected digest
+    bool completeHashing();
+    // A block or the file failed verification: forget the progress and fail
+    void failVerification();
+    // Removes all segment transfers from the engine, keeping their progress. Waits for
+    // queued disk writes; false if one of them (or the final flush) failed.
+    bool stopTransfers();
+    // Updates the throughput average and onProgress, checkpoints the journal (progress timer)
+    void reportProgress();
+    // Resets the byte counters of liveStats to the segments' progress
+    void resetStats();
+    // Ends the download and reports the result unless it was paused
+    void finish(bool success);
 };
 
-#endif // DOWNLOADER_H
\ No newline at end of file
+#endif // DOWNLOADER_H
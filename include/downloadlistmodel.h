@@ -0,0 +1,80 @@
+#ifndef DOWNLOADLISTMODEL_H
+#define DOWNLOADLISTMODEL_H
+
+#include "downloadqueue.h"
+#include <QAbstractTableModel>
+#include <QString>
+#include <QStyledItemDelegate>
+#include <unordered_map>
+#include <vector>
+
+// Table of all jobs of a DownloadQueue: name, size, progress, speed, ETA and state per
+// row. Nothing is pushed into it per byte or per percent; the window calls refresh() at
+// a fixed rate and the model samples the TransferStats of the rows on screen only,
+// emitting one dataChanged per run of changed rows. Rows off screen keep their last
+// values until they are scrolled into view, so the cost of a refresh depends on the
+// height of the view rather than on the number of downloads. GUI thread only.
+class DownloadListModel : public QAbstractTableModel {
+    Q_OBJECT
+public:
+    enum Column {
+        NameColumn,
+        SizeColumn,
+        ProgressColumn, // Percent as an int (DisplayRole), invalid while the size is unknown
+        SpeedColumn,
+        EtaColumn,
+        StateColumn,
+        ColumnCount
+    };
+
+    explicit DownloadListModel(const DownloadQueue* queue, QObject* parent = nullptr);
+
+    // Appends a row for a job of the queue
+    void addJob(int id);
+    // Job id of a row, 0 if out of range
+    int jobAt(int row) const;
+    // Row of a job, -1 if it has none
+    int rowOf(int id) const;
+
+    // Rows currently on screen (inclusive); refresh() samples only these
+    void setVisibleRows(int first, int last);
+    // Samples the visible rows and signals the runs of rows whose text changed
+    void refresh();
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    // What a row shows, kept as display values so a refresh can compare them cheaply
+    struct Row {
+        int id = 0;
+        QString name;
+        QString size;
+        int percent = -1;
+        QString speed;
+        QString eta;
+        QString state;
+    };
+
+    // Updates row from the queue; true if anything it shows changed
+    bool sample(Row& row) const;
+
+    const DownloadQueue* queue;
+    std::vector<Row> rows;
+    std::unordered_map<int, int> rowsById;
+    int firstVisible;
+    int lastVisible;
+};
+
+// Draws the progress column as a progress bar
+class DownloadProgressDelegate : public QStyledItemDelegate {
+    Q_OBJECT
+public:
+    using QStyledItemDelegate::QStyledItemDelegate;
+
+    void paint(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+};
+
+#endif // DOWNLOADLISTMODEL_H
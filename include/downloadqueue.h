@@ -0,0 +1,135 @@
+#ifndef DOWNLOADQUEUE_H
+#define DOWNLOADQUEUE_H
+
+#include <QObject>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "metalink.h"
+#include "streamhash.h"
+#include "transferstats.h"
+
+class Downloader;
+
+// Holds any number of downloads and decides which of them run. A job starts as soon as
+// a slot is free under both the global cap and the cap of its host; higher priority
+// classes go first, jobs of the same class in the order they were added. Jobs whose
+// host is saturated are skipped so other origins can use the free slots.
+// Lives in the thread that created it (the GUI thread); Downloader signals are queued to it.
+class DownloadQueue : public QObject {
+    Q_OBJECT
+public:
+    // Priority classes, lower value runs first
+    enum Priority { High = 0, Normal = 1, Low = 2 };
+    enum JobState { Queued, Active, Paused, Finished, Failed };
+
+    struct Job {
+        int id = 0;
+        std::string url;
+        std::string outputPath;
+        std::string host;            // Origin used for the per-host cap
+        Priority priority = Normal;
+        JobState state = Queued;
+        Downloader* downloader = nullptr; // Exists while the job is active or paused
+        bool resumeQueued = false;   // Queued again after a pause, continues instead of restarting
+        qint64 rateLimit = 0;        // Own bandwidth cap in bytes per second, 0 for none
+        std::shared_ptr<const TransferStats> stats; // Live counters, kept after the job ends
+        std::string expectedDigest;  // "<algorithm>:<hex>" the file must match, empty for none
+        std::string digest;          // "<algorithm>:<hex>" of the finished file, if hashed
+        std::vector<std::string> mirrors; // Other URLs of the same file
+        HashAlgorithm pieceAlgorithm = HashAlgorithm::None; // Expected piece digests, if any
+        int64_t pieceLength = 0;
+        std::vector<std::string> pieces;
+    };
+
+    explicit DownloadQueue(QObject* parent = nullptr);
+    // Stops every running transfer
+    ~DownloadQueue() override;
+
+    // Adds a download and starts it right away if a slot is free, returns the job id.
+    // With an expected digest ("<algorithm>:<hex>") the file is verified while it is written.
+    int enqueue(const std::string& url, const std::string& outputPath, Priority priority = Normal,
+                const std::string& expectedDigest = std::string());
+    // Adds a file of a Metalink document: fetched from all its mirrors at once and checked
+    // against its piece and file digests
+    int enqueue(const Metalink::File& file, const std::string& outputPath, Priority priority = Normal);
+    // Pauses an active or queued job, its slot goes to the next queued job
+    void pause(int id);
+    // Puts a paused job back in the queue, it continues where it stopped
+    void resume(int id);
+
+    // Maximum number of jobs transferring at the same time (at least 1)
+    void setMaxActive(int count);
+    // Maximum number of jobs transferring from the same host at the same time (at least 1)
+    void setMaxPerHost(int count);
+    int maxActive() const { return maxActiveJobs; }
+    int maxPerHost() const { return maxPerHostJobs; }
+    // Parallel connections of each job whose server supports ranges (jobs started later)
+    void setConnectionsPerJob(int count);
+    // Hashes the files of jobs started later that have no expected digest (None for no hashing)
+    void setHashAlgorithm(HashAlgorithm algorithm) { hashAlgorithm = algorithm; }
+    // Small-file mode for jobs started later: no HEAD request per file, see
+    // Downloader::setSkipProbe(). Pays off for many small objects.
+    void setSkipProbe(bool skip) { skipProbe = skip; }
+    // Reuses unchanged copies of earlier downloads for jobs started later, see
+    // Downloader::setUseCache()
+    void setUseCache(bool use) { useCache = use; }
+    // Delta mode for jobs started later: a job whose output file name exists in dir uses
+    // that file as the old copy, see Downloader::setDeltaSource(). Empty turns it off.
+    void setDeltaDirectory(const std::string& dir) { deltaDirectory = dir; }
+    // Downloader::setDecompress() and setCompressedTransfer() for jobs started later
+    void setDecompress(bool enable) { decompress = enable; }
+    void setCompressedTransfer(bool enable) { compressedTransfer = enable; }
+
+    // Bandwidth cap over all jobs in bytes per second (0 for none). Running jobs share
+    // it by priority: High weighs 4, Normal 2 and Low 1, unused shares go to the others.
+    void setGlobalRateLimit(qint64 bytesPerSecond);
+    // Bandwidth cap of one job in bytes per second (0 for none), also while it runs
+    void setRateLimit(int id, qint64 bytesPerSecond);
+
+    // Job lookup, nullptr for unknown ids
+    const Job* job(int id) const;
+    bool isPaused(int id) const;
+    // Live counters of a job for periodic sampling, nullptr before it first started
+    std::shared_ptr<const TransferStats> stats(int id) const;
+    int activeCount() const { return activeJobs; }
+    int queuedCount() const;
+
+signals:
+    // Progress and throughput are not signalled, sample stats() instead
+    void jobStarted(int id);
+    void jobSizeKnown(int id, qint64 size);
+    void jobPaused(int id);
+    void jobResumed(int id);
+    void jobFinished(int id, bool success);
+
+private:
+    std::map<int, Job> jobs;
+    std::deque<int> pending[3]; // Queued job ids per priority class, in arrival order
+    std::map<std::string, int> activePerHost;
+    int nextJobId;
+    int activeJobs;
+    int maxActiveJobs;
+    int maxPerHostJobs;
+    int connectionsPerJob; // 0 keeps the Downloader default
+    HashAlgorithm hashAlgorithm;
+    bool skipProbe;
+    bool useCache;
+    std::string deltaDirectory;
+    bool decompress;
+    bool compressedTransfer;
+
+    // Assigns the id and queues a filled-in job
+    int addJob(Job job);
+    // Starts queued jobs while slots are free
+    void schedule();
+    void startJob(Job& job);
+    // Gives back the slot of a job that stopped transferring
+    void releaseSlot(Job& job);
+    void onJobFinished(int id, bool success);
+    void onJobPaused(int id);
+};
+
+#endif // DOWNLOADQUEUE_H
@@ -1,8 +1,10 @@
 #ifndef DOWNLOADWINDOW_H
 #define DOWNLOADWINDOW_H
 #include <QDialog>
-#include <QThread>
-#include "downloader.h"
+#include <QModelIndex>
+#include "downloadqueue.h"
+
+class DownloadListModel;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class DownloadWindow; }
@@ -23,11 +25,13 @@ private slots:
     void updateUI();
     void onTotalSizeKnown(qint64 size);
     void onDownloadSpeedUpdated(qint64 bytesPerSecond); // Add this line
+    void onCurrentRowChanged(const QModelIndex& current); // A row of the download list was selected
 
 private:
     Ui::DownloadWindow *ui;
-    QThread* downloadThread;
-    Downloader* downloader;
+    DownloadQueue* queue;  // Owns every download started from this window
+    DownloadListModel* listModel; // Rows of all jobs in the download list
+    int currentJobId;      // Job selected in the list and shown by the progress bar and labels, 0 if none
     bool isDownloading;
     
     void updateButtonStates();
@@ -0,0 +1,105 @@
+#ifndef INTEGRITYCHECK_H
+#define INTEGRITYCHECK_H
+
+#include "resumejournal.h"
+#include "streamhash.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Verifies a download while it is written, so no pass over the finished file is needed.
+// Every block of the file (the resume journal's blocks) gets a digest of its own from
+// the bytes going through the write callback, which lets a partial or resumed file be
+// checked block by block. The digest of the whole file follows from the block digests
+// for CRC32C. SHA-256, SHA-1 and xxHash can only run in file order, so they follow a frontier:
+// bytes arriving at the frontier are hashed in stream; bytes that arrived ahead of it
+// (other segments) are read back while the download runs, from the page cache, by
+// catch-up tasks on the write stage thread.
+// Used on the engine thread only; a CatchUp runs on any thread.
+class IntegrityCheck {
+public:
+    // Range of the file to read back and hash, planned by planCatchUp()
+    struct CatchUp {
+        HashAlgorithm algorithm = HashAlgorithm::None;
+        int64_t blockSize = 0;
+        int64_t begin = 0;
+        int64_t end = 0;
+        bool advancesFrontier = false;  // begin is the frontier, frontier continues it
+        int generation = 0;             // Results are dropped if blocks were discarded meanwhile
+        StreamHash frontier;
+        std::vector<size_t> blocks;     // Blocks inside [begin, end) that lack a digest
+        // Results
+        std::vector<std::pair<size_t, std::string>> blockDigests;
+        bool ok = false;                // The range could be read
+        std::atomic<bool> finished{false};
+
+        // Reads [begin, end) of the file at path and hashes it
+        void run(const std::string& path);
+    };
+
+    // Starts over for a file of size bytes (-1 while unknown); None disables checking
+    void reset(HashAlgorithm algorithm, int64_t size, int64_t blockSize = ResumeJournal::kDefaultBlockSize);
+    bool enabled() const { return algo != HashAlgorithm::None; }
+    HashAlgorithm algorithm() const { return algo; }
+    int64_t blockSize() const { return blockBytes; }
+    // Size learned at the end of a download of unknown size
+    void setSize(int64_t size);
+
+    // Expected digests as lowercase hex; a mismatch fails the download. Block digests
+    // fail it as soon as the block is complete.
+    void setExpectedDigest(const std::string& hex) { expected = hex; }
+    const std::string& expectedDigest() const { return expected; }
+    void setExpectedBlockDigests(const std::vector<std::string>& hex) { expectedBlocks = hex; }
+
+    // Bytes written at offset by a transfer that keeps its running block hash in
+    // blockState (initially default-constructed). False if a block they complete does
+    // not match its expected digest.
+    bool update(StreamHash& blockState, int64_t offset, const char* data, size_t length);
+    // Completes the last, short block of a file whose size was unknown, ending at end
+    bool finishBlock(StreamHash& blockState, int64_t end);
+
+    // Plans the next read-back within stored, the merged byte ranges [begin, end) that
+    // are on disk. False if there is nothing to do. While a catch-up that advances the
+    // frontier is out, data at the frontier is not hashed in stream.
+    bool planCatchUp(const std::vector<std::pair<int64_t, int64_t>>& stored, CatchUp& work);
+    // Takes over the results of a finished catch-up; false on a block mismatch
+    bool applyCatchUp(const CatchUp& work);
+    // Forgets a block whose bytes are fetched again, including what the in-order hash took
+    // from it (it starts over from the beginning of the file then)
+    void discardBlock(size_t block);
+
+    // Digest of the whole file as hex, empty while parts of it are not hashed yet
+    std::string fileDigest() const;
+    // True without an expected digest or when the file digest matches it
+    bool matchesExpected() const { return expected.empty() || fileDigest() == expected; }
+    // Block that failed verification, -1 if none
+    int64_t failedBlock() const { return badBlock; }
+
+    // State for the resume journal, and back; restore() keeps the current state if the
+    // saved one is for another algorithm or block size
+    ResumeJournal::HashState state() const;
+    bool restore(const ResumeJournal::HashState& saved);
+
+private:
+    bool completeBlock(size_t block, const std::string& digest);
+    int64_t blockEnd(size_t block) const;
+    bool sequential() const {
+        return algo == HashAlgorithm::Sha256 || algo == HashAlgorithm::Xxh64 || algo == HashAlgorithm::Sha1;
+    }
+
+    HashAlgorithm algo = HashAlgorithm::None;
+    int64_t fileSize = -1;
+    int64_t blockBytes = ResumeJournal::kDefaultBlockSize;
+    std::vector<std::string> blockDigests;   // Hex per block, empty until known
+    std::vector<std::string> expectedBlocks;
+    std::string expected;
+    StreamHash frontier;                     // Sequential algorithms: hash of [0, frontierOffset)
+    int64_t frontierOffset = 0;
+    bool frontierBusy = false;               // A catch-up task owns the frontier
+    int generation = 0;                      // Bumped by discardBlock()
+    int64_t badBlock = -1;
+};
+
+#endif // INTEGRITYCHECK_H
@@ -0,0 +1,156 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum class LogLevel {
+    Trace,
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off
+};
+
+const char* logLevelName(LogLevel level);
+// "trace", "debug", "info", "warning" or "error" (also "off"); false for other names
+bool parseLogLevel(const std::string& name, LogLevel& level);
+
+// Process-wide log of the engine. A message below the level is skipped at the call
+// site before anything is formatted; one above it is formatted into a fixed record on
+// the caller's stack and copied into a ring buffer of the calling thread, without a
+// lock or a system call. A sink thread drains the rings every few milliseconds and
+// writes the records as text (stderr by default), JSON lines or binary records to a
+// file. A ring that is full drops the message and counts it, the write callback never
+// waits for the disk.
+class Logger {
+public:
+    enum Format {
+        Text,  // "<time> <level> [<context>] <message>" per line
+        Json,  // {"time_us":..,"level":"info","context":3,"thread":1,"message":".."} per line
+        // "DMLOG1\n" and a NUL, then per record in host byte order: int64 time in
+        // microseconds since the epoch, uint64 context, uint32 thread, uint8 level,
+        // uint16 length and the message bytes
+        Binary
+    };
+
+    // Longest message; longer ones are cut off
+    static const size_t kMaxMessage = 480;
+
+    static Logger& instance();
+
+    // Messages below level are dropped (default Info). Any thread.
+    static void setLevel(LogLevel level);
+    static bool enabled(LogLevel level) {
+        return static_cast<int>(level) >= threshold.load(std::memory_order_relaxed);
+    }
+    // libcurl's own trace of the transfers (connections, TLS, headers) at Debug level,
+    // through CURLOPT_DEBUGFUNCTION. Off by default; applies to transfers started later.
+    static void setCurlTrace(bool enable);
+    static bool curlTrace() { return curlTraceEnabled.load(std::memory_order_relaxed); }
+
+    // Writes to a file instead of stderr, appending; false if it cannot be opened
+    bool openFile(const std::string& path, Format format);
+    // Hands a message to the sink, normally through LogLine. context identifies the
+    // download (its queue job id), 0 for none.
+    void submit(LogLevel level, uint64_t context, const char* text, size_t length);
+    // Waits until everything logged so far is written
+    void flush();
+
+private:
+    struct Record {
+        int64_t timeUs;
+        uint64_t context;
+        uint16_t length;
+        uint8_t level;
+        char text[kMaxMessage];
+    };
+    // Single producer (its thread), single consumer (the sink thread)
+    struct Ring {
+        std::vector<Record> records;
+        std::atomic<uint64_t> head{0}; // Next record to write, producer only
+        std::atomic<uint64_t> tail{0}; // Next record to read, sink only
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> orphaned{false}; // Its thread exited
+        uint32_t thread = 0;
+    };
+    friend struct LoggerRingHolder;
+
+    Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    Ring* ringOfThisThread();
+    void run();
+    // Writes the records of every ring; sink mutex held
+    void drain();
+    void writeRecord(const Record& record, uint32_t thread);
+    // Stops the sink thread at exit, later messages are written directly
+    static void shutdown();
+
+    static std::atomic<int> threshold;
+    static std::atomic<bool> curlTraceEnabled;
+
+    std::mutex ringMutex; // Guards rings
+    std::vector<std::unique_ptr<Ring>> rings;
+    uint32_t nextThread;
+
+    std::mutex sinkMutex; // Guards the output and draining
+    std::FILE* output;
+    Format format;
+    std::string line; // Formatting buffer of the sink
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<bool> stopping;
+    std::thread thread;
+};
+
+// One message, formatted into a fixed buffer and submitted when it goes out of scope.
+// Used through the LOG_* macros, which skip the whole expression below the level.
+class LogLine {
+public:
+    LogLine(LogLevel level, uint64_t context) : level(level), context(context), length(0) {}
+    ~LogLine() { Logger::instance().submit(level, context, text, length); }
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(const char* value);
+    LogLine& operator<<(const std::string& value) { return append(value.data(), value.size()); }
+    LogLine& operator<<(char value) { return append(&value, 1); }
+    LogLine& operator<<(bool value) { return *this << (value ? "true" : "false"); }
+    LogLine& operator<<(double value);
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+    LogLine& operator<<(T value) { return appendSigned(static_cast<long long>(value)); }
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, int>::type = 0>
+    LogLine& operator<<(T value) { return appendUnsigned(static_cast<unsigned long long>(value)); }
+
+private:
+    LogLine& append(const char* data, size_t size);
+    LogLine& appendSigned(long long value);
+    LogLine& appendUnsigned(unsigned long long value);
+
+    LogLevel level;
+    uint64_t context;
+    size_t length;
+    char text[Logger::kMaxMessage];
+};
+
+#define LOG_AT(level, context) \
+    if (!Logger::enabled(level)) {} else LogLine(level, context)
+#define LOG_TRACE(context) LOG_AT(LogLevel::Trace, context)
+#define LOG_DEBUG(context) LOG_AT(LogLevel::Debug, context)
+#define LOG_INFO(context) LOG_AT(LogLevel::Info, context)
+#define LOG_WARN(context) LOG_AT(LogLevel::Warning, context)
+#define LOG_ERROR(context) LOG_AT(LogLevel::Error, context)
+
+#endif // LOGGER_H
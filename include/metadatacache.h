@@ -0,0 +1,60 @@
+#ifndef METADATACACHE_H
+#define METADATACACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// What is known about the files downloaded before, keyed by URL: the server's
+// validators and where the finished copy was stored. A repeat download asks the server
+// with If-None-Match / If-Modified-Since and, on 304 Not Modified, links the stored
+// copy instead of fetching the body again.
+// Kept in memory as a hash map, persisted as an append-only log in the cache directory
+// that is compacted when it is loaded. Safe to use from any thread.
+class MetadataCache {
+public:
+    struct Entry {
+        std::string etag;         // Validators of the response the copy came from
+        std::string lastModified;
+        int64_t size = -1;
+        std::string path;         // Absolute path of the stored copy
+        int64_t modifiedMs = 0;   // Modification time of the copy when it was stored
+        std::string digest;       // "<algorithm>:<hex>" of the copy, empty if not hashed
+    };
+
+    static MetadataCache& instance();
+
+    // Location of the log; the default is "metadata.cache" in the application's cache
+    // directory. Only call it before the first lookup.
+    void setPath(const std::string& path);
+    // Entry of a URL whose stored copy is still there, unchanged since it was recorded.
+    // False if there is none or the copy was moved, modified or deleted.
+    bool lookup(const std::string& url, Entry& entry);
+    // Records the finished copy of a URL, replacing an older entry. Nothing is kept
+    // without a validator, a conditional request would have nothing to send.
+    void store(const std::string& url, const Entry& entry);
+
+    // Makes to a copy of from at the lowest cost the file system allows: a reflink
+    // (copy-on-write clone), else a hard link, else a plain copy. Replaces to.
+    static bool linkCopy(const std::string& from, const std::string& to);
+    // Modification time of a file in milliseconds since the epoch, 0 if it does not exist
+    static int64_t modificationTime(const std::string& path);
+
+private:
+    MetadataCache();
+    MetadataCache(const MetadataCache&) = delete;
+    MetadataCache& operator=(const MetadataCache&) = delete;
+
+    // Reads the log on first use, rewriting it when most of its lines are outdated
+    void load();
+    bool compact();
+
+    std::mutex mutex;
+    std::string logPath;
+    bool loaded;
+    size_t logLines; // Entries in the log, including replaced ones
+    std::unordered_map<std::string, Entry> entries;
+};
+
+#endif // METADATACACHE_H
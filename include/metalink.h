@@ -0,0 +1,46 @@
+#ifndef METALINK_H
+#define METALINK_H
+
+#include "streamhash.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class QByteArray;
+
+// Reader for Metalink 4 documents (RFC 5854): per published file its size, the mirrors
+// it can be fetched from and the hashes of the whole file and of its pieces. Only what
+// the downloader can use is kept: HTTP(S) mirrors and hash types StreamHash supports.
+class Metalink {
+public:
+    struct File {
+        std::string name;                     // Relative path suggested by the publisher
+        int64_t size = -1;                    // -1 if not given
+        std::vector<std::string> urls;        // HTTP(S) mirrors, most preferred first
+        HashAlgorithm hashAlgorithm = HashAlgorithm::None;
+        std::string hash;                     // Hex digest of the whole file, empty if none usable
+        HashAlgorithm pieceAlgorithm = HashAlgorithm::None;
+        int64_t pieceLength = 0;
+        std::vector<std::string> pieces;      // Hex digest of every pieceLength bytes, in order
+    };
+
+    // Reads a document from a file or from memory; false with error() set if it is not
+    // a Metalink 4 document or lists no file with a usable URL
+    bool load(const std::string& path);
+    bool parse(const QByteArray& document);
+
+    const std::vector<File>& files() const { return entries; }
+    const std::string& error() const { return lastError; }
+
+    // True if a path looks like a Metalink document (".meta4" or ".metalink")
+    static bool isMetalinkPath(const std::string& path);
+    // Last component of a publisher supplied name, so it cannot point outside the
+    // download directory; empty if nothing usable is left
+    static std::string safeFileName(const std::string& name);
+
+private:
+    std::vector<File> entries;
+    std::string lastError;
+};
+
+#endif // METALINK_H
@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <curl/curl.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Distribution of durations over fixed buckets from 1 ms to an hour. Observed on the
+// engine thread and rendered from any other with relaxed atomics, like TransferStats.
+class Histogram {
+public:
+    static const int kBuckets = 20;
+
+    void observe(int64_t microseconds);
+    // Prometheus lines of the histogram (_bucket, _sum and _count); labels is either
+    // empty or "key=\"value\"" put in front of the le label
+    void render(std::string& out, const char* name, const std::string& labels = std::string()) const;
+
+private:
+    std::atomic<uint64_t> counts[kBuckets + 1] = {}; // Last one past the largest bound
+    std::atomic<int64_t> sumUs{0};
+};
+
+// Process-wide counters and latency histograms of all downloads, for capacity planning:
+// where the time of a transfer goes (DNS, connect, TLS, first byte, total, from libcurl's
+// *_TIME_T infos), how often connections are opened instead of reused, retries, and the
+// bytes received over time. Rendered in the Prometheus text format, which the CLI serves
+// on localhost or rewrites into a file.
+class Metrics {
+public:
+    static Metrics& instance();
+
+    // Records the phases and connection reuse of a finished (or failed) easy handle
+    // before it is recycled. Engine thread.
+    void recordTransfer(CURL* handle, CURLcode result);
+    void addReceivedBytes(int64_t bytes) { add(receivedBytes, bytes); }
+    void addWastedBytes(int64_t bytes) { add(wastedBytes, bytes); }
+    void addRetry() { add(retries, 1); }
+    void addTransferStarted() { add(transfersStarted, 1); }
+    void addDownload(bool success, int64_t microseconds);
+
+    // Prometheus text exposition format (version 0.0.4). Any thread.
+    std::string render() const;
+    // Replaces path with the current render() atomically; false if it cannot be written
+    bool writeFile(const std::string& path) const;
+
+private:
+    Metrics() = default;
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    template <typename T, typename V>
+    static void add(std::atomic<T>& counter, V value) {
+        counter.fetch_add(static_cast<T>(value), std::memory_order_relaxed);
+    }
+
+    Histogram dnsTime;        // New connections: name lookup
+    Histogram connectTime;    // New connections: TCP connect after the lookup
+    Histogram tlsTime;        // New TLS connections: handshake after the connect
+    Histogram firstByteTime;  // From the start of the transfer to the first response byte
+    Histogram transferTime;   // Whole transfer
+    Histogram downloadTime;   // Whole download, from the start to its result
+    std::atomic<uint64_t> transfersStarted{0};
+    std::atomic<uint64_t> transfersOk{0};
+    std::atomic<uint64_t> transfersFailed{0};
+    std::atomic<uint64_t> connectionsOpened{0}; // CURLINFO_NUM_CONNECTS of all transfers
+    std::atomic<uint64_t> connectionsReused{0}; // Transfers answered on a connection of an earlier one
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> downloadsOk{0};
+    std::atomic<uint64_t> downloadsFailed{0};
+    std::atomic<int64_t> receivedBytes{0};      // Over the network, before decoding
+    std::atomic<int64_t> wastedBytes{0};
+};
+
+#endif // METRICS_H
@@ -0,0 +1,19 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QTcpServer>
+
+// Serves Metrics::render() to Prometheus scrapers: "GET /metrics" on a localhost port,
+// one response per connection. Runs on the Qt event loop of its thread.
+class MetricsServer : public QTcpServer {
+    Q_OBJECT
+public:
+    explicit MetricsServer(QObject* parent = nullptr);
+    // Listens on 127.0.0.1; false if the port is taken
+    bool start(quint16 port);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+};
+
+#endif // METRICSSERVER_H
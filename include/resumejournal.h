@@ -0,0 +1,80 @@
+#ifndef RESUMEJOURNAL_H
+#define RESUMEJOURNAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Progress of a download that survives restarts and crashes. Kept in a small sidecar
+// file next to the output ("<output>.resume") holding the URL, the size, the server's
+// validators (ETag / Last-Modified) and a bitmap of completed blocks. A block is only
+// marked once its bytes are durable on disk, so after a crash the journal may lag
+// behind the file but never claims data that is not there. Block digests may run
+// ahead of the bitmap; they only depend on the content, which the validators pin.
+class ResumeJournal {
+public:
+    // Granularity of the completion bitmap (a 50 GB file needs ~6 KB of bits)
+    static const int64_t kDefaultBlockSize = 1024 * 1024;
+
+    // Location of the journal belonging to an output file
+    static std::string pathFor(const std::string& outputPath);
+    // Deletes a journal file, if any
+    static void remove(const std::string& path);
+
+    // Starts an empty journal for the given remote object
+    void reset(const std::string& url, int64_t size, const std::string& etag,
+               const std::string& lastModified, int64_t blockSize = kDefaultBlockSize);
+    // Reads a journal written by save(), false if it is missing or unreadable
+    bool load(const std::string& path);
+    // Atomically replaces the journal file (written to a temporary file, synced, renamed)
+    bool save(const std::string& path) const;
+
+    // True if the journal describes the same, unchanged remote object. Needs a validator
+    // on both sides: without one a changed file cannot be told apart.
+    bool matches(const std::string& url, int64_t size, const std::string& etag,
+                 const std::string& lastModified) const;
+    // Validator for an If-Range header: a strong ETag, else the Last-Modified date
+    std::string ifRangeValue() const;
+
+    // Marks every block that lies completely inside [begin, end)
+    void markRange(int64_t begin, int64_t end);
+    bool blockDone(size_t block) const { return (bits[block / 8] >> (block % 8)) & 1; }
+    size_t blockCount() const { return blocks; }
+    int64_t blockSize() const { return blockBytes; }
+    // Bytes covered by completed blocks
+    int64_t completedBytes() const;
+    // Maximal byte ranges of done or missing blocks, in file order
+    struct Run {
+        int64_t first; // First byte
+        int64_t last;  // Last byte (inclusive)
+        bool done;
+    };
+    std::vector<Run> runs() const;
+
+    // Verification state kept with the progress (see IntegrityCheck), so a resumed
+    // download needs no rescan of the blocks it already has
+    struct HashState {
+        std::string algorithm;                 // Empty when not verifying
+        int64_t blockSize = 0;
+        std::vector<std::string> blockDigests; // Hex per block, empty where unknown
+        int64_t frontierOffset = 0;            // In-order hash: bytes covered
+        std::string frontierState;             // In-order hash: StreamHash::save()
+    };
+    void setHashState(const HashState& state) { hashes = state; }
+    const HashState& hashState() const { return hashes; }
+
+    const std::string& url() const { return remoteUrl; }
+    int64_t size() const { return totalSize; }
+
+private:
+    std::string remoteUrl;
+    int64_t totalSize = 0;
+    std::string etag;
+    std::string lastModified;
+    int64_t blockBytes = kDefaultBlockSize;
+    size_t blocks = 0;
+    std::vector<uint8_t> bits; // One bit per block, least significant bit first
+    HashState hashes;
+};
+
+#endif // RESUMEJOURNAL_H
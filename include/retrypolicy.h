@@ -0,0 +1,39 @@
+#ifndef RETRYPOLICY_H
+#define RETRYPOLICY_H
+
+#include <curl/curl.h>
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+// When a failed transfer is tried again and how long it waits. Failures are told apart
+// by curl's result and the HTTP status: a timeout, a reset connection or a 503 pass by
+// themselves, a 404 or a full disk do not. Retries back off exponentially with jitter,
+// so connections that failed together do not come back together, and draw from a
+// budget that refills as data arrives: a flaky link that keeps making progress keeps
+// going, a dead one gives up after a few attempts. One per download, engine thread only.
+class RetryPolicy {
+public:
+    RetryPolicy();
+
+    // True for failures that may not happen again on the next attempt
+    static bool transient(CURLcode result, long httpCode);
+
+    // Wait before the given consecutive attempt of a segment (1 for the first retry),
+    // between half and all of the exponential step. A Retry-After of the server in
+    // seconds (-1 if none) replaces the backoff, up to the longest delay.
+    std::chrono::milliseconds delay(int attempt, int64_t retryAfterS);
+
+    // Full budget, at the start or resume of a download
+    void reset();
+    // Takes one retry, false once the budget is spent. transferredBytes is what the
+    // download received since the reset; every few megabytes of it return one retry.
+    bool consume(int64_t transferredBytes);
+
+private:
+    double tokens;
+    int64_t creditedBytes; // transferredBytes already turned into tokens
+    std::mt19937 random;
+};
+
+#endif // RETRYPOLICY_H
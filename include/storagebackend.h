@@ -0,0 +1,95 @@
+#ifndef STORAGEBACKEND_H
+#define STORAGEBACKEND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Tuning of the output path of a download
+struct StorageOptions {
+    enum Backend {
+        Pwrite,  // Positional writes of coalesced chunks (default, all platforms)
+        IoUring, // Batched io_uring submissions (Linux builds with liburing, else Pwrite)
+        Mmap     // Memory-mapped output file (needs the size up front, else Pwrite)
+    };
+    Backend backend = Pwrite;
+    // Bytes a writer collects before issuing one positional write; larger suits
+    // spinning disks, a few hundred KiB is enough for NVMe
+    size_t chunkSize = 1024 * 1024;
+    // Receive buffer handed to curl (CURLOPT_BUFFERSIZE), up to CURL_MAX_READ_SIZE
+    long receiveBufferSize = 256 * 1024;
+    // io_uring: writes queued before they are submitted in one batch
+    unsigned queueDepth = 32;
+    // Hand chunks to the WriteStage writer thread instead of writing them in curl's callback
+    bool asyncWrites = true;
+};
+
+using StorageBuffer = std::vector<char>;
+
+class WriteStage;
+
+// Output file that accepts writes at arbitrary offsets. writeAt/writeChunk may be
+// called from several threads at once as long as the byte ranges do not overlap.
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+
+    // Opens (and creates) the file; truncate starts it empty. With a known size the
+    // file is extended up front so ranges can land anywhere without growing it.
+    virtual bool open(const std::string& path, int64_t size, bool truncate) = 0;
+    // Writes length bytes at offset before returning
+    virtual bool writeAt(int64_t offset, const char* data, size_t length) = 0;
+    // Writes a full chunk obtained with BufferPool::tryAcquire(reserved). The backend
+    // gives it back to the pool once it is written, so a batching backend keeps it
+    // charged to the memory budget while the write is in flight. buffer is left empty.
+    virtual bool writeChunk(int64_t offset, StorageBuffer& buffer, size_t reserved);
+    // Waits for queued writes and pushes them to the operating system
+    virtual bool flush() = 0;
+    // flush() plus forcing the written data onto stable storage (fdatasync), so it
+    // survives a power loss; used before the resume journal records progress
+    virtual bool sync();
+    virtual void close() = 0;
+    virtual const char* name() const = 0;
+
+    // Backend for the options; a size <= 0 (unknown) rules out Mmap
+    static std::unique_ptr<StorageBackend> create(const StorageOptions& options, int64_t size);
+};
+
+// Sequential writer for one byte range. Collects small pieces from the network into
+// chunkSize buffers and issues one positional write per chunk. The buffers come from
+// the BufferPool; with a WriteStage they are written by its thread, otherwise before
+// write() returns.
+class StorageWriter {
+public:
+    StorageWriter(StorageBackend* backend, size_t chunkSize, int64_t offset, WriteStage* stage = nullptr);
+    ~StorageWriter();
+
+    // Makes sure the next write of length bytes will not have to wait for buffer space.
+    // False when the BufferPool is exhausted; the caller should pause and retry later.
+    bool reserve(size_t length);
+    // Appends at the current offset
+    bool write(const char* data, size_t length);
+    // Writes out (or queues) the partially filled chunk and gives back unused buffers
+    bool flush();
+    // Offset of the next byte (including bytes still buffered)
+    int64_t offset() const { return chunkOffset + static_cast<int64_t>(buffer.size()); }
+    // End of the bytes already handed to the backend (or queued on the stage); the
+    // partially filled chunk is not included
+    int64_t committedOffset() const { return chunkOffset; }
+
+private:
+    // Current chunk to fill, taken from the spare buffers or the pool (async mode)
+    bool takeBuffer();
+
+    StorageBackend* backend;
+    WriteStage* stage;
+    size_t chunkSize;
+    int64_t chunkOffset; // File offset of buffer[0]
+    StorageBuffer buffer;
+    bool haveBuffer;     // buffer holds a reservation from the BufferPool
+    std::vector<StorageBuffer> spare; // Async mode: buffers reserved ahead by reserve()
+};
+
+#endif // STORAGEBACKEND_H
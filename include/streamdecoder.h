@@ -0,0 +1,62 @@
+#ifndef STREAMDECODER_H
+#define STREAMDECODER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Incremental decompressor for downloads that are stored decompressed (".gz" and ".zst"
+// files). The body is fed in as it arrives and the output comes out in bounded steps,
+// so a step whose output does not fit into the write buffers can wait without holding
+// up more than one step of data. The state lives in memory: a paused download continues
+// with a range request at the compressed offset, a restarted process starts over.
+class StreamDecoder {
+public:
+    enum Format {
+        None,
+        Gzip, // RFC 1952, also several members in a row
+        Zstd  // Zstandard frames
+    };
+
+    // Format by the file name extension of a URL or path (".gz", ".tgz", ".zst", ".tzst"),
+    // None for other names or when this build has no decoder for it
+    static Format formatFor(const std::string& url);
+    // Name of the decompressed file: "a.tar.gz" -> "a.tar", "a.tgz" -> "a.tar"
+    static std::string decodedName(const std::string& name);
+    // True for names of already compressed files (archives, images, video), which are
+    // not worth compressing on the wire
+    static bool compressedName(const std::string& url);
+    static const char* formatName(Format format);
+
+    explicit StreamDecoder(Format format);
+    ~StreamDecoder();
+    StreamDecoder(const StreamDecoder&) = delete;
+    StreamDecoder& operator=(const StreamDecoder&) = delete;
+
+    // Feeds the next bytes of the body and returns how many were consumed; the output of
+    // the step is pending() until clearPending(). Data that does not start with the
+    // format's magic bytes is passed through unchanged (the server sent it decoded).
+    size_t decode(const char* data, size_t length);
+    const char* pending() const { return output.data(); }
+    size_t pendingSize() const { return outputSize; }
+    void clearPending() { outputSize = 0; }
+    // The last step filled its output, call decode() again even without new input
+    bool outputFull() const { return outputSize == output.size(); }
+
+    // The stream ended at a frame boundary; false for a truncated body
+    bool finished() const;
+    bool failed() const { return !lastError.empty(); }
+    const std::string& error() const { return lastError; }
+
+private:
+    Format format;
+    bool started;      // The magic bytes were checked
+    bool passThrough;  // Not compressed after all
+    bool atBoundary;   // Between two gzip members or zstd frames
+    void* stream;      // z_stream or ZSTD_DStream
+    std::vector<char> output;
+    size_t outputSize;
+    std::string lastError;
+};
+
+#endif // STREAMDECODER_H
@@ -0,0 +1,63 @@
+#ifndef STREAMHASH_H
+#define STREAMHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Hash functions a download can be verified with
+enum class HashAlgorithm {
+    None,
+    Crc32c, // Castagnoli CRC, hardware instructions on x86 (SSE4.2) and ARMv8; combinable per block
+    Sha256, // SHA-256, SHA extensions on x86 when the CPU has them
+    Xxh64,  // xxHash64, fast in plain 64-bit arithmetic
+    Sha1    // SHA-1, only to check files published with it (zsync manifests, older Metalinks)
+};
+
+// "crc32c", "sha256", "xxh64", "sha1" ("none" for None)
+const char* hashAlgorithmName(HashAlgorithm algorithm);
+// Inverse of hashAlgorithmName(), None for unknown names
+HashAlgorithm hashAlgorithmFromName(const std::string& name);
+// Splits "<algorithm>:<hex digest>" (e.g. "sha256:9f86...") and checks the digest
+// length; false if the algorithm is unknown or the digest malformed
+bool parseDigestSpec(const std::string& spec, HashAlgorithm& algorithm, std::string& hexDigest);
+
+// Incremental hash of a byte stream. Bytes are fed as they arrive, the digest can be
+// read at any point without disturbing the state, and the state can be saved as text
+// to continue after a restart. Copyable, so a running hash can be snapshotted.
+class StreamHash {
+public:
+    explicit StreamHash(HashAlgorithm algorithm = HashAlgorithm::None);
+
+    HashAlgorithm algorithm() const { return algo; }
+    // Bytes hashed so far
+    uint64_t length() const { return total; }
+
+    void update(const void* data, size_t length);
+    // Digest of the bytes so far as lowercase hex (xxh64 and crc32c big-endian, as the
+    // usual command line tools print them)
+    std::string hexDigest() const;
+    // CRC32C of the bytes so far (Crc32c only)
+    uint32_t crc32c() const { return crc; }
+
+    // State as a single line of text, and back; restore() fails on malformed input
+    std::string save() const;
+    bool restore(const std::string& text);
+
+    // CRC32C of A followed by B from the CRCs of A and B and the length of B, without
+    // the data; lets blocks hashed out of order add up to the digest of the whole file
+    static uint32_t crc32cCombine(uint32_t first, uint32_t second, uint64_t secondLength);
+    // Kernel used for the algorithm on this CPU, e.g. "sse4.2", "sha-ni" or "portable"
+    static const char* kernelName(HashAlgorithm algorithm);
+
+private:
+    HashAlgorithm algo;
+    uint64_t total;
+    uint32_t crc;            // Crc32c: finalized CRC of the bytes so far
+    uint32_t sha[8];         // Sha256: chaining state; Sha1: the first five words
+    uint64_t xxh[4];         // Xxh64: lane accumulators
+    unsigned char buffer[64]; // Bytes of an incomplete block (64 for SHA-256 and SHA-1, 32 for xxHash)
+    size_t buffered;
+};
+
+#endif // STREAMHASH_H
@@ -0,0 +1,91 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Arguments of a trace event, formatted as the members of a JSON object
+class TraceArgs {
+public:
+    TraceArgs& add(const char* key, int64_t value);
+    TraceArgs& add(const char* key, const std::string& value);
+    const std::string& str() const { return text; }
+
+private:
+    void key(const char* name);
+
+    std::string text;
+};
+
+// Timeline of the downloads for chrome://tracing and Perfetto: the HEAD probe, the
+// connection phases and each range request of a download, the write callbacks, disk
+// writes and pause/resume, as spans on one track per transfer. Each download is a
+// process in the viewer; the writer thread and other threads without a download are
+// tracks of process 0.
+//
+// Off by default. Every call site checks enabled() first, one relaxed load and a branch
+// that is never taken; nothing else runs and nothing is allocated while it is off. While
+// recording, events are kept in memory under a mutex (they are rare compared to the
+// bytes they describe) up to a fixed number, and written out as a whole by writeFile().
+class Tracer {
+public:
+    static Tracer& instance();
+
+    static bool enabled() { return recording.load(std::memory_order_relaxed); }
+    // Steady clock in microseconds, the time base of all events
+    static int64_t now();
+    static int64_t toUs(std::chrono::steady_clock::time_point time);
+
+    // Drops what was recorded before and starts recording
+    void start();
+    // Stops recording and writes the events as Chrome trace JSON ({"traceEvents":[..]});
+    // false if the file cannot be written
+    bool writeFile(const std::string& path);
+
+    // Id for a process or track of its own, never one of a queue job
+    uint64_t newTrack();
+    // Name shown for a track; track 0 names the process itself
+    void nameTrack(uint64_t process, uint64_t track, const std::string& name);
+    // Track of the calling thread in process 0, named on its first use
+    uint64_t threadTrack(const char* name);
+
+    // A span from startUs to endUs ("ph":"X")
+    void complete(uint64_t process, uint64_t track, const char* category, const std::string& name,
+                  int64_t startUs, int64_t endUs, const TraceArgs& args = TraceArgs());
+    // A point in time ("ph":"i")
+    void instant(uint64_t process, uint64_t track, const char* category, const std::string& name,
+                 const TraceArgs& args = TraceArgs());
+
+private:
+    struct Event {
+        char phase;
+        const char* category;
+        std::string name;
+        uint64_t process;
+        uint64_t track;
+        int64_t startUs;
+        int64_t durationUs;
+        std::string args;
+    };
+
+    Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    void record(Event&& event);
+
+    static std::atomic<bool> recording;
+
+    std::mutex mutex; // Guards the rest
+    std::vector<Event> events;
+    std::map<std::pair<uint64_t, uint64_t>, std::string> names; // Track names, kept across start()
+    uint64_t dropped;
+    std::atomic<uint64_t> nextTrack;
+};
+
+#endif // TRACER_H
@@ -0,0 +1,111 @@
+#ifndef TRANSFERENGINE_H
+#define TRANSFERENGINE_H
+
+#include <curl/curl.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Receives the events of the transfers it registered with the engine.
+// All callbacks run on the engine thread.
+class TransferObserver {
+public:
+    virtual ~TransferObserver() = default;
+    // Called once the easy handle has finished; the handle is already removed from the engine
+    virtual void onTransferDone(CURL* handle, CURLcode result) = 0;
+};
+
+// Runs every transfer of the process on one thread around a single curl multi handle.
+// On Linux sockets are watched with epoll and driven by curl_multi_socket_action,
+// other platforms fall back to curl_multi_poll. Easy handles, timers and observer
+// callbacks are only touched on the engine thread; other threads hand work over with post().
+class TransferEngine {
+public:
+    using Task = std::function<void()>;
+    using TimerId = std::uint64_t;
+
+    // Process-wide engine, the thread is started on first use
+    static TransferEngine& instance();
+
+    // Queues a task for the engine thread (callable from any thread)
+    void post(Task task);
+    // Runs a task on the engine thread and waits for it to finish (callable from any thread)
+    void invoke(Task task);
+    // True when called from the engine thread
+    bool isEngineThread() const;
+
+    // Starts a timer on the engine thread, returns an id for stopTimer (engine thread only)
+    TimerId startTimer(int intervalMs, Task task, bool repeat = false);
+    // Stops a timer, unknown or already fired ids are ignored (engine thread only)
+    void stopTimer(TimerId id);
+
+    // Adds an easy handle, the observer is told when it is done (engine thread only)
+    bool addHandle(CURL* handle, TransferObserver* observer);
+    // Removes an easy handle without notifying its observer (engine thread only)
+    void removeHandle(CURL* handle);
+    // Number of easy handles currently in the multi handle
+    size_t activeTransfers() const { return activeCount.load(); }
+
+    // Easy handle for a new transfer: a recycled one, reset but keeping its internal
+    // buffers, or a new one; nullptr if curl cannot create one (engine thread only)
+    CURL* takeHandle();
+    // Gives back a handle that is not registered any more, for the next transfer to reuse.
+    // Cheaper than curl_easy_cleanup plus curl_easy_init per file (engine thread only).
+    void recycleHandle(CURL* handle);
+
+private:
+    struct Timer {
+        std::chrono::steady_clock::time_point deadline;
+        int intervalMs = 0;
+        bool repeat = false;
+        Task task;
+    };
+
+    TransferEngine();
+    ~TransferEngine();
+    TransferEngine(const TransferEngine&) = delete;
+    TransferEngine& operator=(const TransferEngine&) = delete;
+
+    void run();
+    void wakeUp();
+    void runPendingTasks();
+    void runDueTimers();
+    void processCompletions();
+    // Milliseconds until the next engine timer or curl timeout, -1 when nothing is pending
+    int nextWaitMs() const;
+
+    static int socketCallback(CURL* handle, curl_socket_t socket, int what, void* userp, void* socketp);
+    static int timerCallback(CURLM* multi, long timeoutMs, void* userp);
+
+    CURLM* multi;
+    std::thread thread;
+    std::thread::id threadId;
+    std::atomic<bool> stopping;
+    std::atomic<size_t> activeCount;
+
+    std::mutex taskMutex;
+    std::vector<Task> pendingTasks;
+
+    std::map<TimerId, Timer> timers;
+    TimerId nextTimerId;
+    std::unordered_map<CURL*, TransferObserver*> observers;
+    std::vector<CURL*> idleHandles; // Reset handles kept by recycleHandle()
+
+    // Deadline requested by curl through CURLMOPT_TIMERFUNCTION
+    bool curlTimeoutPending;
+    std::chrono::steady_clock::time_point curlDeadline;
+
+#ifdef __linux__
+    int epollFd; // Watches the transfer sockets and the wake-up eventfd
+    int wakeFd;  // eventfd written by post() to interrupt epoll_wait
+#endif
+};
+
+#endif // TRANSFERENGINE_H
@@ -0,0 +1,55 @@
+#ifndef TRANSFERSTATS_H
+#define TRANSFERSTATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Live numbers of one download. The engine thread is the only writer, any thread may
+// sample them at its own pace (the UI every 100 ms) without locks or queued events.
+// Fields are independent relaxed atomics, so a reader may see values a few writes
+// apart from each other, which is fine for display.
+struct TransferStats {
+    std::atomic<int64_t> totalBytes{-1};     // File size, -1 while unknown
+    std::atomic<int64_t> storedBytes{0};     // Bytes received for the file so far, earlier runs included
+    std::atomic<int64_t> sessionBytes{0};    // Bytes received since the download was started or resumed
+    std::atomic<int64_t> wireBytes{0};       // sessionBytes as they came over the network, before any decoding
+    std::atomic<int64_t> sourceBytes{0};     // Stored decompressed: compressed bytes received, earlier runs included
+    std::atomic<int64_t> sourceTotalBytes{-1}; // Stored decompressed: compressed size, else -1
+    std::atomic<int64_t> startTimeUs{0};     // When the transfers were (re)started, steady clock
+    std::atomic<int64_t> firstDataTimeUs{0}; // When the first body byte of this run arrived, 0 before
+    std::atomic<int64_t> lastDataTimeUs{0};  // When data last arrived, steady clock (sampled every tick)
+    std::atomic<double> bytesPerSecond{0};   // Throughput, exponentially weighted moving average
+    std::atomic<int> connections{0};         // Transfers currently running
+    std::atomic<int> retries{0};             // Transfers retried after a transient failure, since the start
+    std::atomic<int64_t> wastedBytes{0};     // Bytes received but thrown away (restarts, bad blocks), since the start
+
+    // Counter update from the single writer: a load and a store, no locked instruction
+    static void add(std::atomic<int64_t>& counter, int64_t bytes) {
+        counter.store(counter.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    }
+
+    // Progress in percent, -1 while the size is unknown. A file stored decompressed has
+    // its size only at the end, its progress is that through the compressed body.
+    int percent() const {
+        int64_t sourceTotal = sourceTotalBytes.load(std::memory_order_relaxed);
+        if (sourceTotal > 0) {
+            return static_cast<int>(std::min<int64_t>(100, sourceBytes.load(std::memory_order_relaxed) * 100 / sourceTotal));
+        }
+        int64_t total = totalBytes.load(std::memory_order_relaxed);
+        if (total <= 0) {
+            return -1;
+        }
+        int64_t stored = storedBytes.load(std::memory_order_relaxed);
+        return static_cast<int>(std::min<int64_t>(100, stored * 100 / total));
+    }
+
+    // Timestamp in the unit of the *TimeUs fields
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+#endif // TRANSFERSTATS_H
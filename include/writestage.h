@@ -0,0 +1,74 @@
+#ifndef WRITESTAGE_H
+#define WRITESTAGE_H
+
+#include "storagebackend.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Decouples disk writes from the network. Transfers fill chunk buffers drawn from the
+// BufferPool and queue them here; a dedicated writer thread drains the queue into the
+// storage backends, which give the buffers back to the pool once they are written.
+class WriteStage {
+public:
+    // Writer lag
+    struct Stats {
+        size_t queuedBytes = 0;     // Filled buffers waiting for the writer thread
+        size_t queuedWrites = 0;
+        double writerLagMs = 0;     // Age of the oldest queued write
+        uint64_t bytesWritten = 0;  // Total handed to the backends
+    };
+
+    static WriteStage& instance();
+
+    // Queues a filled buffer obtained with BufferPool::tryAcquire(reserved) for writing
+    // at offset; the buffer goes back to the pool once it is written
+    void submit(StorageBackend* backend, int64_t offset, StorageBuffer&& buffer, size_t reserved);
+    // Runs task on the writer thread once every write queued for backend before it is
+    // done (and before any write queued after it). drain() waits for tasks as well.
+    void submitTask(StorageBackend* backend, std::function<void()> task);
+    // Waits until every write queued for backend is done, false if one of them failed.
+    // Clears the error state of the backend.
+    bool drain(StorageBackend* backend);
+    // True once a write for backend has failed
+    bool failed(StorageBackend* backend) const;
+
+    Stats stats() const;
+
+private:
+    struct PendingWrite {
+        StorageBackend* backend = nullptr;
+        int64_t offset = 0;
+        StorageBuffer buffer;
+        size_t reserved = 0;
+        std::chrono::steady_clock::time_point queuedAt;
+        std::function<void()> task; // Set for submitTask() entries, which carry no data
+    };
+
+    WriteStage();
+    ~WriteStage();
+    WriteStage(const WriteStage&) = delete;
+    WriteStage& operator=(const WriteStage&) = delete;
+
+    void run();
+
+    mutable std::mutex mutex;
+    std::condition_variable queueCondition; // Writer thread waits for work
+    std::condition_variable drainCondition; // drain() waits for a backend's writes
+    std::deque<PendingWrite> queue;
+    std::map<StorageBackend*, int> pendingPerBackend;
+    std::map<StorageBackend*, bool> failedBackends;
+    Stats counters;
+    bool stopping;
+
+    std::thread thread;
+};
+
+#endif // WRITESTAGE_H
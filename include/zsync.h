@@ -0,0 +1,81 @@
+#ifndef ZSYNC_H
+#define ZSYNC_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class QByteArray;
+
+// Control file of zsync (".zsync", made by zsyncmake and published next to the file):
+// the new file's length and SHA-1, and for each block a truncated rolling checksum (as
+// rsync's, two 16-bit sums) and a truncated MD4. A client finds the blocks it already has
+// in an older local copy and fetches only the rest with range requests.
+class ZsyncManifest {
+public:
+    // Reads a control file from a file or from memory; false with error() set if it is
+    // malformed or uses a feature that is not supported (gzip-compressed targets)
+    bool load(const std::string& path);
+    bool parse(const QByteArray& document);
+    const std::string& error() const { return lastError; }
+
+    const std::string& fileName() const { return name; }
+    int64_t length() const { return fileLength; }
+    int64_t blockSize() const { return blockBytes; }
+    size_t blockCount() const { return weakSums.size(); }
+    // Lowercase hex SHA-1 of the new file, empty if the control file has none
+    const std::string& sha1() const { return fileSha1; }
+    // Locations of the new file given in the control file, as written (may be relative)
+    const std::vector<std::string>& urls() const { return fileUrls; }
+
+private:
+    friend class ZsyncScan;
+
+    std::string name;
+    int64_t fileLength = 0;
+    int64_t blockBytes = 0;
+    int sequenceMatches = 1;              // Consecutive blocks that must match together
+    int weakBytes = 4;                    // Bytes kept of each rolling checksum
+    int strongBytes = 16;                 // Bytes kept of each MD4
+    std::string fileSha1;
+    std::vector<std::string> fileUrls;
+    std::vector<uint32_t> weakSums;       // Per block, masked to weakBytes
+    std::vector<unsigned char> strongSums; // Per block, strongBytes each
+    std::string lastError;
+};
+
+// Finds the blocks of a manifest in an older local file and copies them into the output,
+// which is created at the new length. Scans every offset of the old file with the rolling
+// checksum, so blocks that moved are found as well; a run of unchanged blocks is skipped
+// through block by block with vectorized checksums. Runs on any thread, like
+// IntegrityCheck::CatchUp, and stops early once cancelled is set.
+class ZsyncScan {
+public:
+    ZsyncScan(std::shared_ptr<const ZsyncManifest> manifest, const std::string& sourcePath,
+              const std::string& outputPath);
+
+    void run();
+
+    // Byte ranges [first, last] of the new file that were not found locally. Gaps of found
+    // blocks shorter than mergeGap are fetched again with them, one request instead of two.
+    std::vector<std::pair<int64_t, int64_t>> missingRanges(int64_t mergeGap) const;
+
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> finished{false};
+    std::atomic<int64_t> scannedBytes{0}; // Progress through the old file
+    // Results, valid once finished
+    bool ok = false;
+    std::string error;
+    int64_t reusedBytes = 0;
+    std::vector<bool> found; // Per block of the new file
+
+private:
+    std::shared_ptr<const ZsyncManifest> manifest;
+    std::string sourcePath;
+    std::string outputPath;
+};
+
+#endif // ZSYNC_H
@@ -0,0 +1,148 @@
+#include "bandwidthshaper.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// Refill period; short enough that a paused transfer resumes before its socket
+// buffer matters, long enough to cost nothing when shaping is on
+static const int kRefillIntervalMs = 20;
+// Tokens an idle client may save up, as time at its rate
+static const double kBurstSeconds = 0.1;
+// Headroom given to a client that used less than its share, so it can ramp up
+static const double kDemandHeadroom = 1.25;
+
+BandwidthShaper& BandwidthShaper::instance() {
+    static BandwidthShaper shaper;
+    return shaper;
+}
+
+BandwidthShaper::BandwidthShaper()
+    : globalBytesPerSecond(0),
+      refillTimer(0)
+{
+}
+
+void BandwidthShaper::setGlobalLimit(int64_t bytesPerSecond) {
+    globalBytesPerSecond.store(std::max<int64_t>(0, bytesPerSecond));
+    TransferEngine::instance().post([this]() { updateShaping(); });
+}
+
+BandwidthShaper::Client* BandwidthShaper::addClient(std::function<void()> wake) {
+    clients.emplace_back();
+    Client* client = &clients.back();
+    client->wake = std::move(wake);
+    updateShaping();
+    return client;
+}
+
+void BandwidthShaper::removeClient(Client* client) {
+    clients.remove_if([client](const Client& c) { return &c == client; });
+    updateShaping();
+}
+
+void BandwidthShaper::setClientLimit(Client* client, int64_t bytesPerSecond) {
+    client->limit = std::max<int64_t>(0, bytesPerSecond);
+    updateShaping();
+}
+
+void BandwidthShaper::setClientWeight(Client* client, double weight) {
+    client->weight = weight > 0 ? weight : 1.0;
+}
+
+void BandwidthShaper::updateShaping() {
+    bool global = globalBytesPerSecond.load() > 0;
+    bool any = false;
+    for (Client& client : clients) {
+        bool shaped = global || client.limit > 0;
+        if (!shaped && client.blocked) {
+            // The limit was lifted while the client waited for tokens
+            client.blocked = false;
+            client.wake();
+        }
+        if (shaped && !client.shaped) {
+            client.tokens = 0;
+            client.used = 0;
+        }
+        client.shaped = shaped;
+        any |= shaped;
+    }
+
+    TransferEngine& engine = TransferEngine::instance();
+    if (any && refillTimer == 0) {
+        lastRefill = std::chrono::steady_clock::now();
+        refillTimer = engine.startTimer(kRefillIntervalMs, [this]() { refill(); }, true);
+    } else if (!any && refillTimer != 0) {
+        engine.stopTimer(refillTimer);
+        refillTimer = 0;
+    }
+}
+
+void BandwidthShaper::refill() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - lastRefill).count();
+    lastRefill = now;
+    if (elapsed <= 0) {
+        return;
+    }
+
+    // Ceiling of every client that wants bandwidth: its own cap, and for a client that
+    // did not use up its tokens the rate it actually received (plus headroom)
+    const double unlimited = std::numeric_limits<double>::infinity();
+    struct Demand {
+        Client* client;
+        double ceiling;
+    };
+    std::vector<Demand> pending;
+    for (Client& client : clients) {
+        client.rate = 0;
+        if (!client.shaped) {
+            continue;
+        }
+        double ceiling = client.limit > 0 ? static_cast<double>(client.limit) : unlimited;
+        if (!client.blocked) {
+            ceiling = std::min(ceiling, client.used / elapsed * kDemandHeadroom);
+        }
+        if (ceiling > 0) {
+            pending.push_back({&client, ceiling});
+        }
+    }
+
+    // Weighted max-min fair share (water filling): clients whose ceiling is below their
+    // weighted share get the ceiling, the rest split what is left by weight
+    int64_t global = globalBytesPerSecond.load();
+    double remaining = global > 0 ? static_cast<double>(global) : unlimited;
+    while (!pending.empty()) {
+        double totalWeight = 0;
+        for (const Demand& demand : pending) {
+            totalWeight += demand.client->weight;
+        }
+        double perWeight = remaining / totalWeight;
+        auto capped = std::stable_partition(pending.begin(), pending.end(), [perWeight](const Demand& demand) {
+            return demand.ceiling > demand.client->weight * perWeight;
+        });
+        if (capped == pending.end()) {
+            for (Demand& demand : pending) {
+                demand.client->rate = demand.client->weight * perWeight;
+            }
+            break;
+        }
+        for (auto it = capped; it != pending.end(); ++it) {
+            it->client->rate = it->ceiling;
+            remaining -= it->ceiling;
+        }
+        pending.erase(capped, pending.end());
+    }
+
+    for (Client& client : clients) {
+        if (!client.shaped) {
+            continue;
+        }
+        double burst = client.rate * kBurstSeconds;
+        client.tokens = std::min(client.tokens + client.rate * elapsed, burst);
+        client.used = 0;
+        if (client.blocked && client.tokens >= 0) {
+            client.blocked = false;
+            client.wake();
+        }
+    }
+}
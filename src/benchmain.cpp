@@ -0,0 +1,449 @@
+// End-to-end benchmark of the download engine. Starts the stand-in server (this binary
+// with --serve) as a child process, so the CPU time and peak RSS measured here belong to
+// the client alone, then drives Downloader and DownloadQueue through fixed scenarios and
+// writes one JSON line per scenario to stdout. Keys come out sorted and the simulated
+// network is seeded, so the output of two commits can be diffed field by field.
+#include "benchserver.h"
+#include "curlshare.h"
+#include "downloader.h"
+#include "downloadqueue.h"
+#include "logger.h"
+#include "transferstats.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <curl/curl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+// Pause/resume cycle: run this long, stay paused this long
+const int kRunBeforePauseMs = 300;
+const int kPausedMs = 100;
+// Keep-alive used on the cycles that keep the connections open
+const int kKeepAliveMs = 30000;
+
+double cpuSeconds() {
+#ifdef Q_OS_WIN
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    auto seconds = [](const FILETIME& time) {
+        return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 1e7;
+    };
+    return seconds(kernel) + seconds(user);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+// Restarts peak RSS tracking where the platform allows it (Linux); elsewhere the peak
+// covers the process so far, so run a single scenario for exact numbers
+void resetPeakRss() {
+#ifdef Q_OS_LINUX
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+#endif
+}
+
+qint64 peakRssKb() {
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return static_cast<qint64>(counters.PeakWorkingSetSize / 1024);
+#elif defined(Q_OS_LINUX)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtoll(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    return -1;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024; // Bytes on macOS
+#endif
+}
+
+double mean(const std::vector<double>& values) {
+    double sum = 0;
+    for (double value : values) sum += value;
+    return values.empty() ? -1 : sum / values.size();
+}
+
+// Compares a downloaded file with the content the server generates
+bool verifyFile(const QString& path, qint64 size) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() != size) {
+        return false;
+    }
+    std::vector<char> expected(1 << 20);
+    qint64 offset = 0;
+    while (offset < size) {
+        QByteArray actual = file.read(static_cast<qint64>(expected.size()));
+        if (actual.isEmpty()) {
+            return false;
+        }
+        fillBenchContent(offset, expected.data(), static_cast<size_t>(actual.size()));
+        if (std::memcmp(actual.constData(), expected.data(), static_cast<size_t>(actual.size())) != 0) {
+            return false;
+        }
+        offset += actual.size();
+    }
+    return true;
+}
+
+struct RunResult {
+    bool ok = false;
+    int files = 0;
+    qint64 bytes = 0;
+    double ttfbMs = -1;                 // Mean request-to-first-byte time
+    double fileMs = -1;                 // Mean start-to-finish time of one file (queue runs)
+    std::vector<double> keptAliveMs;    // Resume latencies over kept-alive connections
+    std::vector<double> reconnectMs;    // Resume latencies with a reconnect
+};
+
+struct Scenario {
+    QString name;
+    QStringList serverArgs;                 // NetworkProfile of the server, as --serve options
+    std::vector<qint64> fileSizes;
+    int pauseCycles = 0;                    // Single download paused and resumed this often
+    bool skipProbe = false;                 // Small-file mode, no HEAD request per file
+};
+
+// One download, optionally paused and resumed pauseCycles times, alternating between
+// kept-alive connections and a full teardown
+RunResult runSingle(const std::string& url, const std::string& outputPath, int connections, int pauseCycles) {
+    RunResult result;
+    Downloader downloader(url, outputPath, nullptr);
+    downloader.setConnectionCount(connections);
+    std::shared_ptr<const TransferStats> stats = downloader.stats();
+    QEventLoop loop;
+    bool finished = false;
+    int cycle = 0;
+    int64_t startUs = TransferStats::nowUs();
+
+    auto noteTtfb = [&]() {
+        int64_t firstUs = stats->firstDataTimeUs.load();
+        if (result.ttfbMs < 0 && firstUs != 0) {
+            result.ttfbMs = (firstUs - startUs) / 1000.0;
+        }
+    };
+    auto pauseLater = [&]() {
+        if (cycle >= pauseCycles) {
+            return;
+        }
+        downloader.setPauseKeepAlive(cycle++ % 2 == 0 ? kKeepAliveMs : 0);
+        QTimer::singleShot(kRunBeforePauseMs, &loop, [&]() {
+            if (!finished) {
+                noteTtfb();
+                downloader.requestPause();
+            }
+        });
+    };
+    QObject::connect(&downloader, &Downloader::downloadPaused, &loop, [&]() {
+        QTimer::singleShot(kPausedMs, &loop, [&]() {
+            if (!finished) downloader.resumeDownload();
+        });
+    });
+    QObject::connect(&downloader, &Downloader::resumeLatencyMeasured, &loop, [&](qint64 us, bool keptAlive) {
+        (keptAlive ? result.keptAliveMs : result.reconnectMs).push_back(us / 1000.0);
+        pauseLater();
+    });
+    QObject::connect(&downloader, &Downloader::downloadFinished, &loop, [&](bool success) {
+        finished = true;
+        result.ok = success;
+        loop.quit();
+    });
+
+    downloader.startDownload();
+    pauseLater();
+    loop.exec();
+
+    noteTtfb();
+    result.files = 1;
+    result.bytes = stats->storedBytes.load();
+    return result;
+}
+
+// Many files through the queue, as a batch would run them
+RunResult runQueue(const std::vector<std::pair<std::string, std::string>>& files, int connections, bool skipProbe) {
+    RunResult result;
+    result.ok = true;
+    DownloadQueue queue;
+    queue.setMaxActive(8);
+    queue.setMaxPerHost(8); // Everything comes from the one local server
+    queue.setConnectionsPerJob(connections);
+    queue.setSkipProbe(skipProbe);
+    QEventLoop loop;
+    std::map<int, int64_t> startUs;
+    double ttfbSumMs = 0;
+    int ttfbCount = 0;
+    double fileSumMs = 0;
+
+    QObject::connect(&queue, &DownloadQueue::jobStarted, &loop, [&](int id) {
+        if (startUs.count(id) == 0) startUs[id] = TransferStats::nowUs();
+    });
+    QObject::connect(&queue, &DownloadQueue::jobFinished, &loop, [&](int id, bool success) {
+        std::shared_ptr<const TransferStats> stats = queue.stats(id);
+        if (stats && stats->firstDataTimeUs.load() != 0) {
+            ttfbSumMs += (stats->firstDataTimeUs.load() - startUs[id]) / 1000.0;
+            ++ttfbCount;
+        }
+        fileSumMs += (TransferStats::nowUs() - startUs[id]) / 1000.0;
+        result.bytes += stats ? stats->storedBytes.load() : 0;
+        result.ok = result.ok && success;
+        if (++result.files == static_cast<int>(files.size())) {
+            loop.quit();
+        }
+    });
+
+    for (const auto& file : files) {
+        queue.enqueue(file.first, file.second);
+    }
+    loop.exec();
+    result.ttfbMs = ttfbCount > 0 ? ttfbSumMs / ttfbCount : -1;
+    result.fileMs = result.files > 0 ? fileSumMs / result.files : -1;
+    return result;
+}
+
+// Starts "<this binary> --serve <args>" and returns the port it listens on, -1 on failure
+int startServer(QProcess& process, const QStringList& args) {
+    process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    process.start(QCoreApplication::applicationFilePath(), QStringList{"--serve"} + args);
+    if (!process.waitForStarted()) {
+        return -1;
+    }
+    while (!process.canReadLine()) {
+        if (!process.waitForReadyRead(5000)) {
+            return -1;
+        }
+    }
+    QByteArray line = process.readLine().trimmed();
+    return line.startsWith("listening ") ? line.mid(10).toInt() : -1;
+}
+
+int serve(const NetworkProfile& profile, int port, const QString& certificatePath, const QString& keyPath) {
+    BenchServer server(profile);
+    if (!certificatePath.isEmpty() && !server.enableTls(certificatePath, keyPath)) {
+        std::cerr << "Cannot use the TLS certificate and key" << std::endl;
+        return 2;
+    }
+    if (!server.listen(QHostAddress::LocalHost, static_cast<quint16>(port))) {
+        std::cerr << "Cannot listen: " << server.errorString().toStdString() << std::endl;
+        return 2;
+    }
+    std::printf("listening %d\n", server.serverPort());
+    std::fflush(stdout);
+    return QCoreApplication::exec();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    CURLcode global_init_res = curl_global_init(CURL_GLOBAL_ALL);
+    if (global_init_res != CURLE_OK) {
+        std::cerr << "FATAL: curl_global_init() failed: "
+                  << curl_easy_strerror(global_init_res) << std::endl;
+        return 1;
+    }
+    if (atexit(curl_global_cleanup) != 0) {
+        std::cerr << "WARNING: Failed to register curl_global_cleanup with atexit." << std::endl;
+    }
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("download-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs the download engine against a local stand-in server "
+                                     "and reports one JSON line per scenario.");
+    parser.addHelpOption();
+    QCommandLineOption scenarioOption("scenario", "Comma-separated scenarios: large, small, small-probe, "
+                                      "pause-resume, flaky, uneven (default all).", "names",
+                                      "large,small,small-probe,pause-resume,flaky,uneven");
+    QCommandLineOption largeSizeOption("large-size", "Size of the large file in MiB (default 256).", "MiB", "256");
+    QCommandLineOption smallCountOption("small-count", "Number of small files (default 200).", "n", "200");
+    QCommandLineOption smallSizeOption("small-size", "Size of each small file in KiB (default 16).", "KiB", "16");
+    QCommandLineOption connectionsOption({"c", "connections"}, "Connections per download (default 4).", "n", "4");
+    QCommandLineOption outputOption("output", "Directory for the downloaded files (default a temporary one).", "dir");
+    QCommandLineOption certOption("tls-cert", "Serve HTTPS with this PEM certificate, which the client trusts.", "file");
+    QCommandLineOption keyOption("tls-key", "PEM private key of --tls-cert.", "file");
+    QCommandLineOption verifyOption("verify", "Check the content of every downloaded file.");
+    QCommandLineOption quietOption({"q", "quiet"}, "Drop the engine's log instead of writing it to stderr.");
+    // Server side, used for the child process and to run the server on its own
+    QCommandLineOption serveOption("serve", "Only run the server; prints \"listening <port>\".");
+    QCommandLineOption portOption("port", "Server port, 0 for any free one (default 0).", "port", "0");
+    QCommandLineOption bandwidthOption("bandwidth", "Bytes per second per connection, 0 for unlimited.", "bytes", "0");
+    QCommandLineOption latencyOption("latency", "Milliseconds before each response.", "ms", "0");
+    QCommandLineOption lossOption("loss", "Chance per 64 KiB of a stall standing in for a lost segment.", "p", "0");
+    QCommandLineOption stallOption("stall", "Length of such a stall in milliseconds (default 200).", "ms", "200");
+    QCommandLineOption disconnectOption("disconnect", "Chance per response of dropping the connection mid-body.", "p", "0");
+    QCommandLineOption slowOption("slow", "Chance per connection of getting a tenth of the bandwidth.", "p", "0");
+    QCommandLineOption seedOption("seed", "Seed of the loss, disconnect and slow draws (default 1).", "n", "1");
+    parser.addOptions({scenarioOption, largeSizeOption, smallCountOption, smallSizeOption, connectionsOption,
+                       outputOption, certOption, keyOption, verifyOption, quietOption, serveOption, portOption,
+                       bandwidthOption, latencyOption, lossOption, stallOption, disconnectOption, slowOption,
+                       seedOption});
+    parser.process(app);
+
+    QString certificatePath = parser.value(certOption);
+    QString keyPath = parser.value(keyOption);
+    if (parser.isSet(serveOption)) {
+        NetworkProfile profile;
+        profile.bandwidth = parser.value(bandwidthOption).toLongLong();
+        profile.latencyMs = parser.value(latencyOption).toInt();
+        profile.loss = parser.value(lossOption).toDouble();
+        profile.stallMs = parser.value(stallOption).toInt();
+        profile.disconnect = parser.value(disconnectOption).toDouble();
+        profile.slow = parser.value(slowOption).toDouble();
+        profile.seed = parser.value(seedOption).toULongLong();
+        return serve(profile, parser.value(portOption).toInt(), certificatePath, keyPath);
+    }
+
+    // stdout carries only JSON, the engine logs to stderr through the Logger
+    std::ostream& json = std::cout;
+    if (parser.isSet(quietOption)) {
+        Logger::setLevel(LogLevel::Off);
+    }
+
+    bool tls = !certificatePath.isEmpty();
+    if (tls && !CurlShare::instance().loadCaBundle(certificatePath.toStdString())) {
+        std::cerr << "Cannot read " << certificatePath.toStdString() << std::endl;
+        return 2;
+    }
+    QStringList tlsArgs;
+    if (tls) {
+        tlsArgs << "--tls-cert" << certificatePath << "--tls-key" << keyPath;
+    }
+
+    QTemporaryDir temporaryDir;
+    QString outputDir = parser.isSet(outputOption) ? parser.value(outputOption) : temporaryDir.path();
+    QDir().mkpath(outputDir);
+
+    const qint64 largeSize = parser.value(largeSizeOption).toLongLong() << 20;
+    const qint64 smallSize = parser.value(smallSizeOption).toLongLong() << 10;
+    const int smallCount = parser.value(smallCountOption).toInt();
+    const int connections = parser.value(connectionsOption).toInt();
+
+    // Fixed conditions per scenario, so runs are comparable across commits
+    std::vector<Scenario> scenarios;
+    scenarios.push_back({"large", {}, {largeSize}, 0});
+    // The same small files with and without a HEAD request each, for the per-file overhead
+    scenarios.push_back({"small", {"--latency", "1"}, std::vector<qint64>(smallCount, smallSize), 0, true});
+    scenarios.push_back({"small-probe", {"--latency", "1"}, std::vector<qint64>(smallCount, smallSize), 0, false});
+    scenarios.push_back({"pause-resume", {"--bandwidth", "20000000"}, {largeSize / 4}, 6});
+    scenarios.push_back({"flaky", {"--bandwidth", "10000000", "--latency", "40", "--loss", "0.01",
+                                   "--disconnect", "0.2"}, {largeSize / 8}, 0});
+    // Some connections crawl, the download should not wait for them
+    scenarios.push_back({"uneven", {"--bandwidth", "20000000", "--latency", "20", "--slow", "0.3"},
+                         {largeSize / 4}, 0});
+
+    QStringList selected = parser.value(scenarioOption).split(',');
+    std::vector<QJsonObject> reports;
+    bool allOk = true;
+    for (const Scenario& scenario : scenarios) {
+        if (!selected.contains(scenario.name)) {
+            continue;
+        }
+        QProcess server;
+        int port = startServer(server, scenario.serverArgs + tlsArgs);
+        if (port < 0) {
+            std::cerr << "Cannot start the benchmark server" << std::endl;
+            return 2;
+        }
+        std::string base = (tls ? "https://localhost:" : "http://127.0.0.1:") + std::to_string(port);
+
+        std::vector<std::pair<std::string, std::string>> files;
+        for (size_t i = 0; i < scenario.fileSizes.size(); ++i) {
+            std::string name = scenario.name.toStdString() + "-" + std::to_string(i) + ".bin";
+            files.emplace_back(base + "/file/" + std::to_string(scenario.fileSizes[i]) + "/" + name,
+                               QDir(outputDir).filePath(QString::fromStdString(name)).toStdString());
+        }
+
+        resetPeakRss();
+        double cpuBefore = cpuSeconds();
+        int64_t startUs = TransferStats::nowUs();
+        RunResult result = files.size() == 1
+            ? runSingle(files[0].first, files[0].second, connections, scenario.pauseCycles)
+            : runQueue(files, connections, scenario.skipProbe);
+        double seconds = (TransferStats::nowUs() - startUs) / 1e6;
+        double cpu = cpuSeconds() - cpuBefore;
+        qint64 peakRss = peakRssKb();
+
+        server.kill();
+        server.waitForFinished();
+
+        QJsonObject report{{"scenario", scenario.name}, {"ok", result.ok}, {"files", result.files},
+                           {"bytes", result.bytes}, {"seconds", seconds},
+                           {"mb_per_s", seconds > 0 ? result.bytes / seconds / 1e6 : 0.0},
+                           {"cpu_s_per_gb", result.bytes > 0 ? cpu / (result.bytes / 1e9) : 0.0},
+                           {"peak_rss_kb", peakRss}, {"ttfb_ms", result.ttfbMs},
+                           {"connections", connections}, {"tls", tls},
+                           {"profile", scenario.serverArgs.join(' ')}};
+        if (result.fileMs >= 0) {
+            report["file_ms"] = result.fileMs;
+        }
+        if (scenario.pauseCycles > 0) {
+            report["resume_keepalive_ms"] = mean(result.keptAliveMs);
+            report["resume_reconnect_ms"] = mean(result.reconnectMs);
+            report["resumes"] = static_cast<int>(result.keptAliveMs.size() + result.reconnectMs.size());
+        }
+        if (parser.isSet(verifyOption)) {
+            bool verified = result.ok;
+            for (size_t i = 0; i < files.size() && verified; ++i) {
+                verified = verifyFile(QString::fromStdString(files[i].second), scenario.fileSizes[i]);
+            }
+            report["verified"] = verified;
+            result.ok = result.ok && verified;
+        }
+        for (const auto& file : files) {
+            QFile::remove(QString::fromStdString(file.second));
+        }
+
+        json << QJsonDocument(report).toJson(QJsonDocument::Compact).toStdString() << '\n';
+        json.flush();
+        reports.push_back(report);
+        allOk = allOk && result.ok;
+    }
+
+    // Human-readable summary next to the log
+    std::fprintf(stderr, "\n%-14s %4s %10s %10s %12s %10s %9s\n",
+                 "scenario", "ok", "MB/s", "CPU s/GB", "peak RSS kB", "TTFB ms", "resume ms");
+    for (const QJsonObject& report : reports) {
+        std::fprintf(stderr, "%-14s %4s %10.1f %10.2f %12lld %10.1f %9.1f\n",
+                     report["scenario"].toString().toStdString().c_str(),
+                     report["ok"].toBool() ? "yes" : "NO",
+                     report["mb_per_s"].toDouble(), report["cpu_s_per_gb"].toDouble(),
+                     static_cast<long long>(report["peak_rss_kb"].toDouble()),
+                     report["ttfb_ms"].toDouble(),
+                     report.contains("resume_keepalive_ms") ? report["resume_keepalive_ms"].toDouble() : -1.0);
+    }
+    return allOk ? 0 : 1;
+}
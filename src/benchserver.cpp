@@ -0,0 +1,273 @@
+#include "benchserver.h"
+#include <QFile>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QTcpSocket>
+#include <QTimer>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// Largest piece generated and written at once
+static const int64_t kChunkSize = 64 * 1024;
+// Bytes allowed to wait in the socket's buffer before pumping pauses
+static const qint64 kSocketBacklog = 512 * 1024;
+// Pacing tick while the bandwidth budget is empty
+static const int kPacingIntervalMs = 5;
+static const char* kLastModified = "Thu, 01 Jan 2026 00:00:00 GMT";
+
+// splitmix64: a cheap, well-mixed function of the word index
+static inline uint64_t contentWord(uint64_t index) {
+    uint64_t x = index + 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+void fillBenchContent(int64_t offset, char* data, size_t length) {
+    while (length > 0) {
+        uint64_t word = contentWord(static_cast<uint64_t>(offset) / 8);
+        size_t skip = static_cast<size_t>(offset % 8);
+        size_t take = std::min(8 - skip, length);
+        std::memcpy(data, reinterpret_cast<const char*>(&word) + skip, take);
+        data += take;
+        offset += static_cast<int64_t>(take);
+        length -= take;
+    }
+}
+
+static qint64 nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BenchServer::BenchServer(const NetworkProfile& profile, QObject* parent)
+    : QTcpServer(parent),
+      profile(profile),
+      random(profile.seed)
+{
+}
+
+bool BenchServer::enableTls(const QString& certificatePath, const QString& keyPath) {
+    QFile certificateFile(certificatePath);
+    QFile keyFile(keyPath);
+    if (!certificateFile.open(QIODevice::ReadOnly) || !keyFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    certificatePem = certificateFile.readAll();
+    keyPem = keyFile.readAll();
+    return QSslSocket::supportsSsl();
+}
+
+void BenchServer::incomingConnection(qintptr socketDescriptor) {
+    QTcpSocket* socket;
+    if (!certificatePem.isEmpty()) {
+        QSslSocket* tlsSocket = new QSslSocket(this);
+        if (!tlsSocket->setSocketDescriptor(socketDescriptor)) {
+            delete tlsSocket;
+            return;
+        }
+        tlsSocket->setLocalCertificate(QSslCertificate(certificatePem, QSsl::Pem));
+        QSslKey key(keyPem, QSsl::Rsa, QSsl::Pem);
+        if (key.isNull()) {
+            key = QSslKey(keyPem, QSsl::Ec, QSsl::Pem);
+        }
+        tlsSocket->setPrivateKey(key);
+        tlsSocket->startServerEncryption();
+        socket = tlsSocket;
+    } else {
+        socket = new QTcpSocket(this);
+        if (!socket->setSocketDescriptor(socketDescriptor)) {
+            delete socket;
+            return;
+        }
+    }
+    new BenchConnection(socket, this);
+}
+
+BenchConnection::BenchConnection(QTcpSocket* socket, BenchServer* server)
+    : QObject(socket), // Goes away with its socket
+      socket(socket),
+      server(server),
+      pacer(new QTimer(this))
+{
+    pacer->setSingleShot(true);
+    connect(pacer, &QTimer::timeout, this, &BenchConnection::pump);
+    connect(socket, &QTcpSocket::readyRead, this, &BenchConnection::onReadyRead);
+    connect(socket, &QTcpSocket::bytesWritten, this, &BenchConnection::pump);
+    connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    lastRefillMs = nowMs();
+    // Flows of one link do not all get the same throughput
+    bandwidth = server->profile.bandwidth;
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    if (server->profile.slow > 0 && chance(server->random) < server->profile.slow) {
+        bandwidth /= 10;
+    }
+}
+
+void BenchConnection::onReadyRead() {
+    input.append(socket->readAll());
+    if (!responding) {
+        handleRequest();
+    }
+}
+
+void BenchConnection::handleRequest() {
+    int headerEnd = input.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        return;
+    }
+    QList<QByteArray> lines = input.left(headerEnd).split('\n');
+    input.remove(0, headerEnd + 4);
+
+    QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+    QByteArray method = requestLine.value(0);
+    QByteArray path = requestLine.value(1);
+    QByteArray range;
+    QByteArray ifRange;
+    bool closeAfter = false;
+    for (int i = 1; i < lines.size(); ++i) {
+        int colon = lines[i].indexOf(':');
+        if (colon < 0) continue;
+        QByteArray name = lines[i].left(colon).trimmed().toLower();
+        QByteArray value = lines[i].mid(colon + 1).trimmed();
+        if (name == "range") range = value;
+        else if (name == "if-range") ifRange = value;
+        else if (name == "connection") closeAfter = value.toLower() == "close";
+    }
+
+    // "/file/<size>" or "/file/<size>/<name>"
+    QList<QByteArray> parts = path.split('/');
+    bool sizeOk = false;
+    int64_t size = parts.size() >= 3 && parts[1] == "file" ? parts[2].toLongLong(&sizeOk) : 0;
+    QByteArray etag = "\"bench-" + QByteArray::number(static_cast<qlonglong>(size)) + "\"";
+
+    QByteArray status = "200 OK";
+    int64_t first = 0;
+    int64_t last = size - 1;
+    QByteArray extraHeaders;
+    if ((method != "GET" && method != "HEAD") || !sizeOk || size < 0) {
+        status = "404 Not Found";
+        first = 0;
+        last = -1;
+    } else if (range.startsWith("bytes=") && (ifRange.isEmpty() || ifRange == etag || ifRange == kLastModified)) {
+        // A single range: "a-b", "a-" or the suffix "-n"
+        QByteArray spec = range.mid(6);
+        int dash = spec.indexOf('-');
+        QByteArray from = spec.left(dash);
+        QByteArray to = spec.mid(dash + 1);
+        if (from.isEmpty()) {
+            first = std::max<int64_t>(0, size - to.toLongLong());
+        } else {
+            first = from.toLongLong();
+            last = to.isEmpty() ? size - 1 : std::min<int64_t>(to.toLongLong(), size - 1);
+        }
+        if (dash < 0 || first >= size || first > last) {
+            status = "416 Range Not Satisfiable";
+            extraHeaders = "Content-Range: bytes */" + QByteArray::number(static_cast<qlonglong>(size)) + "\r\n";
+            first = 0;
+            last = -1;
+        } else {
+            status = "206 Partial Content";
+            extraHeaders = "Content-Range: bytes " + QByteArray::number(static_cast<qlonglong>(first)) + "-" +
+                           QByteArray::number(static_cast<qlonglong>(last)) + "/" +
+                           QByteArray::number(static_cast<qlonglong>(size)) + "\r\n";
+        }
+    }
+
+    QByteArray headers = "HTTP/1.1 " + status + "\r\n";
+    headers += "Content-Length: " + QByteArray::number(static_cast<qlonglong>(last - first + 1)) + "\r\n";
+    headers += "Content-Type: application/octet-stream\r\n";
+    headers += "Accept-Ranges: bytes\r\n";
+    headers += "ETag: " + etag + "\r\n";
+    headers += "Last-Modified: " + QByteArray(kLastModified) + "\r\n";
+    headers += extraHeaders;
+    headers += closeAfter ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+
+    responding = true;
+    position = first;
+    end = method == "HEAD" ? first : last + 1;
+    dropAt = -1;
+    const NetworkProfile& profile = server->profile;
+    if (profile.disconnect > 0 && end > position) {
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        if (chance(server->random) < profile.disconnect) {
+            std::uniform_int_distribution<int64_t> where(position, end - 1);
+            dropAt = where(server->random);
+        }
+    }
+
+    auto respond = [this, headers, closeAfter]() {
+        socket->write(headers);
+        if (closeAfter) {
+            connect(socket, &QTcpSocket::bytesWritten, this, [this]() {
+                if (!responding && socket->bytesToWrite() == 0) socket->disconnectFromHost();
+            });
+        }
+        pump();
+    };
+    if (profile.latencyMs > 0) {
+        QTimer::singleShot(profile.latencyMs, this, respond);
+    } else {
+        respond();
+    }
+}
+
+void BenchConnection::pump() {
+    if (!responding) {
+        return;
+    }
+    const NetworkProfile& profile = server->profile;
+    qint64 now = nowMs();
+    if (now < stalledUntilMs) {
+        pacer->start(static_cast<int>(stalledUntilMs - now));
+        return;
+    }
+    if (bandwidth > 0) {
+        double burst = std::max<double>(kChunkSize, bandwidth / 20.0);
+        tokens = std::min(burst, tokens + bandwidth * (now - lastRefillMs) / 1000.0);
+    }
+    lastRefillMs = now;
+
+    while (position < end && socket->bytesToWrite() < kSocketBacklog) {
+        int64_t length = std::min(kChunkSize, end - position);
+        if (bandwidth > 0) {
+            if (tokens < 1) {
+                pacer->start(kPacingIntervalMs);
+                return;
+            }
+            length = std::min(length, static_cast<int64_t>(tokens));
+        }
+        if (dropAt >= 0) {
+            length = std::min(length, dropAt - position);
+            if (length <= 0) {
+                socket->abort(); // Mid-stream disconnect
+                return;
+            }
+        }
+        chunk.resize(static_cast<int>(length));
+        fillBenchContent(position, chunk.data(), static_cast<size_t>(length));
+        socket->write(chunk);
+        position += length;
+        tokens -= static_cast<double>(length);
+
+        sinceLossCheck += length;
+        if (profile.loss > 0 && sinceLossCheck >= kChunkSize) {
+            sinceLossCheck = 0;
+            std::uniform_real_distribution<double> chance(0.0, 1.0);
+            if (chance(server->random) < profile.loss) {
+                stalledUntilMs = now + profile.stallMs;
+                pacer->start(profile.stallMs);
+                return;
+            }
+        }
+    }
+
+    if (position >= end) {
+        responding = false;
+        if (!input.isEmpty()) {
+            handleRequest(); // Pipelined request
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#include "bufferpool.h"
+#include <algorithm>
+
+// Default memory of all transfers: chunk buffers and the receive buffers of curl
+static const size_t kDefaultBudget = 128 * 1024 * 1024;
+// Smallest size class
+static const size_t kMinClassSize = 4096;
+
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::BufferPool()
+    : spaceWanted(false),
+      nextListenerId(1)
+{
+    counters.budgetBytes = kDefaultBudget;
+}
+
+void BufferPool::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.budgetBytes = bytes;
+    trimIdle();
+}
+
+size_t BufferPool::classSize(size_t size) {
+    size_t charged = kMinClassSize;
+    while (charged < size) {
+        charged *= 2;
+    }
+    return classIndex(charged) < 0 ? size : charged;
+}
+
+int BufferPool::classIndex(size_t charged) {
+    size_t classBytes = kMinClassSize;
+    for (int index = 0; index < kClasses; ++index, classBytes *= 2) {
+        if (classBytes == charged) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+bool BufferPool::tryAcquire(size_t size, StorageBuffer& buffer) {
+    size_t charged = classSize(size);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (usedBytes() + charged > counters.budgetBytes && usedBytes() > 0) {
+        spaceWanted = true;
+        ++counters.refusals;
+        return false;
+    }
+    counters.bufferBytes += charged;
+    noteUsed();
+
+    int index = classIndex(charged);
+    if (index >= 0 && !freeLists[index].empty()) {
+        buffer.swap(freeLists[index].back());
+        freeLists[index].pop_back();
+        counters.idleBytes -= charged;
+    } else {
+        trimIdle(); // Room for the new buffer
+    }
+    buffer.clear();
+    buffer.reserve(charged);
+    return true;
+}
+
+void BufferPool::release(size_t size, StorageBuffer&& buffer) {
+    size_t charged = classSize(size);
+    std::unique_lock<std::mutex> lock(mutex);
+    counters.bufferBytes -= std::min(charged, counters.bufferBytes);
+    int index = classIndex(charged);
+    // Kept for reuse if it still fits next to what is in use, else freed right away
+    if (index >= 0 && buffer.capacity() == charged &&
+        usedBytes() + counters.idleBytes + charged <= counters.budgetBytes) {
+        buffer.clear();
+        freeLists[index].push_back(std::move(buffer));
+        counters.idleBytes += charged;
+    } else {
+        StorageBuffer().swap(buffer);
+    }
+    notifySpace(lock);
+}
+
+size_t BufferPool::reserveReceive(size_t preferred, size_t minimum) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t limit = counters.budgetBytes / 2;
+    size_t bytes = std::max(preferred, minimum);
+    while (counters.receiveBytes + bytes > limit && bytes / 2 >= minimum) {
+        bytes /= 2;
+    }
+    if ((counters.receiveBytes + bytes > limit || usedBytes() + bytes > counters.budgetBytes) && usedBytes() > 0) {
+        spaceWanted = true;
+        ++counters.refusals;
+        return 0;
+    }
+    counters.receiveBytes += bytes;
+    noteUsed();
+    trimIdle();
+    return bytes;
+}
+
+void BufferPool::unreserveReceive(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    counters.receiveBytes -= std::min(bytes, counters.receiveBytes);
+    notifySpace(lock);
+}
+
+int BufferPool::addSpaceListener(std::function<void()> listener) {
+    std::lock_guard<std::mutex> lock(listenerMutex);
+    int id = nextListenerId++;
+    spaceListeners[id] = std::move(listener);
+    return id;
+}
+
+void BufferPool::removeSpaceListener(int id) {
+    // Once this returns the listener is not running and will not be called again
+    std::lock_guard<std::mutex> lock(listenerMutex);
+    spaceListeners.erase(id);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void BufferPool::noteUsed() {
+    counters.peakUsedBytes = std::max(counters.peakUsedBytes, usedBytes());
+}
+
+void BufferPool::trimIdle() {
+    for (int index = kClasses - 1; index >= 0 && usedBytes() + counters.idleBytes > counters.budgetBytes; --index) {
+        size_t classBytes = kMinClassSize << index;
+        while (!freeLists[index].empty() && usedBytes() + counters.idleBytes > counters.budgetBytes) {
+            freeLists[index].pop_back();
+            counters.idleBytes -= classBytes;
+        }
+    }
+}
+
+void BufferPool::notifySpace(std::unique_lock<std::mutex>& lock) {
+    if (!spaceWanted) {
+        return;
+    }
+    spaceWanted = false;
+    lock.unlock();
+    {
+        std::lock_guard<std::mutex> listenerLock(listenerMutex);
+        for (auto& entry : spaceListeners) {
+            entry.second();
+        }
+    }
+    lock.lock();
+}
@@ -0,0 +1,394 @@
+// Headless batch downloader. Reads one download per line ("[digest] <url> [output path]",
+// or a local Metalink file instead of the URL) from a list file or stdin, runs them through the DownloadQueue and reports progress and
+// results as JSON lines on stdout. The engine's own log goes to stderr or a log file.
+#include "bufferpool.h"
+#include "downloadqueue.h"
+#include "logger.h"
+#include "metalink.h"
+#include "metrics.h"
+#include "metricsserver.h"
+#include "streamdecoder.h"
+#include "streamhash.h"
+#include "tracer.h"
+#include "transferstats.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <QUrl>
+#include <curl/curl.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct ListEntry {
+    std::string url;
+    std::string outputPath;
+    std::string expectedDigest;
+    bool namedByUrl = false; // outputPath is the last segment of the URL
+    bool fromMetalink = false;
+    Metalink::File metalinkFile;
+};
+
+// Parses "[digest] <url> [output path]" lines; blank lines and lines starting with '#' are
+// skipped. The digest is "<algorithm>:<hex>" (e.g. "sha256:9f86..."). Without a path the
+// file is named after the last segment of the URL.
+std::vector<ListEntry> readList(std::istream& in) {
+    std::vector<ListEntry> entries;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        size_t last = line.find_last_not_of(" \t\r");
+        line = line.substr(first, last - first + 1);
+
+        ListEntry entry;
+        size_t gap = line.find_first_of(" \t");
+        HashAlgorithm algorithm;
+        std::string hex;
+        if (gap != std::string::npos && parseDigestSpec(line.substr(0, gap), algorithm, hex)) {
+            entry.expectedDigest = line.substr(0, gap);
+            line = line.substr(line.find_first_not_of(" \t", gap));
+            gap = line.find_first_of(" \t");
+        }
+        entry.url = line.substr(0, gap);
+        if (gap != std::string::npos) {
+            // The rest of the line, so paths may contain spaces
+            entry.outputPath = line.substr(line.find_first_not_of(" \t", gap));
+        }
+        // A Metalink names its files itself, see expandMetalinks()
+        if (entry.outputPath.empty() && !Metalink::isMetalinkPath(entry.url)) {
+            QString name = QUrl(QString::fromStdString(entry.url)).fileName();
+            entry.outputPath = name.isEmpty() ? "download" : name.toStdString();
+            entry.namedByUrl = !name.isEmpty();
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// Replaces the entries naming a local Metalink file by one entry per file it describes.
+// A given output path names the file, or the directory for a Metalink with several.
+bool expandMetalinks(std::vector<ListEntry>& entries) {
+    std::vector<ListEntry> expanded;
+    for (const ListEntry& entry : entries) {
+        bool remote = entry.url.rfind("http://", 0) == 0 || entry.url.rfind("https://", 0) == 0;
+        if (remote || !Metalink::isMetalinkPath(entry.url)) {
+            expanded.push_back(entry);
+            continue;
+        }
+        Metalink metalink;
+        if (!metalink.load(entry.url)) {
+            std::cerr << entry.url << ": " << metalink.error() << std::endl;
+            return false;
+        }
+        for (const Metalink::File& file : metalink.files()) {
+            ListEntry item;
+            item.url = file.urls.front();
+            std::string name = Metalink::safeFileName(file.name);
+            if (name.empty()) {
+                name = "download";
+            }
+            if (entry.outputPath.empty()) {
+                item.outputPath = name;
+            } else if (metalink.files().size() == 1) {
+                item.outputPath = entry.outputPath;
+            } else {
+                QDir().mkpath(QString::fromStdString(entry.outputPath));
+                item.outputPath = entry.outputPath + "/" + name;
+            }
+            item.fromMetalink = true;
+            item.metalinkFile = file;
+            expanded.push_back(item);
+        }
+    }
+    entries.swap(expanded);
+    return true;
+}
+
+// Writes one compact JSON object per line and flushes, so readers see it immediately
+void emitJson(std::ostream& out, const QJsonObject& object) {
+    out << QJsonDocument(object).toJson(QJsonDocument::Compact).toStdString() << '\n';
+    out.flush();
+}
+
+double secondsSince(int64_t startUs) {
+    return (TransferStats::nowUs() - startUs) / 1e6;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    CURLcode global_init_res = curl_global_init(CURL_GLOBAL_ALL);
+    if (global_init_res != CURLE_OK) {
+        std::cerr << "FATAL: curl_global_init() failed: "
+                  << curl_easy_strerror(global_init_res) << std::endl;
+        return 1;
+    }
+    if (atexit(curl_global_cleanup) != 0) {
+        std::cerr << "WARNING: Failed to register curl_global_cleanup with atexit." << std::endl;
+    }
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("download-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Downloads every \"[digest] <url> [output path]\" line of a list file "
+                                     "(or stdin) and reports progress as JSON lines.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("list", "List file, '-' or nothing for stdin.");
+    QCommandLineOption concurrencyOption({"j", "concurrency"}, "Downloads running at once (default 3).", "n", "3");
+    QCommandLineOption perHostOption("per-host", "Downloads running at once per host (default 2).", "n", "2");
+    QCommandLineOption connectionsOption({"c", "connections"}, "Connections per download (default 4).", "n", "4");
+    QCommandLineOption rateOption("rate-limit", "Global bandwidth cap in bytes per second (default none).", "bytes", "0");
+    QCommandLineOption memoryOption("memory-budget", "Memory of all transfer buffers in MiB (default 128); "
+                                                     "transfers wait or slow down beyond it.", "mib", "128");
+    QCommandLineOption intervalOption("interval", "Milliseconds between progress lines, 0 for none (default 1000).", "ms", "1000");
+    QCommandLineOption hashOption("hash", "Hash every download with crc32c, sha256, sha1 or xxh64 (default none).",
+                                  "algorithm", "none");
+    QCommandLineOption noProbeOption("no-probe", "Small-file mode: skip the HEAD request of each download and "
+                                                 "take size and range support from the GET response.");
+    QCommandLineOption cacheOption("cache", "Remember finished downloads; an unchanged URL is not fetched again "
+                                            "(the server answers 304) but linked from the stored copy.");
+    QCommandLineOption decompressOption("decompress", "Store .gz and .zst files decompressed as they arrive "
+                                                      "(named without the extension unless a path is given).");
+    QCommandLineOption noCompressionOption("no-compression", "Do not offer gzip/br/zstd content encoding to servers.");
+    QCommandLineOption deltaOption("delta-dir", "Older copies of the files: a download whose file name exists in dir "
+                                                "fetches only the blocks that changed, using <url>.zsync.", "dir");
+    QCommandLineOption quietOption({"q", "quiet"}, "Log only warnings and errors of the engine.");
+    QCommandLineOption logLevelOption("log-level", "Engine log level: trace, debug, info, warning, error or off "
+                                                   "(default info).", "level", "info");
+    QCommandLineOption logFileOption("log-file", "Write the engine's log to a file instead of stderr.", "path");
+    QCommandLineOption logFormatOption("log-format", "Format of the log file: text, json or binary (default json).",
+                                       "format", "json");
+    QCommandLineOption curlTraceOption("curl-trace", "Log libcurl's trace of every transfer (connections, headers) "
+                                                     "at debug level.");
+    QCommandLineOption metricsPortOption("metrics-port", "Serve Prometheus metrics (phase timings, retries, "
+                                                         "bytes) on 127.0.0.1:port/metrics.", "port");
+    QCommandLineOption metricsFileOption("metrics-file", "Rewrite the Prometheus metrics into a file "
+                                                         "periodically and at the end.", "path");
+    QCommandLineOption metricsIntervalOption("metrics-interval", "Milliseconds between metrics file rewrites "
+                                                                 "(default 10000).", "ms", "10000");
+    QCommandLineOption traceFileOption("trace-file", "Record a timeline of the downloads (probes, connection "
+                                                     "phases, ranges, writes, disk flushes, pauses) and write it "
+                                                     "at the end as Chrome trace JSON for Perfetto.", "path");
+    parser.addOptions({concurrencyOption, perHostOption, connectionsOption, rateOption, memoryOption, intervalOption,
+                       hashOption, noProbeOption, cacheOption, decompressOption,
+                       noCompressionOption, deltaOption, quietOption, logLevelOption, logFileOption,
+                       logFormatOption, curlTraceOption, metricsPortOption, metricsFileOption,
+                       metricsIntervalOption, traceFileOption});
+    parser.process(app);
+
+    HashAlgorithm hashAlgorithm = hashAlgorithmFromName(parser.value(hashOption).toStdString());
+    if (hashAlgorithm == HashAlgorithm::None && parser.value(hashOption) != "none") {
+        std::cerr << "Unknown hash algorithm " << parser.value(hashOption).toStdString() << std::endl;
+        return 2;
+    }
+
+    // stdout carries only JSON, the engine logs through the Logger
+    std::ostream& json = std::cout;
+    LogLevel logLevel = LogLevel::Info;
+    if (!parseLogLevel(parser.value(logLevelOption).toStdString(), logLevel)) {
+        std::cerr << "Unknown log level " << parser.value(logLevelOption).toStdString() << std::endl;
+        return 2;
+    }
+    if (parser.isSet(quietOption)) {
+        logLevel = std::max(logLevel, LogLevel::Warning);
+    }
+    if (parser.isSet(curlTraceOption)) {
+        Logger::setCurlTrace(true);
+        logLevel = std::min(logLevel, LogLevel::Debug);
+    }
+    Logger::setLevel(logLevel);
+    if (parser.isSet(logFileOption)) {
+        QString format = parser.value(logFormatOption);
+        Logger::Format logFormat = format == "text" ? Logger::Text : format == "binary" ? Logger::Binary : Logger::Json;
+        if (format != "text" && format != "json" && format != "binary") {
+            std::cerr << "Unknown log format " << format.toStdString() << std::endl;
+            return 2;
+        }
+        if (!Logger::instance().openFile(parser.value(logFileOption).toStdString(), logFormat)) {
+            std::cerr << "Cannot write " << parser.value(logFileOption).toStdString() << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<ListEntry> entries;
+    QString listPath = parser.positionalArguments().value(0, "-");
+    if (listPath == "-") {
+        entries = readList(std::cin);
+    } else {
+        std::ifstream listFile(listPath.toStdString());
+        if (!listFile) {
+            std::cerr << "Cannot read " << listPath.toStdString() << std::endl;
+            return 2;
+        }
+        entries = readList(listFile);
+    }
+    if (!expandMetalinks(entries)) {
+        return 2;
+    }
+    if (entries.empty()) {
+        std::cerr << "No downloads in the list" << std::endl;
+        return 2;
+    }
+    // Files stored decompressed lose the extension of the compressed form
+    if (parser.isSet(decompressOption)) {
+        for (ListEntry& entry : entries) {
+            if (entry.namedByUrl && entry.expectedDigest.empty() &&
+                StreamDecoder::formatFor(entry.url) != StreamDecoder::None) {
+                entry.outputPath = StreamDecoder::decodedName(entry.outputPath);
+            }
+        }
+    }
+
+    MetricsServer metricsServer;
+    if (parser.isSet(metricsPortOption) &&
+        !metricsServer.start(static_cast<quint16>(parser.value(metricsPortOption).toUInt()))) {
+        std::cerr << "Cannot serve metrics on port " << parser.value(metricsPortOption).toStdString() << std::endl;
+        return 2;
+    }
+    std::string metricsPath = parser.value(metricsFileOption).toStdString();
+    QTimer metricsTimer;
+    QObject::connect(&metricsTimer, &QTimer::timeout, [&]() {
+        Metrics::instance().writeFile(metricsPath);
+    });
+    if (!metricsPath.empty()) {
+        if (!Metrics::instance().writeFile(metricsPath)) {
+            std::cerr << "Cannot write " << metricsPath << std::endl;
+            return 2;
+        }
+        metricsTimer.start(std::max(100, parser.value(metricsIntervalOption).toInt()));
+    }
+
+    std::string tracePath = parser.value(traceFileOption).toStdString();
+    if (!tracePath.empty()) {
+        Tracer::instance().start();
+    }
+
+    int memoryMiB = parser.value(memoryOption).toInt();
+    if (memoryMiB <= 0) {
+        std::cerr << "Invalid memory budget " << parser.value(memoryOption).toStdString() << std::endl;
+        return 2;
+    }
+    BufferPool::instance().setBudget(static_cast<size_t>(memoryMiB) * 1024 * 1024);
+
+    DownloadQueue queue;
+    queue.setMaxActive(parser.value(concurrencyOption).toInt());
+    queue.setMaxPerHost(parser.value(perHostOption).toInt());
+    queue.setConnectionsPerJob(parser.value(connectionsOption).toInt());
+    queue.setGlobalRateLimit(parser.value(rateOption).toLongLong());
+    queue.setHashAlgorithm(hashAlgorithm);
+    queue.setSkipProbe(parser.isSet(noProbeOption));
+    queue.setUseCache(parser.isSet(cacheOption));
+    queue.setDeltaDirectory(parser.value(deltaOption).toStdString());
+    queue.setDecompress(parser.isSet(decompressOption));
+    queue.setCompressedTransfer(!parser.isSet(noCompressionOption));
+
+    // enqueue() may start a job (and signal it) before it returns, so the handlers look
+    // jobs up in the queue and create their records on first use
+    struct JobRecord {
+        int64_t startUs = 0;
+        bool done = false;
+    };
+    std::map<int, JobRecord> records;
+    int64_t batchStartUs = TransferStats::nowUs();
+    int finished = 0;
+    int failed = 0;
+    qint64 totalBytes = 0;
+
+    QObject::connect(&queue, &DownloadQueue::jobStarted, [&](int id) {
+        JobRecord& record = records[id];
+        if (record.startUs == 0) {
+            record.startUs = TransferStats::nowUs();
+        }
+        const DownloadQueue::Job* job = queue.job(id);
+        emitJson(json, {{"event", "start"}, {"id", id},
+                        {"url", QString::fromStdString(job->url)},
+                        {"output", QString::fromStdString(job->outputPath)}});
+    });
+    QObject::connect(&queue, &DownloadQueue::jobSizeKnown, [&](int id, qint64 size) {
+        emitJson(json, {{"event", "size"}, {"id", id}, {"total", size}});
+    });
+    QObject::connect(&queue, &DownloadQueue::jobFinished, [&](int id, bool success) {
+        JobRecord& record = records[id];
+        record.done = true;
+        const DownloadQueue::Job* job = queue.job(id);
+        std::shared_ptr<const TransferStats> stats = queue.stats(id);
+        qint64 bytes = stats ? stats->storedBytes.load() : 0;
+        qint64 received = stats ? stats->sessionBytes.load() : 0;
+        double seconds = secondsSince(record.startUs);
+        ++finished;
+        if (success) {
+            totalBytes += received;
+        } else {
+            ++failed;
+        }
+        emitJson(json, {{"event", "done"}, {"id", id}, {"ok", success},
+                        {"url", QString::fromStdString(job->url)},
+                        {"output", QString::fromStdString(job->outputPath)},
+                        {"bytes", bytes}, {"received", received},
+                        {"wire_bytes", static_cast<qint64>(stats ? stats->wireBytes.load() : 0)},
+                        {"retries", stats ? stats->retries.load() : 0},
+                        {"wasted_bytes", static_cast<qint64>(stats ? stats->wastedBytes.load() : 0)}, {"seconds", seconds},
+                        {"bytes_per_second", seconds > 0 ? received / seconds : 0.0},
+                        {"digest", QString::fromStdString(job->digest)}});
+
+        if (finished == static_cast<int>(entries.size())) {
+            double batchSeconds = secondsSince(batchStartUs);
+            emitJson(json, {{"event", "summary"}, {"jobs", finished}, {"ok", finished - failed},
+                            {"failed", failed}, {"bytes", totalBytes}, {"seconds", batchSeconds},
+                            {"bytes_per_second", batchSeconds > 0 ? totalBytes / batchSeconds : 0.0}});
+            if (!metricsPath.empty()) {
+                Metrics::instance().writeFile(metricsPath);
+            }
+            if (!tracePath.empty() && !Tracer::instance().writeFile(tracePath)) {
+                std::cerr << "Cannot write " << tracePath << std::endl;
+            }
+            QCoreApplication::exit(failed == 0 ? 0 : 1);
+        }
+    });
+
+    // Progress is sampled from the stats blocks, like the GUI does
+    QTimer progressTimer;
+    QObject::connect(&progressTimer, &QTimer::timeout, [&]() {
+        for (const auto& entry : records) {
+            if (entry.second.done || entry.second.startUs == 0 || queue.isPaused(entry.first)) {
+                continue;
+            }
+            std::shared_ptr<const TransferStats> stats = queue.stats(entry.first);
+            if (!stats) {
+                continue;
+            }
+            emitJson(json, {{"event", "progress"}, {"id", entry.first},
+                            {"bytes", static_cast<qint64>(stats->storedBytes.load())},
+                            {"total", static_cast<qint64>(stats->totalBytes.load())},
+                            {"percent", stats->percent()},
+                            {"bytes_per_second", stats->bytesPerSecond.load()},
+                            {"connections", stats->connections.load()}});
+        }
+    });
+    int intervalMs = parser.value(intervalOption).toInt();
+    if (intervalMs > 0) {
+        progressTimer.start(intervalMs);
+    }
+
+    for (const ListEntry& entry : entries) {
+        if (entry.fromMetalink) {
+            queue.enqueue(entry.metalinkFile, entry.outputPath);
+        } else {
+            queue.enqueue(entry.url, entry.outputPath, DownloadQueue::Normal, entry.expectedDigest);
+        }
+    }
+    return app.exec();
+}
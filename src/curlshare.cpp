@@ -0,0 +1,123 @@
+#include "curlshare.h"
+#include "logger.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+// Keep resolved host names for as long as connections stay in the pool
+static const long kDnsCacheTimeoutSeconds = 300;
+
+CurlShare& CurlShare::instance() {
+    static CurlShare curlShare;
+    return curlShare;
+}
+
+CurlShare::CurlShare()
+    : share(curl_share_init())
+{
+    if (share) {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockCallback);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockCallback);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    } else {
+        LOG_WARN(0) << "Failed to initialize cURL share handle, caches are per transfer.";
+    }
+
+    // Read the CA bundle shipped next to the executable once for the whole process
+    QString caCertPath = QDir(QCoreApplication::applicationDirPath()).filePath("certs/cacert.pem");
+    if (!loadCaBundle(caCertPath.toStdString())) {
+        LOG_ERROR(0) << "CA certificate file not found at expected path: "
+                     << caCertPath.toStdString();
+    }
+}
+
+bool CurlShare::loadCaBundle(const std::string& path) {
+    QFile caCertFile(QString::fromStdString(path));
+    if (!caCertFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray contents = caCertFile.readAll();
+    caBundle.assign(contents.constData(), static_cast<size_t>(contents.size()));
+    caBundlePath = path;
+    LOG_INFO(0) << "Loaded CA certificate bundle (" << caBundle.size() << " bytes) from: "
+                << caBundlePath;
+    return true;
+}
+
+CurlShare::~CurlShare() {
+    if (share) {
+        curl_share_cleanup(share);
+    }
+}
+
+bool CurlShare::apply(CURL* handle) {
+    if (share) {
+        curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    }
+    curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, kDnsCacheTimeoutSeconds);
+
+    if (caBundle.empty()) {
+        return false;
+    }
+#if LIBCURL_VERSION_NUM >= 0x074D00
+    // The bundle outlives every handle, so curl can use it without copying
+    curl_blob blob;
+    blob.data = const_cast<char*>(caBundle.data());
+    blob.len = caBundle.size();
+    blob.flags = CURL_BLOB_NOCOPY;
+    curl_easy_setopt(handle, CURLOPT_CAINFO_BLOB, &blob);
+#else
+    curl_easy_setopt(handle, CURLOPT_CAINFO, caBundlePath.c_str());
+#endif
+    return true;
+}
+
+// CURLOPT_DEBUGFUNCTION: libcurl's trace of a transfer (info text and headers, not the
+// data), one log message per line
+static int curlTraceCallback(CURL*, curl_infotype type, char* data, size_t size, void* userp) {
+    uint64_t context = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(userp));
+    const char* prefix = nullptr;
+    switch (type) {
+    case CURLINFO_TEXT: prefix = "* "; break;
+    case CURLINFO_HEADER_IN: prefix = "< "; break;
+    case CURLINFO_HEADER_OUT: prefix = "> "; break;
+    default: return 0;
+    }
+    std::string text(data, size);
+    size_t begin = 0;
+    while (begin < text.size()) {
+        size_t end = text.find('\n', begin);
+        end = end == std::string::npos ? text.size() : end;
+        size_t last = text.find_last_not_of("\r\n", end == 0 ? 0 : end - 1);
+        if (last != std::string::npos && last >= begin) {
+            LOG_DEBUG(context) << prefix << text.substr(begin, last - begin + 1);
+        }
+        begin = end + 1;
+    }
+    return 0;
+}
+
+void CurlShare::applyTrace(CURL* handle, uint64_t logContext) {
+    if (!Logger::curlTrace()) {
+        return;
+    }
+    curl_easy_setopt(handle, CURLOPT_DEBUGFUNCTION, curlTraceCallback);
+    curl_easy_setopt(handle, CURLOPT_DEBUGDATA, reinterpret_cast<void*>(static_cast<uintptr_t>(logContext)));
+    curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
+}
+
+void CurlShare::lockCallback(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+    (void)handle;
+    (void)access;
+    static_cast<CurlShare*>(userptr)->locks[data].lock();
+}
+
+void CurlShare::unlockCallback(CURL* handle, curl_lock_data data, void* userptr) {
+    (void)handle;
+    static_cast<CurlShare*>(userptr)->locks[data].unlock();
+}
@@ -0,0 +1,205 @@
+#include "deltasetup.h"
+#include "curlshare.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+
+// Largest zsync manifest accepted (about 7 bytes per block of the file)
+static const size_t kMaxManifestSize = 64 * 1024 * 1024;
+// Found blocks between two missing ranges closer than this are fetched again, one
+// request costs more than the bytes
+static const int64_t kDeltaMergeGap = 256 * 1024;
+// How often a running scan is checked for completion
+static const int kPollIntervalMs = 100;
+
+// Write callback of the manifest request, keeps the body in memory
+static size_t manifestWriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    auto* body = static_cast<std::string*>(userp);
+    size_t bytes = size * nmemb;
+    if (body->size() + bytes > kMaxManifestSize) {
+        return 0;
+    }
+    body->append(static_cast<const char*>(contents), bytes);
+    return bytes;
+}
+
+DeltaSetup::DeltaSetup()
+    : fileSize(0),
+      logContext(0),
+      manifestHandle(nullptr),
+      pollTimer(0)
+{
+}
+
+DeltaSetup::~DeltaSetup() {
+    cancel();
+}
+
+void DeltaSetup::start(const std::string& url, const std::string& manifestLocation, const std::string& source,
+                       const std::string& outputPath, int64_t fileSize, uint64_t logContext, Callback done) {
+    cancel();
+    this->source = source;
+    this->outputPath = outputPath;
+    this->fileSize = fileSize;
+    this->logContext = logContext;
+    this->done = std::move(done);
+
+    std::string location = manifestLocation.empty() ? url + ".zsync" : manifestLocation;
+    if (location.find("://") == std::string::npos) {
+        auto loaded = std::make_shared<ZsyncManifest>();
+        if (!loaded->load(location)) {
+            LOG_WARN(logContext) << "No usable zsync manifest (" << loaded->error() << "), downloading the whole file";
+            complete(Result());
+            return;
+        }
+        startScan(loaded);
+        return;
+    }
+
+    CURL* handle = TransferEngine::instance().takeHandle();
+    if (!handle) {
+        complete(Result());
+        return;
+    }
+    manifestBody.clear();
+    curl_easy_setopt(handle, CURLOPT_URL, location.c_str());
+    CurlShare::applyTrace(handle, logContext);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, manifestWriteCallback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &manifestBody);
+    // The manifest decides which local blocks land where and supplies the SHA-1 the result
+    // is checked against, so it is always verified: without the bundle curl uses its
+    // default CA store, and a failed check means a full download
+    CurlShare::instance().apply(handle);
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 2L);
+    LOG_INFO(logContext) << "Fetching zsync manifest " << location;
+    manifestHandle = handle;
+    if (!TransferEngine::instance().addHandle(handle, this)) {
+        manifestHandle = nullptr;
+        TransferEngine::instance().recycleHandle(handle);
+        complete(Result());
+    }
+}
+
+void DeltaSetup::cancel() {
+    done = nullptr;
+    if (manifestHandle) {
+        TransferEngine::instance().recycleHandle(manifestHandle);
+        manifestHandle = nullptr;
+    }
+    manifestBody.clear();
+    if (scan) {
+        scan->cancelled.store(true);
+        scanThread.join();
+        TransferEngine::instance().stopTimer(pollTimer);
+        pollTimer = 0;
+        scan.reset();
+    }
+    manifest.reset();
+    scratch.clear();
+}
+
+void DeltaSetup::onTransferDone(CURL* handle, CURLcode result) {
+    Metrics::instance().recordTransfer(handle, result);
+    TransferEngine::instance().recycleHandle(manifestHandle);
+    manifestHandle = nullptr;
+    auto parsed = std::make_shared<ZsyncManifest>();
+    bool ok = result == CURLE_OK &&
+              parsed->parse(QByteArray(manifestBody.data(), static_cast<qint64>(manifestBody.size())));
+    manifestBody.clear();
+    manifestBody.shrink_to_fit();
+    if (!ok) {
+        LOG_WARN(logContext) << "No usable zsync manifest ("
+                             << (result != CURLE_OK ? std::string(curl_easy_strerror(result)) : parsed->error())
+                             << "), downloading the whole file";
+        complete(Result());
+        return;
+    }
+    startScan(parsed);
+}
+
+void DeltaSetup::startScan(const std::shared_ptr<const ZsyncManifest>& found) {
+    if (found->length() != fileSize) {
+        LOG_WARN(logContext) << "zsync manifest describes " << found->length() << " bytes, the file has "
+                             << fileSize << ", downloading the whole file";
+        complete(Result());
+        return;
+    }
+    QString output = QString::fromStdString(outputPath);
+    std::string oldCopy = source;
+    if (QFileInfo(QString::fromStdString(oldCopy)).absoluteFilePath() == QFileInfo(output).absoluteFilePath()) {
+        // The scan writes the output, so the old copy moves aside first. One left by an
+        // interrupted run is used if the output is gone.
+        scratch = outputPath + ".zsync-old";
+        QString scratchPath = QString::fromStdString(scratch);
+        if (QFile::exists(output)) {
+            QFile::remove(scratchPath);
+            if (!QFile::rename(output, scratchPath)) {
+                LOG_WARN(logContext) << "Could not move " << outputPath << " aside, downloading the whole file";
+                scratch.clear();
+                complete(Result());
+                return;
+            }
+        }
+        oldCopy = scratch;
+    } else {
+        // A new inode, as for a fresh download: other names of a hard-linked copy keep their bytes
+        QFile::remove(output);
+    }
+    if (!QFileInfo::exists(QString::fromStdString(oldCopy))) {
+        LOG_WARN(logContext) << "Delta source " << oldCopy << " not found, downloading the whole file";
+        scratch.clear();
+        complete(Result());
+        return;
+    }
+
+    LOG_INFO(logContext) << "Looking for the " << found->blockCount() << " blocks of " << found->blockSize()
+                         << " bytes in " << oldCopy;
+    manifest = found;
+    scan = std::make_shared<ZsyncScan>(found, oldCopy, outputPath);
+    std::shared_ptr<ZsyncScan> running = scan;
+    scanThread = std::thread([running]() { running->run(); });
+    pollTimer = TransferEngine::instance().startTimer(kPollIntervalMs, [this]() { finishScan(); }, true);
+}
+
+void DeltaSetup::finishScan() {
+    if (!scan || !scan->finished.load()) {
+        return;
+    }
+    TransferEngine::instance().stopTimer(pollTimer);
+    pollTimer = 0;
+    scanThread.join();
+    std::shared_ptr<ZsyncScan> finished = std::move(scan);
+    std::shared_ptr<const ZsyncManifest> used = std::move(manifest);
+    if (!finished->ok) {
+        // The old copy (also one moved aside) stays for the next attempt
+        LOG_WARN(logContext) << "Delta scan failed: " << finished->error << ", downloading the whole file";
+        scratch.clear();
+        complete(Result());
+        return;
+    }
+    // Its blocks are in the output now
+    if (!scratch.empty()) {
+        QFile::remove(QString::fromStdString(scratch));
+        scratch.clear();
+    }
+    Result result;
+    result.ok = true;
+    result.sha1 = used->sha1();
+    result.missing = finished->missingRanges(kDeltaMergeGap);
+    complete(std::move(result));
+}
+
+void DeltaSetup::complete(Result result) {
+    // The callback may start the setup over, so it runs from a copy
+    Callback callback = std::move(done);
+    done = nullptr;
+    if (callback) {
+        callback(result);
+    }
+}
@@ -1,117 +1,456 @@
 #include "downloader.h"
+#include "bufferpool.h"
+#include "curlshare.h"
+#include "logger.h"
+#include "metadatacache.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "writestage.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
 #include <curl/curl.h>
-#include <fstream>
-#include <iostream>
-#include <QCoreApplication>
 #include <functional>
-#include <QDir>
 #include <string>
-#include <QFileInfo>
 #include <chrono>  // Add this for time measurement
+#include <memory>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <ctime>
 
+// Smallest byte range worth a connection of its own in segmented mode
+static const curl_off_t kMinSegmentSize = 1024 * 1024;
+// Default number of parallel connections for servers that support byte ranges
+static const int kDefaultConnectionCount = 4;
+// Interval of the progress/speed report on the engine thread
+static const int kProgressIntervalMs = 100;
+// Time constant of the throughput average; shorter reacts faster, longer is steadier
+static const double kThroughputTimeConstantS = 2.0;
+// Interval between journal checkpoints; each one syncs the output file
+static const int kJournalIntervalMs = 1000;
+// Reasons a transfer is paused through curl (CurlCallbackContext::pauseReasons)
+static const unsigned kPauseBackpressure = 1; // Write stage buffer pool exhausted
+static const unsigned kPauseUser = 2;         // Paused by requestPause(), connection kept open
+static const unsigned kPauseRate = 4;         // Bandwidth shaper bucket empty
+// Default time a paused transfer keeps its connection before it is torn down
+static const int kDefaultPauseKeepAliveMs = 30000;
+// Smallest part of a running segment that is split off for another connection
+static const curl_off_t kMinSplitSize = 256 * 1024;
+// A segment expected to finish sooner than this is not split, the new request would not pay off
+static const double kMinSplitSeconds = 0.5;
+// Age before a connection's own throughput is trusted over the download's average
+static const double kConnectionWarmupS = 1.0;
+// Times a block is fetched again after failing its digest before the download gives up
+static const int kMaxBlockRepairs = 3;
+// Window over which the connection count control compares throughput
+static const int kAdaptIntervalMs = 2000;
+// Relative throughput change that decides whether a connection count step is kept
+static const double kAdaptMinGain = 0.1;
+// Windows to wait after a step was undone before probing the other direction
+static const int kAdaptBackoffWindows = 5;
+// A transfer that receives nothing for this long is taken as stalled and retried; shorter
+// dips (a busy server, a Wi-Fi handover) are waited out on the open connection
+static const long kStallTimeoutS = 30;
+// Consecutive failed attempts of a segment, none of them making progress, before the
+// download gives up
+static const int kMaxSegmentFailures = 8;
+// Transient failures in a row, none of them making progress, before a mirror is dropped
+// while others are left
+static const int kMaxMirrorFailures = 3;
+// Smallest receive buffer of a transfer when memory is short, curl's default
+static const size_t kMinReceiveBufferSize = 16 * 1024;
+// Tracer tracks of a download besides one per transfer: probe, pauses and the whole
+// download on one, syncs and the final flush on the other
+static const uint64_t kTraceMainTrack = 1;
+static const uint64_t kTraceDiskTrack = 2;
+// Write callbacks within this many microseconds are one span of the trace
+static const int64_t kTraceBatchUs = 10000;
+
+// State of one segment transfer, passed to the curl callbacks and kept alive while
+// its easy handle is registered with the engine
 struct CurlCallbackContext {
-    std::ofstream* fileStream = nullptr;            // Pointer to the output file stream
-    std::atomic<bool>* pausedFlag = nullptr;        // Pointer to the shared pause flag
-    std::function<void(int)>* progressFn = nullptr; // Pointer to the progress callback function object
-    curl_off_t resumeOffset = 0;                    // Value of the resume position for this transfer
-    void* downloaderInstance = nullptr;             // Pointer to the Downloader instance
+    CURL* handle = nullptr;                         // Easy handle of this transfer
+    std::unique_ptr<StorageWriter> writer;          // Coalesces the body into chunks at the segment offset
+    DownloadSegment* segment = nullptr;             // Byte range written by this transfer
+    Downloader* downloader = nullptr;               // Pointer to the Downloader instance
+    std::string range;                              // Value of CURLOPT_RANGE, must outlive the handle
+    bool rangeChecked = false;                      // Set once the response status has been validated
+    unsigned pauseReasons = 0;                      // kPause* bits, the transfer continues once all are clear
+    BandwidthShaper::Client* shaper = nullptr;      // Token bucket of the download
+    TransferStats* stats = nullptr;                 // Live counters of the download
+    curl_slist* headers = nullptr;                  // Extra request headers (If-Range)
+    bool remoteChanged = false;                     // If-Range did not match, the server sent the whole new file
+    bool integrityFailed = false;                   // A block did not match its expected digest
+    curl_off_t requestedEnd = -1;                   // Last byte asked for; beyond segment->end after a split
+    bool rangeSplit = false;                        // Stopped at the end of its split segment
+    std::chrono::steady_clock::time_point startedAt; // Start of the transfer
+    curl_off_t sampledBytes = 0;                    // segment->written at the last throughput sample
+    double bytesPerSecond = 0;                      // Throughput average of this connection
+    int mirror = 0;                                 // Index into Downloader::mirrors
+    curl_off_t rangeTotal = -1;                     // File size from Content-Range, -1 if not sent
+    bool wrongFile = false;                         // A mirror answered with a file of another size
+    RemoteInfo remote;                              // Range support and validators of the response
+    size_t deliveryConsumed = 0;                    // Decoding: bytes of curl's current delivery already decoded
+    bool deliveryCharged = false;                   // The current delivery went through the shaper
+    curl_off_t wireSampled = 0;                     // CURLINFO_SIZE_DOWNLOAD_T at the last sample
+    curl_off_t startProgress = 0;                   // segment->written + received when the transfer started
+    int64_t retryAfterS = -1;                       // Retry-After of an error response in seconds, -1 if none
+    uint64_t logContext = 0;                        // Downloader::logContext, for the callbacks
+    char errbuf[CURL_ERROR_SIZE] = {0};             // Error details from curl
+    // Tracer state, only used when the transfer was started while tracing
+    uint64_t traceProcess = 0;                      // Downloader::traceProcess
+    uint64_t traceTrack = 0;                        // Track of this transfer, 0 if not traced
+    int64_t traceStartUs = 0;                       // Start of the request
+    int traceResult = -1;                           // curl result, -1 if stopped before it finished
+    long traceHttpCode = 0;                         // Final response status
+    int64_t batchStartUs = 0;                       // First write callback of the open batch
+    int64_t batchEndUs = 0;                         // End of the last write callback of the batch
+    int64_t batchBusyUs = 0;                        // Time spent inside the callbacks of the batch
+    int64_t batchBytes = 0;                         // Bytes taken by the callbacks of the batch
+    int batchCalls = 0;                             // Callbacks in the batch, 0 if none is open
+    size_t receiveReserved = 0;                     // Receive buffer charged to the BufferPool
+
+    ~CurlCallbackContext();
 };
 
+// Tracer: the connection phases of a finished transfer on its track, from libcurl's times
+// relative to its start. A transfer on a reused connection only waits for the first byte.
+static void traceConnectionPhases(CURL* handle, uint64_t process, uint64_t track, int64_t startUs) {
+    curl_off_t lookup = 0, connect = 0, tls = 0, firstByte = 0;
+    long connects = 0;
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+
+    Tracer& tracer = Tracer::instance();
+    curl_off_t setupEnd = 0;
+    if (connects > 0) {
+        tracer.complete(process, track, "network", "DNS", startUs, startUs + lookup);
+        if (connect >= lookup) {
+            tracer.complete(process, track, "network", "connect", startUs + lookup, startUs + connect);
+            setupEnd = connect;
+        }
+        if (tls > 0 && tls >= connect) {
+            tracer.complete(process, track, "network", "TLS", startUs + connect, startUs + tls);
+            setupEnd = tls;
+        }
+    }
+    if (firstByte > setupEnd) {
+        tracer.complete(process, track, "network", "wait for first byte", startUs + setupEnd, startUs + firstByte,
+                        TraceArgs().add("reused_connection", static_cast<int64_t>(connects == 0)));
+    }
+}
+
+// Adds what a transfer received over the network since the last sample to wireBytes
+static void sampleWireBytes(CurlCallbackContext* transfer) {
+    curl_off_t received = 0;
+    if (curl_easy_getinfo(transfer->handle, CURLINFO_SIZE_DOWNLOAD_T, &received) == CURLE_OK &&
+        received > transfer->wireSampled) {
+        TransferStats::add(transfer->stats->wireBytes, received - transfer->wireSampled);
+        Metrics::instance().addReceivedBytes(received - transfer->wireSampled);
+        transfer->wireSampled = received;
+    }
+}
+
+// Body of a download stored decompressed: the bytes go through the segment's decoder and
+// what comes out is stored. curl delivers the same data again after a pause, so the part
+// decoded before it is skipped then.
+static size_t decodeBody(CurlCallbackContext* context, IntegrityCheck& integrity, const char* data, size_t bytes) {
+    DownloadSegment* segment = context->segment;
+    StreamDecoder& decoder = *segment->decoder;
+    // The bandwidth cap counts compressed bytes, once per delivery
+    if (!context->deliveryCharged) {
+        if (!BandwidthShaper::instance().consume(context->shaper, bytes)) {
+            context->pauseReasons |= kPauseRate;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        context->deliveryCharged = true;
+    }
+    while (true) {
+        // Output of the last step first, it may not have fit into the write buffers
+        size_t length = decoder.pendingSize();
+        if (length > 0) {
+            if (!context->writer->reserve(length)) {
+                context->pauseReasons |= kPauseBackpressure;
+                return CURL_WRITEFUNC_PAUSE;
+            }
+            curl_off_t offset = segment->start + segment->written;
+            if (!context->writer->write(decoder.pending(), length)) {
+                LOG_ERROR(context->logContext) << "Failed to write to output file at offset " << offset;
+                return 0;
+            }
+            segment->written += length;
+            if (context->stats->firstDataTimeUs.load(std::memory_order_relaxed) == 0) {
+                context->stats->firstDataTimeUs.store(TransferStats::nowUs(), std::memory_order_relaxed);
+            }
+            TransferStats::add(context->stats->storedBytes, static_cast<int64_t>(length));
+            TransferStats::add(context->stats->sessionBytes, static_cast<int64_t>(length));
+            if (integrity.enabled() && !integrity.update(segment->blockHash, offset, decoder.pending(), length)) {
+                context->integrityFailed = true;
+                return 0;
+            }
+            decoder.clearPending();
+        }
+        if (context->deliveryConsumed == bytes && !decoder.outputFull()) {
+            break;
+        }
+        size_t used = decoder.decode(data + context->deliveryConsumed, bytes - context->deliveryConsumed);
+        if (decoder.failed()) {
+            LOG_ERROR(context->logContext) << "Could not decompress the body: " << decoder.error();
+            return 0;
+        }
+        if (used == 0 && decoder.pendingSize() == 0 && context->deliveryConsumed < bytes) {
+            LOG_ERROR(context->logContext) << "Decompression made no progress";
+            return 0;
+        }
+        context->deliveryConsumed += used;
+        segment->received += static_cast<curl_off_t>(used);
+        TransferStats::add(context->stats->sourceBytes, static_cast<int64_t>(used));
+    }
+    context->deliveryConsumed = 0;
+    context->deliveryCharged = false;
+    return bytes;
+}
+
 // WriteCallback function to write data to file
 size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-        // Cast userp to the context struct pointer type
-        auto* context = static_cast<CurlCallbackContext*>(userp);
-    
-     // Check required pointers are valid before dereferencing (optional but safer)
-     if (!context || !context->pausedFlag || !context->fileStream) {
-        return CURL_WRITEFUNC_PAUSE; // Or another error signal, indicates setup issue
-   }
-    // Check if download is paused before writing
-    if (context->pausedFlag->load()) {
-        std::cout << "WriteCallback detected pause, returning CURL_WRITEFUNC_PAUSE" << std::endl;
-        return CURL_WRITEFUNC_PAUSE; // This will pause the transfer
-    }
-    
-    context->fileStream->write(static_cast<char*>(contents), size * nmemb);
-    return size * nmemb;
-}
-
-// Progress callback function to update the download progress
-static int progressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
-    curl_off_t ultotal, curl_off_t ulnow) {
-    // Mark unused parameters to suppress compiler warnings
-    Q_UNUSED(ultotal);
-    Q_UNUSED(ulnow);
-
-    // Cast clientp to the context struct pointer type
-    auto* context = static_cast<CurlCallbackContext*>(clientp);
-
-    // Check required pointers are valid (optional but safer)
-    if (!context || !context->pausedFlag || !context->progressFn) {
-        return 1; // Return non-zero to abort on setup issue
-    }
-
-    // Calculate download speed
-    static curl_off_t lastBytes = 0;
-    static auto lastTime = std::chrono::steady_clock::now();
-    auto currentTime = std::chrono::steady_clock::now();
-    
-    // Calculate time difference in seconds
-    double timeDiff = std::chrono::duration<double>(currentTime - lastTime).count();
-    
-    // Only update speed every 0.5 seconds to avoid UI flicker
-    if (timeDiff >= 0.5) {
-        curl_off_t bytesDiff = dlnow - lastBytes;
-        qint64 bytesPerSecond = static_cast<qint64>(bytesDiff / timeDiff);
-        
-        // Get the Downloader instance from the context
-        auto* downloader = static_cast<Downloader*>(context->downloaderInstance);
-        if (downloader) {
-            // Emit the speed signal
-            QMetaObject::invokeMethod(downloader, "emitSpeedUpdate", 
-                                     Qt::QueuedConnection,
-                                     Q_ARG(qint64, bytesPerSecond));
-        }
-        
-        // Update last values
-        lastBytes = dlnow;
-        lastTime = currentTime;
-    }
+    // Cast userp to the context struct pointer type
+    auto* context = static_cast<CurlCallbackContext*>(userp);
+    DownloadSegment* segment = context->segment;
+    size_t bytes = size * nmemb;
+    curl_off_t offset = segment->start + segment->written;
 
-    // Extract necessary data via the context struct
-    std::function<void(int)>* progressFunc = context->progressFn;
-    curl_off_t resumePosition = context->resumeOffset; // Use value from context
-    std::atomic<bool>* paused = context->pausedFlag;   // Use pointer from context
+    // A server that ignores the Range header sends the whole file with 200; writing
+    // that at the segment offset would corrupt the output, so abort the transfer instead
+    if (!context->rangeChecked) {
+        long httpCode = 0;
+        curl_easy_getinfo(context->handle, CURLINFO_RESPONSE_CODE, &httpCode);
+        // An error page is not the file
+        if (httpCode >= 400) {
+            LOG_WARN(context->logContext) << "Server answered HTTP " << httpCode;
+            return 0;
+        }
+        // A decoded stream continues at its compressed offset
+        bool ranged = (segment->decoder ? segment->received : offset) > 0 || !segment->openEnded();
+        if (ranged && httpCode == 200 && context->headers) {
+            // The validator sent with If-Range no longer matches: the file changed
+            context->remoteChanged = true;
+            return 0;
+        }
+        if (ranged && httpCode != 206) {
+            LOG_WARN(context->logContext) << "Range " << offset << "-" << segment->end
+                                          << " got HTTP " << httpCode << " instead of 206";
+            return 0; // Makes curl fail the transfer with CURLE_WRITE_ERROR
+        }
+        // Mirrors get no If-Range (their validators differ), the size tells a stale copy
+        qint64 expectedSize = context->downloader->totalFileSize;
+        if (context->mirror != 0 && ranged && expectedSize > 0 && context->rangeTotal != expectedSize) {
+            LOG_WARN(context->logContext) << "Mirror has " << context->rangeTotal << " bytes instead of " << expectedSize;
+            context->wrongFile = true;
+            return 0;
+        }
+        context->rangeChecked = true;
+        // Without a probe the size and range support come with the first response
+        if (!ranged && expectedSize < 0) {
+            context->downloader->adoptResponse(context);
+        }
+    }
 
-     // Update progress, accounting for already downloaded bytes
-     if (progressFunc && dltotal > 0) {
-        curl_off_t effectiveTotal = dltotal + resumePosition;
-        curl_off_t effectiveNow = dlnow + resumePosition;
-        int percent = 0;
-        // Avoid division by zero if effectiveTotal somehow becomes zero with positive dltotal
-        if (effectiveTotal > 0) {
-           percent = static_cast<int>((static_cast<double>(effectiveNow) * 100.0) / effectiveTotal);
+    if (segment->decoder) {
+        curl_off_t writtenBefore = segment->written;
+        size_t result = decodeBody(context, context->downloader->integrity, static_cast<const char*>(contents), bytes);
+        if (segment->written > writtenBefore && context->downloader->awaitingResumeData) {
+            context->downloader->noteResumeData();
+        }
+        return result;
+    }
+    // Never write past the end of the range, even if the server sends more
+    size_t toWrite = bytes;
+    if (!segment->openEnded()) {
+        curl_off_t remaining = segment->length() - segment->written;
+        toWrite = static_cast<size_t>(std::min<curl_off_t>(remaining, static_cast<curl_off_t>(bytes)));
+    }
+    if (toWrite > 0) {
+        // Over the bandwidth limit: wait for the shaper's next refill. Checked before
+        // reserving buffers, so a throttled transfer holds none of the memory budget.
+        if (!context->deliveryCharged) {
+            if (!BandwidthShaper::instance().consume(context->shaper, toWrite)) {
+                context->pauseReasons |= kPauseRate;
+                return CURL_WRITEFUNC_PAUSE;
+            }
+            context->deliveryCharged = true;
+        }
+        // Without buffer space, pause instead of blocking the engine thread; curl hands
+        // the same data to this callback again once the transfer is unpaused, and it is
+        // not charged to the shaper a second time
+        if (!context->writer->reserve(toWrite)) {
+            context->pauseReasons |= kPauseBackpressure;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        context->deliveryCharged = false;
+        if (!context->writer->write(static_cast<char*>(contents), toWrite)) {
+            LOG_ERROR(context->logContext) << "Failed to write to output file at offset " << offset;
+            return 0; // Disk errors fail the transfer
+        }
+        segment->written += toWrite;
+        if (context->downloader->awaitingResumeData) {
+            context->downloader->noteResumeData();
+        }
+        if (context->stats->firstDataTimeUs.load(std::memory_order_relaxed) == 0) {
+            context->stats->firstDataTimeUs.store(TransferStats::nowUs(), std::memory_order_relaxed);
         }
+        TransferStats::add(context->stats->storedBytes, static_cast<int64_t>(toWrite));
+        TransferStats::add(context->stats->sessionBytes, static_cast<int64_t>(toWrite));
+        // Hash on the way through; a block failing its expected digest stops the transfer
+        IntegrityCheck& integrity = context->downloader->integrity;
+        if (integrity.enabled() &&
+            !integrity.update(segment->blockHash, offset, static_cast<char*>(contents), toWrite)) {
+            context->integrityFailed = true;
+            return 0;
+        }
+    }
+    // The rest of the requested range went to another connection in a split
+    if (!segment->openEnded() && segment->written == segment->length() && context->requestedEnd > segment->end) {
+        context->rangeSplit = true;
+        return 0;
+    }
+    return bytes;
+}
 
-        percent = std::min(100, std::max(0, percent));
+// Tracer: ends the open batch of write callbacks of a transfer as one span
+static void traceWriteBatch(CurlCallbackContext* context) {
+    if (context->batchCalls == 0) {
+        return;
+    }
+    Tracer::instance().complete(context->traceProcess, context->traceTrack, "write", "write callbacks",
+                                context->batchStartUs, context->batchEndUs,
+                                TraceArgs().add("calls", context->batchCalls).add("bytes", context->batchBytes)
+                                           .add("busy_us", context->batchBusyUs));
+    context->batchCalls = 0;
+    context->batchBytes = 0;
+    context->batchBusyUs = 0;
+}
 
-        // Call the progress function via the pointer stored in the context
-        (*progressFunc)(percent);
+// CURLOPT_WRITEFUNCTION of traced transfers: WriteCallback, with the callbacks of a few
+// milliseconds collected into one span and the pauses they cause marked. Untraced
+// transfers use WriteCallback directly.
+static size_t tracedWriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    auto* context = static_cast<CurlCallbackContext*>(userp);
+    unsigned pausedBefore = context->pauseReasons;
+    int64_t start = Tracer::now();
+    size_t result = WriteCallback(contents, size, nmemb, userp);
+    int64_t end = Tracer::now();
+
+    if (context->batchCalls == 0) {
+        context->batchStartUs = start;
+    }
+    ++context->batchCalls;
+    context->batchEndUs = end;
+    context->batchBusyUs += end - start;
+    if (result == size * nmemb) {
+        context->batchBytes += static_cast<int64_t>(result);
     }
+    if (result == CURL_WRITEFUNC_PAUSE) {
+        traceWriteBatch(context);
+        unsigned reasons = context->pauseReasons & ~pausedBefore;
+        Tracer::instance().instant(context->traceProcess, context->traceTrack, "write",
+                                   (reasons & kPauseBackpressure) ? "paused: no write buffers" : "paused: rate limit");
+    } else if (result != size * nmemb || end - context->batchStartUs >= kTraceBatchUs) {
+        traceWriteBatch(context);
+    }
+    return result;
+}
+
+CurlCallbackContext::~CurlCallbackContext() {
+    curl_slist_free_all(headers);
+    if (receiveReserved > 0) {
+        BufferPool::instance().unreserveReceive(receiveReserved);
+    }
+    if (traceTrack != 0) {
+        traceWriteBatch(this);
+        TraceArgs args;
+        args.add("mirror", mirror).add("http_code", static_cast<int64_t>(traceHttpCode))
+            .add("result", traceResult < 0 ? std::string("stopped")
+                                           : std::string(curl_easy_strerror(static_cast<CURLcode>(traceResult))));
+        Tracer::instance().complete(traceProcess, traceTrack, "transfer", range.empty() ? "GET" : "GET " + range,
+                                    traceStartUs, Tracer::now(), args);
+    }
+}
+
+// Header callback of the HEAD probe, collects range support and the validators of the
+// final response; segment transfers use it for the GET response as well
+static size_t probeHeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    auto* remote = static_cast<RemoteInfo*>(userdata);
+    std::string line(buffer, size * nitems);
+    size_t colon = line.find(':');
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
 
-    // Check if download is paused
-    if (paused->load()) { // Access paused flag via context pointer
-        std::cout << "ProgressCallback detected pause" << std::endl;
-        // DO NOT call curl_easy_pause here - just return non-zero
-        return 1; // Return non-zero to abort current transfer
+    // Each status line starts a new response (redirects), only the last one counts
+    if (name.rfind("http/", 0) == 0) {
+        *remote = RemoteInfo();
+        return size * nitems;
     }
-    // Let the Qt event loop process events occasionally to keep UI responsive
-    static int counter = 0;
-    if (++counter % 10 == 0) { // Process events every 10 callbacks
-        QCoreApplication::processEvents();
+    if (colon == std::string::npos) {
+        return size * nitems;
     }
+    // Validators are compared byte for byte, keep their case and strip the whitespace
+    std::string value = line.substr(colon + 1);
+    size_t first = value.find_first_not_of(" \t");
+    size_t last = value.find_last_not_of(" \t\r\n");
+    value = first == std::string::npos ? std::string() : value.substr(first, last - first + 1);
 
-    return 0; // Continue download
+    if (name == "accept-ranges") {
+        remote->acceptRanges = value.find("bytes") != std::string::npos;
+    } else if (name == "etag") {
+        remote->etag = value;
+    } else if (name == "last-modified") {
+        remote->lastModified = value;
+    } else if (name == "content-encoding") {
+        remote->contentEncoding = value == "identity" ? std::string() : value;
+    }
+    return size * nitems;
+}
+
+// Header callback of segment transfers, keeps the file size from Content-Range and
+// what a probe would have reported
+static size_t segmentHeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    auto* context = static_cast<CurlCallbackContext*>(userdata);
+    probeHeaderCallback(buffer, size, nitems, &context->remote);
+    std::string line(buffer, size * nitems);
+    size_t colon = line.find(':');
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (name.rfind("http/", 0) == 0) {
+        context->rangeTotal = -1; // A new response (redirect)
+        context->retryAfterS = -1;
+    } else if (name == "retry-after" && colon != std::string::npos) {
+        // Delay in seconds or an HTTP date
+        std::string value = line.substr(colon + 1);
+        size_t first = value.find_first_not_of(" \t");
+        size_t last = value.find_last_not_of(" \t\r\n");
+        value = first == std::string::npos ? std::string() : value.substr(first, last - first + 1);
+        if (!value.empty() && std::all_of(value.begin(), value.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            context->retryAfterS = std::strtoll(value.c_str(), nullptr, 10);
+        } else if (!value.empty()) {
+            time_t date = curl_getdate(value.c_str(), nullptr);
+            if (date != -1) {
+                context->retryAfterS = std::max<int64_t>(0, static_cast<int64_t>(date - std::time(nullptr)));
+            }
+        }
+    } else if (name == "content-range" && colon != std::string::npos) {
+        // "bytes first-last/total", total may be "*"
+        size_t slash = line.find('/', colon);
+        if (slash != std::string::npos && std::isdigit(static_cast<unsigned char>(line[slash + 1]))) {
+            context->rangeTotal = std::strtoll(line.c_str() + slash + 1, nullptr, 10);
+        }
+    }
+    return size * nitems;
 }
 
 // Constructor for the Downloader class
@@ -124,283 +463,1817 @@ Downloader::Downloader(const std::string& url, const std::string& outputPath, st
       running(false),
       resumePosition(0),
       totalFileSize(0), // Initialize the qint64 member
-      m_curlHandle(nullptr)
+      connectionCount(kDefaultConnectionCount),
+      pauseKeepAliveMs(kDefaultPauseKeepAliveMs),
+      resumeLatencyUs(-1),
+      rateLimit(0),
+      weight(1.0),
+      journaled(false),
+      restartedOnChange(false),
+      hashAlgorithm(HashAlgorithm::None),
+      hashBlockSize(ResumeJournal::kDefaultBlockSize),
+      skipProbe(false),
+      useCache(false),
+      compressedTransfer(true),
+      decompress(false),
+      logContext(0),
+      probeHandle(nullptr),
+      probeHeaders(nullptr),
+      conditional(false),
+      decodeFormat(StreamDecoder::None),
+      sourceSize(-1),
+      progressTimer(0),
+      liveStats(std::make_shared<TransferStats>()),
+      lastBytes(0),
+      lastPercent(-1),
+      checkpointBytes(0),
+      keepAliveTimer(0),
+      awaitingResumeData(false),
+      resumedKeptAlive(false),
+      pauseBeforeStart(false),
+      shaperClient(nullptr),
+      adaptive(false),
+      targetConnections(kDefaultConnectionCount),
+      adaptStep(0),
+      adaptDirection(1),
+      adaptHold(0),
+      adaptBaseline(0),
+      adaptWindowBytes(0),
+      retryTimer(0),
+      traceProcess(0),
+      probeStartUs(0),
+      pausedAtUs(0),
+      waitingForMemory(false)
 {
-    // Constructor body
+    // Transfers paused for lack of memory continue on the engine thread
+    spaceListener = BufferPool::instance().addSpaceListener([this]() {
+        TransferEngine::instance().post([this]() { resumeBackpressured(); });
+    });
+    // Every download has a token bucket; it only limits once a cap is set
+    TransferEngine::instance().post([this]() {
+        shaperClient = BandwidthShaper::instance().addClient([this]() { clearPauseReason(kPauseRate); });
+        applyShaping();
+    });
+}
+
+Downloader::~Downloader() {
+    BufferPool::instance().removeSpaceListener(spaceListener);
+    // Handles and timers reference this object, drop them before it goes away
+    TransferEngine::instance().invoke([this]() {
+        if (probeHandle) {
+            TransferEngine::instance().recycleHandle(probeHandle);
+            probeHandle = nullptr;
+        }
+        curl_slist_free_all(probeHeaders);
+        probeHeaders = nullptr;
+        delta.cancel();
+        stopTransfers();
+        if (shaperClient) {
+            BandwidthShaper::instance().removeClient(shaperClient);
+            shaperClient = nullptr;
+        }
+    });
+}
+
+void Downloader::onTransferDone(CURL* handle, CURLcode result) {
+    Metrics::instance().recordTransfer(handle, result);
+    if (handle == probeHandle) {
+        onProbeDone(result);
+        return;
+    }
+    for (auto& transfer : transfers) {
+        if (transfer->handle == handle) {
+            onSegmentDone(transfer.get(), result);
+            return;
+        }
+    }
 }
 
-// downloadFile function updated to use member variables instead of parameters
-bool Downloader::downloadFile() { // Parameters removed
+// Slot to start the download process
+void Downloader::startDownload() {
+    TransferEngine::instance().post([this]() {
+        paused.store(false);
+        pauseBeforeStart = false;
+        delta.cancel();
+        resumePosition = 0; // Start from beginning
+        totalFileSize = -1;  // Reset total file size, use -1 to indicate unknown
+        remote = RemoteInfo();
+        segments.clear();
+        restartedOnChange = false;
+        mirrors.clear();
+        mirrors.push_back({url});
+        for (const std::string& mirror : mirrorUrls) {
+            mirrors.push_back({mirror});
+        }
+        blockRepairs.clear();
+        startedAt = std::chrono::steady_clock::now();
+        if (Tracer::enabled()) {
+            traceStart();
+        }
+        liveStats->retries.store(0, std::memory_order_relaxed);
+        liveStats->wastedBytes.store(0, std::memory_order_relaxed);
+        // An expected digest is that of the file as published, not of its decompressed form
+        decodeFormat = decompress.load() && expectedDigest.empty() && expectedBlockDigests.empty()
+                           ? StreamDecoder::formatFor(url) : StreamDecoder::None;
+        sourceSize = -1;
+        // A copy stored before is only fetched again if the server says it changed.
+        // The cache holds files as published, a decompressing download has none there.
+        conditional = useCache.load() && decodeFormat == StreamDecoder::None &&
+                      MetadataCache::instance().lookup(url, cachedCopy) && cachedCopyUsable();
+        // Small-file mode goes straight to the GET, unless a journal of an earlier run
+        // needs the probed size and validators to be continued, or a cached copy the
+        // conditional probe, or a delta download the size to match the manifest against
+        std::string journalPath = ResumeJournal::pathFor(outputPath);
+        if (skipProbe.load() && !conditional && deltaSource.empty() &&
+            !QFileInfo::exists(QString::fromStdString(journalPath))) {
+            journaled = false;
+            downloadFile();
+            return;
+        }
+        startProbe();
+    });
+}
 
-    CURL* curl; // Use local variable for the handle within this function scope
-    CURLcode res;
+// Makes a HEAD request to get total file size and range support before downloading
+void Downloader::startProbe() {
+    CURL* curlHead = TransferEngine::instance().takeHandle();
+    if (!curlHead) {
+        totalFileSize = -1; // Indicate unknown size if HEAD init fails
+        emit totalSizeKnown(totalFileSize); // Emit -1 for unknown size
+        downloadFile();
+        return;
+    }
+
+    curl_easy_setopt(curlHead, CURLOPT_URL, url.c_str()); // Use member url
+    CurlShare::applyTrace(curlHead, logContext);
+    curl_easy_setopt(curlHead, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curlHead, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curlHead, CURLOPT_HEADERFUNCTION, probeHeaderCallback);
+    curl_easy_setopt(curlHead, CURLOPT_HEADERDATA, &remote);
+    curl_slist_free_all(probeHeaders);
+    probeHeaders = nullptr;
+    if (conditional) {
+        if (!cachedCopy.etag.empty()) {
+            probeHeaders = curl_slist_append(probeHeaders, ("If-None-Match: " + cachedCopy.etag).c_str());
+        }
+        if (!cachedCopy.lastModified.empty()) {
+            probeHeaders = curl_slist_append(probeHeaders, ("If-Modified-Since: " + cachedCopy.lastModified).c_str());
+        }
+        curl_easy_setopt(curlHead, CURLOPT_HTTPHEADER, probeHeaders);
+    }
 
-    // Open file in appropriate mode based on resume position
-    std::ios_base::openmode mode = std::ios::binary;
-    if (this->resumePosition > 0) { // Use member variable
-        mode |= std::ios::in | std::ios::out; // Open for update
+    // Same share and CA bundle as the body transfers, so the GET can reuse this connection
+    if (CurlShare::instance().apply(curlHead)) {
+        curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYPEER, 1L);
+        curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYHOST, 2L);
     } else {
-        mode |= std::ios::out | std::ios::trunc; // Create/Truncate new file
+        LOG_WARN(logContext) << "CA cert bundle not found for HEAD request. Verification disabled for this request.";
+        curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYHOST, 0L);
     }
 
-    // Use member variable for path
-    std::ofstream file(this->outputPath, mode); // Use this->outputPath
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file for writing: " << this->outputPath << std::endl; // Use this->outputPath
-        return false;
+    probeHandle = curlHead;
+    if (Tracer::enabled()) {
+        probeStartUs = Tracer::now();
+    }
+    if (!TransferEngine::instance().addHandle(curlHead, this)) {
+        probeHandle = nullptr;
+        TransferEngine::instance().recycleHandle(curlHead);
+        totalFileSize = -1;
+        emit totalSizeKnown(totalFileSize);
+        downloadFile();
     }
+}
 
-    // Seek to resume position if needed
-    if (this->resumePosition > 0) { // Use member variable
-        file.seekp(this->resumePosition);
-        std::cout << "Resuming download from position: " << this->resumePosition << std::endl;
+void Downloader::onProbeDone(CURLcode result) {
+    long httpCode = 0;
+    curl_easy_getinfo(probeHandle, CURLINFO_RESPONSE_CODE, &httpCode);
+    if (Tracer::enabled()) {
+        traceConnectionPhases(probeHandle, traceProcess, kTraceMainTrack, probeStartUs);
+        Tracer::instance().complete(traceProcess, kTraceMainTrack, "transfer", conditional ? "conditional HEAD" : "HEAD",
+                                    probeStartUs, Tracer::now(),
+                                    TraceArgs().add("http_code", static_cast<int64_t>(httpCode))
+                                               .add("result", std::string(curl_easy_strerror(result))));
+    }
+    // Not Modified: the stored copy is current. A changed file gets the usual answer
+    // and continues as if the probe had no condition.
+    if (conditional && result == CURLE_OK && httpCode == 304) {
+        conditional = false;
+        TransferEngine::instance().recycleHandle(probeHandle);
+        probeHandle = nullptr;
+        curl_slist_free_all(probeHeaders);
+        probeHeaders = nullptr;
+        if (useCachedCopy()) {
+            return;
+        }
+        // No copy to be had after all: ask again, this time for the size
+        remote = RemoteInfo();
+        startProbe();
+        return;
     }
+    conditional = false;
+    if (result == CURLE_OK) {
+        // Use CURLINFO_CONTENT_LENGTH_DOWNLOAD_T for large files
+        curl_off_t size_off_t = 0;
+        curl_easy_getinfo(probeHandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size_off_t);
+        if (size_off_t > 0) {
+            totalFileSize = static_cast<qint64>(size_off_t); // Assign to qint64 member
+            LOG_INFO(logContext) << "Total file size from HEAD request: " << totalFileSize;
+        } else {
+            totalFileSize = -1; // Indicate unknown size if HEAD request didn't provide it
+        }
+    } else {
+        LOG_WARN(logContext) << "HEAD request failed: " << curl_easy_strerror(result);
+        totalFileSize = -1; // Indicate unknown size on failure
+        remote = RemoteInfo();
+    }
+    TransferEngine::instance().recycleHandle(probeHandle);
+    probeHandle = nullptr;
+    curl_slist_free_all(probeHeaders);
+    probeHeaders = nullptr;
+
+    // The size of the decompressed file is only known at its end
+    if (decodeFormat != StreamDecoder::None) {
+        sourceSize = totalFileSize;
+        totalFileSize = -1;
+    }
+    if (segments.empty()) {
+        openJournal();
+    }
+
+    // Emit the signal now that the size is known (-1 for unknown size)
+    emit totalSizeKnown(totalFileSize);
+    // An older copy supplies the blocks that did not change, unless a journal already
+    // has the progress of an earlier run
+    if (segments.empty() && !deltaSource.empty() && remote.acceptRanges && totalFileSize > 0) {
+        delta.start(url, deltaManifest, deltaSource, outputPath, totalFileSize, logContext,
+                    [this](const DeltaSetup::Result& result) { applyDelta(result); });
+        return;
+    }
+    downloadFile();
+}
 
-    curl = curl_easy_init(); // Initialize local handle
+void Downloader::applyDelta(const DeltaSetup::Result& result) {
+    if (!result.ok) {
+        downloadFile();
+        return;
+    }
+    // Found runs are done segments, the missing ranges are split as in restoreSegments()
+    resetIntegrity();
+    if (hashAlgorithm == HashAlgorithm::None && !result.sha1.empty()) {
+        // Copied and fetched blocks are checked together against the manifest
+        integrity.reset(HashAlgorithm::Sha1, totalFileSize, hashBlockSize);
+        integrity.setExpectedDigest(result.sha1);
+        LOG_INFO(logContext) << "Verifying with the sha1 of the zsync manifest";
+    }
+    segments.clear();
+    const std::vector<std::pair<int64_t, int64_t>>& missing = result.missing;
+    curl_off_t missingBytes = 0;
+    for (const auto& range : missing) {
+        missingBytes += range.second - range.first + 1;
+    }
+    curl_off_t position = 0;
+    auto addDone = [this](curl_off_t first, curl_off_t last) {
+        DownloadSegment segment;
+        segment.start = first;
+        segment.end = last;
+        segment.written = last - first + 1;
+        segment.done = true;
+        segments.push_back(segment);
+    };
+    for (const auto& range : missing) {
+        if (range.first > position) {
+            addDone(position, range.first - 1);
+        }
+        curl_off_t length = range.second - range.first + 1;
+        curl_off_t count = (connectionCount * length + missingBytes - 1) / missingBytes;
+        count = std::max<curl_off_t>(1, std::min(count, length / kMinSegmentSize));
+        splitRange(range.first, range.second, count);
+        position = range.second + 1;
+    }
+    if (position < totalFileSize) {
+        addDone(position, totalFileSize - 1);
+    }
+    resumePosition = totalFileSize - missingBytes;
+    LOG_INFO(logContext) << "Reusing " << resumePosition << " of " << totalFileSize << " bytes from the old copy, fetching "
+                         << missing.size() << " range(s) of " << missingBytes << " bytes";
+
+    targetConnections = connectionCount;
+    adaptStep = 0;
+    adaptDirection = 1;
+    adaptHold = 0;
+    if (missing.empty()) {
+        resetStats();
+        finish(true);
+        return;
+    }
+    downloadFile();
+}
+
+bool Downloader::cachedCopyUsable() const {
+    // A copy without the digest this download has to report or match is fetched again
+    if (hashAlgorithm == HashAlgorithm::None) {
+        return true;
+    }
+    std::string prefix = std::string(hashAlgorithmName(hashAlgorithm)) + ":";
+    if (cachedCopy.digest.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    return expectedDigest.empty() || cachedCopy.digest == prefix + expectedDigest;
+}
 
-    if (!curl) { // Check initialization result immediately
-        std::cerr << "Failed to initialize cURL." << std::endl;
-        file.close();
-        // No need to set m_curlHandle as it was never assigned
+bool Downloader::useCachedCopy() {
+    std::string target = QFileInfo(QString::fromStdString(outputPath)).absoluteFilePath().toStdString();
+    if (cachedCopy.path != target && !MetadataCache::linkCopy(cachedCopy.path, outputPath)) {
+        LOG_WARN(logContext) << "Could not link " << cachedCopy.path << " to " << outputPath << ", downloading again";
         return false;
     }
+    LOG_INFO(logContext) << "Not modified since the last download, using " << cachedCopy.path;
+    // Whatever an earlier attempt left for this output is superseded by the complete copy
+    ResumeJournal::remove(ResumeJournal::pathFor(outputPath));
+    journaled = false;
+    segments.clear();
+    this->resumePosition = 0;
+    totalFileSize = cachedCopy.size;
+    lastDigest = cachedCopy.digest;
+    resetStats();
+    liveStats->storedBytes.store(cachedCopy.size, std::memory_order_relaxed);
+    liveStats->lastDataTimeUs.store(TransferStats::nowUs(), std::memory_order_relaxed);
 
-    this->m_curlHandle = curl; // Assign to member variable *after* successful init
+    emit totalSizeKnown(totalFileSize);
+    if (onProgress) onProgress(100);
+    Metrics::instance().addDownload(true, std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - startedAt).count());
+    emit downloadFinished(true);
+    return true;
+}
+
+void Downloader::rememberCopy() {
+    MetadataCache::Entry entry;
+    entry.etag = remote.etag;
+    entry.lastModified = remote.lastModified;
+    entry.size = liveStats->storedBytes.load(std::memory_order_relaxed);
+    entry.path = QFileInfo(QString::fromStdString(outputPath)).absoluteFilePath().toStdString();
+    entry.modifiedMs = MetadataCache::modificationTime(outputPath);
+    entry.digest = lastDigest;
+    MetadataCache::instance().store(url, entry);
+}
+
+// Splits the file into equally sized byte ranges, one per connection
+void Downloader::planSegments() {
+    segments.clear();
+
+    // Use parallel ranges when the probe allowed it, otherwise one open range
+    bool segmentable = remote.acceptRanges && connectionCount > 1 && totalFileSize >= 2 * kMinSegmentSize;
+    if (!segmentable) {
+        // The server decides when the body ends, a resume asks for everything after the stored bytes
+        DownloadSegment segment;
+        segment.end = -1;
+        segments.push_back(segment);
+        return;
+    }
+
+    curl_off_t total = static_cast<curl_off_t>(totalFileSize);
+    curl_off_t count = std::min<curl_off_t>(connectionCount, total / kMinSegmentSize);
+    splitRange(0, total - 1, count);
+    LOG_INFO(logContext) << "Split download into " << segments.size() << " segments of ~"
+                         << total / count << " bytes";
+}
+
+void Downloader::splitRange(curl_off_t first, curl_off_t last, curl_off_t count) {
+    curl_off_t segmentSize = (last - first + 1) / count;
+    // Verified downloads split on block boundaries, so each block is hashed by one transfer
+    curl_off_t blockSize = static_cast<curl_off_t>(integrity.blockSize());
+    if (integrity.enabled() && segmentSize >= blockSize) {
+        segmentSize -= segmentSize % blockSize;
+    }
+    for (curl_off_t i = 0; i < count; ++i) {
+        DownloadSegment segment;
+        segment.start = first + i * segmentSize;
+        // The last range absorbs the remainder of the division
+        segment.end = (i == count - 1) ? last : segment.start + segmentSize - 1;
+        segments.push_back(segment);
+    }
+}
+
+void Downloader::openJournal() {
+    std::string path = ResumeJournal::pathFor(outputPath);
+    // Without ranges nothing can be continued, without a validator a changed file
+    // would be mixed into the old bytes
+    journaled = remote.acceptRanges && totalFileSize > 0 &&
+                !(remote.etag.empty() && remote.lastModified.empty());
+    if (!journaled) {
+        ResumeJournal::remove(path);
+        return;
+    }
+
+    ResumeJournal saved;
+    QFileInfo existing(QString::fromStdString(outputPath));
+    if (saved.load(path) && saved.matches(url, totalFileSize, remote.etag, remote.lastModified) &&
+        existing.exists() && existing.size() == totalFileSize) {
+        journal = saved;
+        resetIntegrity();
+        if (integrity.enabled() && !integrity.restore(journal.hashState())) {
+            LOG_INFO(logContext) << "Journal has no " << hashAlgorithmName(hashAlgorithm)
+                                 << " digests, the stored blocks are hashed again";
+        }
+        restoreSegments();
+        resumePosition = journal.completedBytes();
+        LOG_INFO(logContext) << "Continuing from journal " << path << ": " << resumePosition << " of "
+                             << totalFileSize << " bytes already stored";
+        return;
+    }
+    ResumeJournal::remove(path);
+    journal.reset(url, totalFileSize, remote.etag, remote.lastModified);
+}
+
+void Downloader::restoreSegments() {
+    segments.clear();
+    curl_off_t missing = static_cast<curl_off_t>(totalFileSize - journal.completedBytes());
+    for (const ResumeJournal::Run& run : journal.runs()) {
+        curl_off_t length = run.last - run.first + 1;
+        if (run.done) {
+            DownloadSegment segment;
+            segment.start = run.first;
+            segment.end = run.last;
+            segment.written = length;
+            segment.done = true;
+            segments.push_back(segment);
+            continue;
+        }
+        // Spread the connections over the gaps in proportion to their size
+        curl_off_t count = (connectionCount * length + missing - 1) / std::max<curl_off_t>(1, missing);
+        count = std::max<curl_off_t>(1, std::min(count, length / kMinSegmentSize));
+        splitRange(run.first, run.last, count);
+    }
+}
+
+void Downloader::markJournal() {
+    // Adjacent segments together may complete a block that neither covers alone, hence
+    // the merged ranges
+    for (const auto& range : storedRanges()) {
+        journal.markRange(range.first, range.second);
+    }
+    if (integrity.enabled()) {
+        journal.setHashState(integrity.state());
+    }
+}
+
+std::vector<std::pair<int64_t, int64_t>> Downloader::storedRanges() const {
+    // Finished and stopped segments are fully flushed, running ones up to the start of
+    // their partially filled chunk
+    std::vector<std::pair<int64_t, int64_t>> covered;
+    std::vector<std::pair<int64_t, int64_t>> holes;
+    for (const DownloadSegment& segment : segments) {
+        curl_off_t bytes = segment.written;
+        for (const auto& transfer : transfers) {
+            if (transfer->segment == &segment) {
+                bytes = transfer->writer->committedOffset() - segment.start;
+            }
+        }
+        if (bytes > 0) {
+            covered.push_back({segment.start, segment.start + bytes});
+        }
+        if (!segment.done && !segment.openEnded()) {
+            holes.push_back({segment.start + std::max<curl_off_t>(0, bytes), segment.end + 1});
+        }
+    }
+    std::sort(covered.begin(), covered.end());
+    std::vector<std::pair<int64_t, int64_t>> merged;
+    for (const auto& range : covered) {
+        if (!merged.empty() && range.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    // What an unfinished segment has still to write does not count, even where another
+    // segment wrote it before (a block being fetched again)
+    for (const auto& hole : holes) {
+        std::vector<std::pair<int64_t, int64_t>> rest;
+        for (const auto& range : merged) {
+            if (range.second <= hole.first || hole.second <= range.first) {
+                rest.push_back(range);
+                continue;
+            }
+            if (range.first < hole.first) {
+                rest.push_back({range.first, hole.first});
+            }
+            if (hole.second < range.second) {
+                rest.push_back({hole.second, range.second});
+            }
+        }
+        merged.swap(rest);
+    }
+    return merged;
+}
+
+void Downloader::checkpointJournal() {
+    markJournal();
+    // The write stage runs the task after every chunk queued so far, so syncing there
+    // covers all bytes the snapshot claims
+    StorageBackend* backend = storage.get();
+    ResumeJournal snapshot = journal;
+    std::string path = ResumeJournal::pathFor(outputPath);
+    uint64_t process = traceProcess;
+    WriteStage::instance().submitTask(backend, [backend, snapshot, path, process]() {
+        int64_t traceStartUs = Tracer::enabled() ? Tracer::now() : 0;
+        if (backend->sync()) {
+            snapshot.save(path);
+        }
+        if (traceStartUs != 0) {
+            Tracer::instance().complete(process, kTraceDiskTrack, "disk", "sync and journal checkpoint",
+                                        traceStartUs, Tracer::now());
+        }
+    });
+}
 
-    // --- Set Curl Options using Context Struct ---
-    CurlCallbackContext callbackContext; // Define context struct
-    callbackContext.fileStream = &file;
-    callbackContext.pausedFlag = &this->paused;
-    callbackContext.progressFn = &this->onProgress;
-    callbackContext.resumeOffset = this->resumePosition;
-    callbackContext.downloaderInstance = this; // Add this line
+// Starts the transfers of all unfinished segments
+void Downloader::downloadFile() {
+    // A pause requested during the probe or the setup takes effect before any transfer
+    // starts; resumeDownload() continues from here
+    if (pauseBeforeStart) {
+        pauseBeforeStart = false;
+        paused.store(true);
+        LOG_INFO(logContext) << "Download paused before its transfers started";
+        emit downloadPaused();
+        return;
+    }
 
-    curl_easy_setopt(curl, CURLOPT_URL, this->url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &callbackContext); // Pass context to write callback
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressCallback);
-    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &callbackContext); // Pass context to progress callback
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    // Plan the ranges on the first pass only; a resume continues the existing plan
+    bool fresh = segments.empty();
+    if (fresh) {
+        resetIntegrity();
+        planSegments();
+        if (decodeFormat != StreamDecoder::None) {
+            segments.front().decoder = std::make_shared<StreamDecoder>(decodeFormat);
+            LOG_INFO(logContext) << "Storing " << outputPath << " " << StreamDecoder::formatName(decodeFormat)
+                                 << "-decompressed";
+        }
+    }
 
-    if (callbackContext.resumeOffset > 0) {
-        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, callbackContext.resumeOffset);
+    // Create (or truncate) the output file once, every segment writes through the same backend.
+    // A fresh file gets a new inode, so other names of a hard-linked cached copy keep their bytes.
+    if (fresh) {
+        QFile::remove(QString::fromStdString(this->outputPath));
+    }
+    storage = StorageBackend::create(storageOptions, totalFileSize);
+    if (!storage->open(this->outputPath, totalFileSize, fresh)) {
+        LOG_ERROR(logContext) << "Failed to open file for writing: " << this->outputPath;
+        storage.reset();
+        if (fresh) segments.clear();
+        finish(false);
+        return;
+    }
+    LOG_INFO(logContext) << "Writing " << this->outputPath << " with the " << storage->name() << " storage backend";
+    if (journaled) {
+        LOG_INFO(logContext) << "Recording progress in " << ResumeJournal::pathFor(outputPath);
+    }
+
+    running.store(true); // Mark as running before starting
+    // A start or resume by the user tries right away and with a full retry budget
+    for (DownloadSegment& segment : segments) {
+        segment.failures = 0;
+        segment.retryAt = std::chrono::steady_clock::time_point();
+    }
+    retryPolicy.reset();
+    adaptive = remote.acceptRanges && totalFileSize > 0 && connectionCount > 1 &&
+               !segments.empty() && !segments.front().openEnded();
+    if (fresh) {
+        targetConnections = connectionCount;
+        adaptStep = 0;
+        adaptDirection = 1;
+        adaptHold = 0;
+    }
+    if (!rebalance()) {
+        stopTransfers();
+        finish(false);
+        return;
+    }
+
+    resetStats();
+    liveStats->connections.store(static_cast<int>(transfers.size()), std::memory_order_relaxed);
+    lastBytes = this->resumePosition;
+    lastTime = std::chrono::steady_clock::now();
+    lastPercent = -1;
+    lastCheckpoint = lastTime;
+    checkpointBytes = this->resumePosition;
+    adaptWindowStart = lastTime;
+    adaptWindowBytes = this->resumePosition;
+    adaptStep = 0;
+    progressTimer = TransferEngine::instance().startTimer(kProgressIntervalMs, [this]() { reportProgress(); }, true);
+}
+
+bool Downloader::startSegment(DownloadSegment& segment, size_t receiveBytes) {
+    auto transfer = std::make_unique<CurlCallbackContext>();
+    transfer->receiveReserved = receiveBytes;
+    int mirror = pickMirror();
+    if (mirror < 0) {
+        LOG_ERROR(logContext) << "No mirror left to download from";
+        return false;
+    }
+    curl_off_t offset = segment.start + segment.written;
+    // The request of a decoded stream continues the compressed body, the file the output
+    curl_off_t requestOffset = segment.decoder ? segment.received : offset;
+    transfer->writer = std::make_unique<StorageWriter>(storage.get(), storageOptions.chunkSize, offset,
+                                                       storageOptions.asyncWrites ? &WriteStage::instance() : nullptr);
+    if (requestOffset > 0) {
+        LOG_DEBUG(logContext) << "Resuming range from position: " << requestOffset;
+    }
+
+    CURL* curl = TransferEngine::instance().takeHandle();
+    if (!curl) {
+        LOG_ERROR(logContext) << "Failed to initialize cURL.";
+        return false;
+    }
+    // Shared DNS cache, TLS sessions, connection pool and the in-memory CA bundle
+    if (!CurlShare::instance().apply(curl)) {
+        LOG_ERROR(logContext) << "Please ensure 'certs/cacert.pem' exists relative to the executable.";
+        TransferEngine::instance().recycleHandle(curl);
+        return false; // Fail the download explicitly if CA bundle is missing
+    }
+    transfer->handle = curl;
+    transfer->segment = &segment;
+    transfer->downloader = this;
+    transfer->shaper = shaperClient;
+    transfer->stats = liveStats.get();
+    transfer->requestedEnd = segment.end;
+    transfer->startedAt = std::chrono::steady_clock::now();
+    transfer->sampledBytes = segment.written;
+    transfer->startProgress = segment.written + segment.received;
+    transfer->mirror = mirror;
+    transfer->logContext = logContext;
+    if (Tracer::enabled()) {
+        transfer->traceProcess = traceProcess;
+        transfer->traceTrack = Tracer::instance().newTrack();
+        transfer->traceStartUs = Tracer::now();
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, mirrors[mirror].url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, transfer->traceTrack != 0 ? tracedWriteCallback : WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, segmentHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, transfer.get());
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer.get()); // Pass context to write callback
+    // A fresh single stream needs no Range header, everything else asks for its bytes
+    if (requestOffset > 0 || !segment.openEnded()) {
+        transfer->range = std::to_string(requestOffset) + "-" +
+                          (segment.openEnded() ? std::string() : std::to_string(segment.end));
+        curl_easy_setopt(curl, CURLOPT_RANGE, transfer->range.c_str());
+        // Only take the range if the file is still the one the journal describes;
+        // otherwise the server answers 200 with the new file
+        std::string validator = journaled && mirror == 0 ? journal.ifRangeValue() : std::string();
+        if (!validator.empty()) {
+            transfer->headers = curl_slist_append(nullptr, ("If-Range: " + validator).c_str());
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, transfer->headers);
+        }
+    } else if (compressedTransfer.load() && !segment.decoder && !StreamDecoder::compressedName(url)) {
+        // The whole body may come compressed; a range would address the compressed bytes,
+        // so ranged requests stay identity
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
     }
 
     // --- Set other options ---
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L); // Optional: for debugging
+    CurlShare::applyTrace(curl, logContext);
     curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64)");
-    curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 8192L);
-    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 3L);
-    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1000L);
+    curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, static_cast<long>(receiveBytes));
+    // Only a connection that stopped delivering altogether fails, a slow one keeps going
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, kStallTimeoutS);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
     curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
-    // curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 0L); // Often default is fine
-
-    char errbuf[CURL_ERROR_SIZE];
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-    errbuf[0] = 0;
-
-    // --- Moved CA Certificate Handling Inside Function ---
-    QString appDir = QCoreApplication::applicationDirPath();
-    QString caCertPath = QDir(appDir).filePath("certs/cacert.pem");
-    std::string caCertPathStd = caCertPath.toStdString();
-    std::cout << "Attempting to use CA certificate file (relative path resolved to): "
-              << caCertPathStd << std::endl;
-    QFileInfo caCertInfo(caCertPath);
-    if (!caCertInfo.exists() || !caCertInfo.isFile()) {
-        std::cerr << "ERROR: CA certificate file not found at expected path: "
-                  << caCertPathStd << std::endl;
-        std::cerr << "Please ensure 'certs/cacert.pem' exists relative to the executable." << std::endl;
-        // Clean up before returning failure
-        file.close();
-        curl_easy_cleanup(curl);
-        this->m_curlHandle = nullptr;
-        // No need to set running flag here as download hasn't started
-        return false; // Fail the download explicitly if CA bundle is missing
-    } else {
-        curl_easy_setopt(curl, CURLOPT_CAINFO, caCertPathStd.c_str());
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, transfer->errbuf);
+    // Small files share a connection: wait for an HTTP/2 connection to the host that is
+    // being set up rather than opening another. Ranges keep connections of their own.
+    if (skipProbe.load() && segment.openEnded()) {
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
     }
-    // --- End Moved CA Handling ---
-    // --- Perform Download ---
-    running.store(true); // Mark as running before starting
-    res = curl_easy_perform(curl); // BLOCKING call
-    running.store(false); // Mark as not running after completion or failure
 
-    // --- Process Results ---
-    // Get actual downloaded size for this specific transfer attempt
-    curl_off_t downloadedSize = 0;
-    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloadedSize);
+    if (transfer->traceTrack != 0) {
+        Tracer::instance().nameTrack(traceProcess, transfer->traceTrack,
+                                     (transfer->range.empty() ? std::string("whole file") : "range " + transfer->range) +
+                                     (mirror != 0 ? " from mirror " + std::to_string(mirror) : std::string()));
+    }
+    if (!TransferEngine::instance().addHandle(curl, this)) {
+        TransferEngine::instance().recycleHandle(curl);
+        return false;
+    }
+    Metrics::instance().addTransferStarted();
+    transfers.push_back(std::move(transfer));
+    return true;
+}
+
+void Downloader::onSegmentDone(CurlCallbackContext* transfer, CURLcode result) {
+    DownloadSegment* segment = transfer->segment;
 
     // Get final HTTP response code
     long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-    // --- Cleanup ---
-    this->m_curlHandle = nullptr; // Clear member handle pointer *before* cleanup
-    curl_easy_cleanup(curl); // Clean up the local easy handle
-    file.close(); // Close the file stream
-
-    // --- Determine Return Status ---
-
-    // Check if paused based on flag AND specific return codes from callbacks
-    if (this->paused.load() &&
-        (res == CURLE_WRITE_ERROR || res == CURLE_ABORTED_BY_CALLBACK)) {
-         std::ifstream checkFile(this->outputPath, std::ios::binary | std::ios::ate);
-         if (checkFile.good()) {
-             this->resumePosition = checkFile.tellg();
-         } else {
-             // Fallback: update based on downloadedSize if file check fails
-             this->resumePosition += downloadedSize;
-             std::cerr << "Warning: Could not determine file size after pause, using downloadedSize." << std::endl;
-         }
-         std::cout << "Download paused by callback at position: " << this->resumePosition << std::endl;
-         return false; // Paused intentionally, but don't emit signal here
-    }
-
-    // Check for other non-fatal conditions that might imply stopping but allow resume
-    if (res == CURLE_OPERATION_TIMEDOUT || res == CURLE_PARTIAL_FILE) {
-         // Update resume position similarly to pause
-         std::ifstream checkFile(this->outputPath, std::ios::binary | std::ios::ate);
-         if (checkFile.good()) {
-             this->resumePosition = checkFile.tellg();
-         } else {
-             this->resumePosition += downloadedSize;
-             std::cerr << "Warning: Could not determine file size after timeout/partial, using downloadedSize." << std::endl;
-         }
-
-         std::cout << "Download stopped (Timeout/Partial) at position: " << this->resumePosition << std::endl;
-         // Decide if this should be treated as failure or just stopped state
-         // For now, treat as failure for the 'downloadFinished' signal
-         return false;
-    }
-
-    // Check for actual errors
-    if (res != CURLE_OK) {
-        std::cerr << "Download failed: " << curl_easy_strerror(res) << std::endl;
-        if (errbuf[0] != '\0') {
-            std::cerr << "Error details: " << errbuf << std::endl;
-        }
-        std::cerr << "HTTP response code: " << http_code << std::endl;
-        // Don't reset resumePosition on failure, allow retrying from current point
-        return false; // Failure
-    }
-
-    // If CURLE_OK and not paused/stopped above
-    std::cout << "Download completed successfully! HTTP code: " << http_code << std::endl;
-    this->resumePosition = 0; // Reset resume position only on full success
-    return true; // Success
+    curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &http_code);
+    if (transfer->traceTrack != 0) {
+        transfer->traceResult = result;
+        transfer->traceHttpCode = http_code;
+        traceConnectionPhases(transfer->handle, transfer->traceProcess, transfer->traceTrack, transfer->traceStartUs);
+    }
+
+    if (transfer->remoteChanged) {
+        LOG_WARN(logContext) << "Remote file changed since the download started, starting over";
+        journaled = false; // The recorded progress belongs to the old file
+        ResumeJournal::remove(ResumeJournal::pathFor(outputPath));
+        stopTransfers();
+        discardBytes(liveStats->storedBytes.load(std::memory_order_relaxed));
+        segments.clear();
+        this->resumePosition = 0;
+        if (restartedOnChange) {
+            finish(false);
+            return;
+        }
+        restartedOnChange = true;
+        startProbe();
+        return;
+    }
+
+    if (transfer->integrityFailed) {
+        // With other mirrors the block is fetched again from one of them
+        if (mirrors.size() > 1 && repairBlock(integrity.failedBlock(), segment) &&
+            dropMirror(transfer->mirror, "served a block that does not match its digest")) {
+            refill();
+            return;
+        }
+        failVerification();
+        return;
+    }
+    if (transfer->rangeSplit && result == CURLE_WRITE_ERROR) {
+        result = CURLE_OK; // Aborted on purpose at the end of its shortened range
+    }
+
+    sampleWireBytes(transfer);
+    bool flushed = transfer->writer->flush();
+    // An error status without a body never reaches the write callback
+    bool complete = flushed && result == CURLE_OK && http_code < 400 &&
+                    (segment->openEnded() || segment->written == segment->length());
+    if (complete && segment->decoder && !segment->decoder->finished()) {
+        LOG_WARN(logContext) << "Compressed body ended in the middle of a stream";
+        complete = false;
+    }
+    if (!complete) {
+        LOG_WARN(logContext) << "Download failed: " << curl_easy_strerror(result);
+        if (transfer->errbuf[0] != '\0') {
+            LOG_WARN(logContext) << "Error details: " << transfer->errbuf;
+        }
+        LOG_WARN(logContext) << "HTTP response code: " << http_code;
+        // Other mirrors take over the segment when this one serves another file, refuses
+        // it for good or keeps failing; a single timeout or reset is retried like with one
+        // mirror, and local errors (a full disk) say nothing about the mirror at all
+        Mirror& mirror = mirrors[static_cast<size_t>(transfer->mirror)];
+        bool transient = RetryPolicy::transient(result, http_code);
+        if (segment->written + segment->received > transfer->startProgress) {
+            mirror.failures = 0;
+        }
+        const char* dropReason = nullptr;
+        if (transfer->wrongFile) {
+            dropReason = "serves another file";
+        } else if (http_code >= 400 && !transient) {
+            dropReason = "refuses the file";
+        } else if (transient && ++mirror.failures >= kMaxMirrorFailures) {
+            dropReason = "keeps failing";
+        }
+        int usable = static_cast<int>(std::count_if(mirrors.begin(), mirrors.end(),
+                                                    [](const Mirror& m) { return !m.dropped; }));
+        if (flushed && dropReason && usable > 1 && dropMirror(transfer->mirror, dropReason)) {
+            refill();
+            return;
+        }
+        if (flushed && retrySegment(transfer, result, http_code)) {
+            if (paused.load()) {
+                refill(); // Tears down once the last kept-alive transfer is gone
+            }
+            return;
+        }
+        // Other segments keep their progress, allow retrying from the current point
+        stopTransfers();
+        finish(false);
+        return;
+    }
+
+    segment->done = true;
+    mirrors[static_cast<size_t>(transfer->mirror)].failures = 0;
+    TransferEngine::instance().recycleHandle(transfer->handle);
+    transfers.erase(std::find_if(transfers.begin(), transfers.end(),
+                                 [transfer](const std::unique_ptr<CurlCallbackContext>& t) { return t.get() == transfer; }));
+
+    bool allDone = std::all_of(segments.begin(), segments.end(),
+                               [](const DownloadSegment& s) { return s.done; });
+    if (allDone) {
+        LOG_INFO(logContext) << "Download completed successfully! HTTP code: " << http_code;
+        finish(true);
+        return;
+    }
+    // The freed connection takes over part of the segment that would finish last
+    refill();
 }
 
-// Slot to start the download process
-void Downloader::startDownload() {
-    paused.store(false);
-    resumePosition = 0; // Start from beginning
-    totalFileSize = -1;  // Reset total file size, use -1 to indicate unknown
-
-    // Optionally: Make a HEAD request to get total file size before downloading
-    CURL* curlHead = curl_easy_init();
-    if (curlHead) {
-        curl_easy_setopt(curlHead, CURLOPT_URL, url.c_str()); // Use member url
-        curl_easy_setopt(curlHead, CURLOPT_NOBODY, 1L);
-        curl_easy_setopt(curlHead, CURLOPT_HEADER, 1L);
-        curl_easy_setopt(curlHead, CURLOPT_FOLLOWLOCATION, 1L);
-
-        // Add CAINFO for HEAD request as well for consistency
-        QString appDir = QCoreApplication::applicationDirPath();
-        QString caCertPath = QDir(appDir).filePath("certs/cacert.pem");
-        // Correct type: Use std::string since toStdString() returns that
-        std::string caCertPathStd = caCertPath.toStdString();
-        QFileInfo caCertInfo(caCertPath);
-        if (caCertInfo.exists() && caCertInfo.isFile()) {
-            // Now caCertPathStd is std::string, so .c_str() is valid
-            curl_easy_setopt(curlHead, CURLOPT_CAINFO, caCertPathStd.c_str());
-            curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYPEER, 1L);
-            curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYHOST, 2L);
-        } else {
-             std::cerr << "Warning: CA cert bundle not found for HEAD request. Verification disabled for this request." << std::endl;
-             curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYPEER, 0L);
-             curl_easy_setopt(curlHead, CURLOPT_SSL_VERIFYHOST, 0L);
-        }
-        if (curl_easy_perform(curlHead) == CURLE_OK) {
-            // Use CURLINFO_CONTENT_LENGTH_DOWNLOAD_T for large files
-            curl_off_t size_off_t = 0;
-            curl_easy_getinfo(curlHead, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size_off_t);
-            if (size_off_t > 0) {
-                totalFileSize = static_cast<qint64>(size_off_t); // Assign to qint64 member
-                std::cout << "Total file size from HEAD request: " << totalFileSize << std::endl;
-                // Emit the signal now that the size is known
-                emit totalSizeKnown(totalFileSize);
-            } else {
-                totalFileSize = -1; // Indicate unknown size if HEAD request didn't provide it
-                emit totalSizeKnown(totalFileSize); // Emit -1 for unknown size
+void Downloader::refill() {
+    if (paused.load()) {
+        // Nothing new starts while paused; with the last kept-alive transfer gone the
+        // resume has to start the rest over
+        if (transfers.empty()) {
+            stopTransfers();
+        }
+        return;
+    }
+    if (!rebalance()) {
+        stopTransfers();
+        finish(false);
+    }
+}
+
+bool Downloader::retrySegment(CurlCallbackContext* transfer, CURLcode result, long httpCode) {
+    DownloadSegment* segment = transfer->segment;
+    if (transfer->wrongFile || !RetryPolicy::transient(result, httpCode)) {
+        return false;
+    }
+    // An attempt that got somewhere starts the backoff over
+    if (segment->written + segment->received > transfer->startProgress) {
+        segment->failures = 0;
+    }
+    if (++segment->failures > kMaxSegmentFailures) {
+        LOG_ERROR(logContext) << "Giving up after " << kMaxSegmentFailures << " attempts without progress";
+        return false;
+    }
+    if (!retryPolicy.consume(liveStats->sessionBytes.load(std::memory_order_relaxed))) {
+        LOG_ERROR(logContext) << "Giving up, too many retries for the data received";
+        return false;
+    }
+    std::chrono::milliseconds delay = retryPolicy.delay(segment->failures, transfer->retryAfterS);
+    if (!stopSegment(transfer)) {
+        return false;
+    }
+
+    // The next request continues at the segment's progress. Without range support the
+    // server can only send the whole body again, which then starts over.
+    curl_off_t progress = segment->decoder ? segment->received : segment->written;
+    if (segment->openEnded() && progress > 0 && !remote.acceptRanges) {
+        LOG_WARN(logContext) << "Server does not support ranges, starting over";
+        discardBytes(segment->written);
+        TransferStats::add(liveStats->sourceBytes, -static_cast<int64_t>(segment->received));
+        segment->written = 0;
+        segment->received = 0;
+        segment->blockHash = StreamHash();
+        if (segment->decoder) {
+            segment->decoder = std::make_shared<StreamDecoder>(decodeFormat);
+        }
+        resetIntegrity();
+    }
+
+    segment->retryAt = std::chrono::steady_clock::now() + delay;
+    liveStats->retries.store(liveStats->retries.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    Metrics::instance().addRetry();
+    if (Tracer::enabled()) {
+        Tracer::instance().instant(traceProcess, kTraceMainTrack, "transfer", "retry scheduled",
+                                   TraceArgs().add("offset", static_cast<int64_t>(segment->start + segment->written))
+                                              .add("delay_ms", static_cast<int64_t>(delay.count())));
+    }
+    LOG_WARN(logContext) << "Retrying from position " << segment->start + segment->written << " in " << delay.count()
+                         << " ms (attempt " << segment->failures << " of " << kMaxSegmentFailures << ")";
+    scheduleRetry();
+    return true;
+}
+
+void Downloader::scheduleRetry() {
+    TransferEngine& engine = TransferEngine::instance();
+    if (retryTimer != 0) {
+        engine.stopTimer(retryTimer);
+        retryTimer = 0;
+    }
+    waitingForMemory = false;
+    if (!running.load()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (const DownloadSegment& segment : segments) {
+        if (!segment.done && segment.retryAt > now) {
+            next = std::min(next, segment.retryAt);
+        }
+    }
+    if (next == std::chrono::steady_clock::time_point::max()) {
+        return;
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+    retryTimer = engine.startTimer(static_cast<int>(wait), [this]() {
+        retryTimer = 0;
+        refill();
+        scheduleRetry();
+    });
+}
+
+void Downloader::discardBytes(int64_t bytes) {
+    TransferStats::add(liveStats->storedBytes, -bytes);
+    TransferStats::add(liveStats->wastedBytes, bytes);
+    Metrics::instance().addWastedBytes(bytes);
+}
+
+void Downloader::adoptResponse(CurlCallbackContext* transfer) {
+    curl_off_t contentLength = -1;
+    curl_easy_getinfo(transfer->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+    remote = transfer->remote;
+    if (transfer->mirror != 0) {
+        // If-Range is only sent to the main URL, a mirror's validators are of no use
+        remote.etag.clear();
+        remote.lastModified.clear();
+    }
+    if (contentLength <= 0) {
+        return; // The body ends when the server closes it
+    }
+    // The length is that of the compressed body; the stored size shows at the end
+    if (transfer->segment->decoder) {
+        sourceSize = static_cast<qint64>(contentLength);
+        liveStats->sourceTotalBytes.store(sourceSize, std::memory_order_relaxed);
+        return;
+    }
+    if (!transfer->remote.contentEncoding.empty()) {
+        return;
+    }
+    totalFileSize = static_cast<qint64>(contentLength);
+    liveStats->totalBytes.store(totalFileSize, std::memory_order_relaxed);
+    if (integrity.enabled()) {
+        integrity.setSize(totalFileSize);
+    }
+    emit totalSizeKnown(totalFileSize);
+
+    // Large enough to be worth more connections: the stream becomes the first segment,
+    // rebalance() splits off the rest once the progress timer runs
+    if (!remote.acceptRanges || connectionCount <= 1 || contentLength < 2 * kMinSegmentSize) {
+        return;
+    }
+    transfer->segment->end = contentLength - 1;
+    transfer->requestedEnd = contentLength - 1;
+    adaptive = true;
+    LOG_INFO(logContext) << "Total file size from GET response: " << totalFileSize << ", continuing in segments";
+    openJournal();
+}
+
+int Downloader::pickMirror() const {
+    // Each connection goes where it adds the most: the per-connection throughput of a
+    // mirror shared by its connections plus the new one. Unmeasured mirrors count with the
+    // average, so every mirror gets tried and none is starved before it was measured.
+    double measuredSum = 0;
+    int measured = 0;
+    for (const Mirror& mirror : mirrors) {
+        if (!mirror.dropped && mirror.bytesPerSecond > 0) {
+            measuredSum += mirror.bytesPerSecond;
+            ++measured;
+        }
+    }
+    double average = measured > 0 ? measuredSum / measured : 1.0;
+    int best = -1;
+    double bestScore = 0;
+    for (size_t i = 0; i < mirrors.size(); ++i) {
+        if (mirrors[i].dropped) {
+            continue;
+        }
+        int connections = static_cast<int>(std::count_if(transfers.begin(), transfers.end(),
+            [i](const std::unique_ptr<CurlCallbackContext>& t) { return t->mirror == static_cast<int>(i); }));
+        double rate = mirrors[i].bytesPerSecond > 0 ? mirrors[i].bytesPerSecond : average;
+        double score = rate / (connections + 1);
+        if (best < 0 || score > bestScore) {
+            best = static_cast<int>(i);
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+bool Downloader::dropMirror(int index, const std::string& reason) {
+    mirrors[index].dropped = true;
+    LOG_WARN(logContext) << "Dropping mirror " << mirrors[index].url << ": " << reason;
+    // Its segments keep their progress and continue on the remaining mirrors
+    bool ok = true;
+    for (size_t i = transfers.size(); i-- > 0;) {
+        if (transfers[i]->mirror == index) {
+            ok = stopSegment(transfers[i].get()) && ok;
+        }
+    }
+    return ok && std::any_of(mirrors.begin(), mirrors.end(), [](const Mirror& m) { return !m.dropped; });
+}
+
+bool Downloader::repairBlock(int64_t block, DownloadSegment* segment) {
+    if (block < 0 || ++blockRepairs[block] > kMaxBlockRepairs) {
+        return false;
+    }
+    curl_off_t blockSize = static_cast<curl_off_t>(integrity.blockSize());
+    curl_off_t begin = block * blockSize;
+    curl_off_t end = std::min<curl_off_t>(begin + blockSize, totalFileSize) - 1;
+    integrity.discardBlock(static_cast<size_t>(block));
+    if (segment && segment->start <= begin && begin <= segment->start + segment->written) {
+        curl_off_t rewind = segment->start + segment->written - begin;
+        segment->written -= rewind;
+        segment->done = false;
+        segment->blockHash = StreamHash();
+        discardBytes(static_cast<int64_t>(rewind));
+    } else {
+        // Found by a read-back, which cannot tell the source; the stored copy stays
+        // until a segment of its own has written the block again
+        DownloadSegment repair;
+        repair.start = begin;
+        repair.end = end;
+        segments.push_back(repair);
+        discardBytes(static_cast<int64_t>(end - begin + 1));
+    }
+    LOG_WARN(logContext) << "Fetching block " << block << " (bytes " << begin << "-" << end << ") again";
+    return true;
+}
+
+bool Downloader::rebalance() {
+    BufferPool& pool = BufferPool::instance();
+    while (static_cast<int>(transfers.size()) < targetConnections) {
+        // Memory for curl's receive buffer comes first; without it the download waits for
+        // the pool's space listener instead of splitting a segment it cannot start
+        size_t receiveBytes = pool.reserveReceive(static_cast<size_t>(storageOptions.receiveBufferSize),
+                                                  kMinReceiveBufferSize);
+        if (receiveBytes == 0) {
+            waitingForMemory = true;
+            break;
+        }
+        // Segments without a transfer (restored from the journal, or whose connection
+        // was given back) go first, those waiting for a retry once it is due
+        DownloadSegment* next = nullptr;
+        auto now = std::chrono::steady_clock::now();
+        for (DownloadSegment& segment : segments) {
+            bool owned = std::any_of(transfers.begin(), transfers.end(),
+                                     [&segment](const std::unique_ptr<CurlCallbackContext>& t) { return t->segment == &segment; });
+            if (!segment.done && !owned && segment.retryAt <= now) {
+                next = &segment;
+                break;
             }
-        } else {
-             std::cerr << "HEAD request failed: " << curl_easy_strerror(curl_easy_perform(curlHead)) << std::endl;
-             totalFileSize = -1; // Indicate unknown size on failure
-             emit totalSizeKnown(totalFileSize); // Emit -1 for unknown size
         }
-        curl_easy_cleanup(curlHead);
+        if (!next) {
+            next = splitLaggingSegment();
+        }
+        if (!next) {
+            pool.unreserveReceive(receiveBytes);
+            break;
+        }
+        if (!startSegment(*next, receiveBytes)) {
+            return false;
+        }
+    }
+    liveStats->connections.store(static_cast<int>(transfers.size()), std::memory_order_relaxed);
+    return true;
+}
+
+DownloadSegment* Downloader::splitLaggingSegment() {
+    if (!adaptive) {
+        return nullptr;
+    }
+    // Connections that just started have no throughput of their own yet, they are
+    // assumed to get the average of the others
+    auto now = std::chrono::steady_clock::now();
+    auto warm = [now](const CurlCallbackContext& t) {
+        return std::chrono::duration<double>(now - t.startedAt).count() >= kConnectionWarmupS;
+    };
+    double rateSum = 0;
+    int warmCount = 0;
+    for (const auto& transfer : transfers) {
+        if (warm(*transfer)) {
+            rateSum += transfer->bytesPerSecond;
+            ++warmCount;
+        }
+    }
+    double averageRate = warmCount > 0 ? rateSum / warmCount : 0;
+
+    CurlCallbackContext* victim = nullptr;
+    double longest = 0;
+    for (const auto& transfer : transfers) {
+        const DownloadSegment* segment = transfer->segment;
+        curl_off_t remaining = segment->length() - segment->written;
+        if (transfer->pauseReasons & kPauseUser || remaining < 2 * kMinSplitSize) {
+            continue;
+        }
+        double rate = warm(*transfer) ? transfer->bytesPerSecond : averageRate;
+        // Without any measurement yet the largest remainder is split
+        double seconds = averageRate > 0 ? remaining / std::max(rate, 1.0) : static_cast<double>(remaining);
+        if (averageRate > 0 && seconds < kMinSplitSeconds) {
+            continue;
+        }
+        if (seconds > longest) {
+            longest = seconds;
+            victim = transfer.get();
+        }
+    }
+    if (!victim) {
+        return nullptr;
+    }
+
+    // Split so both parts are expected to finish at the same time: the lagging connection
+    // keeps the share its throughput allows, the new one takes the rest
+    DownloadSegment* segment = victim->segment;
+    curl_off_t position = segment->start + segment->written;
+    curl_off_t remaining = segment->end - position + 1;
+    double victimRate = warm(*victim) ? victim->bytesPerSecond : averageRate;
+    double share = averageRate > 0 ? victimRate / (victimRate + averageRate) : 0.5;
+    curl_off_t keep = static_cast<curl_off_t>(remaining * share);
+    keep = std::max(kMinSplitSize, std::min(keep, remaining - kMinSplitSize));
+    curl_off_t split = position + keep;
+    // Verified downloads keep blocks whole within one transfer
+    curl_off_t blockSize = static_cast<curl_off_t>(integrity.blockSize());
+    if (integrity.enabled()) {
+        split = (split + blockSize - 1) / blockSize * blockSize;
+    }
+    if (segment->end + 1 - split < kMinSplitSize) {
+        return nullptr;
+    }
+
+    DownloadSegment rest;
+    rest.start = split;
+    rest.end = segment->end;
+    segment->end = split - 1;
+    segments.push_back(rest);
+    LOG_DEBUG(logContext) << "Split range at " << split << ": " << split - position << " bytes left to the lagging connection, "
+                         << rest.length() << " to a new one";
+    return &segments.back();
+}
+
+bool Downloader::stopSegment(CurlCallbackContext* transfer) {
+    TransferEngine::instance().recycleHandle(transfer->handle);
+    bool ok = transfer->writer->flush();
+    transfers.erase(std::find_if(transfers.begin(), transfers.end(),
+                                 [transfer](const std::unique_ptr<CurlCallbackContext>& t) { return t.get() == transfer; }));
+    liveStats->connections.store(static_cast<int>(transfers.size()), std::memory_order_relaxed);
+    return ok;
+}
+
+bool Downloader::setTargetConnections(int count) {
+    targetConnections = count;
+    // Fewer: give back the slowest connections, their segments wait for a free one
+    while (static_cast<int>(transfers.size()) > targetConnections) {
+        auto slowest = std::min_element(transfers.begin(), transfers.end(),
+                                        [](const std::unique_ptr<CurlCallbackContext>& a,
+                                           const std::unique_ptr<CurlCallbackContext>& b) {
+                                            return a->bytesPerSecond < b->bytesPerSecond;
+                                        });
+        if (!stopSegment(slowest->get())) {
+            return false;
+        }
+    }
+    return rebalance();
+}
+
+void Downloader::adaptConnections() {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - adaptWindowStart).count();
+    if (seconds * 1000 < kAdaptIntervalMs) {
+        return;
+    }
+    curl_off_t stored = liveStats->storedBytes.load(std::memory_order_relaxed);
+    double rate = (stored - adaptWindowBytes) / seconds;
+    adaptWindowStart = now;
+    adaptWindowBytes = stored;
+
+    // A shaped or disk-bound download gains nothing from more connections, and near the
+    // end there is not enough left to keep all of them busy; no measurement then
+    bool limited = rateLimit.load() > 0 || BandwidthShaper::instance().globalLimit() > 0 ||
+                   std::any_of(transfers.begin(), transfers.end(),
+                               [](const std::unique_ptr<CurlCallbackContext>& t) { return t->pauseReasons != 0; });
+    if (limited || static_cast<int>(transfers.size()) < targetConnections) {
+        adaptStep = 0;
+        return;
+    }
+
+    bool ok = true;
+    if (adaptStep != 0) {
+        // A step is kept if an added connection brought a real gain, or a removed one
+        // cost next to nothing
+        bool paidOff = adaptStep > 0 ? rate >= adaptBaseline * (1.0 + kAdaptMinGain)
+                                     : rate >= adaptBaseline * (1.0 - kAdaptMinGain);
+        if (!paidOff) {
+            LOG_INFO(logContext) << "Connection count " << targetConnections << " did not pay off ("
+                                 << static_cast<qint64>(rate) << " B/s), back to " << targetConnections - adaptStep;
+            ok = setTargetConnections(targetConnections - adaptStep);
+            adaptDirection = -adaptStep;
+            adaptStep = 0;
+            adaptHold = kAdaptBackoffWindows;
+            if (!ok) {
+                stopTransfers();
+                finish(false);
+            }
+            return;
+        }
+        adaptDirection = adaptStep;
+    }
+    // Removals compare with the throughput before the first one, so small losses do not add up
+    if (adaptStep >= 0) {
+        adaptBaseline = rate;
+    }
+    adaptStep = 0;
+    if (adaptHold > 0) {
+        --adaptHold;
+        return;
+    }
+
+    int next = targetConnections + adaptDirection;
+    if (next < 1 || next > 2 * connectionCount) {
+        adaptDirection = -adaptDirection;
+        adaptHold = kAdaptBackoffWindows;
+        return;
+    }
+    ok = setTargetConnections(next);
+    if (static_cast<int>(transfers.size()) != next) {
+        // Nothing left worth splitting for another connection
+        targetConnections = static_cast<int>(transfers.size());
     } else {
-        totalFileSize = -1; // Indicate unknown size if HEAD init fails
-        emit totalSizeKnown(totalFileSize); // Emit -1 for unknown size
+        adaptStep = adaptDirection;
+    }
+    if (!ok) {
+        stopTransfers();
+        finish(false);
+    }
+}
+
+void Downloader::resumeBackpressured() {
+    clearPauseReason(kPauseBackpressure);
+    // Transfers that could not start for lack of memory get another chance
+    if (waitingForMemory) {
+        waitingForMemory = false;
+        if (running.load()) {
+            refill();
+        }
+    }
+}
+
+void Downloader::clearPauseReason(unsigned reason) {
+    for (auto& transfer : transfers) {
+        if (transfer->pauseReasons & reason) {
+            transfer->pauseReasons &= ~reason;
+            if (transfer->pauseReasons == 0) {
+                curl_easy_pause(transfer->handle, CURLPAUSE_CONT);
+            }
+        }
+    }
+}
+
+void Downloader::noteResumeData() {
+    awaitingResumeData = false;
+    qint64 latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - resumeRequestedAt).count();
+    resumeLatencyUs.store(latency);
+    if (Tracer::enabled()) {
+        Tracer::instance().complete(traceProcess, kTraceMainTrack, "pause", "resume to first byte",
+                                    Tracer::toUs(resumeRequestedAt), Tracer::now(),
+                                    TraceArgs().add("kept_alive", static_cast<int64_t>(resumedKeptAlive)));
+    }
+    LOG_INFO(logContext) << "Resume latency: " << latency / 1000.0 << " ms ("
+                         << (resumedKeptAlive ? "kept-alive connection" : "new range request") << ")";
+    emit resumeLatencyMeasured(latency, resumedKeptAlive);
+}
+
+void Downloader::resetIntegrity() {
+    integrity.reset(hashAlgorithm, totalFileSize, hashBlockSize);
+    integrity.setExpectedDigest(expectedDigest);
+    integrity.setExpectedBlockDigests(expectedBlockDigests);
+    catchUp.reset();
+    lastDigest.clear();
+    if (integrity.enabled()) {
+        LOG_INFO(logContext) << "Verifying with " << hashAlgorithmName(hashAlgorithm) << " ("
+                             << StreamHash::kernelName(hashAlgorithm) << ")";
+    }
+}
+
+void Downloader::advanceHashing() {
+    if (catchUp) {
+        if (!catchUp->finished.load()) {
+            return;
+        }
+        bool ok = integrity.applyCatchUp(*catchUp);
+        catchUp.reset();
+        if (!ok && !(mirrors.size() > 1 && repairBlock(integrity.failedBlock(), nullptr))) {
+            failVerification();
+            return;
+        }
+        if (!ok) {
+            refill();
+            if (!running.load()) {
+                return;
+            }
+        }
+    }
+    if (!storage) {
+        return;
+    }
+    auto work = std::make_shared<IntegrityCheck::CatchUp>();
+    if (!integrity.planCatchUp(storedRanges(), *work)) {
+        return;
+    }
+    catchUp = work;
+    // The write stage runs the task after every chunk queued so far, so the range is
+    // in the file by then (and most likely still in the page cache)
+    StorageBackend* backend = storage.get();
+    std::string path = outputPath;
+    WriteStage::instance().submitTask(backend, [backend, work, path]() {
+        backend->flush();
+        work->run(path);
+    });
+}
+
+bool Downloader::completeHashing() {
+    // stopTransfers() drained the write stage, a pending catch-up is done
+    if (catchUp) {
+        bool ok = integrity.applyCatchUp(*catchUp);
+        catchUp.reset();
+        if (!ok) {
+            return false;
+        }
+    }
+    curl_off_t size = 0;
+    for (DownloadSegment& segment : segments) {
+        size = std::max(size, segment.start + segment.written);
+    }
+    if (totalFileSize <= 0) {
+        // A stream of unknown size ends its last, short block here
+        integrity.setSize(size);
+        for (DownloadSegment& segment : segments) {
+            if (!integrity.finishBlock(segment.blockHash, segment.start + segment.written)) {
+                return false;
+            }
+        }
+    }
+
+    // Whatever the catch-ups have not reached yet; usually little, as they ran along
+    IntegrityCheck::CatchUp work;
+    std::vector<std::pair<int64_t, int64_t>> whole{{0, static_cast<int64_t>(size)}};
+    while (integrity.planCatchUp(whole, work)) {
+        work.run(outputPath);
+        if (!work.ok) {
+            integrity.applyCatchUp(work);
+            LOG_ERROR(logContext) << "Could not read back " << outputPath << " for verification";
+            return false;
+        }
+        if (!integrity.applyCatchUp(work)) {
+            return false;
+        }
     }
 
+    std::string name = hashAlgorithmName(integrity.algorithm());
+    std::string digest = integrity.fileDigest();
+    if (digest.empty()) {
+        LOG_ERROR(logContext) << "Could not hash all of " << outputPath;
+        return false;
+    }
+    lastDigest = name + ":" + digest;
+    LOG_INFO(logContext) << name << " of " << outputPath << ": " << digest;
+    if (!integrity.matchesExpected()) {
+        LOG_ERROR(logContext) << outputPath << " does not match the expected " << integrity.expectedDigest();
+        return false;
+    }
+    return true;
+}
+
+void Downloader::failVerification() {
+    LOG_ERROR(logContext) << "Verification failed at block " << integrity.failedBlock() << ", discarding the download";
+    // The journal would vouch for bad bytes, drop it with the progress
+    journaled = false;
+    ResumeJournal::remove(ResumeJournal::pathFor(outputPath));
+    stopTransfers();
+    discardBytes(liveStats->storedBytes.load(std::memory_order_relaxed));
+    segments.clear();
+    this->resumePosition = 0;
+    finish(false);
+}
+
+bool Downloader::stopTransfers() {
+    TransferEngine& engine = TransferEngine::instance();
+    bool ok = true;
+    for (auto& transfer : transfers) {
+        sampleWireBytes(transfer.get());
+        engine.recycleHandle(transfer->handle);
+        ok = transfer->writer->flush() && ok; // Buffered bytes are already counted as written
+    }
+    transfers.clear();
+
+    if (storage) {
+        int64_t traceStartUs = Tracer::enabled() ? Tracer::now() : 0;
+        // Queued chunks must be on disk before the file is closed or a resume reads it
+        ok = WriteStage::instance().drain(storage.get()) && ok;
+        ok = storage->flush() && ok;
+        // Everything written is on disk now, record it for a later restart
+        if (journaled && ok && storage->sync()) {
+            markJournal();
+            if (!journal.save(ResumeJournal::pathFor(outputPath))) {
+                LOG_WARN(logContext) << "Could not write " << ResumeJournal::pathFor(outputPath);
+            }
+        }
+        storage->close();
+        storage.reset();
+        if (traceStartUs != 0) {
+            Tracer::instance().complete(traceProcess, kTraceDiskTrack, "disk", "drain, flush and close",
+                                        traceStartUs, Tracer::now(), TraceArgs().add("ok", static_cast<int64_t>(ok)));
+        }
+    }
+
+    if (progressTimer != 0) {
+        engine.stopTimer(progressTimer);
+        progressTimer = 0;
+    }
+    if (keepAliveTimer != 0) {
+        engine.stopTimer(keepAliveTimer);
+        keepAliveTimer = 0;
+    }
+    if (retryTimer != 0) {
+        engine.stopTimer(retryTimer);
+        retryTimer = 0;
+    }
+
+    curl_off_t downloaded = 0;
+    for (const DownloadSegment& segment : segments) {
+        downloaded += segment.written;
+    }
+    this->resumePosition = downloaded;
+    liveStats->connections.store(0, std::memory_order_relaxed);
+    liveStats->bytesPerSecond.store(0, std::memory_order_relaxed);
+    running.store(false);
+    return ok;
+}
+
+void Downloader::resetStats() {
+    curl_off_t downloaded = 0;
+    curl_off_t received = 0;
+    for (const DownloadSegment& segment : segments) {
+        downloaded += segment.written;
+        received += segment.received;
+    }
+    liveStats->totalBytes.store(totalFileSize > 0 ? totalFileSize : -1, std::memory_order_relaxed);
+    liveStats->storedBytes.store(downloaded, std::memory_order_relaxed);
+    liveStats->sessionBytes.store(0, std::memory_order_relaxed);
+    liveStats->wireBytes.store(0, std::memory_order_relaxed);
+    bool decoding = decodeFormat != StreamDecoder::None;
+    liveStats->sourceBytes.store(decoding ? received : 0, std::memory_order_relaxed);
+    liveStats->sourceTotalBytes.store(decoding && sourceSize > 0 ? sourceSize : -1, std::memory_order_relaxed);
+    liveStats->startTimeUs.store(TransferStats::nowUs(), std::memory_order_relaxed);
+    liveStats->firstDataTimeUs.store(0, std::memory_order_relaxed);
+    liveStats->bytesPerSecond.store(0, std::memory_order_relaxed);
+}
+
+void Downloader::reportProgress() {
+    // The write callback keeps the counter current, no need to walk the segments
+    curl_off_t downloaded = liveStats->storedBytes.load(std::memory_order_relaxed);
+
+    for (auto& transfer : transfers) {
+        sampleWireBytes(transfer.get());
+    }
+
+    // A single stream without a known size learns it from the GET response, unless the
+    // length is that of a compressed body
+    curl_off_t total = static_cast<curl_off_t>(totalFileSize);
+    if (total <= 0 && transfers.size() == 1 && !transfers.front()->segment->decoder &&
+        transfers.front()->remote.contentEncoding.empty()) {
+        curl_off_t contentLength = -1;
+        curl_easy_getinfo(transfers.front()->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+        if (contentLength > 0) {
+            total = contentLength + transfers.front()->segment->start;
+            liveStats->totalBytes.store(total, std::memory_order_relaxed);
+        }
+    }
+
+    // Update progress, accounting for already downloaded bytes
+    int percent = liveStats->percent();
+    if (onProgress && percent >= 0) {
+        if (percent != lastPercent) {
+            onProgress(percent);
+            lastPercent = percent;
+        }
+    }
+
+    // Fold the rate since the last tick into the moving average, weighting by elapsed
+    // time so a late tick counts as much as the time it covers
+    auto currentTime = std::chrono::steady_clock::now();
+    double timeDiff = std::chrono::duration<double>(currentTime - lastTime).count();
+    if (timeDiff > 0) {
+        double rate = static_cast<double>(downloaded - lastBytes) / timeDiff;
+        double alpha = 1.0 - std::exp(-timeDiff / kThroughputTimeConstantS);
+        double average = liveStats->bytesPerSecond.load(std::memory_order_relaxed);
+        liveStats->bytesPerSecond.store(average + alpha * (rate - average), std::memory_order_relaxed);
+        if (downloaded != lastBytes) {
+            liveStats->lastDataTimeUs.store(TransferStats::nowUs(), std::memory_order_relaxed);
+        }
+        liveStats->connections.store(static_cast<int>(transfers.size()), std::memory_order_relaxed);
+        lastBytes = downloaded;
+        lastTime = currentTime;
+        // Per connection throughput, to find the one holding up the download
+        for (auto& transfer : transfers) {
+            double connectionRate = static_cast<double>(transfer->segment->written - transfer->sampledBytes) / timeDiff;
+            transfer->bytesPerSecond += alpha * (connectionRate - transfer->bytesPerSecond);
+            transfer->sampledBytes = transfer->segment->written;
+        }
+        // Per mirror: the average of its connections that have been running for a while
+        for (size_t i = 0; i < mirrors.size(); ++i) {
+            double sum = 0;
+            int count = 0;
+            for (const auto& transfer : transfers) {
+                if (transfer->mirror == static_cast<int>(i) &&
+                    std::chrono::duration<double>(currentTime - transfer->startedAt).count() >= kConnectionWarmupS) {
+                    sum += transfer->bytesPerSecond;
+                    ++count;
+                }
+            }
+            if (count > 0) {
+                mirrors[i].bytesPerSecond = sum / count;
+            }
+        }
+    }
+
+    if (journaled && downloaded != checkpointBytes &&
+        currentTime - lastCheckpoint >= std::chrono::milliseconds(kJournalIntervalMs)) {
+        checkpointJournal();
+        checkpointBytes = downloaded;
+        lastCheckpoint = currentTime;
+    }
+
+    if (integrity.enabled()) {
+        advanceHashing();
+    }
+    if (adaptive && !paused.load() && running.load()) {
+        // A download that turned out large enough for segments gets its connections here,
+        // no handle can be added from inside the write callback that found out
+        if (static_cast<int>(transfers.size()) < targetConnections && !rebalance()) {
+            stopTransfers();
+            finish(false);
+            return;
+        }
+        adaptConnections();
+    }
+}
+
+void Downloader::finish(bool success) {
+    // A failed background write only shows up once the queue is drained
+    success = stopTransfers() && success;
+    if (success && integrity.enabled() && !completeHashing()) {
+        // Some stored bytes are wrong, a retry has to start over
+        success = false;
+        journaled = false;
+        ResumeJournal::remove(ResumeJournal::pathFor(outputPath));
+        discardBytes(liveStats->storedBytes.load(std::memory_order_relaxed));
+        segments.clear();
+        this->resumePosition = 0;
+    }
+    if (success) {
+        BufferPool::Stats stats = BufferPool::instance().stats();
+        LOG_INFO(logContext) << "Buffer pool: peak " << stats.peakUsedBytes << " of " << stats.budgetBytes
+                             << " bytes, " << stats.refusals << " requests refused";
+        if (onProgress) onProgress(100);
+        // Also a download of unknown size has one now
+        liveStats->totalBytes.store(liveStats->storedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if (journaled) {
+            ResumeJournal::remove(ResumeJournal::pathFor(outputPath));
+            journaled = false;
+        }
+        if (useCache.load() && decodeFormat == StreamDecoder::None) {
+            rememberCopy();
+        }
+        int64_t wire = liveStats->wireBytes.load(std::memory_order_relaxed);
+        int64_t session = liveStats->sessionBytes.load(std::memory_order_relaxed);
+        if (wire > 0 && wire < session) {
+            LOG_INFO(logContext) << "Received " << wire << " bytes over the network for " << session << " bytes stored";
+        }
+        segments.clear();
+        this->resumePosition = 0; // Reset resume position only on full success
+    }
 
-    // Call downloadFile without parameters
-    bool result = downloadFile();
-    
     // Only emit downloadFinished if we're not paused
-    // This prevents duplicate signals when pausing
-    if (!paused.load()) {
-        emit downloadFinished(result);
+    // This prevents duplicate signals when pausing. A kept-alive transfer can still
+    // complete while paused (its last bytes were in flight), which is reported.
+    if (success || !paused.load()) {
+        Metrics::instance().addDownload(success, std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - startedAt).count());
+        if (Tracer::enabled()) {
+            Tracer::instance().complete(traceProcess, kTraceMainTrack, "download", "download", Tracer::toUs(startedAt),
+                                        Tracer::now(), TraceArgs().add("ok", static_cast<int64_t>(success)));
+        }
+    }
+    if (success && paused.load()) {
+        paused.store(false);
+        emit downloadFinished(true);
+    } else if (!paused.load()) {
+        emit downloadFinished(success);
     }
 }
 
 // Slot to pause the download
 void Downloader::requestPause() {
-    std::cout << "Pause requested directly" << std::endl;
+    LOG_DEBUG(logContext) << "Pause requested directly";
+    if (!running.load() && !paused.load()) {
+        // Still probing or setting up. Decided on the engine thread, where the transfers
+        // either started meanwhile or downloadFile() finds the request before starting them.
+        TransferEngine::instance().post([this]() {
+            if (running.load()) {
+                requestPause();
+            } else if (!paused.load()) {
+                LOG_DEBUG(logContext) << "Pausing once the transfers would start";
+                pauseBeforeStart = true;
+            }
+        });
+        return;
+    }
     // Check if running to avoid emitting pause signal unnecessarily
     if (running.load() && !paused.load()) {  // Add check for !paused.load()
-        std::cout << "Setting paused flag to true directly" << std::endl;
+        LOG_DEBUG(logContext) << "Setting paused flag to true directly";
         paused.store(true);
+        // Pausing happens on the engine thread. The transfers stay connected for the
+        // keep-alive time and are torn down afterwards, keeping their progress for a resume.
+        TransferEngine::instance().post([this]() {
+            if (!paused.load()) {
+                return;
+            }
+            int keepAliveMs = pauseKeepAliveMs.load();
+            if (Tracer::enabled()) {
+                pausedAtUs = Tracer::now();
+                Tracer::instance().instant(traceProcess, kTraceMainTrack, "pause", "pause",
+                                           TraceArgs().add("connections", static_cast<int64_t>(transfers.size()))
+                                                      .add("keep_alive_ms", keepAliveMs));
+            }
+            if (keepAliveMs <= 0 || transfers.empty()) {
+                stopTransfers();
+                LOG_INFO(logContext) << "Download paused at position: " << this->resumePosition;
+                return;
+            }
+            for (auto& transfer : transfers) {
+                transfer->pauseReasons |= kPauseUser;
+                curl_easy_pause(transfer->handle, CURLPAUSE_RECV);
+            }
+            keepAliveTimer = TransferEngine::instance().startTimer(keepAliveMs, [this]() {
+                keepAliveTimer = 0;
+                if (paused.load()) {
+                    if (Tracer::enabled()) {
+                        Tracer::instance().instant(traceProcess, kTraceMainTrack, "pause", "keep-alive expired");
+                    }
+                    stopTransfers();
+                    LOG_INFO(logContext) << "Pause exceeded the keep-alive time, closed connections at position: "
+                                         << this->resumePosition;
+                }
+            });
+            LOG_INFO(logContext) << "Download paused, keeping " << transfers.size() << " connection(s) open for "
+                                 << keepAliveMs << " ms";
+        });
         // Emit the signal immediately from the calling thread (UI thread in this case)
-        // This is safe because the connection in DownloadWindow is QueuedConnection
         emit downloadPaused();
     } else {
-        std::cout << "Direct pause requested but download not running or already paused." << std::endl;
+        LOG_DEBUG(logContext) << "Direct pause requested but download already paused.";
     }
 }
 
 // Slot to resume the download
 void Downloader::resumeDownload() {
-    std::cout << "Resume requested" << std::endl;
-    if (!running.load() && paused.load()) {
+    LOG_DEBUG(logContext) << "Resume requested";
+    auto requestedAt = std::chrono::steady_clock::now();
+    TransferEngine::instance().post([this, requestedAt]() {
+        if (!paused.load()) {
+            return;
+        }
+        resumeRequestedAt = requestedAt;
+        awaitingResumeData = true;
+        if (Tracer::enabled() && pausedAtUs != 0) {
+            Tracer::instance().complete(traceProcess, kTraceMainTrack, "pause", "paused", pausedAtUs, Tracer::now(),
+                                        TraceArgs().add("kept_alive", static_cast<int64_t>(!transfers.empty())));
+        }
+        pausedAtUs = 0;
+
+        // Connections still open: just let the data flow again
+        if (!transfers.empty()) {
+            if (keepAliveTimer != 0) {
+                TransferEngine::instance().stopTimer(keepAliveTimer);
+                keepAliveTimer = 0;
+            }
+            paused.store(false);
+            resumedKeptAlive = true;
+            emit downloadResumed();
+            clearPauseReason(kPauseUser);
+            // Connections that finished during the pause are replaced now
+            if (!rebalance()) {
+                stopTransfers();
+                finish(false);
+            }
+            return;
+        }
+        if (running.load()) {
+            return;
+        }
         paused.store(false);
+        resumedKeptAlive = false;
 
         // Update progress to show current status before resuming
         if (onProgress && totalFileSize > 0) { // Use member onProgress
-            int currentPercent = 0;
-            if (totalFileSize > 0) { // Avoid division by zero
-                 currentPercent = static_cast<int>((static_cast<double>(resumePosition) * 100.0) / totalFileSize);
-            }
+            int currentPercent = static_cast<int>((static_cast<double>(resumePosition) * 100.0) / totalFileSize);
             onProgress(std::min(100, std::max(0, currentPercent))); // Use member onProgress
         }
 
         emit downloadResumed();
-        // Call downloadFile without parameters
-        bool result = downloadFile();
-        
-        // Only emit downloadFinished if we're not paused again
-        // This prevents duplicate signals when pausing during resume
-        if (!paused.load()) {
-            emit downloadFinished(result);
-        }
-    }
+        downloadFile();
+    });
 }
 
 bool Downloader::isPaused() const {
     return paused.load();
-}
\ No newline at end of file
+}
+
+void Downloader::setConnectionCount(int count) {
+    connectionCount = std::max(1, count);
+}
+
+void Downloader::setStorageOptions(const StorageOptions& options) {
+    storageOptions = options;
+}
+
+void Downloader::setPauseKeepAlive(int idleTimeoutMs) {
+    pauseKeepAliveMs.store(std::max(0, idleTimeoutMs));
+}
+
+qint64 Downloader::lastResumeLatencyUs() const {
+    return resumeLatencyUs.load();
+}
+
+void Downloader::setRateLimit(qint64 bytesPerSecond) {
+    rateLimit.store(std::max<qint64>(0, bytesPerSecond));
+    TransferEngine::instance().post([this]() { applyShaping(); });
+}
+
+void Downloader::setWeight(double weight) {
+    this->weight.store(weight > 0 ? weight : 1.0);
+    TransferEngine::instance().post([this]() { applyShaping(); });
+}
+
+void Downloader::applyShaping() {
+    if (!shaperClient) {
+        return;
+    }
+    BandwidthShaper& shaper = BandwidthShaper::instance();
+    shaper.setClientWeight(shaperClient, weight.load());
+    shaper.setClientLimit(shaperClient, rateLimit.load());
+}
+
+void Downloader::setHashAlgorithm(HashAlgorithm algorithm) {
+    hashAlgorithm = algorithm;
+    expectedDigest.clear();
+}
+
+bool Downloader::setExpectedDigest(const std::string& spec) {
+    HashAlgorithm algorithm;
+    std::string hex;
+    if (!parseDigestSpec(spec, algorithm, hex)) {
+        return false;
+    }
+    hashAlgorithm = algorithm;
+    expectedDigest = hex;
+    return true;
+}
+
+void Downloader::setExpectedBlockDigests(HashAlgorithm algorithm, int64_t blockSize,
+                                         const std::vector<std::string>& hexDigests) {
+    if (algorithm != hashAlgorithm) {
+        expectedDigest.clear();
+    }
+    hashAlgorithm = algorithm;
+    hashBlockSize = blockSize > 0 ? blockSize : ResumeJournal::kDefaultBlockSize;
+    expectedBlockDigests = hexDigests;
+}
+
+void Downloader::setMirrors(const std::vector<std::string>& urls) {
+    mirrorUrls = urls;
+}
+
+void Downloader::setSkipProbe(bool skip) {
+    skipProbe.store(skip);
+}
+
+void Downloader::setUseCache(bool use) {
+    useCache.store(use);
+}
+
+void Downloader::setCompressedTransfer(bool enable) {
+    compressedTransfer.store(enable);
+}
+
+void Downloader::setDecompress(bool enable) {
+    decompress.store(enable);
+}
+
+void Downloader::setLogContext(uint64_t id) {
+    logContext = id;
+}
+
+void Downloader::traceStart() {
+    // Queue jobs keep their id as the process, like in the log
+    if (traceProcess == 0) {
+        traceProcess = logContext != 0 ? logContext : Tracer::instance().newTrack();
+    }
+    Tracer& tracer = Tracer::instance();
+    tracer.nameTrack(traceProcess, 0, (logContext != 0 ? "download " + std::to_string(logContext) : std::string("download")) +
+                                      " " + url);
+    tracer.nameTrack(traceProcess, kTraceMainTrack, "download");
+    tracer.nameTrack(traceProcess, kTraceDiskTrack, "disk");
+}
+
+void Downloader::setDeltaSource(const std::string& oldFile, const std::string& manifest) {
+    deltaSource = oldFile;
+    deltaManifest = manifest;
+}
@@ -0,0 +1,189 @@
+#include "downloadlistmodel.h"
+#include <QApplication>
+#include <QFileInfo>
+#include <QLocale>
+#include <QPainter>
+#include <QStyle>
+#include <QStyleOptionProgressBar>
+#include <algorithm>
+
+// Longest remaining time worth showing; slower downloads show no ETA
+static const int64_t kMaxEtaSeconds = 100LL * 3600;
+
+static QString formatSpeed(double bytesPerSecond) {
+    if (bytesPerSecond < 1024)
+        return QString("%1 B/s").arg(static_cast<qint64>(bytesPerSecond));
+    if (bytesPerSecond < 1024 * 1024)
+        return QString::number(bytesPerSecond / 1024.0, 'f', 1) + " KB/s";
+    return QString::number(bytesPerSecond / 1024.0 / 1024.0, 'f', 1) + " MB/s";
+}
+
+static QString formatEta(qint64 seconds) {
+    if (seconds >= 3600)
+        return QString("%1h %2m").arg(seconds / 3600).arg(seconds / 60 % 60, 2, 10, QChar('0'));
+    if (seconds >= 60)
+        return QString("%1m %2s").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+    return QString("%1s").arg(seconds);
+}
+
+static QString stateName(DownloadQueue::JobState state) {
+    switch (state) {
+    case DownloadQueue::Queued: return "Queued";
+    case DownloadQueue::Active: return "Downloading";
+    case DownloadQueue::Paused: return "Paused";
+    case DownloadQueue::Finished: return "Done";
+    default: return "Failed";
+    }
+}
+
+DownloadListModel::DownloadListModel(const DownloadQueue* queue, QObject* parent)
+    : QAbstractTableModel(parent),
+      queue(queue),
+      firstVisible(0),
+      lastVisible(-1)
+{
+}
+
+void DownloadListModel::addJob(int id) {
+    const DownloadQueue::Job* job = queue->job(id);
+    if (!job || rowsById.count(id) > 0) {
+        return;
+    }
+    Row row;
+    row.id = id;
+    row.name = QFileInfo(QString::fromStdString(job->outputPath)).fileName();
+    sample(row);
+
+    int index = static_cast<int>(rows.size());
+    beginInsertRows(QModelIndex(), index, index);
+    rows.push_back(row);
+    rowsById[id] = index;
+    endInsertRows();
+}
+
+int DownloadListModel::jobAt(int row) const {
+    return row >= 0 && row < static_cast<int>(rows.size()) ? rows[static_cast<size_t>(row)].id : 0;
+}
+
+int DownloadListModel::rowOf(int id) const {
+    auto it = rowsById.find(id);
+    return it == rowsById.end() ? -1 : it->second;
+}
+
+void DownloadListModel::setVisibleRows(int first, int last) {
+    firstVisible = std::max(0, first);
+    lastVisible = std::min(last, static_cast<int>(rows.size()) - 1);
+}
+
+void DownloadListModel::refresh() {
+    // Runs of changed rows become one signal each; a view repaints a run at once
+    int runStart = -1;
+    for (int index = firstVisible; index <= lastVisible + 1; ++index) {
+        bool changed = index <= lastVisible && sample(rows[static_cast<size_t>(index)]);
+        if (changed && runStart < 0) {
+            runStart = index;
+        } else if (!changed && runStart >= 0) {
+            emit dataChanged(this->index(runStart, SizeColumn), this->index(index - 1, StateColumn));
+            runStart = -1;
+        }
+    }
+}
+
+bool DownloadListModel::sample(Row& row) const {
+    const DownloadQueue::Job* job = queue->job(row.id);
+    if (!job) {
+        return false;
+    }
+    std::shared_ptr<const TransferStats> stats = job->stats;
+    int64_t total = stats ? stats->totalBytes.load(std::memory_order_relaxed) : -1;
+    int64_t stored = stats ? stats->storedBytes.load(std::memory_order_relaxed) : 0;
+    double bytesPerSecond = stats ? stats->bytesPerSecond.load(std::memory_order_relaxed) : 0;
+
+    QString size = total >= 0 ? QLocale().formattedDataSize(total) : QString();
+    int percent = job->state == DownloadQueue::Finished ? 100 : stats ? stats->percent() : -1;
+    QString speed;
+    QString eta;
+    if (job->state == DownloadQueue::Active && bytesPerSecond > 0) {
+        speed = formatSpeed(bytesPerSecond);
+        if (total > stored) {
+            qint64 seconds = static_cast<qint64>((total - stored) / bytesPerSecond);
+            if (seconds <= kMaxEtaSeconds) {
+                eta = formatEta(seconds);
+            }
+        }
+    }
+    QString state = stateName(job->state);
+
+    if (size == row.size && percent == row.percent && speed == row.speed && eta == row.eta && state == row.state) {
+        return false;
+    }
+    row.size = size;
+    row.percent = percent;
+    row.speed = speed;
+    row.eta = eta;
+    row.state = state;
+    return true;
+}
+
+int DownloadListModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(rows.size());
+}
+
+int DownloadListModel::columnCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant DownloadListModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= static_cast<int>(rows.size())) {
+        return QVariant();
+    }
+    const Row& row = rows[static_cast<size_t>(index.row())];
+    if (role == Qt::TextAlignmentRole && index.column() != NameColumn) {
+        return QVariant(static_cast<int>(Qt::AlignRight | Qt::AlignVCenter));
+    }
+    if (role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    switch (index.column()) {
+    case NameColumn: return row.name;
+    case SizeColumn: return row.size;
+    case ProgressColumn: return row.percent >= 0 ? QVariant(row.percent) : QVariant();
+    case SpeedColumn: return row.speed;
+    case EtaColumn: return row.eta;
+    case StateColumn: return row.state;
+    default: return QVariant();
+    }
+}
+
+QVariant DownloadListModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    switch (section) {
+    case NameColumn: return QString("Name");
+    case SizeColumn: return QString("Size");
+    case ProgressColumn: return QString("Progress");
+    case SpeedColumn: return QString("Speed");
+    case EtaColumn: return QString("ETA");
+    case StateColumn: return QString("State");
+    default: return QVariant();
+    }
+}
+
+void DownloadProgressDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
+                                     const QModelIndex& index) const {
+    QVariant value = index.data();
+    if (!value.isValid()) {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+    QStyleOptionProgressBar bar;
+    bar.rect = option.rect.adjusted(2, 2, -2, -2);
+    bar.state = option.state | QStyle::State_Horizontal;
+    bar.minimum = 0;
+    bar.maximum = 100;
+    bar.progress = value.toInt();
+    bar.text = QString("%1%").arg(bar.progress);
+    bar.textVisible = true;
+    QApplication::style()->drawControl(QStyle::CE_ProgressBar, &bar, painter);
+}
@@ -0,0 +1,274 @@
+#include "downloadqueue.h"
+#include "downloader.h"
+#include "bandwidthshaper.h"
+#include "logger.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QUrl>
+#include <QString>
+#include <algorithm>
+
+// Default caps, a few parallel jobs and at most two against the same origin
+static const int kDefaultMaxActive = 3;
+static const int kDefaultMaxPerHost = 2;
+// Share of the global bandwidth cap per priority class
+static const double kPriorityWeights[] = {4.0, 2.0, 1.0};
+
+DownloadQueue::DownloadQueue(QObject* parent)
+    : QObject(parent),
+      nextJobId(1),
+      activeJobs(0),
+      maxActiveJobs(kDefaultMaxActive),
+      maxPerHostJobs(kDefaultMaxPerHost),
+      connectionsPerJob(0),
+      hashAlgorithm(HashAlgorithm::None),
+      skipProbe(false),
+      useCache(false),
+      decompress(false),
+      compressedTransfer(true)
+{
+}
+
+DownloadQueue::~DownloadQueue() {
+    // Deleting a downloader stops its transfers on the engine
+    for (auto& entry : jobs) {
+        delete entry.second.downloader;
+        entry.second.downloader = nullptr;
+    }
+}
+
+int DownloadQueue::enqueue(const std::string& url, const std::string& outputPath, Priority priority,
+                           const std::string& expectedDigest) {
+    Job job;
+    job.url = url;
+    job.outputPath = outputPath;
+    job.priority = priority;
+    job.expectedDigest = expectedDigest;
+    return addJob(std::move(job));
+}
+
+int DownloadQueue::enqueue(const Metalink::File& file, const std::string& outputPath, Priority priority) {
+    Job job;
+    job.url = file.urls.front();
+    job.outputPath = outputPath;
+    job.priority = priority;
+    if (!file.hash.empty()) {
+        job.expectedDigest = std::string(hashAlgorithmName(file.hashAlgorithm)) + ":" + file.hash;
+    }
+    job.mirrors.assign(file.urls.begin() + 1, file.urls.end());
+    job.pieceAlgorithm = file.pieceAlgorithm;
+    job.pieceLength = file.pieceLength;
+    job.pieces = file.pieces;
+    return addJob(std::move(job));
+}
+
+int DownloadQueue::addJob(Job job) {
+    job.id = nextJobId++;
+    // The per-host cap counts the primary URL's host, mirrors come on top of it
+    job.host = QUrl(QString::fromStdString(job.url)).host().toLower().toStdString();
+
+    int id = job.id;
+    if (job.mirrors.empty()) {
+        LOG_INFO(id) << "Queued job " << id << " (" << job.url << ")";
+    } else {
+        LOG_INFO(id) << "Queued job " << id << " (" << job.url << " and " << job.mirrors.size() << " mirrors)";
+    }
+    pending[job.priority].push_back(id);
+    jobs.emplace(id, std::move(job));
+    schedule();
+    return id;
+}
+
+void DownloadQueue::pause(int id) {
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return;
+    Job& job = it->second;
+
+    if (job.state == Active && job.downloader) {
+        // The slot is released once the downloader confirms the pause
+        job.downloader->requestPause();
+    } else if (job.state == Queued) {
+        std::deque<int>& queue = pending[job.priority];
+        queue.erase(std::remove(queue.begin(), queue.end(), id), queue.end());
+        job.state = Paused;
+        emit jobPaused(id);
+    }
+}
+
+void DownloadQueue::resume(int id) {
+    auto it = jobs.find(id);
+    if (it == jobs.end() || it->second.state != Paused) return;
+    Job& job = it->second;
+
+    job.state = Queued;
+    job.resumeQueued = job.downloader != nullptr;
+    pending[job.priority].push_back(id);
+    schedule();
+}
+
+void DownloadQueue::setMaxActive(int count) {
+    maxActiveJobs = std::max(1, count);
+    schedule();
+}
+
+void DownloadQueue::setMaxPerHost(int count) {
+    maxPerHostJobs = std::max(1, count);
+    schedule();
+}
+
+void DownloadQueue::setConnectionsPerJob(int count) {
+    connectionsPerJob = std::max(0, count);
+}
+
+void DownloadQueue::setGlobalRateLimit(qint64 bytesPerSecond) {
+    BandwidthShaper::instance().setGlobalLimit(bytesPerSecond);
+}
+
+void DownloadQueue::setRateLimit(int id, qint64 bytesPerSecond) {
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return;
+    it->second.rateLimit = std::max<qint64>(0, bytesPerSecond);
+    if (it->second.downloader) {
+        it->second.downloader->setRateLimit(it->second.rateLimit);
+    }
+}
+
+const DownloadQueue::Job* DownloadQueue::job(int id) const {
+    auto it = jobs.find(id);
+    return it != jobs.end() ? &it->second : nullptr;
+}
+
+bool DownloadQueue::isPaused(int id) const {
+    const Job* found = job(id);
+    return found && found->state == Paused;
+}
+
+std::shared_ptr<const TransferStats> DownloadQueue::stats(int id) const {
+    const Job* found = job(id);
+    return found ? found->stats : nullptr;
+}
+
+int DownloadQueue::queuedCount() const {
+    int count = 0;
+    for (const std::deque<int>& queue : pending) {
+        count += static_cast<int>(queue.size());
+    }
+    return count;
+}
+
+void DownloadQueue::schedule() {
+    // Walk the classes from high to low priority; within a class skip jobs whose
+    // host is saturated so they do not block jobs for other origins
+    for (std::deque<int>& queue : pending) {
+        for (auto it = queue.begin(); it != queue.end() && activeJobs < maxActiveJobs;) {
+            Job& job = jobs.at(*it);
+            if (activePerHost[job.host] >= maxPerHostJobs) {
+                ++it;
+                continue;
+            }
+            it = queue.erase(it);
+            startJob(job);
+        }
+        if (activeJobs >= maxActiveJobs) return;
+    }
+}
+
+void DownloadQueue::startJob(Job& job) {
+    int id = job.id;
+    job.state = Active;
+    ++activeJobs;
+    ++activePerHost[job.host];
+
+    if (job.resumeQueued && job.downloader) {
+        job.resumeQueued = false;
+        job.downloader->resumeDownload();
+        emit jobStarted(id);
+        return;
+    }
+
+    // Progress is sampled from the stats block, no per-update events cross threads
+    Downloader* downloader = new Downloader(job.url, job.outputPath, nullptr);
+    job.downloader = downloader;
+    job.stats = downloader->stats();
+    downloader->setLogContext(static_cast<uint64_t>(id));
+    downloader->setWeight(kPriorityWeights[job.priority]);
+    downloader->setRateLimit(job.rateLimit);
+    if (connectionsPerJob > 0) {
+        downloader->setConnectionCount(connectionsPerJob);
+    }
+    downloader->setHashAlgorithm(hashAlgorithm);
+    if (!job.expectedDigest.empty() && !downloader->setExpectedDigest(job.expectedDigest)) {
+        LOG_WARN(id) << "Ignoring malformed digest " << job.expectedDigest << " of job " << id;
+    }
+    if (!job.pieces.empty()) {
+        downloader->setExpectedBlockDigests(job.pieceAlgorithm, job.pieceLength, job.pieces);
+    }
+    downloader->setMirrors(job.mirrors);
+    downloader->setSkipProbe(skipProbe);
+    downloader->setUseCache(useCache);
+    downloader->setDecompress(decompress);
+    downloader->setCompressedTransfer(compressedTransfer);
+    if (!deltaDirectory.empty()) {
+        QString old = QDir(QString::fromStdString(deltaDirectory))
+                          .filePath(QFileInfo(QString::fromStdString(job.outputPath)).fileName());
+        if (QFileInfo::exists(old)) {
+            downloader->setDeltaSource(old.toStdString());
+        }
+    }
+
+    // The Downloader emits from the engine thread, so these connections are queued into this thread.
+    connect(downloader, &Downloader::downloadFinished, this,
+            [this, id](bool success) { onJobFinished(id, success); }, Qt::QueuedConnection);
+    connect(downloader, &Downloader::downloadPaused, this,
+            [this, id]() { onJobPaused(id); }, Qt::QueuedConnection);
+    connect(downloader, &Downloader::downloadResumed, this,
+            [this, id]() { emit jobResumed(id); }, Qt::QueuedConnection);
+    connect(downloader, &Downloader::totalSizeKnown, this,
+            [this, id](qint64 size) { emit jobSizeKnown(id, size); }, Qt::QueuedConnection);
+
+    emit jobStarted(id);
+    downloader->startDownload();
+}
+
+void DownloadQueue::releaseSlot(Job& job) {
+    --activeJobs;
+    if (--activePerHost[job.host] <= 0) {
+        activePerHost.erase(job.host);
+    }
+}
+
+void DownloadQueue::onJobFinished(int id, bool success) {
+    auto it = jobs.find(id);
+    if (it == jobs.end() || !it->second.downloader) return;
+    Job& job = it->second;
+
+    // A paused download can still complete with the bytes that were in flight; its
+    // slot was released when it paused
+    if (job.state == Active) {
+        releaseSlot(job);
+    } else if (job.state == Queued) {
+        std::deque<int>& queue = pending[job.priority];
+        queue.erase(std::remove(queue.begin(), queue.end(), id), queue.end());
+    } else if (job.state != Paused) {
+        return;
+    }
+    job.state = success ? Finished : Failed;
+    job.digest = job.downloader->digest();
+    // The downloader is done, free it; a failed job can be enqueued again
+    job.downloader->deleteLater();
+    job.downloader = nullptr;
+
+    emit jobFinished(id, success);
+    schedule(); // Hand the freed slot to the next job right away
+}
+
+void DownloadQueue::onJobPaused(int id) {
+    auto it = jobs.find(id);
+    if (it == jobs.end() || it->second.state != Active) return;
+    Job& job = it->second;
+
+    job.state = Paused;
+    releaseSlot(job);
+    emit jobPaused(id);
+    schedule();
+}
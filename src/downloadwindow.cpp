@@ -1,23 +1,29 @@
 #include "downloadwindow.h" // Includes the header file for this class (DownloadWindow). This declares the class structure.
 #include "ui_downloadwindow.h" // Includes the header file generated by Qt's UI compiler (uic) from the .ui file. It defines the `Ui::DownloadWindow` class which sets up the graphical elements.
-#include "downloader.h" // Includes the header file for the Downloader class, which handles the actual file downloading logic.
+#include "downloadqueue.h" // Includes the header file for the DownloadQueue class, which schedules the downloads.
+#include "downloadlistmodel.h" // Table model of all jobs, shown in the download list.
+#include "tracer.h" // Timeline of the downloads, recorded when tracing is on.
+#include "logger.h" // Debug messages go through the downloads' logger.
 #include <QMessageBox> // Includes the Qt class for displaying standard message boxes (like warnings or information).
 #include <QFileDialog> // Includes the Qt class for showing standard file dialogs (like "Save As...").
-#include <QThread> // Includes the Qt class for managing threads.
 #include <QTimer> // Includes the Qt class for creating timers that fire signals at regular intervals.
-#include <iostream> // Includes the standard C++ library for input/output streams (used here for debug messages with std::cout/cerr).
+#include <QHeaderView> // Column and row headers of the download list.
 #include <QLocale> // Include for formatting size
+#include <algorithm> // For std::max.
 
 // Constructor for the DownloadWindow class.
 DownloadWindow::DownloadWindow(QWidget *parent) // Takes an optional parent widget, standard for Qt widgets.
     : QDialog(parent) // Initializes the base class (QDialog), making this a dialog window.
     , ui(new Ui::DownloadWindow) // Creates an instance of the UI class generated from the .ui file.
-    , downloadThread(nullptr) // Initializes the pointer to the download thread to null.
-    , downloader(nullptr) // Initializes the pointer to the Downloader object to null.
+    , queue(new DownloadQueue(this)) // Creates the download queue, owned by this window.
+    , listModel(new DownloadListModel(queue, this)) // Creates the model of the download list, owned by this window.
+    , currentJobId(0) // No job is shown yet.
     , isDownloading(false) // Initializes the flag indicating if a download is active to false.
 {
     ui->setupUi(this); // Sets up the user interface defined in the .ui file onto this dialog window.
     setWindowTitle("Download Manager"); // Sets the title displayed in the window's title bar.
+    // Downloading an unchanged URL again links the stored copy instead of fetching it.
+    queue->setUseCache(true);
 
     // Connect buttons signals to slots (methods) in this class.
     // When downloadButton is clicked, call the onDownloadClicked method.
@@ -25,6 +31,18 @@ DownloadWindow::DownloadWindow(QWidget *parent) // Takes an optional parent widg
     // When pauseResumeButton is clicked, call the onPauseResumeClicked method.
     connect(ui->pauseResumeButton, &QPushButton::clicked, this, &DownloadWindow::onPauseResumeClicked);
     
+    // Show every job in the download list; selecting a row shows it in the widgets above.
+    QTableView *table = ui->downloadTable;
+    table->setModel(listModel);
+    table->setItemDelegateForColumn(DownloadListModel::ProgressColumn, new DownloadProgressDelegate(table));
+    table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    table->setSelectionMode(QAbstractItemView::SingleSelection);
+    table->verticalHeader()->hide();
+    // Fixed row heights let the view lay out 10,000+ rows without measuring each of them.
+    table->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    table->horizontalHeader()->setSectionResizeMode(DownloadListModel::NameColumn, QHeaderView::Stretch);
+    connect(table->selectionModel(), &QItemSelectionModel::currentRowChanged, this, &DownloadWindow::onCurrentRowChanged);
+
     // Initially disable the pause/resume button because no download is active.
     ui->pauseResumeButton->setEnabled(false);
     // Set the initial text of the pause/resume button.
@@ -36,62 +54,84 @@ DownloadWindow::DownloadWindow(QWidget *parent) // Takes an optional parent widg
     connect(progressTimer, &QTimer::timeout, this, &DownloadWindow::updateUI);
     // Start the timer to emit the timeout signal every 100 milliseconds.
     progressTimer->start(100);
+
+    // Forward the queue's events of the job shown in this window to the existing slots.
+    // Progress and speed are not events; updateUI samples them from the job's stats.
+    connect(queue, &DownloadQueue::jobFinished, this, [this](int id, bool success) {
+        if (id == currentJobId) onDownloadComplete(success);
+    });
+    connect(queue, &DownloadQueue::jobPaused, this, [this](int id) {
+        if (id == currentJobId) onDownloadPaused();
+    });
+    connect(queue, &DownloadQueue::jobResumed, this, [this](int id) {
+        if (id == currentJobId) onDownloadResumed();
+    });
+    connect(queue, &DownloadQueue::jobSizeKnown, this, [this](int id, qint64 size) {
+        if (id == currentJobId) onTotalSizeKnown(size);
+    });
 }
 
 // Destructor for the DownloadWindow class.
 DownloadWindow::~DownloadWindow()
 {
-    // Clean up the download thread if it exists and is running.
-    if (downloadThread && downloadThread->isRunning()) {
-        if (downloader) {
-            QMetaObject::invokeMethod(downloader, "pauseDownload", Qt::BlockingQueuedConnection); // Blocking call to ensure pause happens.
-        }
-        downloadThread->quit(); // Politely asks the thread's event loop to exit.
-        if (!downloadThread->wait(3000)) { // Waits up to 3000 milliseconds (3 seconds) for the thread to finish cleanly.
-            // If the thread doesn't finish within the timeout...
-            std::cerr << "Warning: Download thread did not finish gracefully. Terminating." << std::endl; // Print a warning.
-            downloadThread->terminate(); // Forcefully terminates the thread (use with caution, can cause resource leaks).
-            downloadThread->wait(); // Wait again after termination to ensure OS cleans up thread resources.
-        }
-    }
+    // The queue is a child of this window; deleting it stops its transfers on the transfer engine.
     delete ui; // Deletes the UI object created in the constructor, standard Qt cleanup.
 }
 
 // Slot to update the UI based on the downloader's state. Called by the QTimer.
 void DownloadWindow::updateUI()
 {
-    // Do nothing if no download is active or the downloader object doesn't exist.
-    if (!isDownloading || !downloader) return;
-
-    // Update the pause/resume button based on whether the downloader is currently paused.
-    if (downloader->isPaused()) {
-        ui->pauseResumeButton->setText("Resume"); // Set text to "Resume" if paused.
-        ui->pauseResumeButton->setEnabled(true); // Ensure button is enabled.
-    } else {
-        ui->pauseResumeButton->setText("Pause"); // Set text to "Pause" if running.
-        ui->pauseResumeButton->setEnabled(true); // Ensure button is enabled.
-    }
+    int64_t traceStartUs = Tracer::enabled() ? Tracer::now() : 0; // Time the refresh for the trace, if one is recorded.
+
+    // Refresh the rows of the download list that are on screen; rows scrolled out of view
+    // are not sampled, so the cost does not grow with the number of downloads.
+    QTableView *table = ui->downloadTable;
+    int lastRow = table->rowAt(table->viewport()->height() - 1);
+    listModel->setVisibleRows(table->rowAt(0), lastRow < 0 ? listModel->rowCount() - 1 : lastRow);
+    listModel->refresh();
+
+    // The widgets above the list only follow a selected, unfinished download.
+    if (isDownloading && currentJobId != 0) {
+        // Update the pause/resume button based on whether the current job is paused.
+        if (queue->isPaused(currentJobId)) {
+            ui->pauseResumeButton->setText("Resume"); // Set text to "Resume" if paused.
+            ui->pauseResumeButton->setEnabled(true); // Ensure button is enabled.
+        } else {
+            ui->pauseResumeButton->setText("Pause"); // Set text to "Pause" if running.
+            ui->pauseResumeButton->setEnabled(true); // Ensure button is enabled.
+        }
 
-    // Process any pending events in the Qt event loop to keep the UI responsive.
-    // Note: Frequent calls can sometimes impact performance; the timer helps regulate this.
-    QCoreApplication::processEvents();
+        // Sample the live counters of the job; the transfer thread never posts events for them.
+        std::shared_ptr<const TransferStats> stats = queue->stats(currentJobId);
+        if (stats) {
+            int percent = stats->percent();
+            if (percent >= 0) ui->progressBar->setValue(percent);
+            if (!queue->isPaused(currentJobId)) {
+                onDownloadSpeedUpdated(static_cast<qint64>(stats->bytesPerSecond.load(std::memory_order_relaxed)));
+            }
+        }
+    }
+    if (traceStartUs != 0) { // A slow UI thread shows up as long refresh spans next to the downloads.
+        Tracer& tracer = Tracer::instance();
+        tracer.complete(0, tracer.threadTrack("UI thread"), "ui", "refresh", traceStartUs, Tracer::now());
+    }
 }
 
 // Helper function to centralize updating the enabled/disabled state and text of buttons.
 void DownloadWindow::updateButtonStates() {
-    if (isDownloading) { // If a download is currently active...
-        ui->downloadButton->setEnabled(false); // Disable the main download button.
-        // Enable the pause/resume button only if the downloader object actually exists.
-        ui->pauseResumeButton->setEnabled(downloader != nullptr);
-
-        // Check the actual paused state of the downloader to set the button text correctly.
-        if (downloader && downloader->isPaused()) {
+    // More downloads can always be added to the queue.
+    ui->downloadButton->setEnabled(true);
+    if (isDownloading) { // If the shown download is queued, running or paused...
+        // Enable the pause/resume button only if there is a job to control.
+        ui->pauseResumeButton->setEnabled(currentJobId != 0);
+
+        // Check the actual paused state of the job to set the button text correctly.
+        if (queue->isPaused(currentJobId)) {
             ui->pauseResumeButton->setText("Resume");
         } else {
             ui->pauseResumeButton->setText("Pause");
         }
     } else { // If no download is active...
-        ui->downloadButton->setEnabled(true); // Enable the main download button.
         ui->pauseResumeButton->setEnabled(false); // Disable the pause/resume button.
         ui->pauseResumeButton->setText("Pause"); // Reset the text to "Pause".
     }
@@ -158,115 +198,38 @@ void DownloadWindow::onDownloadClicked() {
     ui->sizeLabel->setText("Size: Determining..."); // Initial text
     ui->speedLabel->setText("Speed: 0 B/s"); // Reset speed label
 
-    // --- Cleanup existing thread and downloader first ---
-    // Check if a download thread already exists from a previous download.
-    if (downloadThread) {
-        if (downloadThread->isRunning()) { // Check if the previous thread is still running.
-            std::cout << "Cleaning up previous download thread..." << std::endl;
-
-            // Pause the download if it's currently running.
-            if (downloader) {
-                QMetaObject::invokeMethod(downloader, "pauseDownload", Qt::BlockingQueuedConnection);
-            }
-            downloadThread->quit(); // Ask the previous thread to stop its event loop.
-            if (!downloadThread->wait(1000)) { // Wait briefly (1 second) for it to finish.
-                 std::cerr << "Warning: Previous download thread did not finish gracefully during cleanup." << std::endl;
-                 // Avoid terminating here if possible; let deleteLater handle it eventually.
-            }
-            // The finished signal connected later should trigger deleteLater for the old objects.
-        } else {
-        }
-        // Clear the pointers immediately after initiating cleanup to avoid using stale objects.
-        // Note: The actual deletion happens later via deleteLater.
-        downloader = nullptr;
-        downloadThread = nullptr;
-    }
-    // --- End cleanup ---
-
-    // Create a lambda function to capture the 'this' pointer and update the progress bar.
-    // This lambda will be passed to the Downloader object.
-    auto updateProgress = [this](int percent) {
-        // Use QMetaObject::invokeMethod to safely call the UI update code from the main GUI thread.
-        // This is crucial because the lambda will be called from the download thread.
-        QMetaObject::invokeMethod(this, [this, percent]() {
-            // Check if the UI elements still exist (window might be closing).
-            if (ui && ui->progressBar) {
-                ui->progressBar->setValue(percent); // Update the progress bar value.
-            }
-            // Avoid explicit QCoreApplication::processEvents() here; rely on the main event loop and the timer.
-        }, Qt::QueuedConnection); // QueuedConnection ensures the lambda runs in the receiver's (this window's) thread event loop.
-    };
-
-    // Create a new QThread object, setting this window as the parent for memory management.
-    downloadThread = new QThread(this);
-    // Create a new Downloader object, passing the URL, output path, and the progress update lambda.
-    downloader = new Downloader(url.toStdString(), output.toStdString(), updateProgress);
-    // Move the Downloader object to the newly created thread. All its slots will now execute in that thread.
-    downloader->moveToThread(downloadThread);
-
-    // --- Connections for the new thread and downloader ---
-    // When the thread starts, call the Downloader's startDownload method.
-    // --- Connect signals and slots ---
-    // Existing connections
-    connect(downloadThread, &QThread::started, downloader, &Downloader::startDownload);
-    connect(downloader, &Downloader::downloadFinished, this, &DownloadWindow::onDownloadComplete);
-    connect(downloader, &Downloader::downloadPaused, this, &DownloadWindow::onDownloadPaused);
-    connect(downloader, &Downloader::downloadResumed, this, &DownloadWindow::onDownloadResumed);
-    connect(downloader, &Downloader::totalSizeKnown, this, &DownloadWindow::onTotalSizeKnown);
-    
-    // Add this new connection
-    connect(downloader, &Downloader::downloadSpeedUpdated, this, &DownloadWindow::onDownloadSpeedUpdated);
-    
-    // When the thread finishes (after quit() is called and the event loop stops), schedule the Downloader object for deletion.
-    connect(downloadThread, &QThread::finished, downloader, &QObject::deleteLater);
-
-    // When the thread finishes, schedule the QThread object itself for deletion.
-    connect(downloadThread, &QThread::finished, downloadThread, &QObject::deleteLater);
-
-    // Connect signals emitted by the Downloader (from the worker thread) to slots in this window (GUI thread).
-    // Use QueuedConnection to ensure the slots are executed safely in the GUI thread's event loop.
-    // When download finishes (successfully or not), call onDownloadComplete.
-    connect(downloader, &Downloader::downloadFinished, this, &DownloadWindow::onDownloadComplete, Qt::QueuedConnection);
-    // When download is paused, call onDownloadPaused.
-    connect(downloader, &Downloader::downloadPaused, this, &DownloadWindow::onDownloadPaused, Qt::QueuedConnection);
-    // When download is resumed, call onDownloadResumed.
-    connect(downloader, &Downloader::downloadResumed, this, &DownloadWindow::onDownloadResumed, Qt::QueuedConnection);
-
-    // *** New Connection ***
-    connect(downloader, &Downloader::totalSizeKnown, this, &DownloadWindow::onTotalSizeKnown);
-
-
-    // --- Start Download ---
+    // --- Queue Download ---
+    // The queue starts the job as soon as a slot is free; earlier downloads keep running.
+    DownloadQueue::Priority priority =
+        static_cast<DownloadQueue::Priority>(ui->priorityComboBox->currentIndex());
+    currentJobId = queue->enqueue(url.toStdString(), output.toStdString(), priority);
     isDownloading = true; // Set the flag indicating a download is active.
-    updateButtonStates(); // Update the button states (disable download, enable pause).
-    downloadThread->start(); // Start the event loop of the download thread, which triggers the download via the 'started' signal.
+    listModel->addJob(currentJobId); // Add its row to the download list...
+    ui->downloadTable->selectRow(listModel->rowOf(currentJobId)); // ...and select it as the shown job.
+    updateButtonStates(); // Update the button states (enable pause).
 }
 
 // Slot called when the Pause/Resume button is clicked.
 void DownloadWindow::onPauseResumeClicked() {
-    std::cout << "Pause/Resume button clicked" << std::endl; // Debug output.
-    // Do nothing if the downloader object doesn't exist.
-    if (!downloader) return;
+    LOG_DEBUG(currentJobId) << "Pause/Resume button clicked";
+    // Do nothing if there is no job to control.
+    if (currentJobId == 0) return;
 
     // Optional: Could temporarily disable the button here, but updateButtonStates/updateUI should handle it.
     // ui->pauseResumeButton->setEnabled(false);
 
-    if (downloader->isPaused()) { // If the download is currently paused...
-        std::cout << "Calling resumeDownload via invokeMethod" << std::endl; // Debug output.
-        // Call the resumeDownload method on the downloader object.
-        // Use invokeMethod with QueuedConnection because resumeDownload might interact with network operations
-        // or start the download loop again within the downloader's thread.
-        QMetaObject::invokeMethod(downloader, "resumeDownload", Qt::QueuedConnection);
+    if (queue->isPaused(currentJobId)) { // If the download is currently paused...
+        LOG_DEBUG(currentJobId) << "Resuming job " << currentJobId;
+        // Put the job back in the queue; it continues as soon as a slot is free.
+        queue->resume(currentJobId);
 
         // Optimistic UI update (commented out): Let updateUI or onDownloadResumed handle the final state.
         // ui->pauseResumeButton->setText("Pause");
         // ui->pauseResumeButton->setEnabled(true);
     } else { // If the download is currently running...
-        std::cout << "Calling requestPause directly" << std::endl; // Debug output.
-        // Call the requestPause method on the downloader object.
-        // This method likely sets an atomic flag quickly, so it can be called directly
-        // (though calling via invokeMethod would also be safe).
-        downloader->requestPause();
+        LOG_DEBUG(currentJobId) << "Pausing job " << currentJobId;
+        // Pause the job; its slot goes to the next queued download.
+        queue->pause(currentJobId);
 
         // Optimistic UI update (commented out): Let updateUI or onDownloadPaused handle the final state.
         // ui->pauseResumeButton->setText("Resume");
@@ -289,8 +252,8 @@ void DownloadWindow::onDownloadComplete(bool success) {
     processingCompletion = true;
     
     // Check if this is a pause rather than a real completion/failure
-    if (downloader && downloader->isPaused()) {
-        std::cout << "onDownloadComplete: Ignoring 'false' success because download is paused." << std::endl;
+    if (queue->isPaused(currentJobId)) {
+        LOG_DEBUG(currentJobId) << "onDownloadComplete: Ignoring 'false' success because download is paused.";
         processingCompletion = false;
         return;
     }
@@ -300,15 +263,16 @@ void DownloadWindow::onDownloadComplete(bool success) {
     updateButtonStates();
 
     // Reset size label only on real completion/failure, not pause
-    if (!downloader || !downloader->isPaused()) {
+    if (!queue->isPaused(currentJobId)) {
          ui->sizeLabel->setText("Size: N/A");
          ui->speedLabel->setText("Speed: 0 B/s");
     }
 
     if (success) {
+        ui->progressBar->setValue(100); // The last sample may predate the final bytes
         QMessageBox::information(this, "Download Complete",
                                  "The file has been downloaded successfully.");
-    } else if (!downloader || !downloader->isPaused()) { // Only show failure if not paused
+    } else if (!queue->isPaused(currentJobId)) { // Only show failure if not paused
         QMessageBox::critical(this, "Download Failed",
                               "There was an error downloading the file.");
     }
@@ -329,7 +293,7 @@ void DownloadWindow::onDownloadPaused() {
     
     // Use invokeMethod to ensure UI updates run in the main GUI thread.
     QMetaObject::invokeMethod(this, [this]() {
-        std::cout << "Download paused, updating UI" << std::endl; // Debug output.
+        LOG_DEBUG(currentJobId) << "Download paused, updating UI";
         // Optional: Show a message box indicating pause (commented out).
         // QMessageBox::information(this, "Download Paused",
         //                       "The download has been paused. Click Resume to continue.");
@@ -337,9 +301,7 @@ void DownloadWindow::onDownloadPaused() {
         // Update the pause/resume button text and state.
         ui->pauseResumeButton->setText("Resume");
         ui->pauseResumeButton->setEnabled(true);
-
-        // Process events to ensure the UI updates immediately.
-        QCoreApplication::processEvents();
+        ui->speedLabel->setText("Speed: 0 B/s");
     }, Qt::QueuedConnection); // Ensure execution in the GUI thread.
     
     processingPause = false;
@@ -358,7 +320,7 @@ void DownloadWindow::onDownloadResumed() {
     
     // Use invokeMethod to ensure UI updates run in the main GUI thread.
     QMetaObject::invokeMethod(this, [this]() {
-        std::cout << "Download resumed, updating UI" << std::endl;
+        LOG_DEBUG(currentJobId) << "Download resumed, updating UI";
         // Update the pause/resume button to show "Pause" again
         ui->pauseResumeButton->setText("Pause");
         ui->pauseResumeButton->setEnabled(true);
@@ -384,15 +346,33 @@ void DownloadWindow::onTotalSizeKnown(qint64 size) {
     }, Qt::QueuedConnection);
 }
 
+// Shows the sampled throughput; called from updateUI in the GUI thread.
 void DownloadWindow::onDownloadSpeedUpdated(qint64 bytesPerSecond) {
-    QMetaObject::invokeMethod(this, [this, bytesPerSecond]() {
-        QString speedStr;
-        if (bytesPerSecond < 1024)
-            speedStr = QString("%1 B/s").arg(bytesPerSecond);
-        else if (bytesPerSecond < 1024 * 1024)
-            speedStr = QString::number(bytesPerSecond / 1024.0, 'f', 2) + " KB/s";
-        else
-            speedStr = QString::number(bytesPerSecond / 1024.0 / 1024.0, 'f', 2) + " MB/s";
-        ui->speedLabel->setText("Speed: " + speedStr);
-    }, Qt::QueuedConnection);
-}
\ No newline at end of file
+    QString speedStr;
+    if (bytesPerSecond < 1024)
+        speedStr = QString("%1 B/s").arg(bytesPerSecond);
+    else if (bytesPerSecond < 1024 * 1024)
+        speedStr = QString::number(bytesPerSecond / 1024.0, 'f', 2) + " KB/s";
+    else
+        speedStr = QString::number(bytesPerSecond / 1024.0 / 1024.0, 'f', 2) + " MB/s";
+    ui->speedLabel->setText("Speed: " + speedStr);
+}
+
+// Slot called when another row of the download list is selected: the widgets above the list follow that job.
+void DownloadWindow::onCurrentRowChanged(const QModelIndex &current) {
+    int id = listModel->jobAt(current.row());
+    if (id == 0 || id == currentJobId) return; // Nothing new to show.
+    currentJobId = id;
+    const DownloadQueue::Job *job = queue->job(id);
+    // Only queued, running or paused jobs can be paused or resumed.
+    isDownloading = job && job->state != DownloadQueue::Finished && job->state != DownloadQueue::Failed;
+
+    // Show what is known of the job right away; the timer keeps progress and speed current.
+    std::shared_ptr<const TransferStats> stats = queue->stats(id);
+    int percent = stats ? stats->percent() : -1;
+    if (job && job->state == DownloadQueue::Finished) percent = 100;
+    ui->progressBar->setValue(std::max(0, percent));
+    onTotalSizeKnown(stats ? stats->totalBytes.load(std::memory_order_relaxed) : -1);
+    ui->speedLabel->setText("Speed: 0 B/s");
+    updateButtonStates();
+}
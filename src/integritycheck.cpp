@@ -0,0 +1,299 @@
+#include "integritycheck.h"
+#include "logger.h"
+#include <QFile>
+#include <QString>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+// Most a single catch-up task reads, so one never holds up the write stage for long
+static const int64_t kCatchUpLimit = 64 * 1024 * 1024;
+// Read size of a catch-up
+static const int64_t kCatchUpChunk = 1024 * 1024;
+
+void IntegrityCheck::CatchUp::run(const std::string& path) {
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(begin)) {
+        finished.store(true);
+        return;
+    }
+    size_t nextBlock = 0; // Index into blocks
+    StreamHash blockState;
+    int64_t offset = begin;
+    while (offset < end) {
+        QByteArray chunk = file.read(std::min(kCatchUpChunk, end - offset));
+        if (chunk.isEmpty()) {
+            finished.store(true);
+            return;
+        }
+        const char* data = chunk.constData();
+        int64_t length = chunk.size();
+        if (advancesFrontier) {
+            frontier.update(data, static_cast<size_t>(length));
+        }
+        // Block digests for the wanted blocks this chunk touches
+        while (length > 0 && nextBlock < blocks.size()) {
+            int64_t blockStart = static_cast<int64_t>(blocks[nextBlock]) * blockSize;
+            int64_t blockLast = std::min(blockStart + blockSize, end);
+            if (offset + length <= blockStart) {
+                break;
+            }
+            if (offset < blockStart) {
+                data += blockStart - offset;
+                length -= blockStart - offset;
+                offset = blockStart;
+            }
+            if (offset == blockStart) {
+                blockState = StreamHash(algorithm);
+            }
+            int64_t take = std::min(length, blockLast - offset);
+            blockState.update(data, static_cast<size_t>(take));
+            data += take;
+            length -= take;
+            offset += take;
+            if (offset == blockLast) {
+                blockDigests.push_back({blocks[nextBlock], blockState.hexDigest()});
+                ++nextBlock;
+            }
+        }
+        offset += length;
+    }
+    ok = true;
+    finished.store(true);
+}
+
+void IntegrityCheck::reset(HashAlgorithm algorithm, int64_t size, int64_t blockSize) {
+    algo = algorithm;
+    fileSize = size > 0 ? size : -1;
+    blockBytes = std::max<int64_t>(1, blockSize);
+    blockDigests.assign(fileSize > 0 ? static_cast<size_t>((fileSize + blockBytes - 1) / blockBytes) : 0,
+                        std::string());
+    frontier = StreamHash(algorithm);
+    frontierOffset = 0;
+    frontierBusy = false;
+    badBlock = -1;
+    ++generation;
+}
+
+void IntegrityCheck::setSize(int64_t size) {
+    fileSize = size;
+    blockDigests.resize(static_cast<size_t>((size + blockBytes - 1) / blockBytes));
+}
+
+int64_t IntegrityCheck::blockEnd(size_t block) const {
+    int64_t end = static_cast<int64_t>(block + 1) * blockBytes;
+    return fileSize > 0 ? std::min(end, fileSize) : end;
+}
+
+bool IntegrityCheck::update(StreamHash& blockState, int64_t offset, const char* data, size_t length) {
+    // In-order algorithms take the bytes at the frontier straight away
+    if (sequential() && !frontierBusy && offset <= frontierOffset &&
+        frontierOffset < offset + static_cast<int64_t>(length)) {
+        size_t skip = static_cast<size_t>(frontierOffset - offset);
+        frontier.update(data + skip, length - skip);
+        frontierOffset = offset + static_cast<int64_t>(length);
+    }
+
+    bool ok = true;
+    while (length > 0) {
+        size_t block = static_cast<size_t>(offset / blockBytes);
+        int64_t blockStart = static_cast<int64_t>(block) * blockBytes;
+        int64_t end = blockEnd(block);
+        size_t take = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(length), end - offset));
+        if (offset == blockStart) {
+            blockState = StreamHash(algo);
+        }
+        // A transfer that started inside the block has no state for its beginning; the
+        // block is left to a catch-up
+        bool tracking = blockState.algorithm() == algo &&
+                        static_cast<int64_t>(blockState.length()) == offset - blockStart;
+        if (tracking) {
+            blockState.update(data, take);
+            if (offset + static_cast<int64_t>(take) == end) {
+                ok = completeBlock(block, blockState.hexDigest()) && ok;
+            }
+        } else {
+            blockState = StreamHash();
+        }
+        data += take;
+        offset += static_cast<int64_t>(take);
+        length -= take;
+    }
+    return ok;
+}
+
+bool IntegrityCheck::finishBlock(StreamHash& blockState, int64_t end) {
+    if (blockState.length() == 0 || blockState.algorithm() != algo) {
+        return true;
+    }
+    int64_t start = end - static_cast<int64_t>(blockState.length());
+    if (start % blockBytes != 0) {
+        return true;
+    }
+    size_t block = static_cast<size_t>(start / blockBytes);
+    if (block >= blockDigests.size()) {
+        blockDigests.resize(block + 1);
+    }
+    bool ok = completeBlock(block, blockState.hexDigest());
+    blockState = StreamHash();
+    return ok;
+}
+
+bool IntegrityCheck::completeBlock(size_t block, const std::string& digest) {
+    if (block >= blockDigests.size()) {
+        blockDigests.resize(block + 1); // Size unknown, the list grows with the stream
+    }
+    blockDigests[block] = digest;
+    if (block < expectedBlocks.size() && !expectedBlocks[block].empty() && expectedBlocks[block] != digest) {
+        LOG_WARN(0) << "Block " << block << " failed " << hashAlgorithmName(algo) << " verification: got "
+                    << digest << ", expected " << expectedBlocks[block];
+        badBlock = static_cast<int64_t>(block);
+        return false;
+    }
+    return true;
+}
+
+bool IntegrityCheck::planCatchUp(const std::vector<std::pair<int64_t, int64_t>>& stored, CatchUp& work) {
+    if (!enabled() || frontierBusy) {
+        return false;
+    }
+    work.algorithm = algo;
+    work.blockSize = blockBytes;
+    work.generation = generation;
+    work.blocks.clear();
+    work.advancesFrontier = false;
+    work.blockDigests.clear();
+    work.ok = false;
+    work.finished.store(false);
+
+    // Sequential hashes: the stored bytes from the frontier on that it has not seen yet
+    if (sequential()) {
+        for (const auto& range : stored) {
+            if (range.first <= frontierOffset && frontierOffset < range.second) {
+                work.begin = frontierOffset;
+                work.end = std::min(range.second, frontierOffset + kCatchUpLimit);
+                work.advancesFrontier = true;
+                work.frontier = frontier;
+                break;
+            }
+        }
+    }
+
+    // Blocks that are fully on disk but were not hashed in stream (their transfer
+    // started inside them, or the journal had no digest for them)
+    auto storedBlock = [&stored, this](size_t block) {
+        int64_t begin = static_cast<int64_t>(block) * blockBytes;
+        int64_t end = blockEnd(block);
+        for (const auto& range : stored) {
+            if (range.first <= begin && end <= range.second) return true;
+        }
+        return false;
+    };
+    if (work.advancesFrontier) {
+        // Fill in the ones inside the frontier range on the same read
+        for (size_t block = static_cast<size_t>(work.begin / blockBytes); block < blockDigests.size(); ++block) {
+            int64_t begin = static_cast<int64_t>(block) * blockBytes;
+            if (begin >= work.end) break;
+            if (blockDigests[block].empty() && begin >= work.begin && blockEnd(block) <= work.end) {
+                work.blocks.push_back(block);
+            }
+        }
+        frontierBusy = true;
+        return true;
+    }
+    for (size_t block = 0; block < blockDigests.size(); ++block) {
+        if (!blockDigests[block].empty() || !storedBlock(block)) {
+            continue;
+        }
+        // A run of such blocks in one read
+        work.begin = static_cast<int64_t>(block) * blockBytes;
+        while (block < blockDigests.size() && blockDigests[block].empty() && storedBlock(block) &&
+               static_cast<int64_t>(work.blocks.size()) * blockBytes < kCatchUpLimit) {
+            work.blocks.push_back(block++);
+        }
+        work.end = blockEnd(work.blocks.back());
+        return true;
+    }
+    return false;
+}
+
+bool IntegrityCheck::applyCatchUp(const CatchUp& work) {
+    if (work.advancesFrontier) {
+        frontierBusy = false;
+    }
+    if (work.generation != generation) {
+        return true; // Read before a block was discarded, possibly the bad bytes
+    }
+    if (work.advancesFrontier && work.ok && work.begin == frontierOffset) {
+        frontier = work.frontier;
+        frontierOffset = work.end;
+    }
+    bool ok = true;
+    for (const auto& result : work.blockDigests) {
+        ok = completeBlock(result.first, result.second) && ok;
+    }
+    return ok;
+}
+
+void IntegrityCheck::discardBlock(size_t block) {
+    if (block < blockDigests.size()) {
+        blockDigests[block].clear();
+    }
+    if (sequential() && frontierOffset > static_cast<int64_t>(block) * blockBytes) {
+        frontier = StreamHash(algo);
+        frontierOffset = 0;
+    }
+    badBlock = -1;
+    ++generation;
+}
+
+std::string IntegrityCheck::fileDigest() const {
+    if (fileSize <= 0) {
+        return std::string();
+    }
+    if (sequential()) {
+        return frontierOffset == fileSize ? frontier.hexDigest() : std::string();
+    }
+    // CRC32C: fold the block CRCs together in file order
+    uint32_t crc = 0;
+    for (size_t block = 0; block < blockDigests.size(); ++block) {
+        if (blockDigests[block].empty()) {
+            return std::string();
+        }
+        uint32_t blockCrc = static_cast<uint32_t>(std::strtoul(blockDigests[block].c_str(), nullptr, 16));
+        int64_t length = blockEnd(block) - static_cast<int64_t>(block) * blockBytes;
+        crc = StreamHash::crc32cCombine(crc, blockCrc, static_cast<uint64_t>(length));
+    }
+    char hex[9];
+    std::snprintf(hex, sizeof(hex), "%08x", crc);
+    return hex;
+}
+
+ResumeJournal::HashState IntegrityCheck::state() const {
+    ResumeJournal::HashState saved;
+    saved.algorithm = hashAlgorithmName(algo);
+    saved.blockSize = blockBytes;
+    saved.blockDigests = blockDigests;
+    if (sequential() && !frontierBusy) {
+        saved.frontierOffset = frontierOffset;
+        saved.frontierState = frontier.save();
+    }
+    return saved;
+}
+
+bool IntegrityCheck::restore(const ResumeJournal::HashState& saved) {
+    if (hashAlgorithmFromName(saved.algorithm) != algo || saved.blockSize != blockBytes ||
+        saved.blockDigests.size() != blockDigests.size()) {
+        return false;
+    }
+    blockDigests = saved.blockDigests;
+    if (sequential()) {
+        StreamHash restored;
+        if (saved.frontierOffset > 0 && restored.restore(saved.frontierState) && restored.algorithm() == algo &&
+            static_cast<int64_t>(restored.length()) == saved.frontierOffset) {
+            frontier = restored;
+            frontierOffset = saved.frontierOffset;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,270 @@
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+// Records per thread ring; a burst beyond this before the sink runs is dropped
+static const size_t kRingRecords = 512;
+// Time between two drains of the rings when nothing asks for one earlier
+static const int kSinkIntervalMs = 20;
+
+static const char kBinaryMagic[8] = {'D', 'M', 'L', 'O', 'G', '1', '\n', '\0'};
+
+std::atomic<int> Logger::threshold{static_cast<int>(LogLevel::Info)};
+std::atomic<bool> Logger::curlTraceEnabled{false};
+
+// Marks the ring of a thread as orphaned when the thread exits; the sink frees it
+// once it has written what is left
+struct LoggerRingHolder {
+    Logger::Ring* ring = nullptr;
+    ~LoggerRingHolder() {
+        if (ring) {
+            ring->orphaned.store(true, std::memory_order_release);
+            ring = nullptr;
+        }
+    }
+};
+static thread_local LoggerRingHolder ringHolder;
+
+const char* logLevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Trace: return "trace";
+    case LogLevel::Debug: return "debug";
+    case LogLevel::Info: return "info";
+    case LogLevel::Warning: return "warning";
+    case LogLevel::Error: return "error";
+    default: return "off";
+    }
+}
+
+bool parseLogLevel(const std::string& name, LogLevel& level) {
+    for (int i = static_cast<int>(LogLevel::Trace); i <= static_cast<int>(LogLevel::Off); ++i) {
+        if (name == logLevelName(static_cast<LogLevel>(i))) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+Logger& Logger::instance() {
+    // Never destroyed: threads and static destructors may still log during exit, the
+    // sink is stopped and drained by an atexit handler instead
+    static Logger* logger = new Logger();
+    return *logger;
+}
+
+Logger::Logger()
+    : nextThread(1),
+      output(stderr),
+      format(Text),
+      stopping(false)
+{
+    thread = std::thread(&Logger::run, this);
+    std::atexit(&Logger::shutdown);
+}
+
+void Logger::setLevel(LogLevel level) {
+    threshold.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+void Logger::setCurlTrace(bool enable) {
+    curlTraceEnabled.store(enable, std::memory_order_relaxed);
+}
+
+bool Logger::openFile(const std::string& path, Format fileFormat) {
+    std::FILE* file = std::fopen(path.c_str(), fileFormat == Binary ? "ab" : "a");
+    if (!file) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    drain(); // What was logged before goes to the old output
+    if (output != stderr) {
+        std::fclose(output);
+    }
+    output = file;
+    format = fileFormat;
+    if (format == Binary && std::ftell(output) == 0) {
+        std::fwrite(kBinaryMagic, 1, sizeof(kBinaryMagic), output);
+    }
+    return true;
+}
+
+Logger::Ring* Logger::ringOfThisThread() {
+    if (!ringHolder.ring) {
+        auto ring = std::make_unique<Ring>();
+        ring->records.resize(kRingRecords);
+        std::lock_guard<std::mutex> lock(ringMutex);
+        ring->thread = nextThread++;
+        ringHolder.ring = ring.get();
+        rings.push_back(std::move(ring));
+    }
+    return ringHolder.ring;
+}
+
+void Logger::submit(LogLevel level, uint64_t context, const char* text, size_t length) {
+    Ring* ring = ringOfThisThread();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == ring->records.size()) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Record& record = ring->records[head % ring->records.size()];
+    record.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    record.context = context;
+    record.level = static_cast<uint8_t>(level);
+    record.length = static_cast<uint16_t>(std::min(length, kMaxMessage));
+    std::memcpy(record.text, text, record.length);
+    ring->head.store(head + 1, std::memory_order_release);
+
+    if (stopping.load(std::memory_order_acquire)) {
+        flush(); // No sink thread any more
+    } else if (level >= LogLevel::Error) {
+        wakeCondition.notify_one();
+    }
+}
+
+void Logger::flush() {
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    drain();
+    std::fflush(output);
+}
+
+void Logger::run() {
+    while (!stopping.load(std::memory_order_acquire)) {
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait_for(lock, std::chrono::milliseconds(kSinkIntervalMs));
+        }
+        flush();
+    }
+}
+
+void Logger::drain() {
+    std::lock_guard<std::mutex> lock(ringMutex);
+    for (size_t i = 0; i < rings.size();) {
+        Ring& ring = *rings[i];
+        // Read before the records: everything its thread logged is visible then
+        bool orphaned = ring.orphaned.load(std::memory_order_acquire);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        for (; tail != head; ++tail) {
+            writeRecord(ring.records[tail % ring.records.size()], ring.thread);
+        }
+        ring.tail.store(tail, std::memory_order_release);
+        uint64_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            Record note;
+            note.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            note.context = 0;
+            note.level = static_cast<uint8_t>(LogLevel::Warning);
+            int length = std::snprintf(note.text, sizeof(note.text), "%llu log messages dropped, the ring was full",
+                                       static_cast<unsigned long long>(dropped));
+            note.length = static_cast<uint16_t>(std::max(0, length));
+            writeRecord(note, ring.thread);
+        }
+        if (orphaned) {
+            rings.erase(rings.begin() + static_cast<std::ptrdiff_t>(i));
+        } else {
+            ++i;
+        }
+    }
+}
+
+void Logger::writeRecord(const Record& record, uint32_t thread) {
+    if (format == Binary) {
+        std::fwrite(&record.timeUs, sizeof(record.timeUs), 1, output);
+        std::fwrite(&record.context, sizeof(record.context), 1, output);
+        std::fwrite(&thread, sizeof(thread), 1, output);
+        std::fwrite(&record.level, sizeof(record.level), 1, output);
+        std::fwrite(&record.length, sizeof(record.length), 1, output);
+        std::fwrite(record.text, 1, record.length, output);
+        return;
+    }
+
+    const char* level = logLevelName(static_cast<LogLevel>(record.level));
+    char prefix[128];
+    if (format == Json) {
+        std::snprintf(prefix, sizeof(prefix), "{\"time_us\":%lld,\"level\":\"%s\",\"context\":%llu,\"thread\":%u,\"message\":\"",
+                      static_cast<long long>(record.timeUs), level,
+                      static_cast<unsigned long long>(record.context), thread);
+        line = prefix;
+        for (size_t i = 0; i < record.length; ++i) {
+            unsigned char c = static_cast<unsigned char>(record.text[i]);
+            if (c == '"' || c == '\\') {
+                line += '\\';
+                line += static_cast<char>(c);
+            } else if (c < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                line += escaped;
+            } else {
+                line += static_cast<char>(c);
+            }
+        }
+        line += "\"}\n";
+    } else {
+        // Only the sink thread formats, under sinkMutex
+        std::time_t seconds = static_cast<std::time_t>(record.timeUs / 1000000);
+        std::tm* local = std::localtime(&seconds);
+        char time[16] = "--:--:--";
+        if (local) {
+            std::strftime(time, sizeof(time), "%H:%M:%S", local);
+        }
+        if (record.context != 0) {
+            std::snprintf(prefix, sizeof(prefix), "%s.%03d %-7s [%llu] ", time,
+                          static_cast<int>(record.timeUs / 1000 % 1000), level,
+                          static_cast<unsigned long long>(record.context));
+        } else {
+            std::snprintf(prefix, sizeof(prefix), "%s.%03d %-7s ", time,
+                          static_cast<int>(record.timeUs / 1000 % 1000), level);
+        }
+        line = prefix;
+        line.append(record.text, record.length);
+        line += '\n';
+    }
+    std::fwrite(line.data(), 1, line.size(), output);
+}
+
+void Logger::shutdown() {
+    Logger& logger = instance();
+    logger.stopping.store(true, std::memory_order_release);
+    logger.wakeCondition.notify_one();
+    if (logger.thread.joinable()) {
+        logger.thread.join();
+    }
+    logger.flush();
+}
+
+LogLine& LogLine::append(const char* data, size_t size) {
+    size_t take = std::min(size, Logger::kMaxMessage - length);
+    std::memcpy(text + length, data, take);
+    length += take;
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const char* value) {
+    return value ? append(value, std::strlen(value)) : append("(null)", 6);
+}
+
+LogLine& LogLine::operator<<(double value) {
+    char buffer[32];
+    int size = std::snprintf(buffer, sizeof(buffer), "%g", value);
+    return append(buffer, static_cast<size_t>(std::max(0, size)));
+}
+
+LogLine& LogLine::appendSigned(long long value) {
+    char buffer[24];
+    int size = std::snprintf(buffer, sizeof(buffer), "%lld", value);
+    return append(buffer, static_cast<size_t>(std::max(0, size)));
+}
+
+LogLine& LogLine::appendUnsigned(unsigned long long value) {
+    char buffer[24];
+    int size = std::snprintf(buffer, sizeof(buffer), "%llu", value);
+    return append(buffer, static_cast<size_t>(std::max(0, size)));
+}
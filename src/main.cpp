@@ -1,5 +1,6 @@
 #include <QApplication>
 #include "downloadwindow.h"
+#include "tracer.h"
 #include <curl/curl.h>
 #include <cstdlib>     // Required for atexit
 #include <iostream>    // For potential error output
@@ -22,8 +23,18 @@ int main(int argc, char *argv[]) {
                    << std::endl;
     }
 
+    // DOWNLOADER_TRACE_FILE records a timeline of the session, written when the window closes
+    const char* tracePath = std::getenv("DOWNLOADER_TRACE_FILE");
+    if (tracePath && *tracePath) {
+        Tracer::instance().start();
+    }
+
     QApplication app(argc, argv);
     DownloadWindow window;
     window.show();
-    return app.exec();
+    int result = app.exec();
+    if (tracePath && *tracePath && !Tracer::instance().writeFile(tracePath)) {
+        std::cerr << "Cannot write " << tracePath << std::endl;
+    }
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include "metadatacache.h"
+#include "logger.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QString>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+// First line of the log; bump the number when the format changes
+static const char* kCacheMagic = "download-metadata-cache 1";
+// Outdated lines the log may carry before it is rewritten on load
+static const size_t kCompactSlack = 256;
+
+// One line per entry: url, etag, last-modified, size, mtime, digest, path
+static std::string formatLine(const std::string& url, const MetadataCache::Entry& entry) {
+    return url + "\t" + entry.etag + "\t" + entry.lastModified + "\t" + std::to_string(entry.size) + "\t" +
+           std::to_string(entry.modifiedMs) + "\t" + entry.digest + "\t" + entry.path + "\n";
+}
+
+static bool parseLine(const std::string& line, std::string& url, MetadataCache::Entry& entry) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (fields.size() < 6) {
+        size_t tab = line.find('\t', start);
+        if (tab == std::string::npos) {
+            return false;
+        }
+        fields.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    url = fields[0];
+    entry.etag = fields[1];
+    entry.lastModified = fields[2];
+    entry.size = std::strtoll(fields[3].c_str(), nullptr, 10);
+    entry.modifiedMs = std::strtoll(fields[4].c_str(), nullptr, 10);
+    entry.digest = fields[5];
+    entry.path = line.substr(start);
+    return !url.empty() && !entry.path.empty() && entry.size >= 0;
+}
+
+// Tabs and line breaks would break the log format
+static bool storable(const std::string& text) {
+    return text.find_first_of("\t\r\n") == std::string::npos;
+}
+
+MetadataCache& MetadataCache::instance() {
+    static MetadataCache cache;
+    return cache;
+}
+
+MetadataCache::MetadataCache()
+    : loaded(false),
+      logLines(0)
+{
+    QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!directory.isEmpty()) {
+        logPath = QDir(directory).filePath("metadata.cache").toStdString();
+    }
+}
+
+void MetadataCache::setPath(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    logPath = path;
+    loaded = false;
+    entries.clear();
+}
+
+void MetadataCache::load() {
+    loaded = true;
+    logLines = 0;
+    QFile file(QString::fromStdString(logPath));
+    if (logPath.empty() || !file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QByteArray contents = file.readAll();
+    std::istringstream in(std::string(contents.constData(), static_cast<size_t>(contents.size())));
+    std::string line;
+    if (!std::getline(in, line) || line != kCacheMagic) {
+        return; // Another format, it is replaced by the next store()
+    }
+    while (std::getline(in, line)) {
+        std::string url;
+        Entry entry;
+        if (parseLine(line, url, entry)) {
+            entries[url] = entry; // Later lines replace earlier ones
+            ++logLines;
+        }
+    }
+    file.close();
+    if (logLines > 2 * entries.size() + kCompactSlack && !compact()) {
+        LOG_WARN(0) << "Could not compact the metadata cache " << logPath;
+    }
+}
+
+bool MetadataCache::compact() {
+    QSaveFile file(QString::fromStdString(logPath));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    std::string text = std::string(kCacheMagic) + "\n";
+    for (const auto& entry : entries) {
+        text += formatLine(entry.first, entry.second);
+    }
+    if (file.write(text.data(), static_cast<qint64>(text.size())) != static_cast<qint64>(text.size()) ||
+        !file.commit()) {
+        return false;
+    }
+    logLines = entries.size();
+    return true;
+}
+
+bool MetadataCache::lookup(const std::string& url, Entry& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!loaded) {
+        load();
+    }
+    auto found = entries.find(url);
+    if (found == entries.end()) {
+        return false;
+    }
+    // One stat tells whether the copy is still the one that was recorded
+    QFileInfo copy(QString::fromStdString(found->second.path));
+    if (!copy.isFile() || copy.size() != found->second.size ||
+        copy.lastModified().toMSecsSinceEpoch() != found->second.modifiedMs) {
+        entries.erase(found); // Stays in the log until a compaction or a new store()
+        return false;
+    }
+    entry = found->second;
+    return true;
+}
+
+void MetadataCache::store(const std::string& url, const Entry& entry) {
+    if ((entry.etag.empty() && entry.lastModified.empty()) || entry.path.empty() ||
+        !storable(url) || !storable(entry.etag) || !storable(entry.lastModified) ||
+        !storable(entry.digest) || !storable(entry.path)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!loaded) {
+        load();
+    }
+    entries[url] = entry;
+    if (logPath.empty()) {
+        return;
+    }
+
+    // Appending keeps a store cheap however many entries there are
+    QFile file(QString::fromStdString(logPath));
+    bool fresh = !file.exists() || logLines == 0;
+    QDir().mkpath(QFileInfo(file).absolutePath());
+    if (fresh) {
+        // Also replaces a log of another format
+        if (!compact()) {
+            LOG_WARN(0) << "Could not write the metadata cache " << logPath;
+        }
+        return;
+    }
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        LOG_WARN(0) << "Could not write the metadata cache " << logPath;
+        return;
+    }
+    std::string line = formatLine(url, entry);
+    file.write(line.data(), static_cast<qint64>(line.size()));
+    ++logLines;
+}
+
+bool MetadataCache::linkCopy(const std::string& from, const std::string& to) {
+    QFile::remove(QString::fromStdString(to));
+#if defined(__linux__) && defined(FICLONE)
+    // Reflink: shares the blocks until either file is written (Btrfs, XFS, bcachefs)
+    int source = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source >= 0) {
+        int target = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        bool cloned = false;
+        if (target >= 0) {
+            cloned = ::ioctl(target, FICLONE, source) == 0;
+            ::close(target);
+            if (!cloned) {
+                ::unlink(to.c_str());
+            }
+        }
+        ::close(source);
+        if (cloned) {
+            return true;
+        }
+    }
+#endif
+    // Hard link: the same file under a second name, on the same volume only
+#ifdef _WIN32
+    if (CreateHardLinkW(QString::fromStdString(to).toStdWString().c_str(),
+                        QString::fromStdString(from).toStdWString().c_str(), nullptr)) {
+        return true;
+    }
+#else
+    if (::link(from.c_str(), to.c_str()) == 0) {
+        return true;
+    }
+#endif
+    return QFile::copy(QString::fromStdString(from), QString::fromStdString(to));
+}
+
+int64_t MetadataCache::modificationTime(const std::string& path) {
+    QFileInfo info(QString::fromStdString(path));
+    return info.exists() ? info.lastModified().toMSecsSinceEpoch() : 0;
+}
@@ -0,0 +1,155 @@
+#include "metalink.h"
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QXmlStreamReader>
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+static const char* kMetalinkNamespace = "urn:ietf:params:xml:ns:metalink";
+// Priority of a URL that has none; RFC 5854 allows 1 (best) to 999999
+static const int kLowestPriority = 999999;
+
+// IANA hash names ("sha-256") and StreamHash names ("sha256") to the algorithm
+static HashAlgorithm algorithmFromType(const QString& type) {
+    std::string name = type.toLower().toStdString();
+    name.erase(std::remove(name.begin(), name.end(), '-'), name.end());
+    return hashAlgorithmFromName(name);
+}
+
+// Preference when a file lists several hash types
+static int strength(HashAlgorithm algorithm) {
+    switch (algorithm) {
+    case HashAlgorithm::Sha256: return 4;
+    case HashAlgorithm::Sha1: return 3;
+    case HashAlgorithm::Xxh64: return 2;
+    case HashAlgorithm::Crc32c: return 1;
+    default: return 0;
+    }
+}
+
+// Lowercase hex digest if it is well formed for the algorithm, else empty
+static std::string checkedDigest(HashAlgorithm algorithm, const QString& text) {
+    std::string hex = text.trimmed().toLower().toStdString();
+    HashAlgorithm parsed;
+    std::string digest;
+    std::string spec = std::string(hashAlgorithmName(algorithm)) + ":" + hex;
+    return parseDigestSpec(spec, parsed, digest) ? digest : std::string();
+}
+
+bool Metalink::load(const std::string& path) {
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        entries.clear();
+        lastError = "cannot read " + path;
+        return false;
+    }
+    return parse(file.readAll());
+}
+
+bool Metalink::parse(const QByteArray& document) {
+    entries.clear();
+    lastError.clear();
+    QXmlStreamReader xml(document);
+    if (!xml.readNextStartElement() || xml.name() != QLatin1String("metalink") ||
+        xml.namespaceUri() != QLatin1String(kMetalinkNamespace)) {
+        lastError = "not a Metalink 4 document";
+        return false;
+    }
+
+    while (xml.readNextStartElement()) {
+        if (xml.name() != QLatin1String("file")) {
+            xml.skipCurrentElement();
+            continue;
+        }
+        File file;
+        file.name = xml.attributes().value("name").toString().toStdString();
+        std::vector<std::pair<int, std::string>> urls; // (priority, url)
+        while (xml.readNextStartElement()) {
+            if (xml.name() == QLatin1String("size")) {
+                bool ok = false;
+                qint64 size = xml.readElementText().trimmed().toLongLong(&ok);
+                file.size = ok && size >= 0 ? size : -1;
+            } else if (xml.name() == QLatin1String("url")) {
+                bool ok = false;
+                int priority = xml.attributes().value("priority").toInt(&ok);
+                QString url = xml.readElementText().trimmed();
+                if (url.startsWith("http://") || url.startsWith("https://")) {
+                    urls.push_back({ok ? priority : kLowestPriority, url.toStdString()});
+                }
+            } else if (xml.name() == QLatin1String("hash")) {
+                HashAlgorithm algorithm = algorithmFromType(xml.attributes().value("type").toString());
+                std::string digest = checkedDigest(algorithm, xml.readElementText());
+                if (!digest.empty() && strength(algorithm) > strength(file.hashAlgorithm)) {
+                    file.hashAlgorithm = algorithm;
+                    file.hash = digest;
+                }
+            } else if (xml.name() == QLatin1String("pieces")) {
+                HashAlgorithm algorithm = algorithmFromType(xml.attributes().value("type").toString());
+                qint64 length = xml.attributes().value("length").toLongLong();
+                std::vector<std::string> pieces;
+                bool valid = algorithm != HashAlgorithm::None && length > 0;
+                while (xml.readNextStartElement()) {
+                    if (xml.name() == QLatin1String("hash")) {
+                        std::string digest = checkedDigest(algorithm, xml.readElementText());
+                        valid = valid && !digest.empty();
+                        pieces.push_back(digest);
+                    } else {
+                        xml.skipCurrentElement();
+                    }
+                }
+                if (valid && !pieces.empty() && strength(algorithm) > strength(file.pieceAlgorithm)) {
+                    file.pieceAlgorithm = algorithm;
+                    file.pieceLength = length;
+                    file.pieces = pieces;
+                }
+            } else {
+                xml.skipCurrentElement();
+            }
+        }
+        // Pieces that do not add up to the size cannot be checked against the file
+        if (file.size >= 0 && !file.pieces.empty() &&
+            static_cast<int64_t>(file.pieces.size()) != (file.size + file.pieceLength - 1) / file.pieceLength) {
+            file.pieceAlgorithm = HashAlgorithm::None;
+            file.pieceLength = 0;
+            file.pieces.clear();
+        }
+        std::stable_sort(urls.begin(), urls.end(),
+                         [](const std::pair<int, std::string>& a, const std::pair<int, std::string>& b) {
+                             return a.first < b.first;
+                         });
+        for (const auto& url : urls) {
+            file.urls.push_back(url.second);
+        }
+        if (!file.urls.empty()) {
+            entries.push_back(file);
+        }
+    }
+    if (xml.hasError()) {
+        entries.clear();
+        lastError = "malformed Metalink: " + xml.errorString().toStdString();
+        return false;
+    }
+    if (entries.empty()) {
+        lastError = "Metalink lists no file with an HTTP(S) URL";
+        return false;
+    }
+    return true;
+}
+
+bool Metalink::isMetalinkPath(const std::string& path) {
+    std::string lower = path;
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    auto endsWith = [&lower](const std::string& suffix) {
+        return lower.size() >= suffix.size() && lower.compare(lower.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    return endsWith(".meta4") || endsWith(".metalink");
+}
+
+std::string Metalink::safeFileName(const std::string& name) {
+    size_t slash = name.find_last_of("/\\");
+    std::string base = slash == std::string::npos ? name : name.substr(slash + 1);
+    return base == "." || base == ".." ? std::string() : base;
+}
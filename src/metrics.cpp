@@ -0,0 +1,176 @@
+#include "metrics.h"
+#include "bufferpool.h"
+#include "writestage.h"
+#include <QByteArray>
+#include <QSaveFile>
+#include <QString>
+#include <cstdio>
+
+// Upper bounds of the histogram buckets in seconds: connection setup is milliseconds,
+// a whole transfer may take an hour
+static const double kBucketBounds[Histogram::kBuckets] = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1,
+    2.5, 5, 10, 30, 60, 120, 300, 600, 1800, 3600};
+
+static const char* const kPrefix = "downloader_";
+
+static std::string formatSeconds(double seconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", seconds);
+    return buffer;
+}
+
+// HELP and TYPE lines of a metric
+static void describe(std::string& out, const char* name, const char* type, const char* help) {
+    out += std::string("# HELP ") + kPrefix + name + " " + help + "\n";
+    out += std::string("# TYPE ") + kPrefix + name + " " + type + "\n";
+}
+
+static void sample(std::string& out, const char* name, const std::string& labels, uint64_t value) {
+    out += kPrefix;
+    out += name;
+    if (!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    out += " " + std::to_string(value) + "\n";
+}
+
+void Histogram::observe(int64_t microseconds) {
+    double seconds = static_cast<double>(microseconds) / 1e6;
+    int bucket = 0;
+    while (bucket < kBuckets && seconds > kBucketBounds[bucket]) {
+        ++bucket;
+    }
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(microseconds, std::memory_order_relaxed);
+}
+
+void Histogram::render(std::string& out, const char* name, const std::string& labels) const {
+    std::string bucketName = std::string(name) + "_bucket";
+    std::string prefix = labels.empty() ? std::string() : labels + ",";
+    uint64_t cumulative = 0;
+    for (int i = 0; i <= kBuckets; ++i) {
+        cumulative += counts[i].load(std::memory_order_relaxed);
+        std::string bound = i < kBuckets ? formatSeconds(kBucketBounds[i]) : std::string("+Inf");
+        sample(out, bucketName.c_str(), prefix + "le=\"" + bound + "\"", cumulative);
+    }
+    out += kPrefix + std::string(name) + "_sum";
+    if (!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    out += " " + formatSeconds(static_cast<double>(sumUs.load(std::memory_order_relaxed)) / 1e6) + "\n";
+    sample(out, (std::string(name) + "_count").c_str(), labels, cumulative);
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::recordTransfer(CURL* handle, CURLcode result) {
+    add(result == CURLE_OK ? transfersOk : transfersFailed, 1);
+    curl_off_t lookup = 0, connect = 0, tls = 0, firstByte = 0, total = 0;
+    long connects = 0;
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+
+    // The times are cumulative from the start of the transfer; a reused connection has
+    // no setup phases of its own
+    if (connects > 0) {
+        add(connectionsOpened, connects);
+        dnsTime.observe(lookup);
+        if (connect >= lookup) {
+            connectTime.observe(connect - lookup);
+        }
+        if (tls > 0 && tls >= connect) {
+            tlsTime.observe(tls - connect);
+        }
+    } else if (firstByte > 0) {
+        add(connectionsReused, 1); // Answered without a connection of its own
+    }
+    if (firstByte > 0) {
+        firstByteTime.observe(firstByte);
+    }
+    transferTime.observe(total);
+}
+
+void Metrics::addDownload(bool success, int64_t microseconds) {
+    add(success ? downloadsOk : downloadsFailed, 1);
+    downloadTime.observe(microseconds);
+}
+
+std::string Metrics::render() const {
+    std::string out;
+    describe(out, "dns_seconds", "histogram", "Name lookup time of new connections.");
+    dnsTime.render(out, "dns_seconds");
+    describe(out, "connect_seconds", "histogram", "TCP connect time of new connections, after the name lookup.");
+    connectTime.render(out, "connect_seconds");
+    describe(out, "tls_seconds", "histogram", "TLS handshake time of new connections, after the connect.");
+    tlsTime.render(out, "tls_seconds");
+    describe(out, "first_byte_seconds", "histogram", "Time from the start of a transfer to its first response byte.");
+    firstByteTime.render(out, "first_byte_seconds");
+    describe(out, "transfer_seconds", "histogram", "Duration of transfers (probes and segments).");
+    transferTime.render(out, "transfer_seconds");
+    describe(out, "download_seconds", "histogram", "Duration of downloads from the start to the result.");
+    downloadTime.render(out, "download_seconds");
+
+    describe(out, "transfers_started_total", "counter", "Segment transfers started.");
+    sample(out, "transfers_started_total", std::string(), transfersStarted.load(std::memory_order_relaxed));
+    describe(out, "transfers_total", "counter", "Transfers finished (probes, manifests and segments), by result.");
+    sample(out, "transfers_total", "result=\"ok\"", transfersOk.load(std::memory_order_relaxed));
+    sample(out, "transfers_total", "result=\"error\"", transfersFailed.load(std::memory_order_relaxed));
+    describe(out, "connections_opened_total", "counter", "Connections opened by transfers.");
+    sample(out, "connections_opened_total", std::string(), connectionsOpened.load(std::memory_order_relaxed));
+    describe(out, "connections_reused_total", "counter", "Transfers that reused an open connection.");
+    sample(out, "connections_reused_total", std::string(), connectionsReused.load(std::memory_order_relaxed));
+    describe(out, "retries_total", "counter", "Transfers retried after a transient failure.");
+    sample(out, "retries_total", std::string(), retries.load(std::memory_order_relaxed));
+    describe(out, "downloads_total", "counter", "Downloads finished, by result.");
+    sample(out, "downloads_total", "result=\"ok\"", downloadsOk.load(std::memory_order_relaxed));
+    sample(out, "downloads_total", "result=\"error\"", downloadsFailed.load(std::memory_order_relaxed));
+    describe(out, "received_bytes_total", "counter", "Bytes received over the network.");
+    sample(out, "received_bytes_total", std::string(),
+           static_cast<uint64_t>(receivedBytes.load(std::memory_order_relaxed)));
+    describe(out, "wasted_bytes_total", "counter", "Bytes received and thrown away (restarts, bad blocks).");
+    sample(out, "wasted_bytes_total", std::string(),
+           static_cast<uint64_t>(wastedBytes.load(std::memory_order_relaxed)));
+
+    BufferPool::Stats pool = BufferPool::instance().stats();
+    describe(out, "memory_budget_bytes", "gauge", "Memory budget of the transfer buffers.");
+    sample(out, "memory_budget_bytes", std::string(), pool.budgetBytes);
+    describe(out, "memory_bytes", "gauge", "Buffer memory by use: chunk buffers, curl receive buffers, idle.");
+    sample(out, "memory_bytes", "use=\"chunks\"", pool.bufferBytes);
+    sample(out, "memory_bytes", "use=\"receive\"", pool.receiveBytes);
+    sample(out, "memory_bytes", "use=\"idle\"", pool.idleBytes);
+    describe(out, "memory_refusals_total", "counter", "Buffer requests refused for lack of memory.");
+    sample(out, "memory_refusals_total", std::string(), pool.refusals);
+
+    WriteStage::Stats writes = WriteStage::instance().stats();
+    describe(out, "write_queue_bytes", "gauge", "Filled chunk buffers waiting for the writer thread.");
+    sample(out, "write_queue_bytes", std::string(), writes.queuedBytes);
+    describe(out, "write_queue_writes", "gauge", "Writes waiting for the writer thread.");
+    sample(out, "write_queue_writes", std::string(), writes.queuedWrites);
+    describe(out, "write_lag_seconds", "gauge", "Age of the oldest write waiting for the writer thread.");
+    out += std::string(kPrefix) + "write_lag_seconds " + formatSeconds(writes.writerLagMs / 1e3) + "\n";
+    describe(out, "written_bytes_total", "counter", "Bytes handed to storage by the writer thread.");
+    sample(out, "written_bytes_total", std::string(), writes.bytesWritten);
+    return out;
+}
+
+bool Metrics::writeFile(const std::string& path) const {
+    // A scraper reading the file never sees it half written
+    QSaveFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    std::string text = render();
+    if (file.write(text.data(), static_cast<qint64>(text.size())) != static_cast<qint64>(text.size())) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
@@ -0,0 +1,53 @@
+#include "metricsserver.h"
+#include "metrics.h"
+#include <QByteArray>
+#include <QHostAddress>
+#include <QTcpSocket>
+
+// Largest request head read before the connection is dropped
+static const int kMaxRequestSize = 8192;
+
+MetricsServer::MetricsServer(QObject* parent)
+    : QTcpServer(parent)
+{
+}
+
+bool MetricsServer::start(quint16 port) {
+    return listen(QHostAddress::LocalHost, port);
+}
+
+void MetricsServer::incomingConnection(qintptr socketDescriptor) {
+    QTcpSocket* socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+    connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    connect(socket, &QTcpSocket::readyRead, socket, [socket]() {
+        // The request stays buffered in the socket until its head is complete
+        QByteArray input = socket->peek(kMaxRequestSize + 1);
+        if (input.indexOf("\r\n\r\n") < 0) {
+            if (input.size() > kMaxRequestSize) {
+                socket->abort();
+            }
+            return;
+        }
+        socket->readAll();
+        QList<QByteArray> requestLine = input.left(input.indexOf("\r\n")).split(' ');
+        QByteArray path = requestLine.value(1);
+        QByteArray status = "200 OK";
+        QByteArray body;
+        if (requestLine.value(0) != "GET") {
+            status = "405 Method Not Allowed";
+        } else if (path != "/metrics" && path != "/") {
+            status = "404 Not Found";
+        } else {
+            body = QByteArray::fromStdString(Metrics::instance().render());
+        }
+        socket->write("HTTP/1.1 " + status + "\r\n"
+                      "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                      "Connection: close\r\n\r\n" + body);
+        socket->disconnectFromHost();
+    });
+}
@@ -0,0 +1,209 @@
+#include "resumejournal.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QString>
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+// First line of every journal; bump the number when the format changes
+static const char* kJournalMagic = "download-journal 1";
+
+static const char* kHexDigits = "0123456789abcdef";
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// "d1,d2,-,d4" with "-" for a block without digest
+static std::vector<std::string> splitDigests(const std::string& list) {
+    std::vector<std::string> digests;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        std::string item = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        digests.push_back(item == "-" ? std::string() : item);
+        if (comma == std::string::npos) break;
+        start = comma + 1;
+    }
+    return digests;
+}
+
+std::string ResumeJournal::pathFor(const std::string& outputPath) {
+    return outputPath + ".resume";
+}
+
+void ResumeJournal::remove(const std::string& path) {
+    QFile::remove(QString::fromStdString(path));
+}
+
+void ResumeJournal::reset(const std::string& url, int64_t size, const std::string& etag,
+                          const std::string& lastModified, int64_t blockSize) {
+    remoteUrl = url;
+    totalSize = std::max<int64_t>(0, size);
+    this->etag = etag;
+    this->lastModified = lastModified;
+    blockBytes = std::max<int64_t>(1, blockSize);
+    blocks = static_cast<size_t>((totalSize + blockBytes - 1) / blockBytes);
+    bits.assign((blocks + 7) / 8, 0);
+    hashes = HashState();
+}
+
+bool ResumeJournal::load(const std::string& path) {
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray contents = file.readAll();
+    std::istringstream in(std::string(contents.constData(), static_cast<size_t>(contents.size())));
+
+    std::string line;
+    if (!std::getline(in, line) || line != kJournalMagic) {
+        return false;
+    }
+    std::string url, etag, lastModified, hex;
+    int64_t size = -1;
+    int64_t blockSize = 0;
+    HashState savedHashes;
+    while (std::getline(in, line)) {
+        size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? std::string() : line.substr(space + 1);
+        if (key == "url") url = value;
+        else if (key == "size") size = std::strtoll(value.c_str(), nullptr, 10);
+        else if (key == "etag") etag = value;
+        else if (key == "last-modified") lastModified = value;
+        else if (key == "block-size") blockSize = std::strtoll(value.c_str(), nullptr, 10);
+        else if (key == "blocks") hex = value;
+        else if (key == "hash") savedHashes.algorithm = value;
+        else if (key == "hash-block-size") savedHashes.blockSize = std::strtoll(value.c_str(), nullptr, 10);
+        else if (key == "block-digests") savedHashes.blockDigests = splitDigests(value);
+        else if (key == "hash-frontier") {
+            // "<offset> <state>"
+            size_t gap = value.find(' ');
+            savedHashes.frontierOffset = std::strtoll(value.c_str(), nullptr, 10);
+            savedHashes.frontierState = gap == std::string::npos ? std::string() : value.substr(gap + 1);
+        }
+    }
+    if (url.empty() || size <= 0 || blockSize <= 0) {
+        return false;
+    }
+    // Checked before the bitmap is allocated, so a corrupt size cannot ask for terabytes
+    uint64_t blockCount = static_cast<uint64_t>(size / blockSize + (size % blockSize != 0));
+    if (hex.size() != (blockCount + 7) / 8 * 2) {
+        return false; // Truncated or written for another size
+    }
+
+    reset(url, size, etag, lastModified, blockSize);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        int high = hexValue(hex[2 * i]);
+        int low = hexValue(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bits[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+    hashes = savedHashes;
+    return true;
+}
+
+bool ResumeJournal::save(const std::string& path) const {
+    std::string text = std::string(kJournalMagic) + "\n";
+    text += "url " + remoteUrl + "\n";
+    text += "size " + std::to_string(totalSize) + "\n";
+    text += "etag " + etag + "\n";
+    text += "last-modified " + lastModified + "\n";
+    text += "block-size " + std::to_string(blockBytes) + "\n";
+    text += "blocks ";
+    for (uint8_t byte : bits) {
+        text += kHexDigits[byte >> 4];
+        text += kHexDigits[byte & 0x0F];
+    }
+    text += "\n";
+    if (!hashes.algorithm.empty()) {
+        text += "hash " + hashes.algorithm + "\n";
+        text += "hash-block-size " + std::to_string(hashes.blockSize) + "\n";
+        text += "block-digests ";
+        for (size_t i = 0; i < hashes.blockDigests.size(); ++i) {
+            text += (i > 0 ? "," : "") + (hashes.blockDigests[i].empty() ? std::string("-") : hashes.blockDigests[i]);
+        }
+        text += "\n";
+        if (!hashes.frontierState.empty()) {
+            text += "hash-frontier " + std::to_string(hashes.frontierOffset) + " " + hashes.frontierState + "\n";
+        }
+    }
+
+    // QSaveFile writes a temporary file and renames it over the old journal on commit,
+    // so a crash leaves either the previous or the new journal, never a torn one
+    QSaveFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(text.data(), static_cast<qint64>(text.size()));
+    return file.commit();
+}
+
+bool ResumeJournal::matches(const std::string& url, int64_t size, const std::string& etag,
+                            const std::string& lastModified) const {
+    if (url != remoteUrl || size != totalSize) {
+        return false;
+    }
+    if (!etag.empty() && !this->etag.empty()) {
+        return etag == this->etag;
+    }
+    if (!lastModified.empty() && !this->lastModified.empty()) {
+        return lastModified == this->lastModified;
+    }
+    return false;
+}
+
+std::string ResumeJournal::ifRangeValue() const {
+    // If-Range only accepts strong entity tags (RFC 9110 13.1.5)
+    if (!etag.empty() && etag.rfind("W/", 0) != 0) {
+        return etag;
+    }
+    return lastModified;
+}
+
+void ResumeJournal::markRange(int64_t begin, int64_t end) {
+    begin = std::max<int64_t>(0, begin);
+    end = std::min(end, totalSize);
+    // Round the start up to a block boundary; the end may stop at the short last block
+    for (int64_t block = (begin + blockBytes - 1) / blockBytes; block < static_cast<int64_t>(blocks); ++block) {
+        int64_t blockEnd = std::min((block + 1) * blockBytes, totalSize);
+        if (blockEnd > end) {
+            break;
+        }
+        bits[static_cast<size_t>(block / 8)] |= static_cast<uint8_t>(1u << (block % 8));
+    }
+}
+
+int64_t ResumeJournal::completedBytes() const {
+    int64_t done = 0;
+    for (size_t block = 0; block < blocks; ++block) {
+        if (blockDone(block)) {
+            int64_t start = static_cast<int64_t>(block) * blockBytes;
+            done += std::min(start + blockBytes, totalSize) - start;
+        }
+    }
+    return done;
+}
+
+std::vector<ResumeJournal::Run> ResumeJournal::runs() const {
+    std::vector<Run> result;
+    size_t block = 0;
+    while (block < blocks) {
+        bool done = blockDone(block);
+        size_t last = block;
+        while (last + 1 < blocks && blockDone(last + 1) == done) {
+            ++last;
+        }
+        int64_t first = static_cast<int64_t>(block) * blockBytes;
+        int64_t lastByte = std::min(static_cast<int64_t>(last + 1) * blockBytes, totalSize) - 1;
+        result.push_back({first, lastByte, done});
+        block = last + 1;
+    }
+    return result;
+}
@@ -0,0 +1,71 @@
+#include "retrypolicy.h"
+#include <algorithm>
+
+// First backoff step; each further consecutive failure doubles it
+static const int64_t kBaseDelayMs = 500;
+// Longest wait before a retry, also the cap of a server's Retry-After
+static const int64_t kMaxDelayMs = 60000;
+// Retries a download may make before data has to arrive to allow more
+static const double kRetryBudget = 10;
+// Received bytes that return one retry to the budget
+static const int64_t kRefillBytes = 8 * 1024 * 1024;
+
+RetryPolicy::RetryPolicy()
+    : tokens(kRetryBudget),
+      creditedBytes(0),
+      random(std::random_device()())
+{
+}
+
+bool RetryPolicy::transient(CURLcode result, long httpCode) {
+    // An error status fails the transfer through the write callback, the status decides
+    if (httpCode >= 400) {
+        return httpCode == 408 || httpCode == 429 || httpCode == 500 || httpCode == 502 ||
+               httpCode == 503 || httpCode == 504;
+    }
+    switch (result) {
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_RECV_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        // CURLE_WRITE_ERROR is the write callback refusing the data (disk full, a range
+        // ignored by the server), which the next attempt would run into again
+        return false;
+    }
+}
+
+std::chrono::milliseconds RetryPolicy::delay(int attempt, int64_t retryAfterS) {
+    if (retryAfterS >= 0) {
+        return std::chrono::milliseconds(std::min(retryAfterS * 1000, kMaxDelayMs));
+    }
+    int64_t step = kBaseDelayMs << std::min(std::max(attempt - 1, 0), 16);
+    step = std::min(step, kMaxDelayMs);
+    std::uniform_int_distribution<int64_t> jitter(step / 2, step);
+    return std::chrono::milliseconds(jitter(random));
+}
+
+void RetryPolicy::reset() {
+    tokens = kRetryBudget;
+    creditedBytes = 0;
+}
+
+bool RetryPolicy::consume(int64_t transferredBytes) {
+    if (transferredBytes > creditedBytes) {
+        tokens = std::min(kRetryBudget, tokens + static_cast<double>(transferredBytes - creditedBytes) / kRefillBytes);
+        creditedBytes = transferredBytes;
+    }
+    if (tokens < 1) {
+        return false;
+    }
+    tokens -= 1;
+    return true;
+}
@@ -0,0 +1,519 @@
+#include "storagebackend.h"
+#include "bufferpool.h"
+#include "logger.h"
+#include "tracer.h"
+#include "writestage.h"
+#include <QFile>
+#include <QString>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+bool StorageBackend::writeChunk(int64_t offset, StorageBuffer& buffer, size_t reserved) {
+    bool ok = writeAt(offset, buffer.data(), buffer.size());
+    BufferPool::instance().release(reserved, std::move(buffer));
+    buffer = StorageBuffer();
+    return ok;
+}
+
+bool StorageBackend::sync() {
+    return flush();
+}
+
+// --- Positional writes ---
+
+// pwrite() on POSIX, WriteFile() with an explicit offset on Windows. Both are safe
+// for concurrent writers and never move a shared file position.
+class PwriteStorage : public StorageBackend {
+public:
+    ~PwriteStorage() override { close(); }
+
+    bool open(const std::string& path, int64_t size, bool truncate) override {
+#ifdef _WIN32
+        std::wstring widePath = QString::fromStdString(path).toStdWString();
+        file = CreateFileW(widePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        if (truncate && size > 0) {
+            LARGE_INTEGER end;
+            end.QuadPart = size;
+            SetFilePointerEx(file, end, nullptr, FILE_BEGIN);
+            SetEndOfFile(file);
+        }
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (truncate && size > 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            LOG_WARN(0) << "Could not extend " << path << " to " << size << " bytes";
+        }
+#endif
+        return true;
+    }
+
+    bool writeAt(int64_t offset, const char* data, size_t length) override {
+        while (length > 0) {
+#ifdef _WIN32
+            OVERLAPPED position = {};
+            position.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+            position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD toWrite = static_cast<DWORD>(std::min<size_t>(length, 1u << 30));
+            DWORD written = 0;
+            if (!WriteFile(file, data, toWrite, &written, &position)) {
+                return false;
+            }
+#else
+            ssize_t written = ::pwrite(fd, data, length, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+#endif
+            data += written;
+            offset += written;
+            length -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    // Writes go straight to the operating system, nothing is buffered here
+    bool flush() override { return true; }
+
+    bool sync() override {
+#ifdef _WIN32
+        return file != INVALID_HANDLE_VALUE && FlushFileBuffers(file);
+#elif defined(__linux__)
+        return fd >= 0 && fdatasync(fd) == 0;
+#else
+        return fd >= 0 && fsync(fd) == 0;
+#endif
+    }
+
+    void close() override {
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
+    const char* name() const override { return "pwrite"; }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+};
+
+// --- Memory-mapped file ---
+
+// Maps the whole, pre-sized output file; a write is a memcpy into the page cache
+class MmapStorage : public StorageBackend {
+public:
+    ~MmapStorage() override { close(); }
+
+    bool open(const std::string& path, int64_t size, bool truncate) override {
+        if (size <= 0) {
+            return false;
+        }
+        file.setFileName(QString::fromStdString(path));
+        QIODevice::OpenMode mode = QIODevice::ReadWrite;
+        if (truncate) mode |= QIODevice::Truncate;
+        if (!file.open(mode)) {
+            return false;
+        }
+        if (file.size() != size && !file.resize(size)) {
+            file.close();
+            return false;
+        }
+        mapped = file.map(0, size);
+        mappedSize = size;
+        if (!mapped) {
+            file.close();
+            return false;
+        }
+        return true;
+    }
+
+    bool writeAt(int64_t offset, const char* data, size_t length) override {
+        if (!mapped || offset < 0 || offset + static_cast<int64_t>(length) > mappedSize) {
+            return false;
+        }
+        std::memcpy(mapped + offset, data, length);
+        return true;
+    }
+
+    // Dirty pages are written back by the operating system and on unmap
+    bool flush() override { return mapped != nullptr; }
+
+    bool sync() override {
+        if (!mapped) {
+            return false;
+        }
+#ifdef _WIN32
+        return FlushViewOfFile(mapped, 0) != 0;
+#else
+        return msync(mapped, static_cast<size_t>(mappedSize), MS_SYNC) == 0;
+#endif
+    }
+
+    void close() override {
+        if (mapped) {
+            file.unmap(mapped);
+            mapped = nullptr;
+        }
+        if (file.isOpen()) {
+            file.close();
+        }
+    }
+
+    const char* name() const override { return "mmap"; }
+
+private:
+    QFile file;
+    uchar* mapped = nullptr;
+    int64_t mappedSize = 0;
+};
+
+// --- io_uring ---
+
+#ifdef HAVE_LIBURING
+
+// Queues chunk writes and submits them in batches of queueDepth. A chunk buffer stays
+// with the ring, still charged to the BufferPool, until its write completes.
+class IoUringStorage : public StorageBackend {
+public:
+    explicit IoUringStorage(unsigned queueDepth)
+        : depth(std::max(1u, queueDepth)), ringSlots(depth * 2) {}
+    ~IoUringStorage() override { close(); }
+
+    bool open(const std::string& path, int64_t size, bool truncate) override {
+        if (io_uring_queue_init(depth * 2, &ring, 0) != 0) {
+            return false;
+        }
+        ringReady = true;
+        if (!plain.open(path, size, truncate)) {
+            return false;
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        for (size_t i = 0; i < ringSlots.size(); ++i) {
+            freeSlots.push_back(i);
+        }
+        return fd >= 0;
+    }
+
+    bool writeAt(int64_t offset, const char* data, size_t length) override {
+        return plain.writeAt(offset, data, length);
+    }
+
+    bool writeChunk(int64_t offset, StorageBuffer& buffer, size_t reserved) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeSlots.empty() && !reap(true)) {
+            BufferPool::instance().release(reserved, std::move(buffer));
+            buffer = StorageBuffer();
+            return false;
+        }
+        size_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        ringSlots[slot].data.swap(buffer);
+        ringSlots[slot].reserved = reserved;
+        ringSlots[slot].offset = offset;
+
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (!sqe) {
+            io_uring_submit(&ring);
+            queued = 0;
+            sqe = io_uring_get_sqe(&ring);
+        }
+        if (!sqe) {
+            // Ring still full, write this chunk directly
+            bool ok = plain.writeAt(offset, ringSlots[slot].data.data(), ringSlots[slot].data.size());
+            releaseSlot(slot);
+            return ok && reap(false);
+        }
+        io_uring_prep_write(sqe, fd, ringSlots[slot].data.data(), static_cast<unsigned>(ringSlots[slot].data.size()),
+                            static_cast<__u64>(offset));
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(slot));
+        ++inFlight;
+        if (++queued >= depth) {
+            io_uring_submit(&ring);
+            queued = 0;
+        }
+        return reap(false);
+    }
+
+    bool flush() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queued > 0) {
+            io_uring_submit(&ring);
+            queued = 0;
+        }
+        // Every write is waited for, failed or not, so their buffers go back to the pool
+        while (inFlight > 0) {
+            unsigned before = inFlight;
+            reap(true);
+            if (inFlight == before) break; // Waiting itself failed
+        }
+        return !failed;
+    }
+
+    bool sync() override {
+        return flush() && plain.sync();
+    }
+
+    void close() override {
+        if (ringReady) {
+            flush();
+            io_uring_queue_exit(&ring);
+            ringReady = false;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        plain.close();
+    }
+
+    const char* name() const override { return "io_uring"; }
+
+private:
+    struct Slot {
+        StorageBuffer data;
+        size_t reserved = 0; // BufferPool charge of data
+        int64_t offset = 0;
+    };
+
+    // Gives the slot's buffer back to the BufferPool and the slot to the free list
+    void releaseSlot(size_t slot) {
+        BufferPool::instance().release(ringSlots[slot].reserved, std::move(ringSlots[slot].data));
+        ringSlots[slot].data = StorageBuffer();
+        ringSlots[slot].reserved = 0;
+        freeSlots.push_back(slot);
+    }
+
+    // Collects completions (waiting for at least one if wait is set) and frees their ringSlots
+    bool reap(bool wait) {
+        if (wait && queued > 0) {
+            io_uring_submit(&ring);
+            queued = 0;
+        }
+        io_uring_cqe* cqe = nullptr;
+        while ((wait ? io_uring_wait_cqe(&ring, &cqe) : io_uring_peek_cqe(&ring, &cqe)) == 0 && cqe) {
+            size_t slot = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+            Slot& done = ringSlots[slot];
+            if (cqe->res < 0) {
+                failed = true;
+            } else if (static_cast<size_t>(cqe->res) < done.data.size()) {
+                // Finish a short write synchronously
+                failed |= !plain.writeAt(done.offset + cqe->res, done.data.data() + cqe->res,
+                                         done.data.size() - static_cast<size_t>(cqe->res));
+            }
+            io_uring_cqe_seen(&ring, cqe);
+            releaseSlot(slot);
+            --inFlight;
+            wait = false;
+        }
+        return !failed;
+    }
+
+    unsigned depth;
+    std::vector<Slot> ringSlots;
+    std::vector<size_t> freeSlots;
+    io_uring ring;
+    bool ringReady = false;
+    int fd = -1;
+    unsigned queued = 0;   // Prepared but not yet submitted
+    unsigned inFlight = 0; // Submitted or queued, not yet completed
+    bool failed = false;
+    std::mutex mutex;
+    PwriteStorage plain;   // Creates the file and serves unbatched writes
+};
+
+#endif // HAVE_LIBURING
+
+std::unique_ptr<StorageBackend> StorageBackend::create(const StorageOptions& options, int64_t size) {
+    switch (options.backend) {
+    case StorageOptions::IoUring:
+#ifdef HAVE_LIBURING
+        return std::make_unique<IoUringStorage>(options.queueDepth);
+#else
+        LOG_WARN(0) << "io_uring storage is not available in this build, using pwrite";
+        break;
+#endif
+    case StorageOptions::Mmap:
+        if (size > 0) {
+            return std::make_unique<MmapStorage>();
+        }
+        break;
+    case StorageOptions::Pwrite:
+        break;
+    }
+    return std::make_unique<PwriteStorage>();
+}
+
+// Tracer: a write of the synchronous path, on the track of the calling thread
+static void traceDirectWrite(int64_t startUs, int64_t offset, size_t bytes) {
+    Tracer& tracer = Tracer::instance();
+    tracer.complete(0, tracer.threadTrack("engine (direct writes)"), "disk", "write", startUs, Tracer::now(),
+                    TraceArgs().add("offset", offset).add("bytes", static_cast<int64_t>(bytes)));
+}
+
+StorageWriter::StorageWriter(StorageBackend* backend, size_t chunkSize, int64_t offset, WriteStage* stage)
+    : backend(backend),
+      stage(stage),
+      chunkSize(std::max<size_t>(chunkSize, 4096)),
+      chunkOffset(offset),
+      haveBuffer(false)
+{
+}
+
+StorageWriter::~StorageWriter() {
+    flush();
+    if (haveBuffer) {
+        BufferPool::instance().release(chunkSize, std::move(buffer)); // An empty buffer of the sync mode
+    }
+}
+
+bool StorageWriter::reserve(size_t length) {
+    if (!stage) {
+        return true;
+    }
+    size_t room = haveBuffer ? chunkSize - buffer.size() : 0;
+    if (length <= room) {
+        return true;
+    }
+    size_t needed = (length - room + chunkSize - 1) / chunkSize;
+    while (spare.size() < needed) {
+        StorageBuffer fresh;
+        if (!BufferPool::instance().tryAcquire(chunkSize, fresh)) {
+            // Hold nothing while waiting, so paused writers cannot starve the running ones
+            flush();
+            return false;
+        }
+        spare.push_back(std::move(fresh));
+    }
+    return true;
+}
+
+bool StorageWriter::takeBuffer() {
+    // Errors of earlier chunks show up here, once per chunk rather than per callback
+    if (stage->failed(backend)) {
+        return false;
+    }
+    if (!spare.empty()) {
+        buffer.swap(spare.back());
+        spare.pop_back();
+    } else if (!BufferPool::instance().tryAcquire(chunkSize, buffer)) {
+        return false;
+    }
+    haveBuffer = true;
+    return true;
+}
+
+bool StorageWriter::write(const char* data, size_t length) {
+    if (stage) {
+        // Always copy: the data has to outlive the callback until the writer thread gets to it
+        while (length > 0) {
+            if (!haveBuffer && !takeBuffer()) {
+                return false;
+            }
+            size_t take = std::min(length, chunkSize - buffer.size());
+            buffer.insert(buffer.end(), data, data + take);
+            data += take;
+            length -= take;
+            if (buffer.size() >= chunkSize) {
+                stage->submit(backend, chunkOffset, std::move(buffer), chunkSize);
+                chunkOffset += static_cast<int64_t>(chunkSize);
+                buffer = StorageBuffer();
+                haveBuffer = false;
+            }
+        }
+        return true;
+    }
+
+    while (length > 0) {
+        // A piece at least as large as a chunk is written without copying it first, and so
+        // is everything while the pool has no buffer to collect small pieces in
+        if (!haveBuffer && length < chunkSize) {
+            haveBuffer = BufferPool::instance().tryAcquire(chunkSize, buffer);
+        }
+        if (buffer.empty() && (length >= chunkSize || !haveBuffer)) {
+            int64_t traceStartUs = Tracer::enabled() ? Tracer::now() : 0;
+            bool ok = backend->writeAt(chunkOffset, data, length);
+            if (traceStartUs != 0) {
+                traceDirectWrite(traceStartUs, chunkOffset, length);
+            }
+            chunkOffset += static_cast<int64_t>(length);
+            return ok;
+        }
+        size_t take = std::min(length, chunkSize - buffer.size());
+        buffer.insert(buffer.end(), data, data + take);
+        data += take;
+        length -= take;
+        if (buffer.size() >= chunkSize && !flush()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StorageWriter::flush() {
+    if (stage) {
+        for (StorageBuffer& unused : spare) {
+            BufferPool::instance().release(chunkSize, std::move(unused));
+        }
+        spare.clear();
+        if (haveBuffer) {
+            int64_t at = chunkOffset;
+            chunkOffset += static_cast<int64_t>(buffer.size());
+            if (buffer.empty()) {
+                BufferPool::instance().release(chunkSize, std::move(buffer));
+            } else {
+                stage->submit(backend, at, std::move(buffer), chunkSize);
+            }
+            buffer = StorageBuffer();
+            haveBuffer = false;
+        }
+        return !stage->failed(backend);
+    }
+
+    if (buffer.empty()) {
+        return true;
+    }
+    int64_t at = chunkOffset;
+    size_t length = buffer.size(); // writeChunk() takes the buffer
+    chunkOffset += static_cast<int64_t>(length);
+    int64_t traceStartUs = Tracer::enabled() ? Tracer::now() : 0;
+    // The buffer goes back to the pool with the write; the next piece takes one again
+    bool ok = backend->writeChunk(at, buffer, chunkSize);
+    if (traceStartUs != 0) {
+        traceDirectWrite(traceStartUs, at, length);
+    }
+    haveBuffer = false;
+    return ok;
+}
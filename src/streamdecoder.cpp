@@ -0,0 +1,220 @@
+#include "streamdecoder.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Output of one decode() step; the write callback stores it before the next step
+static const size_t kDecodeChunk = 256 * 1024;
+
+static const unsigned char kGzipMagic[] = {0x1f, 0x8b};
+static const unsigned char kZstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+// Last path segment of a URL (or a path), lowercase, without query or fragment
+static std::string lowerFileName(const std::string& url) {
+    std::string path = url.substr(0, url.find_first_of("?#"));
+    path = path.substr(path.find_last_of('/') + 1);
+    std::transform(path.begin(), path.end(), path.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return path;
+}
+
+static bool endsWith(const std::string& text, const char* suffix) {
+    size_t length = std::strlen(suffix);
+    return text.size() > length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+StreamDecoder::Format StreamDecoder::formatFor(const std::string& url) {
+    std::string name = lowerFileName(url);
+#ifdef HAVE_ZLIB
+    if (endsWith(name, ".gz") || endsWith(name, ".tgz")) {
+        return Gzip;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (endsWith(name, ".zst") || endsWith(name, ".tzst")) {
+        return Zstd;
+    }
+#endif
+    (void)name;
+    return None;
+}
+
+std::string StreamDecoder::decodedName(const std::string& name) {
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (endsWith(lower, ".tgz")) {
+        return name.substr(0, name.size() - 4) + ".tar";
+    }
+    if (endsWith(lower, ".tzst")) {
+        return name.substr(0, name.size() - 5) + ".tar";
+    }
+    if (endsWith(lower, ".gz")) {
+        return name.substr(0, name.size() - 3);
+    }
+    if (endsWith(lower, ".zst")) {
+        return name.substr(0, name.size() - 4);
+    }
+    return name;
+}
+
+bool StreamDecoder::compressedName(const std::string& url) {
+    static const char* const kCompressed[] = {
+        ".gz", ".tgz", ".zst", ".tzst", ".bz2", ".xz", ".lz", ".lzma", ".7z", ".zip", ".rar",
+        ".jar", ".apk", ".deb", ".rpm", ".whl", ".jpg", ".jpeg", ".png", ".gif", ".webp",
+        ".mp3", ".mp4", ".mkv", ".webm", ".ogg", ".flac"};
+    std::string name = lowerFileName(url);
+    for (const char* suffix : kCompressed) {
+        if (endsWith(name, suffix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* StreamDecoder::formatName(Format format) {
+    switch (format) {
+    case Gzip: return "gzip";
+    case Zstd: return "zstd";
+    default: return "none";
+    }
+}
+
+StreamDecoder::StreamDecoder(Format format)
+    : format(format),
+      started(false),
+      passThrough(format == None),
+      atBoundary(false),
+      stream(nullptr),
+      output(kDecodeChunk),
+      outputSize(0)
+{
+#ifdef HAVE_ZLIB
+    if (format == Gzip) {
+        auto* z = new z_stream();
+        // 16 + window bits: gzip wrapper only
+        if (inflateInit2(z, 16 + MAX_WBITS) != Z_OK) {
+            delete z;
+            lastError = "cannot initialize zlib";
+        } else {
+            stream = z;
+        }
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (format == Zstd) {
+        ZSTD_DStream* zstd = ZSTD_createDStream();
+        if (!zstd || ZSTD_isError(ZSTD_initDStream(zstd))) {
+            ZSTD_freeDStream(zstd);
+            lastError = "cannot initialize zstd";
+        } else {
+            stream = zstd;
+        }
+    }
+#endif
+    if (!passThrough && !stream && lastError.empty()) {
+        lastError = std::string("no ") + formatName(format) + " support in this build";
+    }
+}
+
+StreamDecoder::~StreamDecoder() {
+#ifdef HAVE_ZLIB
+    if (format == Gzip && stream) {
+        auto* z = static_cast<z_stream*>(stream);
+        inflateEnd(z);
+        delete z;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (format == Zstd && stream) {
+        ZSTD_freeDStream(static_cast<ZSTD_DStream*>(stream));
+    }
+#endif
+}
+
+size_t StreamDecoder::decode(const char* data, size_t length) {
+    if (failed()) {
+        return 0;
+    }
+    if (!started && length > 0) {
+        // What the first bytes allow to compare; a body of one byte is not compressed anyway
+        const unsigned char* magic = format == Gzip ? kGzipMagic : kZstdMagic;
+        size_t magicLength = format == Gzip ? sizeof(kGzipMagic) : sizeof(kZstdMagic);
+        passThrough = passThrough || std::memcmp(data, magic, std::min(length, magicLength)) != 0;
+        started = true;
+    }
+    size_t space = output.size() - outputSize;
+    if (passThrough) {
+        size_t take = std::min(length, space);
+        std::memcpy(output.data() + outputSize, data, take);
+        outputSize += take;
+        return take;
+    }
+
+    size_t consumed = 0;
+#ifdef HAVE_ZLIB
+    if (format == Gzip) {
+        auto* z = static_cast<z_stream*>(stream);
+        z->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        z->avail_in = static_cast<uInt>(std::min<size_t>(length, 0x7fffffff));
+        z->next_out = reinterpret_cast<Bytef*>(output.data() + outputSize);
+        z->avail_out = static_cast<uInt>(space);
+        while (z->avail_out > 0) {
+            if (atBoundary) {
+                if (z->avail_in == 0) {
+                    break;
+                }
+                inflateReset(z); // Another member follows
+                atBoundary = false;
+            }
+            uInt before = z->avail_in + z->avail_out;
+            int result = inflate(z, Z_NO_FLUSH);
+            if (result == Z_STREAM_END) {
+                atBoundary = true;
+            } else if (result != Z_OK && result != Z_BUF_ERROR) {
+                lastError = z->msg ? z->msg : "corrupt gzip data";
+                break;
+            }
+            if (z->avail_in + z->avail_out == before && result != Z_STREAM_END) {
+                break; // Needs more input
+            }
+        }
+        consumed = length - z->avail_in;
+        outputSize = output.size() - z->avail_out;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (format == Zstd) {
+        auto* zstd = static_cast<ZSTD_DStream*>(stream);
+        ZSTD_inBuffer in = {data, length, 0};
+        ZSTD_outBuffer out = {output.data(), output.size(), outputSize};
+        while (out.pos < out.size) {
+            size_t before = in.pos + out.pos;
+            size_t result = ZSTD_decompressStream(zstd, &out, &in);
+            if (ZSTD_isError(result)) {
+                lastError = ZSTD_getErrorName(result);
+                break;
+            }
+            // 0 once a frame is complete and flushed, another frame may follow
+            atBoundary = result == 0;
+            if (in.pos + out.pos == before) {
+                break;
+            }
+        }
+        consumed = in.pos;
+        outputSize = out.pos;
+    }
+#endif
+    return consumed;
+}
+
+bool StreamDecoder::finished() const {
+    return !failed() && (!started || passThrough || atBoundary);
+}
@@ -0,0 +1,645 @@
+#include "streamhash.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define STREAMHASH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define STREAMHASH_ARM_CRC 1
+#include <arm_acle.h>
+#endif
+
+// GCC and Clang compile intrinsics only inside functions built for the instruction
+// set; MSVC accepts them anywhere
+#if defined(STREAMHASH_X86) && !defined(_MSC_VER)
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_SHANI __attribute__((target("sha,sse4.1")))
+#else
+#define TARGET_SSE42
+#define TARGET_SHANI
+#endif
+
+static const char* kHexDigits = "0123456789abcdef";
+
+static std::string toHex(const unsigned char* bytes, size_t length) {
+    std::string hex;
+    hex.reserve(length * 2);
+    for (size_t i = 0; i < length; ++i) {
+        hex += kHexDigits[bytes[i] >> 4];
+        hex += kHexDigits[bytes[i] & 0x0F];
+    }
+    return hex;
+}
+
+static uint64_t load64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, 8); // Little-endian hosts only, like the rest of the engine
+    return value;
+}
+
+static uint32_t load32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, 4);
+    return value;
+}
+
+// --- CPU features ---
+
+#ifdef STREAMHASH_X86
+static void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    int out[4];
+    __cpuidex(out, leaf, subleaf);
+    for (int i = 0; i < 4; ++i) regs[i] = static_cast<unsigned>(out[i]);
+#else
+    __asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                         : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+struct CpuFeatures {
+    bool sse42 = false;
+    bool shaNi = false;
+
+    CpuFeatures() {
+        unsigned regs[4];
+        cpuid(0, 0, regs);
+        unsigned maxLeaf = regs[0];
+        cpuid(1, 0, regs);
+        sse42 = (regs[2] >> 20) & 1;
+        bool sse41 = (regs[2] >> 19) & 1;
+        if (maxLeaf >= 7) {
+            cpuid(7, 0, regs);
+            shaNi = sse41 && ((regs[1] >> 29) & 1);
+        }
+    }
+};
+
+static const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features;
+    return features;
+}
+#endif
+
+// --- CRC32C ---
+
+static const uint32_t kCrc32cPoly = 0x82F63B78; // Castagnoli, reflected
+
+// Slicing-by-8 tables for CPUs without a CRC instruction
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ kCrc32cPoly : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int slice = 1; slice < 8; ++slice) {
+                table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+static uint32_t crc32cPortable(uint32_t crc, const unsigned char* data, size_t length) {
+    static const Crc32cTables tables;
+    const auto& t = tables.table;
+    while (length >= 8) {
+        uint64_t word = load64(data) ^ crc;
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^
+              t[4][(word >> 24) & 0xFF] ^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+              t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef STREAMHASH_X86
+TARGET_SSE42
+static uint32_t crc32cSse42(uint32_t crc, const unsigned char* data, size_t length) {
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        crc64 = _mm_crc32_u64(crc64, load64(data));
+        data += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+#ifdef STREAMHASH_ARM_CRC
+static uint32_t crc32cArm(uint32_t crc, const unsigned char* data, size_t length) {
+    while (length >= 8) {
+        crc = __crc32cd(crc, load64(data));
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+// Raw CRC update (no pre/post inversion) with the best kernel for this CPU
+static uint32_t crc32cUpdate(uint32_t crc, const unsigned char* data, size_t length) {
+#if defined(STREAMHASH_ARM_CRC)
+    return crc32cArm(crc, data, length);
+#else
+#ifdef STREAMHASH_X86
+    if (cpuFeatures().sse42) {
+        return crc32cSse42(crc, data, length);
+    }
+#endif
+    return crc32cPortable(crc, data, length);
+#endif
+}
+
+// a * b modulo the CRC polynomial, in the reflected bit order
+static uint32_t multiplyModPoly(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t product = 0;
+    for (;;) {
+        if (a & m) {
+            product ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ kCrc32cPoly : b >> 1;
+    }
+    return product;
+}
+
+uint32_t StreamHash::crc32cCombine(uint32_t first, uint32_t second, uint64_t secondLength) {
+    // x^(2^k) mod P for k = 0..63, so x^(8 * length) takes one multiplication per bit
+    struct PowerTable {
+        uint32_t power[64];
+        PowerTable() {
+            uint32_t p = 1u << 30; // x^1
+            power[0] = p;
+            for (int k = 1; k < 64; ++k) {
+                power[k] = p = multiplyModPoly(p, p);
+            }
+        }
+    };
+    static const PowerTable table;
+
+    uint32_t shift = 1u << 31; // x^0
+    uint64_t bits = secondLength * 8;
+    for (int k = 0; bits != 0 && k < 64; ++k, bits >>= 1) {
+        if (bits & 1) {
+            shift = multiplyModPoly(table.power[k], shift);
+        }
+    }
+    return multiplyModPoly(shift, first) ^ second;
+}
+
+// --- SHA-256 ---
+
+static const uint32_t kSha256Round[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t kSha256Initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline uint32_t loadBigEndian32(const unsigned char* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+static void sha256BlocksPortable(uint32_t state[8], const unsigned char* data, size_t blocks) {
+    while (blocks--) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = loadBigEndian32(data + 4 * i);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) +
+                          kSha256Round[i] + w[i];
+            uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef STREAMHASH_X86
+// SHA extensions: two rounds per sha256rnds2, the message schedule in sha256msg1/2.
+// The state is kept as ABEF/CDGH register pairs as the instructions expect.
+TARGET_SHANI
+static void sha256BlocksShaNi(uint32_t state[8], const unsigned char* data, size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1); // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);    // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);          // CDGH
+
+    while (blocks--) {
+        __m128i saved0 = state0;
+        __m128i saved1 = state1;
+        __m128i w[4];
+        for (int i = 0; i < 4; ++i) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), byteSwap);
+        }
+        for (int group = 0; group < 16; ++group) {
+            __m128i& words = w[group % 4];
+            if (group >= 4) {
+                // W[t..t+3] from W[t-16..t-1]: sigma0 terms, W[t-7], then sigma1 terms
+                const __m128i& w16 = words;
+                const __m128i& w12 = w[(group + 1) % 4];
+                const __m128i& w8 = w[(group + 2) % 4];
+                const __m128i& w4 = w[(group + 3) % 4];
+                words = _mm_sha256msg2_epu32(
+                    _mm_add_epi32(_mm_sha256msg1_epu32(w16, w12), _mm_alignr_epi8(w4, w8, 4)), w4);
+            }
+            __m128i message = _mm_add_epi32(
+                words, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&kSha256Round[4 * group])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);       // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);    // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0); // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);    // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+#endif
+
+static void sha256Blocks(uint32_t state[8], const unsigned char* data, size_t blocks) {
+#ifdef STREAMHASH_X86
+    if (cpuFeatures().shaNi) {
+        sha256BlocksShaNi(state, data, blocks);
+        return;
+    }
+#endif
+    sha256BlocksPortable(state, data, blocks);
+}
+
+// --- SHA-1 ---
+
+static const uint32_t kSha1Initial[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+
+static inline uint32_t rotl32(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+static void sha1Blocks(uint32_t state[5], const unsigned char* data, size_t blocks) {
+    while (blocks--) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = loadBigEndian32(data + 4 * i);
+        }
+        for (int i = 16; i < 80; ++i) {
+            w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5a827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ed9eba1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else { f = b ^ c ^ d; k = 0xca62c1d6; }
+            uint32_t t = rotl32(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rotl32(b, 30); b = a; a = t;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+        data += 64;
+    }
+}
+
+// --- xxHash64 ---
+
+static const uint64_t kXxhPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kXxhPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kXxhPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kXxhPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kXxhPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+
+static inline uint64_t xxhRound(uint64_t accumulator, uint64_t input) {
+    accumulator += input * kXxhPrime2;
+    return rotl64(accumulator, 31) * kXxhPrime1;
+}
+
+static inline uint64_t xxhMerge(uint64_t hash, uint64_t lane) {
+    hash ^= xxhRound(0, lane);
+    return hash * kXxhPrime1 + kXxhPrime4;
+}
+
+static void xxhStripes(uint64_t lanes[4], const unsigned char* data, size_t stripes) {
+    uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    while (stripes--) {
+        v1 = xxhRound(v1, load64(data));
+        v2 = xxhRound(v2, load64(data + 8));
+        v3 = xxhRound(v3, load64(data + 16));
+        v4 = xxhRound(v4, load64(data + 24));
+        data += 32;
+    }
+    lanes[0] = v1; lanes[1] = v2; lanes[2] = v3; lanes[3] = v4;
+}
+
+// --- StreamHash ---
+
+const char* hashAlgorithmName(HashAlgorithm algorithm) {
+    switch (algorithm) {
+    case HashAlgorithm::Crc32c: return "crc32c";
+    case HashAlgorithm::Sha256: return "sha256";
+    case HashAlgorithm::Xxh64: return "xxh64";
+    case HashAlgorithm::Sha1: return "sha1";
+    default: return "none";
+    }
+}
+
+HashAlgorithm hashAlgorithmFromName(const std::string& name) {
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (lower == "crc32c") return HashAlgorithm::Crc32c;
+    if (lower == "sha256" || lower == "sha-256") return HashAlgorithm::Sha256;
+    if (lower == "xxh64" || lower == "xxhash64") return HashAlgorithm::Xxh64;
+    if (lower == "sha1" || lower == "sha-1") return HashAlgorithm::Sha1;
+    return HashAlgorithm::None;
+}
+
+bool parseDigestSpec(const std::string& spec, HashAlgorithm& algorithm, std::string& hexDigest) {
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    algorithm = hashAlgorithmFromName(spec.substr(0, colon));
+    hexDigest = spec.substr(colon + 1);
+    std::transform(hexDigest.begin(), hexDigest.end(), hexDigest.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    size_t expectedLength = algorithm == HashAlgorithm::Sha256 ? 64
+                          : algorithm == HashAlgorithm::Sha1 ? 40
+                          : algorithm == HashAlgorithm::Xxh64 ? 16 : 8;
+    return algorithm != HashAlgorithm::None && hexDigest.size() == expectedLength &&
+           hexDigest.find_first_not_of(kHexDigits) == std::string::npos;
+}
+
+StreamHash::StreamHash(HashAlgorithm algorithm)
+    : algo(algorithm),
+      total(0),
+      crc(0),
+      buffered(0)
+{
+    std::memcpy(sha, kSha256Initial, sizeof(sha));
+    if (algorithm == HashAlgorithm::Sha1) {
+        std::memcpy(sha, kSha1Initial, sizeof(kSha1Initial));
+    }
+    xxh[0] = kXxhPrime1 + kXxhPrime2; // Seed 0
+    xxh[1] = kXxhPrime2;
+    xxh[2] = 0;
+    xxh[3] = 0 - kXxhPrime1;
+    std::memset(buffer, 0, sizeof(buffer));
+}
+
+void StreamHash::update(const void* data, size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    total += length;
+    if (algo == HashAlgorithm::Crc32c) {
+        crc = ~crc32cUpdate(~crc, bytes, length);
+        return;
+    }
+    if (algo != HashAlgorithm::Sha256 && algo != HashAlgorithm::Xxh64 && algo != HashAlgorithm::Sha1) {
+        return;
+    }
+
+    // All work on fixed blocks: fill the partial one first, run whole blocks straight
+    // from the input, keep the rest
+    size_t blockSize = algo == HashAlgorithm::Xxh64 ? 32 : 64;
+    auto process = [this](const unsigned char* blocks, size_t count) {
+        if (algo == HashAlgorithm::Sha256) sha256Blocks(sha, blocks, count);
+        else if (algo == HashAlgorithm::Sha1) sha1Blocks(sha, blocks, count);
+        else xxhStripes(xxh, blocks, count);
+    };
+    if (buffered > 0) {
+        size_t take = std::min(blockSize - buffered, length);
+        std::memcpy(buffer + buffered, bytes, take);
+        buffered += take;
+        bytes += take;
+        length -= take;
+        if (buffered < blockSize) {
+            return;
+        }
+        process(buffer, 1);
+        buffered = 0;
+    }
+    if (length >= blockSize) {
+        size_t count = length / blockSize;
+        process(bytes, count);
+        bytes += count * blockSize;
+        length -= count * blockSize;
+    }
+    std::memcpy(buffer, bytes, length);
+    buffered = length;
+}
+
+std::string StreamHash::hexDigest() const {
+    switch (algo) {
+    case HashAlgorithm::Crc32c: {
+        unsigned char out[4] = {static_cast<unsigned char>(crc >> 24), static_cast<unsigned char>(crc >> 16),
+                                static_cast<unsigned char>(crc >> 8), static_cast<unsigned char>(crc)};
+        return toHex(out, 4);
+    }
+    case HashAlgorithm::Sha256:
+    case HashAlgorithm::Sha1: {
+        // Padding: 0x80, zeros, then the bit length, on a copy of the state
+        uint32_t state[8];
+        std::memcpy(state, sha, sizeof(state));
+        unsigned char tail[128] = {0};
+        std::memcpy(tail, buffer, buffered);
+        tail[buffered] = 0x80;
+        size_t tailLength = buffered < 56 ? 64 : 128;
+        uint64_t bits = total * 8;
+        for (int i = 0; i < 8; ++i) {
+            tail[tailLength - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+        }
+        int words = algo == HashAlgorithm::Sha1 ? 5 : 8;
+        if (algo == HashAlgorithm::Sha1) {
+            sha1Blocks(state, tail, tailLength / 64);
+        } else {
+            sha256Blocks(state, tail, tailLength / 64);
+        }
+        unsigned char out[32];
+        for (int i = 0; i < words; ++i) {
+            out[4 * i] = static_cast<unsigned char>(state[i] >> 24);
+            out[4 * i + 1] = static_cast<unsigned char>(state[i] >> 16);
+            out[4 * i + 2] = static_cast<unsigned char>(state[i] >> 8);
+            out[4 * i + 3] = static_cast<unsigned char>(state[i]);
+        }
+        return toHex(out, 4 * words);
+    }
+    case HashAlgorithm::Xxh64: {
+        uint64_t hash;
+        if (total >= 32) {
+            hash = rotl64(xxh[0], 1) + rotl64(xxh[1], 7) + rotl64(xxh[2], 12) + rotl64(xxh[3], 18);
+            for (int i = 0; i < 4; ++i) {
+                hash = xxhMerge(hash, xxh[i]);
+            }
+        } else {
+            hash = kXxhPrime5; // Seed 0
+        }
+        hash += total;
+        const unsigned char* p = buffer;
+        size_t left = buffered;
+        for (; left >= 8; p += 8, left -= 8) {
+            hash ^= xxhRound(0, load64(p));
+            hash = rotl64(hash, 27) * kXxhPrime1 + kXxhPrime4;
+        }
+        if (left >= 4) {
+            hash ^= static_cast<uint64_t>(load32(p)) * kXxhPrime1;
+            hash = rotl64(hash, 23) * kXxhPrime2 + kXxhPrime3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left > 0; ++p, --left) {
+            hash ^= *p * kXxhPrime5;
+            hash = rotl64(hash, 11) * kXxhPrime1;
+        }
+        hash ^= hash >> 33;
+        hash *= kXxhPrime2;
+        hash ^= hash >> 29;
+        hash *= kXxhPrime3;
+        hash ^= hash >> 32;
+        unsigned char out[8];
+        for (int i = 0; i < 8; ++i) {
+            out[i] = static_cast<unsigned char>(hash >> (56 - 8 * i));
+        }
+        return toHex(out, 8);
+    }
+    default:
+        return std::string();
+    }
+}
+
+std::string StreamHash::save() const {
+    // "<algorithm> <total> <state words...> <buffered bytes as hex>"
+    std::ostringstream out;
+    out << hashAlgorithmName(algo) << ' ' << total;
+    if (algo == HashAlgorithm::Crc32c) {
+        out << ' ' << crc;
+    } else if (algo == HashAlgorithm::Sha256) {
+        for (uint32_t word : sha) out << ' ' << word;
+    } else if (algo == HashAlgorithm::Sha1) {
+        for (int i = 0; i < 5; ++i) out << ' ' << sha[i];
+    } else if (algo == HashAlgorithm::Xxh64) {
+        for (uint64_t lane : xxh) out << ' ' << lane;
+    }
+    out << ' ' << (buffered > 0 ? toHex(buffer, buffered) : "-");
+    return out.str();
+}
+
+bool StreamHash::restore(const std::string& text) {
+    std::istringstream in(text);
+    std::string name;
+    StreamHash state;
+    if (!(in >> name >> state.total)) {
+        return false;
+    }
+    state.algo = hashAlgorithmFromName(name);
+    if (state.algo == HashAlgorithm::Crc32c) {
+        in >> state.crc;
+    } else if (state.algo == HashAlgorithm::Sha256) {
+        for (uint32_t& word : state.sha) in >> word;
+    } else if (state.algo == HashAlgorithm::Sha1) {
+        for (int i = 0; i < 5; ++i) in >> state.sha[i];
+    } else if (state.algo == HashAlgorithm::Xxh64) {
+        for (uint64_t& lane : state.xxh) in >> lane;
+    } else {
+        return false;
+    }
+    std::string hex;
+    if (!(in >> hex)) {
+        return false;
+    }
+    if (hex != "-") {
+        size_t blockSize = state.algo == HashAlgorithm::Xxh64 ? 32 : 64;
+        if (hex.size() % 2 != 0 || hex.size() / 2 >= blockSize ||
+            hex.find_first_not_of(kHexDigits) != std::string::npos) {
+            return false;
+        }
+        state.buffered = hex.size() / 2;
+        for (size_t i = 0; i < state.buffered; ++i) {
+            state.buffer[i] = static_cast<unsigned char>(std::strtoul(hex.substr(2 * i, 2).c_str(), nullptr, 16));
+        }
+    }
+    if (state.total % (state.algo == HashAlgorithm::Xxh64 ? 32 : 64) != state.buffered &&
+        state.algo != HashAlgorithm::Crc32c) {
+        return false;
+    }
+    *this = state;
+    return true;
+}
+
+const char* StreamHash::kernelName(HashAlgorithm algorithm) {
+    switch (algorithm) {
+    case HashAlgorithm::Crc32c:
+#if defined(STREAMHASH_ARM_CRC)
+        return "armv8-crc";
+#else
+#ifdef STREAMHASH_X86
+        if (cpuFeatures().sse42) return "sse4.2";
+#endif
+        return "portable";
+#endif
+    case HashAlgorithm::Sha256:
+#ifdef STREAMHASH_X86
+        if (cpuFeatures().shaNi) return "sha-ni";
+#endif
+        return "portable";
+    case HashAlgorithm::Xxh64:
+        return "scalar";
+    case HashAlgorithm::Sha1:
+        return "portable";
+    default:
+        return "none";
+    }
+}
@@ -0,0 +1,182 @@
+#include "tracer.h"
+#include <QByteArray>
+#include <QSaveFile>
+#include <QString>
+#include <algorithm>
+#include <cstdio>
+
+// Events kept while recording; about 100 bytes each, later ones are counted and dropped
+static const size_t kMaxEvents = 2 * 1000 * 1000;
+// Tracks and processes of newTrack() start above any queue job id
+static const uint64_t kFirstTrack = 1000000;
+
+std::atomic<bool> Tracer::recording{false};
+
+static void appendEscaped(std::string& out, const std::string& value) {
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+}
+
+void TraceArgs::key(const char* name) {
+    if (!text.empty()) {
+        text += ',';
+    }
+    text += '"';
+    text += name;
+    text += "\":";
+}
+
+TraceArgs& TraceArgs::add(const char* name, int64_t value) {
+    key(name);
+    text += std::to_string(value);
+    return *this;
+}
+
+TraceArgs& TraceArgs::add(const char* name, const std::string& value) {
+    key(name);
+    text += '"';
+    appendEscaped(text, value);
+    text += '"';
+    return *this;
+}
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer()
+    : dropped(0),
+      nextTrack(kFirstTrack)
+{
+}
+
+int64_t Tracer::now() {
+    return toUs(std::chrono::steady_clock::now());
+}
+
+int64_t Tracer::toUs(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+}
+
+void Tracer::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    dropped = 0;
+    names[{0, 0}] = "threads";
+    recording.store(true, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::newTrack() {
+    return nextTrack.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Tracer::nameTrack(uint64_t process, uint64_t track, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    names[{process, track}] = name;
+}
+
+uint64_t Tracer::threadTrack(const char* name) {
+    thread_local uint64_t track = 0;
+    if (track == 0) {
+        track = newTrack();
+        nameTrack(0, track, name);
+    }
+    return track;
+}
+
+void Tracer::complete(uint64_t process, uint64_t track, const char* category, const std::string& name,
+                      int64_t startUs, int64_t endUs, const TraceArgs& args) {
+    record({'X', category, name, process, track, startUs, std::max<int64_t>(0, endUs - startUs), args.str()});
+}
+
+void Tracer::instant(uint64_t process, uint64_t track, const char* category, const std::string& name,
+                     const TraceArgs& args) {
+    record({'i', category, name, process, track, now(), 0, args.str()});
+}
+
+void Tracer::record(Event&& event) {
+    if (!enabled()) {
+        return; // Stopped since the caller checked
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() >= kMaxEvents) {
+        ++dropped;
+        return;
+    }
+    events.push_back(std::move(event));
+}
+
+bool Tracer::writeFile(const std::string& path) {
+    recording.store(false, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separate = [&]() {
+        if (!first) {
+            out += ",\n";
+        }
+        first = false;
+    };
+    for (const auto& entry : names) {
+        separate();
+        bool process = entry.first.second == 0;
+        out += std::string("{\"ph\":\"M\",\"name\":\"") + (process ? "process_name" : "thread_name") +
+               "\",\"pid\":" + std::to_string(entry.first.first) +
+               ",\"tid\":" + std::to_string(entry.first.second) + ",\"args\":{\"name\":\"";
+        appendEscaped(out, entry.second);
+        out += "\"}}";
+    }
+    char numbers[96];
+    for (const Event& event : events) {
+        separate();
+        out += "{\"ph\":\"";
+        out += event.phase;
+        out += "\",\"cat\":\"";
+        out += event.category;
+        out += "\",\"name\":\"";
+        appendEscaped(out, event.name);
+        std::snprintf(numbers, sizeof(numbers), "\",\"pid\":%llu,\"tid\":%llu,\"ts\":%lld",
+                      static_cast<unsigned long long>(event.process), static_cast<unsigned long long>(event.track),
+                      static_cast<long long>(event.startUs));
+        out += numbers;
+        if (event.phase == 'X') {
+            out += ",\"dur\":" + std::to_string(event.durationUs);
+        } else {
+            out += ",\"s\":\"t\""; // Instant events belong to their track
+        }
+        if (!event.args.empty()) {
+            out += ",\"args\":{" + event.args + "}";
+        }
+        out += "}";
+    }
+    if (dropped > 0) {
+        separate();
+        out += "{\"ph\":\"i\",\"cat\":\"tracer\",\"name\":\"" + std::to_string(dropped) +
+               " events dropped\",\"pid\":0,\"tid\":0,\"ts\":" + std::to_string(now()) + ",\"s\":\"g\"}";
+    }
+    out += "\n]}\n";
+    events.clear();
+    events.shrink_to_fit();
+
+    QSaveFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    if (file.write(out.data(), static_cast<qint64>(out.size())) != static_cast<qint64>(out.size())) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
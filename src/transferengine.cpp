@@ -0,0 +1,365 @@
+#include "transferengine.h"
+#include "logger.h"
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// Recycled easy handles kept for reuse; more are cleaned up
+static const size_t kMaxIdleHandles = 64;
+
+TransferEngine& TransferEngine::instance() {
+    static TransferEngine engine;
+    return engine;
+}
+
+TransferEngine::TransferEngine()
+    : multi(curl_multi_init()),
+      stopping(false),
+      activeCount(0),
+      nextTimerId(1),
+      curlTimeoutPending(false)
+#ifdef __linux__
+      , epollFd(-1),
+      wakeFd(-1)
+#endif
+{
+    if (!multi) {
+        LOG_ERROR(0) << "Failed to initialize cURL multi handle for the transfer engine.";
+        return;
+    }
+    // Transfers to an HTTP/2 server share its connection as streams
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+#ifdef __linux__
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event wakeEvent{};
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEvent);
+
+    // Let curl tell us which sockets to watch and when its next timeout is due
+    curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socketCallback);
+    curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timerCallback);
+    curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+#endif
+
+    thread = std::thread(&TransferEngine::run, this);
+    threadId = thread.get_id();
+}
+
+TransferEngine::~TransferEngine() {
+    stopping.store(true);
+    wakeUp();
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    // Transfers still registered at exit are dropped without notifying their observers
+    for (auto& entry : observers) {
+        curl_multi_remove_handle(multi, entry.first);
+    }
+    observers.clear();
+    for (CURL* handle : idleHandles) {
+        curl_easy_cleanup(handle);
+    }
+    idleHandles.clear();
+    if (multi) {
+        curl_multi_cleanup(multi);
+    }
+#ifdef __linux__
+    if (wakeFd >= 0) close(wakeFd);
+    if (epollFd >= 0) close(epollFd);
+#endif
+}
+
+void TransferEngine::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        pendingTasks.push_back(std::move(task));
+    }
+    wakeUp();
+}
+
+void TransferEngine::invoke(Task task) {
+    // Running inline avoids a deadlock when invoked from the engine thread itself,
+    // and keeps working during static destruction after the thread has exited
+    if (isEngineThread() || !thread.joinable() || stopping.load()) {
+        task();
+        return;
+    }
+
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    bool done = false;
+    post([&]() {
+        task();
+        std::lock_guard<std::mutex> lock(doneMutex);
+        done = true;
+        doneCondition.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&]() { return done; });
+}
+
+bool TransferEngine::isEngineThread() const {
+    return std::this_thread::get_id() == threadId;
+}
+
+TransferEngine::TimerId TransferEngine::startTimer(int intervalMs, Task task, bool repeat) {
+    Timer timer;
+    timer.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(intervalMs);
+    timer.intervalMs = intervalMs;
+    timer.repeat = repeat;
+    timer.task = std::move(task);
+    TimerId id = nextTimerId++;
+    timers.emplace(id, std::move(timer));
+    return id;
+}
+
+void TransferEngine::stopTimer(TimerId id) {
+    timers.erase(id);
+}
+
+bool TransferEngine::addHandle(CURL* handle, TransferObserver* observer) {
+    if (curl_multi_add_handle(multi, handle) != CURLM_OK) {
+        return false;
+    }
+    observers[handle] = observer;
+    activeCount.store(observers.size());
+    return true;
+}
+
+CURL* TransferEngine::takeHandle() {
+    if (idleHandles.empty()) {
+        return curl_easy_init();
+    }
+    CURL* handle = idleHandles.back();
+    idleHandles.pop_back();
+    return handle;
+}
+
+void TransferEngine::recycleHandle(CURL* handle) {
+    if (!handle) {
+        return;
+    }
+    removeHandle(handle);
+    if (idleHandles.size() >= kMaxIdleHandles) {
+        curl_easy_cleanup(handle);
+        return;
+    }
+    // Options go back to their defaults; the connection itself lives on in the pool
+    curl_easy_reset(handle);
+    idleHandles.push_back(handle);
+}
+
+void TransferEngine::removeHandle(CURL* handle) {
+    if (observers.erase(handle) > 0) {
+        curl_multi_remove_handle(multi, handle);
+        activeCount.store(observers.size());
+    }
+}
+
+void TransferEngine::wakeUp() {
+#ifdef __linux__
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+#else
+    if (multi) {
+        curl_multi_wakeup(multi);
+    }
+#endif
+}
+
+void TransferEngine::runPendingTasks() {
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        tasks.swap(pendingTasks);
+    }
+    for (Task& task : tasks) {
+        task();
+    }
+}
+
+void TransferEngine::runDueTimers() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<TimerId> due;
+    for (const auto& entry : timers) {
+        if (entry.second.deadline <= now) {
+            due.push_back(entry.first);
+        }
+    }
+
+    for (TimerId id : due) {
+        // A previous task may have stopped this timer
+        auto it = timers.find(id);
+        if (it == timers.end()) continue;
+
+        Task task = it->second.task;
+        if (it->second.repeat) {
+            it->second.deadline = now + std::chrono::milliseconds(it->second.intervalMs);
+        } else {
+            timers.erase(it);
+        }
+        task();
+    }
+}
+
+void TransferEngine::processCompletions() {
+    int queued = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        CURL* handle = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        auto it = observers.find(handle);
+        TransferObserver* observer = (it != observers.end()) ? it->second : nullptr;
+
+        // Remove first so the observer is free to clean up or re-add the handle
+        removeHandle(handle);
+        if (observer) {
+            observer->onTransferDone(handle, result);
+        }
+    }
+}
+
+int TransferEngine::nextWaitMs() const {
+    auto now = std::chrono::steady_clock::now();
+    bool haveDeadline = false;
+    std::chrono::steady_clock::time_point deadline;
+
+    if (curlTimeoutPending) {
+        deadline = curlDeadline;
+        haveDeadline = true;
+    }
+    for (const auto& entry : timers) {
+        if (!haveDeadline || entry.second.deadline < deadline) {
+            deadline = entry.second.deadline;
+            haveDeadline = true;
+        }
+    }
+    if (!haveDeadline) {
+        return -1;
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+    return static_cast<int>(std::max<long long>(0, wait));
+}
+
+#ifdef __linux__
+
+// Keeps the epoll set in sync with the sockets curl wants to watch
+int TransferEngine::socketCallback(CURL* handle, curl_socket_t socket, int what, void* userp, void* socketp) {
+    (void)handle;
+    (void)socketp;
+    auto* engine = static_cast<TransferEngine*>(userp);
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(engine->epollFd, EPOLL_CTL_DEL, socket, nullptr);
+        return 0;
+    }
+
+    epoll_event event{};
+    event.data.fd = socket;
+    if (what & CURL_POLL_IN) event.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) event.events |= EPOLLOUT;
+    if (epoll_ctl(engine->epollFd, EPOLL_CTL_MOD, socket, &event) != 0 && errno == ENOENT) {
+        epoll_ctl(engine->epollFd, EPOLL_CTL_ADD, socket, &event);
+    }
+    return 0;
+}
+
+// Remembers when curl_multi_socket_action has to be called with CURL_SOCKET_TIMEOUT
+int TransferEngine::timerCallback(CURLM* multi, long timeoutMs, void* userp) {
+    (void)multi;
+    auto* engine = static_cast<TransferEngine*>(userp);
+    if (timeoutMs < 0) {
+        engine->curlTimeoutPending = false;
+    } else {
+        engine->curlTimeoutPending = true;
+        engine->curlDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    }
+    return 0;
+}
+
+void TransferEngine::run() {
+    const int kMaxEvents = 64;
+    epoll_event events[kMaxEvents];
+    int stillRunning = 0;
+
+    while (!stopping.load()) {
+        int count = epoll_wait(epollFd, events, kMaxEvents, nextWaitMs());
+        if (count < 0 && errno != EINTR) {
+            LOG_ERROR(0) << "Transfer engine: epoll_wait failed, errno " << errno;
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd) {
+                uint64_t value = 0;
+                ssize_t ignored = read(wakeFd, &value, sizeof(value));
+                (void)ignored;
+                continue;
+            }
+            int flags = 0;
+            if (events[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+            if (events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+            curl_multi_socket_action(multi, fd, flags, &stillRunning);
+        }
+
+        if (curlTimeoutPending && curlDeadline <= std::chrono::steady_clock::now()) {
+            curlTimeoutPending = false;
+            curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &stillRunning);
+        }
+
+        processCompletions();
+        runPendingTasks();
+        runDueTimers();
+        // Tasks and timers may have added or removed handles
+        processCompletions();
+    }
+}
+
+#else
+
+// Longest time the fallback loop sleeps in curl_multi_poll when nothing else is due
+static const int kMaxPollWaitMs = 1000;
+
+int TransferEngine::socketCallback(CURL*, curl_socket_t, int, void*, void*) {
+    return 0;
+}
+
+int TransferEngine::timerCallback(CURLM*, long, void*) {
+    return 0;
+}
+
+void TransferEngine::run() {
+    int stillRunning = 0;
+
+    while (!stopping.load()) {
+        curl_multi_perform(multi, &stillRunning);
+        processCompletions();
+        runPendingTasks();
+        runDueTimers();
+
+        int waitMs = nextWaitMs();
+        if (waitMs < 0 || waitMs > kMaxPollWaitMs) {
+            waitMs = kMaxPollWaitMs;
+        }
+        // curl_multi_poll also returns early for curl's own timeouts and curl_multi_wakeup()
+        curl_multi_poll(multi, nullptr, 0, waitMs, nullptr);
+    }
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "writestage.h"
+#include "logger.h"
+#include "tracer.h"
+#include <algorithm>
+
+WriteStage& WriteStage::instance() {
+    static WriteStage stage;
+    return stage;
+}
+
+WriteStage::WriteStage()
+    : stopping(false)
+{
+    thread = std::thread(&WriteStage::run, this);
+}
+
+WriteStage::~WriteStage() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void WriteStage::submit(StorageBackend* backend, int64_t offset, StorageBuffer&& buffer, size_t reserved) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        PendingWrite write;
+        write.backend = backend;
+        write.offset = offset;
+        write.buffer.swap(buffer);
+        write.reserved = reserved;
+        write.queuedAt = std::chrono::steady_clock::now();
+        counters.queuedBytes += write.buffer.size();
+        ++counters.queuedWrites;
+        ++pendingPerBackend[backend];
+        queue.push_back(std::move(write));
+    }
+    queueCondition.notify_one();
+}
+
+void WriteStage::submitTask(StorageBackend* backend, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        PendingWrite entry;
+        entry.backend = backend;
+        entry.queuedAt = std::chrono::steady_clock::now();
+        entry.task = std::move(task);
+        ++pendingPerBackend[backend];
+        queue.push_back(std::move(entry));
+    }
+    queueCondition.notify_one();
+}
+
+bool WriteStage::drain(StorageBackend* backend) {
+    std::unique_lock<std::mutex> lock(mutex);
+    drainCondition.wait(lock, [&]() {
+        auto it = pendingPerBackend.find(backend);
+        return it == pendingPerBackend.end() || it->second == 0;
+    });
+    pendingPerBackend.erase(backend);
+    bool ok = !failedBackends[backend];
+    failedBackends.erase(backend);
+    return ok;
+}
+
+bool WriteStage::failed(StorageBackend* backend) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = failedBackends.find(backend);
+    return it != failedBackends.end() && it->second;
+}
+
+WriteStage::Stats WriteStage::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats snapshot = counters;
+    if (!queue.empty()) {
+        snapshot.writerLagMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - queue.front().queuedAt).count();
+    }
+    return snapshot;
+}
+
+void WriteStage::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queueCondition.wait(lock, [&]() { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return; // Stopping and nothing left to write
+        }
+
+        PendingWrite write = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        if (write.task) {
+            write.task();
+            lock.lock();
+            --pendingPerBackend[write.backend];
+            drainCondition.notify_all();
+            continue;
+        }
+
+        size_t length = write.buffer.size();
+        int64_t traceStartUs = Tracer::enabled() ? Tracer::now() : 0;
+        bool ok = write.backend->writeChunk(write.offset, write.buffer, write.reserved);
+        if (traceStartUs != 0) {
+            Tracer& tracer = Tracer::instance();
+            tracer.complete(0, tracer.threadTrack("write stage"), "disk", "write chunk", traceStartUs, Tracer::now(),
+                            TraceArgs().add("offset", write.offset).add("bytes", static_cast<int64_t>(length)));
+        }
+
+        lock.lock();
+        counters.queuedBytes -= length;
+        --counters.queuedWrites;
+        if (ok) {
+            counters.bytesWritten += length;
+        } else {
+            failedBackends[write.backend] = true;
+            LOG_ERROR(0) << "Write stage: writing " << length << " bytes at offset " << write.offset
+                         << " with " << write.backend->name() << " failed";
+        }
+        --pendingPerBackend[write.backend];
+        drainCondition.notify_all();
+    }
+}
@@ -0,0 +1,446 @@
+#include "zsync.h"
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define ZSYNC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Old file read per step of the scan
+static const int64_t kScanChunk = 16 * 1024 * 1024;
+// Largest block size accepted, zsyncmake uses 2 KiB or 4 KiB
+static const int64_t kMaxBlockSize = 1024 * 1024;
+
+static const char* kHexDigits = "0123456789abcdef";
+
+// --- MD4 (RFC 1320), the strong checksum of zsync ---
+
+static inline uint32_t rotl32(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+static void md4Block(uint32_t state[4], const unsigned char* data) {
+    uint32_t x[16];
+    for (int i = 0; i < 16; ++i) {
+        x[i] = static_cast<uint32_t>(data[4 * i]) | (static_cast<uint32_t>(data[4 * i + 1]) << 8) |
+               (static_cast<uint32_t>(data[4 * i + 2]) << 16) | (static_cast<uint32_t>(data[4 * i + 3]) << 24);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    static const int kShift1[4] = {3, 7, 11, 19};
+    static const int kShift2[4] = {3, 5, 9, 13};
+    static const int kShift3[4] = {3, 9, 11, 15};
+    static const int kOrder3[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+    for (int i = 0; i < 16; ++i) {
+        uint32_t t = rotl32(a + ((b & c) | (~b & d)) + x[i], kShift1[i % 4]);
+        a = d; d = c; c = b; b = t;
+    }
+    for (int i = 0; i < 16; ++i) {
+        int k = (i % 4) * 4 + i / 4;
+        uint32_t t = rotl32(a + ((b & c) | (b & d) | (c & d)) + x[k] + 0x5a827999, kShift2[i % 4]);
+        a = d; d = c; c = b; b = t;
+    }
+    for (int i = 0; i < 16; ++i) {
+        uint32_t t = rotl32(a + (b ^ c ^ d) + x[kOrder3[i]] + 0x6ed9eba1, kShift3[i % 4]);
+        a = d; d = c; c = b; b = t;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+}
+
+static void md4(const unsigned char* data, size_t length, unsigned char out[16]) {
+    uint32_t state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    size_t whole = length / 64;
+    for (size_t i = 0; i < whole; ++i) {
+        md4Block(state, data + 64 * i);
+    }
+    unsigned char tail[128] = {0};
+    size_t rest = length - whole * 64;
+    std::memcpy(tail, data + whole * 64, rest);
+    tail[rest] = 0x80;
+    size_t tailLength = rest < 56 ? 64 : 128;
+    uint64_t bits = static_cast<uint64_t>(length) * 8;
+    for (int i = 0; i < 8; ++i) {
+        tail[tailLength - 8 + i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+    for (size_t i = 0; i < tailLength / 64; ++i) {
+        md4Block(state, tail + 64 * i);
+    }
+    for (int i = 0; i < 16; ++i) {
+        out[i] = static_cast<unsigned char>(state[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+// --- Rolling checksum ---
+
+// a = sum of the bytes, b = sum of (length - i) * byte i, both modulo 2^16
+struct RollingSum {
+    uint16_t a = 0;
+    uint16_t b = 0;
+
+    uint32_t value() const { return (static_cast<uint32_t>(a) << 16) | b; }
+    // Moves the window one byte on: out leaves, in enters (blocks of 2^shift bytes)
+    void roll(unsigned char out, unsigned char in, int shift) {
+        a = static_cast<uint16_t>(a + in - out);
+        b = static_cast<uint16_t>(b + a - (static_cast<uint32_t>(out) << shift));
+    }
+};
+
+// Checksum of a whole window, used at the start and after every matched block
+static RollingSum rollingSum(const unsigned char* data, size_t length) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+    size_t i = 0;
+#ifdef ZSYNC_SSE2
+    // 16 bytes per step: psadbw adds them up, pmaddwd weighs them 16..1. The weight of
+    // the chunks before (16 for each later chunk) is added through the running sum.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightsLow = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weightsHigh = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i sums = zero;      // Byte sum so far, in two 64-bit lanes
+    __m128i previous = zero;  // Sum of the byte sums before each chunk
+    __m128i weighted = zero;  // Weighted sums within the chunks, 4 x 32 bit
+    size_t chunks = length / 16;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * chunk));
+        previous = _mm_add_epi32(previous, sums);
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes, zero));
+        weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsLow));
+        weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsHigh));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+    a = lanes[0] + lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), previous);
+    uint32_t before = lanes[0] + lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), weighted);
+    // So far the weights are those of a window of 16 * chunks bytes; the rest of the
+    // window adds (length - 16 * chunks) to each of them
+    i = 16 * chunks;
+    b = 16 * before + lanes[0] + lanes[1] + lanes[2] + lanes[3] + static_cast<uint32_t>(length - i) * a;
+#endif
+    for (; i < length; ++i) {
+        a += data[i];
+        b += static_cast<uint32_t>(length - i) * data[i];
+    }
+    RollingSum sum;
+    sum.a = static_cast<uint16_t>(a);
+    sum.b = static_cast<uint16_t>(b);
+    return sum;
+}
+
+// --- ZsyncManifest ---
+
+bool ZsyncManifest::load(const std::string& path) {
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        lastError = "cannot read " + path;
+        return false;
+    }
+    return parse(file.readAll());
+}
+
+bool ZsyncManifest::parse(const QByteArray& document) {
+    *this = ZsyncManifest();
+    const char* data = document.constData();
+    size_t size = static_cast<size_t>(document.size());
+    size_t position = 0;
+    bool compressedOnly = false;
+
+    // "Key: value" lines up to an empty line, then the checksums
+    while (true) {
+        const char* end = static_cast<const char*>(std::memchr(data + position, '\n', size - position));
+        if (!end) {
+            lastError = "truncated zsync header";
+            return false;
+        }
+        std::string line(data + position, static_cast<size_t>(end - (data + position)));
+        position = static_cast<size_t>(end - data) + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            break;
+        }
+        size_t colon = line.find(": ");
+        if (colon == std::string::npos) {
+            lastError = "malformed zsync header line: " + line;
+            return false;
+        }
+        std::string key = line.substr(0, colon);
+        std::string value = line.substr(colon + 2);
+        if (key == "zsync") {
+            continue;
+        } else if (key == "Filename") {
+            name = value;
+        } else if (key == "Blocksize") {
+            blockBytes = std::strtoll(value.c_str(), nullptr, 10);
+        } else if (key == "Length") {
+            fileLength = std::strtoll(value.c_str(), nullptr, 10);
+        } else if (key == "Hash-Lengths") {
+            // "<sequence matches>,<rolling checksum bytes>,<MD4 bytes>"
+            char* next = nullptr;
+            sequenceMatches = static_cast<int>(std::strtol(value.c_str(), &next, 10));
+            weakBytes = *next == ',' ? static_cast<int>(std::strtol(next + 1, &next, 10)) : 0;
+            strongBytes = *next == ',' ? static_cast<int>(std::strtol(next + 1, &next, 10)) : 0;
+        } else if (key == "URL") {
+            fileUrls.push_back(value);
+        } else if (key == "Z-URL") {
+            compressedOnly = true;
+        } else if (key == "SHA-1") {
+            fileSha1 = value;
+            std::transform(fileSha1.begin(), fileSha1.end(), fileSha1.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        }
+    }
+
+    if (blockBytes <= 0 || blockBytes > kMaxBlockSize || (blockBytes & (blockBytes - 1)) != 0 || fileLength < 0) {
+        lastError = "unsupported zsync block size or length";
+        return false;
+    }
+    if (sequenceMatches < 1 || sequenceMatches > 2 || weakBytes < 1 || weakBytes > 4 ||
+        strongBytes < 3 || strongBytes > 16) {
+        lastError = "unsupported zsync Hash-Lengths";
+        return false;
+    }
+    if (fileUrls.empty() && compressedOnly) {
+        lastError = "zsync file only describes a compressed download";
+        return false;
+    }
+    if (!fileSha1.empty() && (fileSha1.size() != 40 || fileSha1.find_first_not_of(kHexDigits) != std::string::npos)) {
+        fileSha1.clear();
+    }
+
+    // Divided rather than multiplied out, a huge Length must not wrap around
+    uint64_t blocks = static_cast<uint64_t>(fileLength / blockBytes + (fileLength % blockBytes != 0));
+    size_t entryBytes = static_cast<size_t>(weakBytes + strongBytes);
+    if (blocks > (size - position) / entryBytes) {
+        lastError = "zsync checksums are truncated";
+        return false;
+    }
+    weakSums.resize(blocks);
+    strongSums.resize(blocks * static_cast<size_t>(strongBytes));
+    const unsigned char* entry = reinterpret_cast<const unsigned char*>(data + position);
+    for (size_t block = 0; block < blocks; ++block, entry += entryBytes) {
+        // The last weakBytes bytes of the big-endian a and b
+        uint32_t weak = 0;
+        for (int i = 0; i < weakBytes; ++i) {
+            weak = (weak << 8) | entry[i];
+        }
+        weakSums[block] = weak;
+        std::memcpy(&strongSums[block * static_cast<size_t>(strongBytes)], entry + weakBytes,
+                    static_cast<size_t>(strongBytes));
+    }
+    return true;
+}
+
+// --- ZsyncScan ---
+
+ZsyncScan::ZsyncScan(std::shared_ptr<const ZsyncManifest> manifest, const std::string& sourcePath,
+                     const std::string& outputPath)
+    : manifest(std::move(manifest)),
+      sourcePath(sourcePath),
+      outputPath(outputPath)
+{
+}
+
+void ZsyncScan::run() {
+    const ZsyncManifest& m = *manifest;
+    const size_t blocks = m.blockCount();
+    const size_t blockSize = static_cast<size_t>(m.blockBytes);
+    int shift = 0;
+    while ((static_cast<size_t>(1) << shift) < blockSize) {
+        ++shift;
+    }
+    const uint32_t weakMask = m.weakBytes == 4 ? 0xffffffffu : (1u << (8 * m.weakBytes)) - 1;
+    found.assign(blocks, false);
+
+    QFile source(QString::fromStdString(sourcePath));
+    QFile output(QString::fromStdString(outputPath));
+    if (!source.open(QIODevice::ReadOnly)) {
+        error = "cannot read " + sourcePath;
+        finished.store(true);
+        return;
+    }
+    if (!output.open(QIODevice::ReadWrite | QIODevice::Truncate) || !output.resize(m.fileLength)) {
+        error = "cannot create " + outputPath;
+        finished.store(true);
+        return;
+    }
+
+    // Blocks by rolling checksum, and a bit filter in front of the binary search that
+    // rejects most offsets with one memory access
+    std::vector<std::pair<uint32_t, uint32_t>> index(blocks); // (weak sum, block)
+    for (size_t block = 0; block < blocks; ++block) {
+        index[block] = {m.weakSums[block], static_cast<uint32_t>(block)};
+    }
+    std::sort(index.begin(), index.end());
+    int filterBits = 16;
+    while ((static_cast<size_t>(1) << filterBits) < 8 * blocks && filterBits < 30) {
+        ++filterBits;
+    }
+    std::vector<uint64_t> filter((static_cast<size_t>(1) << filterBits) / 64 + 1, 0);
+    auto filterSlot = [filterBits](uint32_t weak) { return (weak * 2654435761u) >> (32 - filterBits); };
+    for (const auto& entry : index) {
+        uint32_t slot = filterSlot(entry.first);
+        filter[slot / 64] |= static_cast<uint64_t>(1) << (slot % 64);
+    }
+
+    auto strongMatches = [&m](size_t block, const unsigned char* digest) {
+        return std::memcmp(&m.strongSums[block * static_cast<size_t>(m.strongBytes)], digest,
+                           static_cast<size_t>(m.strongBytes)) == 0;
+    };
+    auto store = [&](size_t block, const unsigned char* data) {
+        int64_t offset = static_cast<int64_t>(block) * m.blockBytes;
+        int64_t length = std::min<int64_t>(m.blockBytes, m.fileLength - offset);
+        found[block] = true;
+        reusedBytes += length;
+        return output.seek(offset) && output.write(reinterpret_cast<const char*>(data), length) == length;
+    };
+
+    // The window and, for sequence matches, the block after it must be in the buffer.
+    // The file is followed by zeros, as zsyncmake pads the last block.
+    const size_t lookahead = 2 * blockSize;
+    std::vector<unsigned char> buffer(static_cast<size_t>(kScanChunk) + lookahead);
+    size_t filled = 0;     // Bytes in buffer
+    size_t dataEnd = 0;    // Bytes of the file in buffer, the rest is padding
+    size_t x = 0;          // Window start in buffer
+    bool atEnd = false;
+    bool fresh = true;
+    RollingSum sum;
+    size_t remaining = blocks;
+    unsigned char digest[16];
+    unsigned char nextDigest[16];
+
+    while (remaining > 0 && !cancelled.load()) {
+        if (filled - x < lookahead + 1 && !atEnd) {
+            // Keep the current window, read what follows it
+            std::memmove(buffer.data(), buffer.data() + x, filled - x);
+            filled -= x;
+            dataEnd = filled;
+            scannedBytes.fetch_add(static_cast<int64_t>(x));
+            x = 0;
+            qint64 got = source.read(reinterpret_cast<char*>(buffer.data()) + filled,
+                                     static_cast<qint64>(buffer.size() - filled));
+            if (got < 0) {
+                error = "cannot read " + sourcePath;
+                finished.store(true);
+                return;
+            }
+            filled += static_cast<size_t>(got);
+            dataEnd = filled;
+            if (got == 0) {
+                atEnd = true;
+                size_t padding = std::min(lookahead, buffer.size() - filled);
+                std::memset(buffer.data() + filled, 0, padding);
+                filled += padding;
+            }
+            continue;
+        }
+        if (x >= dataEnd || filled - x < blockSize) {
+            break; // Every window that starts in the file was looked at
+        }
+        if (fresh) {
+            sum = rollingSum(buffer.data() + x, blockSize);
+            fresh = false;
+        }
+
+        uint32_t weak = sum.value() & weakMask;
+        uint32_t slot = filterSlot(weak);
+        bool matched = false;
+        if (filter[slot / 64] & (static_cast<uint64_t>(1) << (slot % 64))) {
+            auto range = std::equal_range(index.begin(), index.end(), std::make_pair(weak, 0u),
+                                          [](const std::pair<uint32_t, uint32_t>& l, const std::pair<uint32_t, uint32_t>& r) {
+                                              return l.first < r.first;
+                                          });
+            bool hashed = false;
+            bool nextWeakDone = false;
+            bool nextHashed = false;
+            uint32_t nextWeak = 0;
+            bool haveNext = filled - x >= 2 * blockSize;
+            for (auto it = range.first; it != range.second; ++it) {
+                size_t block = it->second;
+                bool wanted = !found[block] || (m.sequenceMatches > 1 && block + 1 < blocks && !found[block + 1]);
+                if (!wanted) {
+                    continue;
+                }
+                // With sequence matches the following block has to match as well,
+                // which makes up for the few bytes kept of each checksum
+                bool needNext = m.sequenceMatches > 1 && block + 1 < blocks;
+                if (needNext) {
+                    if (!haveNext) continue;
+                    if (!nextWeakDone) {
+                        nextWeak = rollingSum(buffer.data() + x + blockSize, blockSize).value() & weakMask;
+                        nextWeakDone = true;
+                    }
+                    if (nextWeak != m.weakSums[block + 1]) {
+                        continue;
+                    }
+                }
+                if (!hashed) {
+                    md4(buffer.data() + x, blockSize, digest);
+                    hashed = true;
+                }
+                if (!strongMatches(block, digest)) {
+                    continue;
+                }
+                if (needNext) {
+                    if (!nextHashed) {
+                        md4(buffer.data() + x + blockSize, blockSize, nextDigest);
+                        nextHashed = true;
+                    }
+                    if (!strongMatches(block + 1, nextDigest)) {
+                        continue;
+                    }
+                }
+                bool written = true;
+                if (!found[block]) {
+                    written = store(block, buffer.data() + x);
+                    --remaining;
+                }
+                if (needNext && !found[block + 1]) {
+                    written = store(block + 1, buffer.data() + x + blockSize) && written;
+                    --remaining;
+                }
+                if (!written) {
+                    error = "cannot write " + outputPath;
+                    finished.store(true);
+                    return;
+                }
+                matched = true;
+            }
+        }
+
+        if (matched) {
+            // The next block of the old file is likely the next one of the new file too
+            x += blockSize;
+            fresh = true;
+        } else {
+            sum.roll(buffer[x], buffer[x + blockSize], shift);
+            ++x;
+        }
+    }
+    scannedBytes.fetch_add(static_cast<int64_t>(std::min(x, dataEnd)));
+    ok = !cancelled.load() && output.flush();
+    finished.store(true);
+}
+
+std::vector<std::pair<int64_t, int64_t>> ZsyncScan::missingRanges(int64_t mergeGap) const {
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    const int64_t blockSize = manifest->blockSize();
+    const int64_t length = manifest->length();
+    for (size_t block = 0; block < found.size(); ++block) {
+        if (found[block]) {
+            continue;
+        }
+        int64_t first = static_cast<int64_t>(block) * blockSize;
+        int64_t last = std::min(first + blockSize, length) - 1;
+        if (!ranges.empty() && first - ranges.back().second - 1 < mergeGap) {
+            ranges.back().second = last;
+        } else {
+            ranges.push_back({first, last});
+        }
+    }
+    return ranges;
+}
@@ -0,0 +1,250 @@
+#include "metalink.h"
+#include "resumejournal.h"
+#include "zsync.h"
+#include <QByteArray>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+
+// The parsers behind Metalink input, delta downloads and resume journals. They are pure
+// functions of their input, so each edge case is one small document.
+class ParserTest : public QObject {
+    Q_OBJECT
+private slots:
+    void metalinkOrdersMirrors();
+    void metalinkKeepsStrongestHash();
+    void metalinkChecksPieces();
+    void metalinkRejectsUnusableDocuments();
+    void metalinkFileNames();
+    void journalRoundTrip();
+    void journalRejectsDamagedFiles();
+    void zsyncReadsChecksums();
+    void zsyncChecksHashLengths();
+    void zsyncRejectsUnusableDocuments();
+};
+
+static QByteArray metalinkDocument(const QByteArray& files) {
+    return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+           "<metalink xmlns=\"urn:ietf:params:xml:ns:metalink\">\n" + files + "</metalink>\n";
+}
+
+void ParserTest::metalinkOrdersMirrors() {
+    Metalink metalink;
+    QVERIFY(metalink.parse(metalinkDocument(
+        "<file name=\"dir/example.iso\"><size>10</size>"
+        "<url priority=\"2\">http://b.example/f</url>"
+        "<url>http://c.example/f</url>"
+        "<url priority=\"1\">https://a.example/f</url>"
+        "<url priority=\"1\">ftp://d.example/f</url>"
+        "</file>")));
+    QCOMPARE(metalink.files().size(), size_t(1));
+    const Metalink::File& file = metalink.files()[0];
+    QCOMPARE(file.name, std::string("dir/example.iso"));
+    QCOMPARE(file.size, int64_t(10));
+    // Lowest priority number first, unprioritized last, other schemes left out
+    QCOMPARE(file.urls, (std::vector<std::string>{"https://a.example/f", "http://b.example/f", "http://c.example/f"}));
+    QCOMPARE(file.hashAlgorithm, HashAlgorithm::None);
+    QVERIFY(file.pieces.empty());
+}
+
+void ParserTest::metalinkKeepsStrongestHash() {
+    Metalink metalink;
+    QVERIFY(metalink.parse(metalinkDocument(
+        "<file name=\"f\"><url>http://a.example/f</url>"
+        "<hash type=\"crc32c\">0a0b0c0d</hash>"
+        "<hash type=\"sha-256\">" + QByteArray(64, 'A') + "</hash>"
+        "<hash type=\"sha-1\">" + QByteArray(39, 'b') + "</hash>"
+        "<hash type=\"md5\">" + QByteArray(32, 'c') + "</hash>"
+        "</file>")));
+    const Metalink::File& file = metalink.files()[0];
+    QCOMPARE(file.hashAlgorithm, HashAlgorithm::Sha256);
+    QCOMPARE(file.hash, std::string(64, 'a'));
+}
+
+void ParserTest::metalinkChecksPieces() {
+    const QByteArray piece = "<hash>" + QByteArray(40, '1') + "</hash>";
+    Metalink metalink;
+    // 10 bytes in pieces of 4: three pieces
+    QVERIFY(metalink.parse(metalinkDocument(
+        "<file name=\"f\"><size>10</size><url>http://a.example/f</url>"
+        "<pieces type=\"sha-1\" length=\"4\">" + piece + piece + piece + "</pieces></file>")));
+    QCOMPARE(metalink.files()[0].pieceAlgorithm, HashAlgorithm::Sha1);
+    QCOMPARE(metalink.files()[0].pieceLength, int64_t(4));
+    QCOMPARE(metalink.files()[0].pieces.size(), size_t(3));
+
+    // A count that does not add up to the size is dropped, the file is still usable
+    QVERIFY(metalink.parse(metalinkDocument(
+        "<file name=\"f\"><size>10</size><url>http://a.example/f</url>"
+        "<pieces type=\"sha-1\" length=\"4\">" + piece + piece + "</pieces></file>")));
+    QCOMPARE(metalink.files()[0].pieceAlgorithm, HashAlgorithm::None);
+    QCOMPARE(metalink.files()[0].pieceLength, int64_t(0));
+    QVERIFY(metalink.files()[0].pieces.empty());
+
+    // So is a set with a malformed digest or without a length
+    QVERIFY(metalink.parse(metalinkDocument(
+        "<file name=\"f\"><size>10</size><url>http://a.example/f</url>"
+        "<pieces type=\"sha-1\" length=\"4\">" + piece + "<hash>xyz</hash>" + piece + "</pieces></file>")));
+    QVERIFY(metalink.files()[0].pieces.empty());
+    QVERIFY(metalink.parse(metalinkDocument(
+        "<file name=\"f\"><size>10</size><url>http://a.example/f</url>"
+        "<pieces type=\"sha-1\">" + piece + piece + piece + "</pieces></file>")));
+    QVERIFY(metalink.files()[0].pieces.empty());
+}
+
+void ParserTest::metalinkRejectsUnusableDocuments() {
+    Metalink metalink;
+    // Metalink 3 has another namespace
+    QVERIFY(!metalink.parse("<metalink xmlns=\"http://www.metalinker.org/\"><files/></metalink>"));
+    QVERIFY(!metalink.error().empty());
+    QVERIFY(!metalink.parse(metalinkDocument("<file name=\"f\"><url>ftp://a.example/f</url></file>")));
+    QVERIFY(metalink.files().empty());
+    QVERIFY(!metalink.parse(metalinkDocument("<file name=\"f\"><url>http://a.example/f</url>")));
+    QVERIFY(metalink.files().empty());
+    QVERIFY(!metalink.load("/nonexistent/file.meta4"));
+}
+
+void ParserTest::metalinkFileNames() {
+    QCOMPARE(Metalink::safeFileName("../../etc/passwd"), std::string("passwd"));
+    QCOMPARE(Metalink::safeFileName("dir\\file.iso"), std::string("file.iso"));
+    QCOMPARE(Metalink::safeFileName("dir/.."), std::string());
+    QCOMPARE(Metalink::safeFileName("dir/"), std::string());
+    QVERIFY(Metalink::isMetalinkPath("release.META4"));
+    QVERIFY(Metalink::isMetalinkPath("release.metalink"));
+    QVERIFY(!Metalink::isMetalinkPath("release.meta4.txt"));
+}
+
+void ParserTest::journalRoundTrip() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const std::string path = ResumeJournal::pathFor(dir.filePath("out.bin").toStdString());
+    // 37 bytes in blocks of 4: ten blocks, the last one a single byte
+    ResumeJournal journal;
+    journal.reset("http://a.example/f", 37, "\"v1\"", "Tue, 01 Jan 2030 00:00:00 GMT", 4);
+    journal.markRange(0, 13); // Blocks 0 to 2, the partial block 3 is not done
+    journal.markRange(36, 37);
+    ResumeJournal::HashState hashes;
+    hashes.algorithm = "crc32c";
+    hashes.blockSize = 4;
+    hashes.blockDigests = {"0a0b0c0d", "", "01020304"};
+    hashes.frontierOffset = 12;
+    hashes.frontierState = "state";
+    journal.setHashState(hashes);
+    QVERIFY(journal.save(path));
+
+    ResumeJournal loaded;
+    QVERIFY(loaded.load(path));
+    QCOMPARE(loaded.url(), std::string("http://a.example/f"));
+    QCOMPARE(loaded.size(), int64_t(37));
+    QCOMPARE(loaded.blockSize(), int64_t(4));
+    QCOMPARE(loaded.blockCount(), size_t(10));
+    for (size_t block = 0; block < loaded.blockCount(); ++block) {
+        QCOMPARE(loaded.blockDone(block), block < 3 || block == 9);
+    }
+    QCOMPARE(loaded.completedBytes(), int64_t(13));
+    std::vector<ResumeJournal::Run> runs = loaded.runs();
+    QCOMPARE(runs.size(), size_t(3));
+    QCOMPARE(runs[0].first, int64_t(0));
+    QCOMPARE(runs[0].last, int64_t(11));
+    QVERIFY(runs[0].done);
+    QCOMPARE(runs[1].first, int64_t(12));
+    QCOMPARE(runs[1].last, int64_t(35));
+    QVERIFY(!runs[1].done);
+    QCOMPARE(runs[2].first, int64_t(36));
+    QCOMPARE(runs[2].last, int64_t(36));
+    QVERIFY(runs[2].done);
+
+    // The validator that was saved decides, a changed file starts over
+    QVERIFY(loaded.matches("http://a.example/f", 37, "\"v1\"", ""));
+    QVERIFY(!loaded.matches("http://a.example/f", 37, "\"v2\"", ""));
+    QVERIFY(!loaded.matches("http://a.example/f", 38, "\"v1\"", ""));
+    QCOMPARE(loaded.ifRangeValue(), std::string("\"v1\""));
+
+    const ResumeJournal::HashState& restored = loaded.hashState();
+    QCOMPARE(restored.algorithm, hashes.algorithm);
+    QCOMPARE(restored.blockSize, hashes.blockSize);
+    QCOMPARE(restored.blockDigests, hashes.blockDigests);
+    QCOMPARE(restored.frontierOffset, hashes.frontierOffset);
+    QCOMPARE(restored.frontierState, hashes.frontierState);
+}
+
+static bool loadJournalText(const QTemporaryDir& dir, const QByteArray& text) {
+    QFile file(dir.filePath("out.bin.journal"));
+    if (!file.open(QIODevice::WriteOnly) || file.write(text) != text.size()) {
+        return false;
+    }
+    file.close();
+    ResumeJournal journal;
+    return journal.load(file.fileName().toStdString());
+}
+
+void ParserTest::journalRejectsDamagedFiles() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QByteArray header = "url http://a.example/f\nsize 37\nblock-size 4\n";
+    // Ten blocks take two bitmap bytes
+    QVERIFY(loadJournalText(dir, "download-journal 1\n" + header + "blocks 0702\n"));
+    QVERIFY(!loadJournalText(dir, "download-journal 2\n" + header + "blocks 0702\n"));
+    QVERIFY(!loadJournalText(dir, "download-journal 1\n" + header + "blocks 070\n"));
+    QVERIFY(!loadJournalText(dir, "download-journal 1\n" + header + "blocks 070200\n"));
+    QVERIFY(!loadJournalText(dir, "download-journal 1\n" + header + "blocks 07zz\n"));
+    // A corrupt size is refused before a bitmap for it is allocated
+    QVERIFY(!loadJournalText(dir, "download-journal 1\nurl http://a.example/f\nsize 4611686018427387904\n"
+                                  "block-size 1\nblocks 00\n"));
+    ResumeJournal journal;
+    QVERIFY(!journal.load(dir.filePath("missing.journal").toStdString()));
+}
+
+// A zsync control file, by default for a 10 byte file in blocks of 4, followed by
+// checksums bytes of block checksums
+static QByteArray zsyncDocument(const QByteArray& hashLengths, int checksums,
+                                const QByteArray& length = "10", const QByteArray& blockSize = "4") {
+    return "zsync: 0.6.2\nFilename: f\nBlocksize: " + blockSize + "\nLength: " + length +
+           "\nHash-Lengths: " + hashLengths + "\nURL: f\nSHA-1: " + QByteArray(40, 'A') + "\n\n" +
+           QByteArray(checksums, '\x01');
+}
+
+void ParserTest::zsyncReadsChecksums() {
+    ZsyncManifest manifest;
+    // Three blocks of one rolling checksum byte and three MD4 bytes
+    QVERIFY(manifest.parse(zsyncDocument("1,2,3", 15)));
+    QCOMPARE(manifest.fileName(), std::string("f"));
+    QCOMPARE(manifest.length(), int64_t(10));
+    QCOMPARE(manifest.blockSize(), int64_t(4));
+    QCOMPARE(manifest.blockCount(), size_t(3));
+    QCOMPARE(manifest.sha1(), std::string(40, 'a'));
+    QCOMPARE(manifest.urls(), std::vector<std::string>{"f"});
+
+    // A malformed SHA-1 is dropped, the blocks are still usable
+    QVERIFY(manifest.parse("zsync: 0.6.2\r\nBlocksize: 4\r\nLength: 4\r\nHash-Lengths: 1,2,3\r\n"
+                           "URL: f\r\nSHA-1: abc\r\n\r\n" + QByteArray(5, '\x01')));
+    QCOMPARE(manifest.blockCount(), size_t(1));
+    QVERIFY(manifest.sha1().empty());
+}
+
+void ParserTest::zsyncChecksHashLengths() {
+    ZsyncManifest manifest;
+    QVERIFY(manifest.parse(zsyncDocument("2,4,16", 60)));
+    QVERIFY(!manifest.parse(zsyncDocument("1,0,3", 9)));
+    QVERIFY(!manifest.parse(zsyncDocument("3,2,3", 15)));
+    QVERIFY(!manifest.parse(zsyncDocument("1,2,2", 12)));
+    QVERIFY(!manifest.parse(zsyncDocument("1,5,16", 63)));
+    QCOMPARE(manifest.error(), std::string("unsupported zsync Hash-Lengths"));
+}
+
+void ParserTest::zsyncRejectsUnusableDocuments() {
+    ZsyncManifest manifest;
+    QVERIFY(!manifest.parse(zsyncDocument("1,2,3", 14)));
+    QCOMPARE(manifest.error(), std::string("zsync checksums are truncated"));
+    QCOMPARE(manifest.blockCount(), size_t(0));
+    // A length whose block count overflows when multiplied out
+    QVERIFY(!manifest.parse(zsyncDocument("1,2,3", 15, "9223372036854775807", "1")));
+    QCOMPARE(manifest.error(), std::string("zsync checksums are truncated"));
+    QVERIFY(!manifest.parse(zsyncDocument("1,2,3", 20, "10", "3")));
+    QVERIFY(!manifest.parse("zsync: 0.6.2\nBlocksize: 4\nLength: 10\n"));
+    QCOMPARE(manifest.error(), std::string("truncated zsync header"));
+    QVERIFY(!manifest.parse("zsync: 0.6.2\nBlocksize: 4\nLength: 0\nZ-URL: f.gz\n\n"));
+    QVERIFY(!manifest.load("/nonexistent/file.zsync"));
+}
+
+QTEST_GUILESS_MAIN(ParserTest)
+#include "tst_parsers.moc"